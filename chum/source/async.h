@@ -0,0 +1,163 @@
+#pragma once
+
+#include "disassembler.h"
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace chum {
+
+// Runs a function at some point in the future, on any thread. This is
+// usually a thin wrapper over the caller's thread pool.
+using executor = std::function<void(std::function<void()>)>;
+
+// A flag that can be shared by many async operations in order to cancel
+// them. Cancelled operations resume their caller with an empty result.
+class cancellation_token {
+public:
+  // Request cancellation of every operation that uses this token.
+  void cancel() const {
+    flag_->store(true, std::memory_order_relaxed);
+  }
+
+  // Whether cancellation has been requested.
+  bool cancelled() const {
+    return flag_->load(std::memory_order_relaxed);
+  }
+
+  // Get the underlying flag, for APIs that poll it directly.
+  std::atomic<bool> const* flag() const {
+    return flag_.get();
+  }
+
+private:
+  std::shared_ptr<std::atomic<bool>> flag_ =
+    std::make_shared<std::atomic<bool>>(false);
+};
+
+// The awaitable that is returned by async_disassemble(). Every chunk of the
+// disassembly is posted to the executor separately, so that other work that
+// is queued on the same executor gets a chance to run in between.
+class disassemble_awaitable {
+public:
+  disassemble_awaitable(executor exec, std::vector<std::uint8_t> file_buffer,
+      disassemble_options const& options, cancellation_token token,
+      std::size_t const chunk_size)
+    : exec_(std::move(exec)), task_(std::move(file_buffer), options),
+      token_(std::move(token)), chunk_size_(chunk_size) {}
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  void await_suspend(std::coroutine_handle<> const handle) {
+    handle_ = handle;
+    post_chunk();
+  }
+
+  // Returns an empty result if the disassembly failed or was cancelled.
+  std::optional<disassembled_binary> await_resume() {
+    return std::move(result_);
+  }
+
+private:
+  // Post the next chunk to the executor. The chunk can finish (and resume
+  // the caller, which destroys this awaitable) before the executor returns,
+  // so the executor is copied first and nothing is touched after posting.
+  void post_chunk() {
+    auto const exec = exec_;
+    exec([this] { run_chunk(); });
+  }
+
+  // Run a single chunk, and either post the next chunk or resume the caller.
+  void run_chunk() {
+    if (!token_.cancelled() && task_.step(chunk_size_)) {
+      post_chunk();
+      return;
+    }
+
+    if (!token_.cancelled())
+      result_ = task_.finish();
+
+    handle_.resume();
+  }
+
+private:
+  executor exec_;
+  disassembly_task task_;
+  cancellation_token token_;
+  std::size_t chunk_size_ = 0;
+  std::coroutine_handle<> handle_ = nullptr;
+  std::optional<disassembled_binary> result_ = {};
+};
+
+// The awaitable that is returned by async_create(). Emission runs as a
+// single job on the executor, but it stops between basic blocks as soon as
+// the token is cancelled.
+class create_awaitable {
+public:
+  create_awaitable(executor exec, binary const& bin,
+      create_options const& options, cancellation_token token)
+    : exec_(std::move(exec)), bin_(bin), options_(options),
+      token_(std::move(token)) {
+    options_.cancel = token_.flag();
+  }
+
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  void await_suspend(std::coroutine_handle<> const handle) {
+    handle_ = handle;
+
+    // The job can resume the caller (and destroy this awaitable) before the
+    // executor returns, so post through a copy of it.
+    auto const exec = exec_;
+    exec([this] {
+      if (!token_.cancelled()) {
+        auto file = bin_.create(options_);
+        if (!file.empty() && !token_.cancelled())
+          result_ = std::move(file);
+      }
+
+      handle_.resume();
+    });
+  }
+
+  // Returns an empty result if emission failed or was cancelled.
+  std::optional<std::vector<std::uint8_t>> await_resume() {
+    return std::move(result_);
+  }
+
+private:
+  executor exec_;
+  binary const& bin_;
+  create_options options_;
+  cancellation_token token_;
+  std::coroutine_handle<> handle_ = nullptr;
+  std::optional<std::vector<std::uint8_t>> result_ = {};
+};
+
+// Disassemble an image on an executor, yielding after every chunk_size
+// entries of the disassembly queue. The awaiting coroutine is resumed on
+// the executor thread that finishes the last chunk.
+inline disassemble_awaitable async_disassemble(executor exec,
+    std::vector<std::uint8_t> file_buffer, disassemble_options const& options = {},
+    cancellation_token token = {}, std::size_t const chunk_size = 1024) {
+  return { std::move(exec), std::move(file_buffer), options,
+    std::move(token), chunk_size };
+}
+
+// Create a PE file from a binary on an executor. The binary must not be
+// modified until the awaiting coroutine is resumed.
+inline create_awaitable async_create(executor exec, binary const& bin,
+    create_options const& options = {}, cancellation_token token = {}) {
+  return { std::move(exec), bin, options, std::move(token) };
+}
+
+} // namespace chum
@@ -1,19 +1,25 @@
 #include "binary.h"
+#include "util.h"
 
 #include <cassert>
 #include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 #include <set>
+#include <string_view>
+#include <utility>
 
 #include <Windows.h>
 #include <zycore/Format.h>
 
 namespace chum {
 
-static ZydisFormatterFunc orig_zydis_format_operand_mem = nullptr;
-static ZydisFormatterFunc orig_zydis_format_operand_imm = nullptr;
+// These are shared by every binary (and every thread), so they're atomic.
+static std::atomic<ZydisFormatterFunc> orig_zydis_format_operand_mem = nullptr;
+static std::atomic<ZydisFormatterFunc> orig_zydis_format_operand_imm = nullptr;
 
 static ZyanStatus hook_zydis_format_operand_mem(
     ZydisFormatter const* const formatter,
@@ -23,7 +29,7 @@ static ZyanStatus hook_zydis_format_operand_mem(
     return orig_zydis_format_operand_mem(formatter, buffer, context);
 
   auto const mask = (1ull << context->instruction->raw.disp.size) - 1;
-  auto const& sym_table = *reinterpret_cast<std::vector<symbol*>*>(context->user_data);
+  auto const& sym_table = *reinterpret_cast<std::pmr::vector<symbol*>*>(context->user_data);
   auto const sym_id = *reinterpret_cast<std::uint64_t const*>(&context->operand->mem.disp.value) & mask;
   auto const sym = sym_table[sym_id];
 
@@ -48,7 +54,7 @@ static ZyanStatus hook_zydis_format_operand_imm(
     return orig_zydis_format_operand_imm(formatter, buffer, context);
 
   auto const mask = (1ull << context->operand->size) - 1;
-  auto const& sym_table = *reinterpret_cast<std::vector<symbol*>*>(context->user_data);
+  auto const& sym_table = *reinterpret_cast<std::pmr::vector<symbol*>*>(context->user_data);
   auto const sym = sym_table[context->operand->imm.value.u & mask];
 
   ZyanString* string;
@@ -64,7 +70,14 @@ static ZyanStatus hook_zydis_format_operand_imm(
 }
 
 // Create an empty binary.
-binary::binary() {
+binary::binary()
+  : binary(std::pmr::get_default_resource()) {}
+
+// Create an empty binary where everything is allocated from the specified
+// memory resource.
+binary::binary(std::pmr::memory_resource* const resource)
+    : storage_(resource), symbols_(resource), data_blocks_(resource),
+      basic_blocks_(resource), import_modules_(resource), exports_(resource) {
   // Initialize the Zydis decoder for x86-64.
   assert(ZYAN_SUCCESS(ZydisDecoderInit(&decoder_,
     ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64)));
@@ -80,13 +93,17 @@ binary::binary() {
   ZydisFormatterSetProperty(&formatter_,
     ZYDIS_FORMATTER_PROP_FORCE_RELATIVE_RIPREL, true);
 
-  orig_zydis_format_operand_mem = hook_zydis_format_operand_mem;
+  // The hook is swapped with the original function. The original is the
+  // same for every formatter, so every binary stores the same value.
+  auto format_operand_mem = reinterpret_cast<void const*>(hook_zydis_format_operand_mem);
   ZydisFormatterSetHook(&formatter_, ZYDIS_FORMATTER_FUNC_FORMAT_OPERAND_MEM,
-    reinterpret_cast<void const**>(&orig_zydis_format_operand_mem));
+    &format_operand_mem);
+  orig_zydis_format_operand_mem = reinterpret_cast<ZydisFormatterFunc>(format_operand_mem);
 
-  orig_zydis_format_operand_imm = hook_zydis_format_operand_imm;
+  auto format_operand_imm = reinterpret_cast<void const*>(hook_zydis_format_operand_imm);
   ZydisFormatterSetHook(&formatter_, ZYDIS_FORMATTER_FUNC_FORMAT_OPERAND_IMM,
-    reinterpret_cast<void const**>(&orig_zydis_format_operand_imm));
+    &format_operand_imm);
+  orig_zydis_format_operand_imm = reinterpret_cast<ZydisFormatterFunc>(format_operand_imm);
 
   // Create the null symbol.
   auto const null_symbol = create_symbol(symbol_type::invalid, "<null>");
@@ -95,42 +112,176 @@ binary::binary() {
 
 // Free any resources.
 binary::~binary() {
-  for (auto const e : symbols_)
-    delete e;
-  for (auto const e : data_blocks_)
-    delete e;
-  for (auto const e : basic_blocks_)
-    delete e;
-  for (auto const e : import_modules_)
-    delete e;
+  release();
 }
 
 // Move constructor.
-binary::binary(binary&& other) {
-  // I *think* this is correct...
-  std::swap(decoder_,        other.decoder_);
-  std::swap(formatter_,      other.formatter_);
-  std::swap(entrypoint_,     other.entrypoint_);
-  std::swap(symbols_,        other.symbols_);
-  std::swap(data_blocks_,    other.data_blocks_);
-  std::swap(basic_blocks_,   other.basic_blocks_);
-  std::swap(import_modules_, other.import_modules_);
-}
+binary::binary(binary&& other)
+    : decoder_(other.decoder_),
+      formatter_(other.formatter_),
+      entrypoint_(std::exchange(other.entrypoint_, nullptr)),
+      storage_(other.storage_),
+      symbols_(std::move(other.symbols_)),
+      data_blocks_(std::move(other.data_blocks_)),
+      basic_blocks_(std::move(other.basic_blocks_)),
+      import_modules_(std::move(other.import_modules_)),
+      exports_(std::move(other.exports_)) {}
 
 // Move assignment operator.
 binary& binary::operator=(binary&& other) {
-  // I *think* this is correct...
-  std::swap(decoder_,        other.decoder_);
-  std::swap(formatter_,      other.formatter_);
-  std::swap(entrypoint_,     other.entrypoint_);
-  std::swap(symbols_,        other.symbols_);
-  std::swap(data_blocks_,    other.data_blocks_);
-  std::swap(basic_blocks_,   other.basic_blocks_);
-  std::swap(import_modules_, other.import_modules_);
+  if (this == &other)
+    return *this;
+
+  // Our own objects need to be freed with our own resource.
+  release();
+
+  decoder_   = other.decoder_;
+  formatter_ = other.formatter_;
+
+  // Objects can't be taken over from another resource, since our resource
+  // is fixed. Copy everything into our own resource instead.
+  if (storage_ != other.storage_) {
+    create_symbol(symbol_type::invalid, "<null>");
+    other.clone_into(*this);
+    other.release();
+    return *this;
+  }
+
+  entrypoint_ = std::exchange(other.entrypoint_, nullptr);
+
+  symbols_        = std::move(other.symbols_);
+  data_blocks_    = std::move(other.data_blocks_);
+  basic_blocks_   = std::move(other.basic_blocks_);
+  import_modules_ = std::move(other.import_modules_);
+  exports_        = std::move(other.exports_);
+
+  other.symbols_.clear();
+  other.data_blocks_.clear();
+  other.basic_blocks_.clear();
+  other.import_modules_.clear();
+  other.exports_.clear();
 
   return *this;
 }
 
+// Free every symbol, block, and import module.
+void binary::release() {
+  for (auto const e : symbols_)
+    delete_object(storage_, e);
+  for (auto const e : data_blocks_)
+    delete_object(storage_, e);
+  for (auto const e : basic_blocks_)
+    delete_object(storage_, e);
+
+  for (auto const e : import_modules_) {
+    for (auto const ir : e->routines_)
+      delete_object(storage_, ir);
+    delete_object(storage_, e);
+  }
+
+  symbols_.clear();
+  data_blocks_.clear();
+  basic_blocks_.clear();
+  import_modules_.clear();
+  exports_.clear();
+  entrypoint_ = nullptr;
+}
+
+// Create a deep copy of this binary.
+binary binary::clone() const {
+  binary copy(storage_);
+  clone_into(copy);
+  return copy;
+}
+
+// Copy every symbol, block, and import module into a newly created binary.
+void binary::clone_into(binary& dst) const {
+  // The null symbol is copied along with every other symbol.
+  assert(dst.symbols_.size() == 1 && dst.basic_blocks_.empty() &&
+    dst.data_blocks_.empty() && dst.import_modules_.empty());
+  delete_object(dst.storage_, dst.symbols_[0]);
+  dst.symbols_.clear();
+
+  // Everything is created with the destination's resource and then
+  // assigned, since copy construction would use the default resource for
+  // the instructions, bytes, and names instead.
+  auto const resource = dst.storage_;
+
+  std::unordered_map<data_block const*, data_block*> db_map = {};
+  for (auto const db : data_blocks_) {
+    auto const copy = db_map[db] = dst.data_blocks_.emplace_back(
+      new_object<data_block>(resource, resource));
+    *copy = *db;
+  }
+
+  std::unordered_map<basic_block const*, basic_block*> bb_map = { { nullptr, nullptr } };
+  for (auto const bb : basic_blocks_) {
+    auto const copy = bb_map[bb] = dst.basic_blocks_.emplace_back(
+      new_object<basic_block>(resource, resource));
+    *copy = *bb;
+  }
+
+  std::unordered_map<import_routine const*, import_routine*> ir_map = {};
+  for (auto const mod : import_modules_) {
+    auto const copy = dst.import_modules_.emplace_back(
+      new_object<import_module>(resource, dst, mod->name()));
+
+    for (auto const ir : mod->routines_) {
+      auto const ir_copy = ir_map[ir] = copy->routines_.emplace_back(
+        new_object<import_routine>(resource, resource));
+      *ir_copy = *ir;
+    }
+  }
+
+  for (auto const sym : symbols_) {
+    auto const copy = dst.symbols_.emplace_back(new_object<symbol>(resource, resource));
+    *copy = *sym;
+
+    switch (sym->type) {
+    case symbol_type::code:
+      copy->bb = bb_map.at(sym->bb);
+      break;
+    case symbol_type::data:
+      copy->db = sym->db ? db_map.at(sym->db) : nullptr;
+      break;
+    case symbol_type::import:
+      copy->ir = sym->ir ? ir_map.at(sym->ir) : nullptr;
+      break;
+    default:
+      break;
+    }
+  }
+
+  dst.entrypoint_ = bb_map.at(entrypoint_);
+  dst.exports_    = exports_;
+}
+
+// Get an estimate of the amount of heap memory used by this binary.
+std::size_t binary::memory_usage() const {
+  std::size_t size = 0;
+
+  for (auto const sym : symbols_)
+    size += sizeof(*sym) + sym->name.capacity();
+
+  for (auto const bb : basic_blocks_)
+    size += sizeof(*bb) + bb->instructions.capacity() * sizeof(instruction);
+
+  for (auto const db : data_blocks_)
+    size += sizeof(*db) + db->bytes.capacity();
+
+  for (auto const mod : import_modules_) {
+    size += sizeof(*mod);
+    for (auto const ir : mod->routines_)
+      size += sizeof(*ir) + ir->name.capacity();
+  }
+
+  size += symbols_.capacity() * sizeof(symbol*);
+  size += basic_blocks_.capacity() * sizeof(basic_block*);
+  size += data_blocks_.capacity() * sizeof(data_block*);
+
+  return size;
+}
+
 // Print the contents of this binary, for debugging purposes.
 void binary::print(bool const verbose) {
   std::printf("[+] Symbols (%zu):\n", symbols_.size());
@@ -165,6 +316,14 @@ void binary::print(bool const verbose) {
     std::printf("[+]\n");
   }
 
+  std::printf("[+] Exports (%zu):\n", exports_.size());
+
+  if (verbose) {
+    for (auto const sym_id : exports_)
+      std::printf("[+]   %s\n", get_symbol(sym_id)->name.c_str());
+    std::printf("[+]\n");
+  }
+
   std::printf("[+] Data blocks (%zu):\n", data_blocks_.size());
 
   if (verbose) {
@@ -188,9 +347,21 @@ void binary::print(bool const verbose) {
 
       // Print the fallthrough target symbol ID, if it exists.
       if (bb->fallthrough_target)
-        std::printf(" Fallthrough: %-6u\n", bb->fallthrough_target.value);
-      else
-        std::printf("\n");
+        std::printf(" Fallthrough: %-6u", bb->fallthrough_target.value);
+
+      // Print the padding, if it exists.
+      if (bb->padding)
+        std::printf(" Padding: %-3u", bb->padding);
+
+      // Print the profile weights, if they exist.
+      if (bb->weight || bb->taken_weight || bb->fallthrough_weight) {
+        std::printf(" Weight: %-10llu Taken: %-10llu Fallthrough: %-10llu",
+          static_cast<unsigned long long>(bb->weight),
+          static_cast<unsigned long long>(bb->taken_weight),
+          static_cast<unsigned long long>(bb->fallthrough_weight));
+      }
+
+      std::printf("\n");
 
       // Print the symbol name as a label.
       if (auto const sym = get_symbol(bb->sym_id); sym && !sym->name.empty()) {
@@ -222,38 +393,207 @@ void binary::print(bool const verbose) {
 }
 
 // Create a new PE file from this binary.
-bool binary::create(char const* const path) const {
-  pb::pe_builder pe = {};
-  if (!create(pe))
-    return {};
+bool binary::create(char const* const path,
+    create_options const& options) const {
+  if (!options.strip_relocs) {
+    pb::pe_builder pe = {};
+    if (!create(pe, options))
+      return {};
+
+    return pe.write(path);
+  }
 
-  return pe.write(path);
+  // The headers need to be patched before the file is written.
+  auto const file = create(options);
+  if (file.empty())
+    return false;
+
+  std::ofstream stream(path, std::ios::binary);
+  stream.write(reinterpret_cast<char const*>(file.data()), file.size());
+
+  return static_cast<bool>(stream);
 }
 
 // Create a new PE file from this binary.
-std::vector<std::uint8_t> binary::create() const {
+std::vector<std::uint8_t> binary::create(create_options const& options) const {
   pb::pe_builder pe = {};
-  if (!create(pe))
+  if (!create(pe, options))
     return {};
 
-  return pe.write();
+  auto file = pe.write();
+
+  // An image without relocations can't be loaded at a random base.
+  if (options.strip_relocs && file.size() >= sizeof(IMAGE_DOS_HEADER)) {
+    auto const dos_header = reinterpret_cast<PIMAGE_DOS_HEADER>(file.data());
+    if (dos_header->e_lfanew > 0 &&
+        dos_header->e_lfanew + sizeof(IMAGE_NT_HEADERS64) <= file.size()) {
+      reinterpret_cast<PIMAGE_NT_HEADERS64>(file.data() + dos_header->e_lfanew)
+        ->OptionalHeader.DllCharacteristics &= ~IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE;
+    }
+  }
+
+  return file;
+}
+
+// Create the .idata section and assign addresses to every import symbol.
+void binary::create_import_section(pb::pe_builder& pe,
+    create_options const& options, std::vector<std::uint64_t>& sym_to_va) const {
+  if (import_modules_.empty())
+    return;
+
+  // Create the .idata section for holding the IAT.
+  auto& idata_sec = pe.section()
+    .name(".idata")
+    .characteristics(IMAGE_SCN_MEM_READ);
+
+  auto& idata_data = idata_sec.data();
+  auto const idata_rva = pe.rvirtual_address(idata_sec);
+
+  // Allocate space for every descriptor (plus the null descriptor).
+  idata_data.insert(end(idata_data), (import_modules_.size() + 1)
+    * sizeof(IMAGE_IMPORT_DESCRIPTOR) , 0);
+
+  for (std::size_t i = 0; i < import_modules_.size(); ++i) {
+    auto const& imp_mod = import_modules_[i];
+
+    // The export names of this module, if a local copy of it can be found.
+    // These are sorted, since the loader binary searches through them.
+    std::vector<std::string> export_names = {};
+    for (auto const& dir : options.import_search_paths) {
+      export_names = read_export_names((dir + "\\" + imp_mod->name()).c_str());
+      if (!export_names.empty())
+        break;
+    }
+
+    if (export_names.empty() && !options.import_search_paths.empty())
+      std::printf("[!] Failed to find the export table for %s.\n", imp_mod->name());
+
+    // Set the Name RVA to the ASCII string we're about to append.
+    reinterpret_cast<PIMAGE_IMPORT_DESCRIPTOR>(
+      &idata_data[i * sizeof(IMAGE_IMPORT_DESCRIPTOR)])->Name =
+      idata_rva + static_cast<std::uint32_t>(idata_data.size());
+
+    // Append the name of this import module to the .idata section
+    // (plus the null-terminator).
+    idata_data.insert(end(idata_data), imp_mod->name(),
+      imp_mod->name() + std::strlen(imp_mod->name()) + 1);
+
+    // Set the OrigFirstThunk RVA to the name thunk table that we're about to append.
+    reinterpret_cast<PIMAGE_IMPORT_DESCRIPTOR>(
+      &idata_data[i * sizeof(IMAGE_IMPORT_DESCRIPTOR)])->OriginalFirstThunk =
+      idata_rva + static_cast<std::uint32_t>(idata_data.size());
+
+    auto const name_table_off = idata_data.size();
+
+    // Allocate the thunk table (plus the null thunk).
+    idata_data.insert(end(idata_data), 8 * (imp_mod->routines().size() + 1), 0);
+
+    for (std::size_t j = 0; j < imp_mod->routines().size(); ++j) {
+      auto const& routine = imp_mod->routines()[j];
+
+      // Set the RVA to the IMAGE_IMPORT_BY_NAME that we're about to append.
+      *reinterpret_cast<std::uint64_t*>(&idata_data[name_table_off + j * 8]) =
+        idata_rva + idata_data.size();
+
+      // IMAGE_IMPORT_BY_NAME::Hint, which is the index of the routine in the
+      // export name table of the module (or 0 if we don't know it).
+      std::uint16_t hint = 0;
+      std::string_view const routine_name = routine->name;
+      if (auto const it = std::lower_bound(begin(export_names),
+          end(export_names), routine_name); it != end(export_names) &&
+          *it == routine_name && it - begin(export_names) <= 0xFFFF)
+        hint = static_cast<std::uint16_t>(it - begin(export_names));
+
+      idata_data.insert(end(idata_data),
+        reinterpret_cast<std::uint8_t const*>(&hint),
+        reinterpret_cast<std::uint8_t const*>(&hint) + 2);
+
+      // IMAGE_IMPORT_BY_NAME::Name.
+      idata_data.insert(end(idata_data), begin(routine->name), end(routine->name));
+      idata_data.insert(end(idata_data), 1, 0);
+    }
+
+    // Set the FirstThunk RVA to the thunk table that we're about to append.
+    reinterpret_cast<PIMAGE_IMPORT_DESCRIPTOR>(
+      &idata_data[i * sizeof(IMAGE_IMPORT_DESCRIPTOR)])->FirstThunk =
+      idata_rva + static_cast<std::uint32_t>(idata_data.size());
+
+    auto const thunk_table_off = idata_data.size();
+
+    // Allocate the thunk table which is identical to the name thunk table.
+    idata_data.insert(end(idata_data), 8 * (imp_mod->routines().size() + 1), 0);
+    std::memcpy(&idata_data[thunk_table_off],
+      &idata_data[name_table_off], 8 * imp_mod->routines().size());
+
+    // Set the symbol VAs in the symbol table for each routine.
+    for (std::size_t j = 0; j < imp_mod->routines().size(); ++j) {
+      sym_to_va[imp_mod->routines()[j]->sym_id.value] =
+        pe.virtual_address(idata_sec) + thunk_table_off + j * 8;
+    }
+  }
+
+  pe.data_directory(IMAGE_DIRECTORY_ENTRY_IMPORT,
+    idata_rva, static_cast<std::uint32_t>(idata_data.size()));
 }
 
 // Create a new PE file from this binary.
-bool binary::create(pb::pe_builder& pe) const {
-  pe.file_characteristics(IMAGE_FILE_EXECUTABLE_IMAGE | IMAGE_FILE_DLL);
+bool binary::create(pb::pe_builder& pe, create_options const& options) const {
+  // A DLL has to be relocated whenever its preferred base is taken.
+  if (options.strip_relocs && !options.executable) {
+    std::printf("[!] Relocations can only be stripped from executables.\n");
+    return false;
+  }
+
+  std::uint16_t file_characteristics = IMAGE_FILE_EXECUTABLE_IMAGE;
+  if (!options.executable)
+    file_characteristics |= IMAGE_FILE_DLL;
+  if (options.strip_relocs)
+    file_characteristics |= IMAGE_FILE_RELOCS_STRIPPED;
+
+  pe.file_characteristics(file_characteristics);
 
   // We don't want to resize in the middle of adding sections.
   if (pe.sections_until_resize() < 1 + data_blocks_.size())
     return false;
 
+  // Symbol table that maps symbols to virtual addresses.
+  std::vector<std::uint64_t> sym_to_va(symbols_.size(), 0);
+
+  // The loader fills in the IAT before anything else gets touched, so it
+  // goes first.
+  if (options.load_order_sections)
+    create_import_section(pe, options, sym_to_va);
+
   // Map a data block to its virtual address.
   std::unordered_map<data_block*, std::uint64_t> db_to_va;
 
   // Map a data block to its section.
   std::unordered_map<data_block*, pb::pe_section*> db_to_sec;
 
-  for (auto const db : data_blocks_) {
+  auto ordered_data_blocks = data_blocks_;
+
+  if (options.load_order_sections) {
+    // Data blocks that hold pointers get touched when base relocations are
+    // applied, so keep them next to each other.
+    std::unordered_set<data_block*> pointer_blocks = {};
+    for (auto const sym : symbols_) {
+      if (sym->type == symbol_type::data && sym->target)
+        pointer_blocks.insert(sym->db);
+    }
+
+    auto const rank = [&](data_block* const db) {
+      if (pointer_blocks.count(db))
+        return 0;
+      return db->read_only ? 1 : 2;
+    };
+
+    std::stable_sort(begin(ordered_data_blocks), end(ordered_data_blocks),
+      [&](data_block* const left, data_block* const right) {
+        return rank(left) < rank(right);
+      });
+  }
+
+  for (auto const db : ordered_data_blocks) {
     // Create a new section.
     auto& sec = pe.section()
       .name(".rdata")
@@ -266,15 +606,12 @@ bool binary::create(pb::pe_builder& pe) const {
     }
 
     // Copy the data from the data block into the section.
-    sec.data() = db->bytes;
+    sec.data().assign(begin(db->bytes), end(db->bytes));
 
     db_to_va[db] = pe.virtual_address(sec);
     db_to_sec[db] = &sec;
   }
 
-  // Symbol table that maps symbols to virtual addresses.
-  std::vector<std::uint64_t> sym_to_va(symbols_.size(), 0);
-
   bool has_base_relocs = false;
 
   // Assign virtual addresses to the symbols that we already know.
@@ -290,80 +627,8 @@ bool binary::create(pb::pe_builder& pe) const {
     }
   }
 
-  // Handle imports.
-  if (!import_modules_.empty()) {
-    // Create the .idata section for holding the IAT.
-    auto& idata_sec = pe.section()
-      .name(".idata")
-      .characteristics(IMAGE_SCN_MEM_READ);
-
-    auto& idata_data = idata_sec.data();
-    auto const idata_rva = pe.rvirtual_address(idata_sec);
-
-    // Allocate space for every descriptor (plus the null descriptor).
-    idata_data.insert(end(idata_data), (import_modules_.size() + 1)
-      * sizeof(IMAGE_IMPORT_DESCRIPTOR) , 0);
-
-    for (std::size_t i = 0; i < import_modules_.size(); ++i) {
-      auto const& imp_mod = import_modules_[i];
-
-      // Set the Name RVA to the ASCII string we're about to append.
-      reinterpret_cast<PIMAGE_IMPORT_DESCRIPTOR>(
-        &idata_data[i * sizeof(IMAGE_IMPORT_DESCRIPTOR)])->Name =
-        idata_rva + static_cast<std::uint32_t>(idata_data.size());
-
-      // Append the name of this import module to the .idata section
-      // (plus the null-terminator).
-      idata_data.insert(end(idata_data), imp_mod->name(),
-        imp_mod->name() + std::strlen(imp_mod->name()) + 1);
-
-      // Set the OrigFirstThunk RVA to the name thunk table that we're about to append.
-      reinterpret_cast<PIMAGE_IMPORT_DESCRIPTOR>(
-        &idata_data[i * sizeof(IMAGE_IMPORT_DESCRIPTOR)])->OriginalFirstThunk =
-        idata_rva + static_cast<std::uint32_t>(idata_data.size());
-
-      auto const name_table_off = idata_data.size();
-
-      // Allocate the thunk table (plus the null thunk).
-      idata_data.insert(end(idata_data), 8 * (imp_mod->routines().size() + 1), 0);
-
-      for (std::size_t j = 0; j < imp_mod->routines().size(); ++j) {
-        auto const& routine = imp_mod->routines()[j];
-
-        // Set the RVA to the IMAGE_IMPORT_BY_NAME that we're about to append.
-        *reinterpret_cast<std::uint64_t*>(&idata_data[name_table_off + j * 8]) =
-          idata_rva + idata_data.size();
-
-        // IMAGE_IMPORT_BY_NAME::Hint.
-        idata_data.insert(end(idata_data), 2, 0);
-
-        // IMAGE_IMPORT_BY_NAME::Name.
-        idata_data.insert(end(idata_data), begin(routine->name), end(routine->name));
-        idata_data.insert(end(idata_data), 1, 0);
-      }
-
-      // Set the FirstThunk RVA to the thunk table that we're about to append.
-      reinterpret_cast<PIMAGE_IMPORT_DESCRIPTOR>(
-        &idata_data[i * sizeof(IMAGE_IMPORT_DESCRIPTOR)])->FirstThunk =
-        idata_rva + static_cast<std::uint32_t>(idata_data.size());
-
-      auto const thunk_table_off = idata_data.size();
-
-      // Allocate the thunk table which is identical to the name thunk table.
-      idata_data.insert(end(idata_data), 8 * (imp_mod->routines().size() + 1), 0);
-      std::memcpy(&idata_data[thunk_table_off],
-        &idata_data[name_table_off], 8 * imp_mod->routines().size());
-
-      // Set the symbol VAs in the symbol table for each routine.
-      for (std::size_t j = 0; j < imp_mod->routines().size(); ++j) {
-        sym_to_va[imp_mod->routines()[j]->sym_id.value] =
-          pe.virtual_address(idata_sec) + thunk_table_off + j * 8;
-      }
-    }
-
-    pe.data_directory(IMAGE_DIRECTORY_ENTRY_IMPORT,
-      idata_rva, static_cast<std::uint32_t>(idata_data.size()));
-  }
+  if (!options.load_order_sections)
+    create_import_section(pe, options, sym_to_va);
 
   // Create the .text section for holding code.
   auto& text_sec = pe.section()
@@ -381,13 +646,44 @@ bool binary::create(pb::pe_builder& pe) const {
 
   std::vector<delayed_reloc_entry> delayed_relocs = {};
 
+  // This is only used for filling in the layout report.
+  struct emitted_block_entry {
+    symbol_id     sym_id;
+    std::uint32_t start;
+    std::uint32_t end;
+  };
+
+  // This is only used for filling in the layout report.
+  struct branch_site_entry {
+    std::uint64_t rip;
+    symbol_id     target;
+  };
+
+  auto const report = options.report;
+
+  std::vector<emitted_block_entry> emitted_blocks = {};
+  std::vector<branch_site_entry> branch_sites = {};
+
+  if (report) {
+    // Reset every output value, while keeping the inputs intact.
+    *report = { report->hot_percent, std::move(report->block_weights),
+      report->original_code_size, report->original_data_size };
+    emitted_blocks.reserve(basic_blocks_.size());
+  }
+
   // Write every instruction to the text section (first pass).
   for (std::size_t block_idx = 0; block_idx < basic_blocks_.size(); ++block_idx) {
     auto const bb = basic_blocks_[block_idx];
 
+    if (options.cancel && options.cancel->load(std::memory_order_relaxed))
+      return false;
+
     // Make sure this block isn't written already.
     assert(sym_to_va[bb->sym_id.value] == 0);
 
+    // Reserve any padding that comes before this block.
+    text_sec_data.insert(end(text_sec_data), bb->padding, 0xCC);
+
     // Assign this basic block an address.
     sym_to_va[bb->sym_id.value] = text_sec_va + text_sec_data.size();
 
@@ -414,6 +710,9 @@ bool binary::create(pb::pe_builder& pe) const {
 
       symbol_id delay_sym_id = null_symbol_id;
 
+      // The target of this instruction, if it is a relative JMP or JCC.
+      symbol_id branch_sym_id = null_symbol_id;
+
       // Convert the relative addresses into absolute addresses.
       if (decoded_instr.attributes & ZYDIS_ATTRIB_IS_RELATIVE) {
         for (std::size_t i = 0; i < decoded_instr.operand_count_visible; ++i) {
@@ -429,6 +728,10 @@ bool binary::create(pb::pe_builder& pe) const {
               decoded_instr.raw.imm[0].offset, decoded_instr.raw.imm[0].size / 8);
             assert(sym_id != null_symbol_id);
 
+            if (decoded_instr.meta.category == ZYDIS_CATEGORY_COND_BR ||
+                decoded_instr.meta.category == ZYDIS_CATEGORY_UNCOND_BR)
+              branch_sym_id = sym_id;
+
             if (sym_to_va[sym_id.value] != 0)
               enc_op.imm.u = sym_to_va[sym_id.value];
             else {
@@ -478,15 +781,49 @@ bool binary::create(pb::pe_builder& pe) const {
           delay_sym_id
         });
       }
+
+      if (!report)
+        continue;
+
+      report->instruction_bytes += instr_length;
+
+      if (!branch_sym_id)
+        continue;
+
+      // Decode the new instruction to see which branch size was chosen.
+      ZydisDecodedInstruction new_instr;
+      if (ZYAN_FAILED(ZydisDecoderDecodeFull(&decoder_, instr_buffer,
+          instr_length, &new_instr, decoded_ops)))
+        return false;
+
+      if (new_instr.raw.imm[0].size == 8)
+        ++report->rel8_branch_count;
+      else
+        ++report->rel32_branch_count;
+
+      branch_sites.push_back({ text_sec_va + text_sec_data.size(), branch_sym_id });
+    }
+
+    if (report) {
+      emitted_blocks.push_back({ bb->sym_id, static_cast<std::uint32_t>(
+        sym_to_va[bb->sym_id.value] - text_sec_va), 0 });
     }
 
-    if (!bb->fallthrough_target)
+    if (!bb->fallthrough_target) {
+      if (report)
+        emitted_blocks.back().end = static_cast<std::uint32_t>(text_sec_data.size());
       continue;
+    }
 
-    // If the next block is the fallthrough block, there is no need to do anything.
+    // If the next block is the fallthrough block, there is no need to do
+    // anything (unless we need to jump over its padding).
     if (block_idx < basic_blocks_.size() - 1 &&
-        basic_blocks_[block_idx + 1]->sym_id == bb->fallthrough_target)
+        basic_blocks_[block_idx + 1]->sym_id == bb->fallthrough_target &&
+        !basic_blocks_[block_idx + 1]->padding) {
+      if (report)
+        emitted_blocks.back().end = static_cast<std::uint32_t>(text_sec_data.size());
       continue;
+    }
 
     auto const ft_sym = get_symbol(bb->fallthrough_target);
 
@@ -515,6 +852,16 @@ bool binary::create(pb::pe_builder& pe) const {
         ft_sym->id
       });
     }
+
+    if (report) {
+      emitted_blocks.back().end = static_cast<std::uint32_t>(text_sec_data.size());
+
+      ++report->fallthrough_jmp_count;
+      report->fallthrough_jmp_bytes += sizeof(rel_jmp);
+      ++report->rel32_branch_count;
+
+      branch_sites.push_back({ text_sec_va + text_sec_data.size(), ft_sym->id });
+    }
   }
 
   // Patch every delayed reloc.
@@ -532,11 +879,11 @@ bool binary::create(pb::pe_builder& pe) const {
     std::memcpy(&text_sec_data[reloc.offset], &off, reloc.size);
   }
 
+  // This is a sorted map where the key is a PFN of a reloc block.
+  std::map<std::uint32_t, std::set<std::uint16_t>> reloc_blocks = {};
+
   // Handle base relocs (data symbols that point to another symbol).
   if (has_base_relocs) {
-    // This is a sorted map where the key is a PFN of a reloc block.
-    std::map<std::uint32_t, std::set<std::uint16_t>> reloc_blocks = {};
-
     for (auto const sym : symbols_) {
       if (sym->type != symbol_type::data || !sym->target)
         continue;
@@ -558,11 +905,16 @@ bool binary::create(pb::pe_builder& pe) const {
       auto& block = reloc_blocks.insert({ rva >> 12, {} }).first->second;
       block.emplace(rva & 0xFFF);
     }
+  }
 
-    // Create the .reloc section for holding base reloc information.
+  // Create the .reloc section for holding base reloc information. The
+  // pointers still need to be patched (above) even if this is skipped.
+  if (has_base_relocs && !options.strip_relocs) {
+    // The loader only reads this section when the image gets rebased.
     auto& reloc_sec = pe.section()
       .name(".reloc")
-      .characteristics(IMAGE_SCN_MEM_READ);
+      .characteristics(IMAGE_SCN_MEM_READ | (options.load_order_sections ?
+        IMAGE_SCN_MEM_DISCARDABLE : 0));
     auto& reloc_data = reloc_sec.data();
 
     struct base_reloc_entry {
@@ -599,6 +951,146 @@ bool binary::create(pb::pe_builder& pe) const {
       pe.rvirtual_address(reloc_sec), static_cast<std::uint32_t>(reloc_data.size()));
   }
 
+  // Handle exports. This needs to happen after every other section has been
+  // created, since pe_section references are invalidated if the section
+  // table gets resized.
+  if (!exports_.empty()) {
+    auto& edata_sec = pe.section()
+      .name(".edata")
+      .characteristics(IMAGE_SCN_MEM_READ);
+
+    auto& edata_data = edata_sec.data();
+    auto const edata_rva = pe.rvirtual_address(edata_sec);
+
+    // The export names need to be sorted so that the loader can binary
+    // search through them.
+    auto sorted_exports = exports_;
+    std::sort(begin(sorted_exports), end(sorted_exports),
+      [&](symbol_id const left, symbol_id const right) {
+        return get_symbol(left)->name < get_symbol(right)->name;
+      });
+
+    auto const count = static_cast<std::uint32_t>(sorted_exports.size());
+
+    // IMAGE_EXPORT_DIRECTORY, followed by the function, name, and ordinal
+    // tables, followed by every name.
+    auto const functions_off = sizeof(IMAGE_EXPORT_DIRECTORY);
+    auto const names_off     = functions_off + count * 4;
+    auto const ordinals_off  = names_off + count * 4;
+    auto const strings_off   = ordinals_off + count * 2;
+
+    edata_data.insert(end(edata_data), strings_off, 0);
+
+    auto const module_name_rva = edata_rva +
+      static_cast<std::uint32_t>(edata_data.size());
+
+    // We don't know what the module will be called, so leave the name empty.
+    edata_data.insert(end(edata_data), 1, 0);
+
+    for (std::uint32_t i = 0; i < count; ++i) {
+      auto const sym = get_symbol(sorted_exports[i]);
+      assert(sym->type != symbol_type::import);
+
+      auto const function_rva = static_cast<std::uint32_t>(
+        sym_to_va[sym->id.value] - pe.image_base());
+      auto const name_rva = edata_rva + static_cast<std::uint32_t>(edata_data.size());
+      auto const ordinal = static_cast<std::uint16_t>(i);
+
+      std::memcpy(&edata_data[functions_off + i * 4], &function_rva, 4);
+      std::memcpy(&edata_data[names_off + i * 4], &name_rva, 4);
+      std::memcpy(&edata_data[ordinals_off + i * 2], &ordinal, 2);
+
+      edata_data.insert(end(edata_data), begin(sym->name), end(sym->name));
+      edata_data.insert(end(edata_data), 1, 0);
+    }
+
+    auto const dir = reinterpret_cast<PIMAGE_EXPORT_DIRECTORY>(&edata_data[0]);
+    dir->Name                  = module_name_rva;
+    dir->Base                  = 1;
+    dir->NumberOfFunctions     = count;
+    dir->NumberOfNames         = count;
+    dir->AddressOfFunctions    = edata_rva + static_cast<std::uint32_t>(functions_off);
+    dir->AddressOfNames        = edata_rva + static_cast<std::uint32_t>(names_off);
+    dir->AddressOfNameOrdinals = edata_rva + static_cast<std::uint32_t>(ordinals_off);
+
+    pe.data_directory(IMAGE_DIRECTORY_ENTRY_EXPORT,
+      edata_rva, static_cast<std::uint32_t>(edata_data.size()));
+  }
+
+  if (report) {
+    report->block_count = emitted_blocks.size();
+    report->code_size   = text_sec_data.size();
+
+    for (auto const db : data_blocks_)
+      report->data_size += db->bytes.size();
+
+    // Calculate the average branch distance now that every symbol has been
+    // assigned an address.
+    if (!branch_sites.empty()) {
+      double total_distance = 0.0;
+      for (auto const& site : branch_sites) {
+        auto const target = sym_to_va[site.target.value];
+        total_distance += static_cast<double>(target > site.rip ?
+          target - site.rip : site.rip - target);
+      }
+
+      report->average_branch_distance = total_distance / branch_sites.size();
+    }
+
+    // Sort the emitted blocks from hottest to coldest, ignoring any blocks
+    // that don't have a weight. If no weights were provided, fall back to
+    // the weights that were attached to each block from a profile.
+    auto const weight = [&](emitted_block_entry const& entry) -> std::uint64_t {
+      if (report->block_weights.empty())
+        return get_symbol(entry.sym_id)->bb->weight;
+      if (entry.sym_id.value >= report->block_weights.size())
+        return 0;
+      return report->block_weights[entry.sym_id.value];
+    };
+
+    auto const hot_end = std::partition(begin(emitted_blocks),
+      end(emitted_blocks), [&](auto const& entry) { return weight(entry) > 0; });
+    std::stable_sort(begin(emitted_blocks), hot_end,
+      [&](auto const& left, auto const& right) {
+        return weight(left) > weight(right);
+      });
+
+    // The hottest N% of every emitted block.
+    auto const hot_count = (std::min)(static_cast<std::size_t>(hot_end -
+      begin(emitted_blocks)), static_cast<std::size_t>(report->hot_percent *
+      emitted_blocks.size() / 100.0 + 0.5));
+
+    std::set<std::uint64_t> hot_pages = {};
+    std::set<std::uint64_t> hot_lines = {};
+
+    for (std::size_t i = 0; i < hot_count; ++i) {
+      auto const start = text_sec_va + emitted_blocks[i].start;
+      auto const end   = text_sec_va + emitted_blocks[i].end;
+
+      if (start == end)
+        continue;
+
+      for (auto va = start >> 12; va <= (end - 1) >> 12; ++va)
+        hot_pages.insert(va);
+      for (auto va = start >> 6; va <= (end - 1) >> 6; ++va)
+        hot_lines.insert(va);
+    }
+
+    report->hot_block_count = hot_count;
+    report->hot_page_count  = hot_pages.size();
+    report->hot_line_count  = hot_lines.size();
+
+    if (report->original_code_size) {
+      report->code_growth = static_cast<double>(report->code_size) /
+        report->original_code_size;
+    }
+
+    if (report->original_data_size) {
+      report->data_growth = static_cast<double>(report->data_size) /
+        report->original_data_size;
+    }
+  }
+
   // Set the entrypoint to the start of the text section.
   if (entrypoint_)
     pe.entrypoint(sym_to_va[entrypoint_->sym_id.value]);
@@ -618,10 +1110,13 @@ void binary::entrypoint(basic_block* const bb) {
 
 // Create a new symbol that is assigned a unique symbol ID.
 symbol* binary::create_symbol(symbol_type const type, char const* const name) {
-  auto const sym = symbols_.emplace_back(new symbol{});
+  auto const sym = symbols_.emplace_back(new_object<symbol>(storage_, storage_));
   sym->id        = symbol_id{ static_cast<std::uint32_t>(symbols_.size() - 1) };
   sym->type      = type;
   sym->name      = name ? name : "";
+
+  CHUM_COUNT_OP(symbol_allocations);
+
   return sym;
 }
 
@@ -633,20 +1128,20 @@ symbol* binary::get_symbol(symbol_id const sym_id) const {
 }
 
 // Get every symbol.
-std::vector<symbol*>& binary::symbols() {
+std::pmr::vector<symbol*>& binary::symbols() {
   return symbols_;
 }
 
 // Get every symbol.
-std::vector<symbol*> const& binary::symbols() const {
+std::pmr::vector<symbol*> const& binary::symbols() const {
   return symbols_;
 }
 
 // Create a zero-initialized data block of the specified size and alignment.
 data_block* binary::create_data_block(
     std::uint32_t const size, std::uint32_t const alignment) {
-  auto const db = data_blocks_.emplace_back(new data_block{});
-  db->bytes     = std::vector<std::uint8_t>(size, 0);
+  auto const db = data_blocks_.emplace_back(new_object<data_block>(storage_, storage_));
+  db->bytes.assign(size, 0);
   db->alignment = alignment;
   db->read_only = false;
   return db;
@@ -655,24 +1150,24 @@ data_block* binary::create_data_block(
 // Create and initialize a new data block from a raw blob of data.
 data_block* binary::create_data_block(void const* const data,
     std::uint32_t const size, std::uint32_t const alignment) {
-  // "Iterators" to pass to std::vector constructor.
+  // "Iterators" to pass to std::vector::assign().
   auto const data_begin = static_cast<std::uint8_t const*>(data);
   auto const data_end   = data_begin + size;
 
-  auto const db = data_blocks_.emplace_back(new data_block{});
-  db->bytes     = std::vector<std::uint8_t>(data_begin, data_end);
+  auto const db = data_blocks_.emplace_back(new_object<data_block>(storage_, storage_));
+  db->bytes.assign(data_begin, data_end);
   db->alignment = alignment;
   db->read_only = false;
   return db;
 }
 
 // Get every data block.
-std::vector<data_block*>& binary::data_blocks() {
+std::pmr::vector<data_block*>& binary::data_blocks() {
   return data_blocks_;
 }
 
 // Get every data block.
-std::vector<data_block*> const& binary::data_blocks() const {
+std::pmr::vector<data_block*> const& binary::data_blocks() const {
   return data_blocks_;
 }
 
@@ -684,7 +1179,7 @@ basic_block* binary::create_basic_block(symbol_id const sym_id) {
   auto const sym = symbols_[sym_id.value];
   assert(sym->type == symbol_type::code);
 
-  sym->bb = basic_blocks_.emplace_back(new basic_block{});
+  sym->bb = basic_blocks_.emplace_back(new_object<basic_block>(storage_, storage_));
   sym->bb->sym_id             = sym_id;
   sym->bb->fallthrough_target = null_symbol_id;
   sym->bb->instructions       = {};
@@ -702,19 +1197,19 @@ basic_block* binary::create_basic_block(char const* const name) {
 }
 
 // Get every basic block.
-std::vector<basic_block*>& binary::basic_blocks() {
+std::pmr::vector<basic_block*>& binary::basic_blocks() {
   return basic_blocks_;
 }
 
 // Get every basic block.
-std::vector<basic_block*> const& binary::basic_blocks() const {
+std::pmr::vector<basic_block*> const& binary::basic_blocks() const {
   return basic_blocks_;
 }
 
 // Create an empty import module.
 import_module* binary::create_import_module(char const* const name) {
   // TODO: Make sure this isn't a duplicate.
-  return import_modules_.emplace_back(new import_module(*this, name));
+  return import_modules_.emplace_back(new_object<import_module>(storage_, *this, name));
 }
 
 // Get an import routine.
@@ -756,10 +1251,33 @@ import_routine* binary::get_or_create_import_routine(
   return create_import_module(module_name)->create_routine(routine_name);
 }
 
+// Export a symbol from the created PE file. The name of the symbol is
+// used as the export name, so it must not be empty.
+void binary::export_symbol(symbol_id const sym_id) {
+  assert(!get_symbol(sym_id)->name.empty());
+  exports_.push_back(sym_id);
+}
+
+// Get every exported symbol.
+std::pmr::vector<symbol_id> const& binary::exports() const {
+  return exports_;
+}
+
+// Get the memory resource that symbols, blocks, and import modules are
+// allocated from.
+std::pmr::memory_resource* binary::storage_resource() const {
+  return storage_;
+}
+
 // Get the underlying Zydis decoder.
 ZydisDecoder* binary::decoder() {
   return &decoder_;
 }
 
+// Get the underlying Zydis decoder.
+ZydisDecoder const* binary::decoder() const {
+  return &decoder_;
+}
+
 } // namespace chum
 
@@ -3,8 +3,12 @@
 #include "block.h"
 #include "symbol.h"
 #include "imports.h"
+#include "layout_report.h"
 
+#include <atomic>
+#include <memory_resource>
 #include <vector>
+#include <string>
 #include <tuple>
 
 #include <pe-builder/pe-builder.h>
@@ -12,6 +16,36 @@
 
 namespace chum {
 
+// Optional settings that control how binary::create() emits a PE file.
+struct create_options {
+  // If non-null, this is filled in with statistics about the code layout
+  // that was produced.
+  layout_report* report = nullptr;
+
+  // Directories that contain local copies of the imported DLLs. If an
+  // imported module is found in one of these, its export name table is used
+  // to fill in IMAGE_IMPORT_BY_NAME::Hint so that the loader can skip the
+  // binary search for every import.
+  std::vector<std::string> import_search_paths = {};
+
+  // Emit an executable instead of a DLL.
+  bool executable = false;
+
+  // Don't emit base relocations, and clear the DYNAMIC_BASE flag. This is
+  // only safe for executables that are always loaded at their preferred base
+  // address, so create() fails if this is set without executable.
+  bool strip_relocs = false;
+
+  // Order the sections by when the loader (and startup code) first touches
+  // them: .idata, data blocks that hold pointers, read-only data, writable
+  // data, .text, and finally .reloc.
+  bool load_order_sections = false;
+
+  // If non-null, emission stops (and fails) as soon as this is set. This is
+  // checked between basic blocks.
+  std::atomic<bool> const* cancel = nullptr;
+};
+
 // This is a database that contains the code and data that makes up an
 // x86-64 binary.
 class binary {
@@ -19,30 +53,44 @@ public:
   // Create an empty binary.
   binary();
 
+  // Create an empty binary where every container, symbol, and block (along
+  // with the instructions, data bytes, and names inside of them) is
+  // allocated from the specified memory resource. It must outlive the binary.
+  explicit binary(std::pmr::memory_resource* resource);
+
   // Free any resources.
   ~binary();
 
   // Move constructor.
   binary(binary&& other);
 
-  // Move assignment operator.
+  // Move assignment operator. This binary keeps its own memory resource: if
+  // the other binary uses a different one, everything is copied into this
+  // binary's resource (as if by clone()) and the other binary is emptied.
   binary& operator=(binary&& other);
 
   // Prevent copying.
   binary(binary const&) = delete;
   binary& operator=(binary const&) = delete;
 
+  // Create a deep copy of this binary. Symbol IDs are preserved, so any
+  // symbol ID from this binary refers to the same symbol in the copy.
+  binary clone() const;
+
+  // Get an estimate of the amount of heap memory used by this binary.
+  std::size_t memory_usage() const;
+
   // Print the contents of this binary, for debugging purposes.
   void print(bool verbose = false);
 
   // Create a new PE file from this binary.
-  bool create(char const* path) const;
+  bool create(char const* path, create_options const& options = {}) const;
 
   // Create a new PE file from this binary.
-  std::vector<std::uint8_t> create() const;
+  std::vector<std::uint8_t> create(create_options const& options = {}) const;
 
   // Create a new PE file from this binary.
-  bool create(pb::pe_builder& pe) const;
+  bool create(pb::pe_builder& pe, create_options const& options = {}) const;
 
   // Get the entrypoint of this binary, if it exists.
   basic_block* entrypoint() const;
@@ -57,10 +105,10 @@ public:
   symbol* get_symbol(symbol_id sym_id) const;
 
   // Get every symbol.
-  std::vector<symbol*>& symbols();
+  std::pmr::vector<symbol*>& symbols();
 
   // Get every symbol.
-  std::vector<symbol*> const& symbols() const;
+  std::pmr::vector<symbol*> const& symbols() const;
 
   // Create a zero-initialized data block of the specified size and alignment.
   data_block* create_data_block(
@@ -71,10 +119,10 @@ public:
     std::uint32_t size, std::uint32_t alignment = 1);
 
   // Get every data block.
-  std::vector<data_block*>& data_blocks();
+  std::pmr::vector<data_block*>& data_blocks();
 
   // Get every data block.
-  std::vector<data_block*> const& data_blocks() const;
+  std::pmr::vector<data_block*> const& data_blocks() const;
 
   // Create a new basic block for the specific code symbol. This block
   // contains zero instructions upon creation. This function also updates
@@ -86,10 +134,10 @@ public:
   basic_block* create_basic_block(char const* name = nullptr);
 
   // Get every basic block.
-  std::vector<basic_block*>& basic_blocks();
+  std::pmr::vector<basic_block*>& basic_blocks();
 
   // Get every basic block.
-  std::vector<basic_block*> const& basic_blocks() const;
+  std::pmr::vector<basic_block*> const& basic_blocks() const;
 
   // Create an empty import module.
   import_module* create_import_module(char const* name);
@@ -103,15 +151,36 @@ public:
   import_routine* get_or_create_import_routine(
     char const* module_name, char const* routine_name);
 
+  // Export a symbol from the created PE file. The name of the symbol is
+  // used as the export name, so it must not be empty.
+  void export_symbol(symbol_id sym_id);
+
+  // Get every exported symbol.
+  std::pmr::vector<symbol_id> const& exports() const;
+
+  // Get the memory resource that symbols, blocks, and import modules are
+  // allocated from. This is fixed when the binary is created.
+  std::pmr::memory_resource* storage_resource() const;
+
   // Get the underlying Zydis decoder.
   ZydisDecoder* decoder();
 
+  // Get the underlying Zydis decoder.
+  ZydisDecoder const* decoder() const;
+
 public:
   // Create a new instruction.
   template <typename... Args>
   instruction instr(Args&&... args) const;
 
+protected:
+  // Copy every symbol, block, and import module into a newly created binary.
+  void clone_into(binary& dst) const;
+
 private:
+  // Free every symbol, block, and import module.
+  void release();
+
   // This is a helper function for instr() that serializes a single item
   // into the instruction that is currently being built.
   template <std::size_t Idx, typename... Args>
@@ -125,6 +194,10 @@ private:
   // Encode and push a new instruction.
   void instr_push_enc_req(instruction& instr, ZydisEncoderRequest const* enc_req) const;
 
+  // Create the .idata section and assign addresses to every import symbol.
+  void create_import_section(pb::pe_builder& pe, create_options const& options,
+    std::vector<std::uint64_t>& sym_to_va) const;
+
 private:
   // ---------------
   // Remember to add any new members to the move constructor/assignment operator!
@@ -136,21 +209,29 @@ private:
   // This is an optional pointer to the entrypoint of this binary.
   basic_block* entrypoint_ = nullptr;
 
+  // This is where every symbol, block, and import module is allocated from.
+  // It needs to be declared before the containers, since they're created
+  // with it.
+  std::pmr::memory_resource* storage_ = std::pmr::get_default_resource();
+
   // Most of these containers need to store pointers to the contained
   // structures since they require stability. We dont want to invalidate
   // any existing pointers whenever an insertion/deletion occurs.
 
   // Every symbol that makes up this binary. These are accessed with symbol IDs.
-  std::vector<symbol*> symbols_ = {};
+  std::pmr::vector<symbol*> symbols_;
 
   // Every piece of data that makes up this binary.
-  std::vector<data_block*> data_blocks_ = {};
+  std::pmr::vector<data_block*> data_blocks_;
 
   // Every piece of code that makes up this binary.
-  std::vector<basic_block*> basic_blocks_ = {};
+  std::pmr::vector<basic_block*> basic_blocks_;
 
   // These are imports from external modules.
-  std::vector<import_module*> import_modules_ = {};
+  std::pmr::vector<import_module*> import_modules_;
+
+  // These are the symbols that are exported by name.
+  std::pmr::vector<symbol_id> exports_;
 };
 
 // Create a new instruction.
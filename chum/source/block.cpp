@@ -2,6 +2,11 @@
 
 namespace chum {
 
+// Create a basic block whose instructions are allocated from a specific
+// memory resource.
+basic_block::basic_block(std::pmr::memory_resource* const resource)
+  : instructions(resource) {}
+
 // Insert an instruction into the basic block.
 void basic_block::insert(instruction const& instr, std::size_t const pos) {
   instructions.insert(begin(instructions) + pos, instr);
@@ -12,5 +17,10 @@ void basic_block::push(instruction const& instr) {
   instructions.push_back(instr);
 }
 
+// Create a data block whose bytes are allocated from a specific memory
+// resource.
+data_block::data_block(std::pmr::memory_resource* const resource)
+  : bytes(resource), read_only(false) {}
+
 } // namespace chum
 
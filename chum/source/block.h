@@ -4,6 +4,7 @@
 #include "symbol.h"
 
 #include <cstdint>
+#include <memory_resource>
 #include <vector>
 
 namespace chum {
@@ -18,6 +19,12 @@ namespace chum {
 // as unintuitive as this may seem. This means that there may be CALLs in
 // the middle of a basic block as long as the target function will return.
 struct basic_block {
+  basic_block() = default;
+
+  // Create a basic block whose instructions are allocated from a specific
+  // memory resource.
+  explicit basic_block(std::pmr::memory_resource* resource);
+
   // The symbol that points to the beginning of this basic block.
   symbol_id sym_id = null_symbol_id;
 
@@ -28,7 +35,26 @@ struct basic_block {
 
   // The instructions that make up this block. The last instruction is a
   // terminating instruction.
-  std::vector<instruction> instructions = {};
+  std::pmr::vector<instruction> instructions = {};
+
+  // The number of INT3 bytes that are emitted directly before this block.
+  // Execution never falls through into the padding, which makes it useful
+  // as scratch space for hot-patching.
+  std::uint8_t padding = 0;
+
+  // Instrumentation passes (edge coverage, latency probes, and memory
+  // tracing) leave this block alone. This is set for every block of a
+  // function that matched a signature with signature_flag_no_instrument.
+  bool no_instrument = false;
+
+  // The number of times that this block was executed, according to a
+  // profile. This is 0 if no profile has been attached.
+  std::uint64_t weight = 0;
+
+  // The number of times that the terminating branch was taken, and the
+  // number of times that execution fell through to the fallthrough target.
+  std::uint64_t taken_weight       = 0;
+  std::uint64_t fallthrough_weight = 0;
 
   // Insert an instruction into the basic block.
   void insert(instruction const& instr, std::size_t pos = 0);
@@ -39,8 +65,14 @@ struct basic_block {
 
 // A data block is a contiguous blob of data.
 struct data_block {
+  data_block() = default;
+
+  // Create a data block whose bytes are allocated from a specific memory
+  // resource.
+  explicit data_block(std::pmr::memory_resource* resource);
+
   // The raw data that makes up this block.
-  std::vector<std::uint8_t> bytes = {};
+  std::pmr::vector<std::uint8_t> bytes = {};
 
   // The alignment of the starting address for this data block. This value
   // must be a power of 2. A value of 1 indicates no alignment at all.
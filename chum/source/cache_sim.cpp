@@ -0,0 +1,140 @@
+#include "cache_sim.h"
+#include "memory_trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+
+namespace chum {
+
+// A set-associative cache with LRU replacement.
+class simulated_cache {
+public:
+  simulated_cache(std::uint32_t const set_count, std::uint32_t const associativity)
+    : set_count_(set_count), associativity_(associativity),
+      tags_(std::size_t(set_count) * associativity, 0),
+      stamps_(std::size_t(set_count) * associativity, 0) {}
+
+  // Access a single line, and return true if it was already cached.
+  bool access(std::uint64_t const line) {
+    auto const set = static_cast<std::size_t>(line % set_count_) * associativity_;
+
+    // Tags are stored off by one, so that 0 is an empty way.
+    auto const tag = line / set_count_ + 1;
+
+    std::size_t victim = set;
+    for (auto i = set; i < set + associativity_; ++i) {
+      if (tags_[i] == tag) {
+        stamps_[i] = ++clock_;
+        return true;
+      }
+
+      if (stamps_[i] < stamps_[victim])
+        victim = i;
+    }
+
+    tags_[victim]   = tag;
+    stamps_[victim] = ++clock_;
+    return false;
+  }
+
+private:
+  std::uint32_t set_count_     = 0;
+  std::uint32_t associativity_ = 0;
+
+  // The tag in every way of every set, and when it was last used.
+  std::vector<std::uint64_t> tags_   = {};
+  std::vector<std::uint64_t> stamps_ = {};
+  std::uint64_t clock_ = 0;
+};
+
+// Replay a memory trace dump through a simulated cache.
+std::optional<cache_sim_result> simulate_cache(trace_dump const& dump,
+    cache_config const& config) {
+  if (dump.kind != trace_kind::address)
+    return {};
+
+  if (!config.line_size || (config.line_size & (config.line_size - 1)) ||
+      !config.associativity || config.size < config.line_size * config.associativity)
+    return {};
+
+  auto const set_count = config.size / (config.line_size * config.associativity);
+
+  std::uint32_t line_shift = 0;
+  while ((1u << line_shift) < config.line_size)
+    ++line_shift;
+
+  cache_sim_result result = {};
+
+  std::vector<instruction_misses> stats(dump.id_rvas.size());
+  for (std::size_t i = 0; i < stats.size(); ++i)
+    stats[i].rva = dump.id_rvas[i];
+
+  // Every thread gets its own cache, unless they're all shared.
+  std::unordered_map<std::uint32_t, simulated_cache> caches = {};
+
+  for (auto const& ring : dump.rings) {
+    for (auto const& record : ring) {
+      auto const id = record.id & ~memory_trace_store_flag;
+      if (id >= stats.size())
+        continue;
+
+      auto const thread = config.per_thread ? record.thread_id : 0;
+      auto it = caches.find(thread);
+      if (it == end(caches))
+        it = caches.emplace(thread, simulated_cache(set_count, config.associativity)).first;
+
+      auto const hit = it->second.access(record.value >> line_shift);
+      auto& s = stats[id];
+
+      if (record.id & memory_trace_store_flag) {
+        ++s.stores;
+        s.store_misses += !hit;
+      }
+      else {
+        ++s.loads;
+        s.load_misses += !hit;
+      }
+
+      ++result.accesses;
+      result.misses += !hit;
+    }
+  }
+
+  for (auto const& s : stats) {
+    if (s.loads || s.stores)
+      result.instructions.push_back(s);
+  }
+
+  std::stable_sort(begin(result.instructions), end(result.instructions),
+    [](auto const& left, auto const& right) {
+      return left.load_misses + left.store_misses > right.load_misses + right.store_misses;
+    });
+
+  return result;
+}
+
+// Print the miss rates of the instructions with the most misses.
+void print_cache_sim_result(cache_sim_result const& result, std::size_t const max_count) {
+  std::printf("[+] %llu access(es), %llu miss(es) (%.2f%%).\n",
+    static_cast<unsigned long long>(result.accesses),
+    static_cast<unsigned long long>(result.misses),
+    result.accesses ? 100.0 * result.misses / result.accesses : 0.0);
+
+  auto const count = (std::min)(max_count, result.instructions.size());
+  std::printf("[+] Instructions with the most misses (%zu of %zu):\n",
+    count, result.instructions.size());
+
+  for (std::size_t i = 0; i < count; ++i) {
+    auto const& s = result.instructions[i];
+    auto const accesses = s.loads + s.stores;
+    auto const misses   = s.load_misses + s.store_misses;
+
+    std::printf("[+]   RVA: 0x%-8X Loads: %-10llu Stores: %-10llu Misses: %-10llu (%.2f%%)\n",
+      s.rva, static_cast<unsigned long long>(s.loads),
+      static_cast<unsigned long long>(s.stores),
+      static_cast<unsigned long long>(misses), 100.0 * misses / accesses);
+  }
+}
+
+} // namespace chum
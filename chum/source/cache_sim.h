@@ -0,0 +1,59 @@
+#pragma once
+
+#include "trace_buffer.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace chum {
+
+// The geometry of a simulated set-associative cache with LRU replacement.
+// Stores allocate a line, just like loads.
+struct cache_config {
+  // The total size of the cache, in bytes.
+  std::uint32_t size = 32 * 1024;
+
+  // The size of a cache line, in bytes. This must be a power of 2.
+  std::uint32_t line_size = 64;
+
+  // The number of lines in every set.
+  std::uint32_t associativity = 8;
+
+  // Simulate a private cache for every thread, rather than a single cache
+  // that is shared by every thread. Records from different threads can't
+  // be interleaved in their original order, so a shared cache sees each
+  // ring's records one ring after another.
+  bool per_thread = true;
+};
+
+// The simulated misses of a single instruction.
+struct instruction_misses {
+  // The RVA of the instruction in the original image.
+  std::uint32_t rva = 0;
+
+  std::uint64_t loads        = 0;
+  std::uint64_t stores       = 0;
+  std::uint64_t load_misses  = 0;
+  std::uint64_t store_misses = 0;
+};
+
+struct cache_sim_result {
+  // Every instruction that was executed at least once, most misses first.
+  std::vector<instruction_misses> instructions = {};
+
+  std::uint64_t accesses = 0;
+  std::uint64_t misses   = 0;
+};
+
+// Replay a memory trace dump (see instrument_memory_accesses()) through a
+// simulated cache, and count the misses of every instruction. Accesses are
+// assumed to touch a single line. Returns an empty result if the dump isn't
+// an address trace or the cache geometry is invalid.
+std::optional<cache_sim_result> simulate_cache(trace_dump const& dump,
+  cache_config const& config = {});
+
+// Print the miss rates of the instructions with the most misses.
+void print_cache_sim_result(cache_sim_result const& result, std::size_t max_count = 50);
+
+} // namespace chum
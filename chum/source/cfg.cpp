@@ -0,0 +1,109 @@
+#include "cfg.h"
+
+namespace chum {
+
+// Figure out where control flow can go after executing a basic block.
+block_exit get_block_exit(binary const& bin, basic_block const* const bb) {
+  block_exit exit = {};
+  exit.fallthrough_target = bb->fallthrough_target;
+
+  if (bb->instructions.empty())
+    return exit;
+
+  auto const& instr = bb->instructions.back();
+
+  ZydisDecodedInstruction decoded_instr;
+  ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT];
+  if (ZYAN_FAILED(ZydisDecoderDecodeFull(bin.decoder(), instr.bytes,
+      instr.length, &decoded_instr, decoded_ops))) {
+    exit.is_indirect = true;
+    return exit;
+  }
+
+  if (decoded_instr.meta.category == ZYDIS_CATEGORY_RET) {
+    exit.is_return = true;
+    return exit;
+  }
+
+  if (decoded_instr.meta.category != ZYDIS_CATEGORY_COND_BR &&
+      decoded_instr.meta.category != ZYDIS_CATEGORY_UNCOND_BR)
+    return exit;
+
+  // JMP reg, JMP [mem], etc.
+  if (!decoded_instr.raw.imm[0].is_relative) {
+    exit.is_indirect = true;
+    return exit;
+  }
+
+  // We need to copy the symbol ID this way in order to workaround
+  // annoying sign bugs.
+  symbol_id sym_id = null_symbol_id;
+  std::memcpy(&sym_id.value, instr.bytes +
+    decoded_instr.raw.imm[0].offset, decoded_instr.raw.imm[0].size / 8);
+
+  auto const sym = bin.get_symbol(sym_id);
+  if (!sym || sym->type != symbol_type::code) {
+    exit.is_indirect = true;
+    return exit;
+  }
+
+  exit.branch_target = sym_id;
+  return exit;
+}
+
+// Get the direct successors of a basic block.
+std::vector<basic_block*> get_successors(
+    binary const& bin, basic_block const* const bb) {
+  auto const exit = get_block_exit(bin, bb);
+
+  std::vector<basic_block*> successors = {};
+
+  if (exit.branch_target)
+    successors.push_back(bin.get_symbol(exit.branch_target)->bb);
+
+  if (exit.fallthrough_target && exit.fallthrough_target != exit.branch_target) {
+    if (auto const sym = bin.get_symbol(exit.fallthrough_target);
+        sym && sym->type == symbol_type::code)
+      successors.push_back(sym->bb);
+  }
+
+  return successors;
+}
+
+// Get the direct predecessors of every basic block, indexed by symbol ID.
+std::vector<std::vector<basic_block*>> get_predecessors(binary const& bin) {
+  std::vector<std::vector<basic_block*>> predecessors(bin.symbols().size());
+
+  for (auto const bb : bin.basic_blocks()) {
+    for (auto const succ : get_successors(bin, bb))
+      predecessors[succ->sym_id.value].push_back(bb);
+  }
+
+  return predecessors;
+}
+
+// Get every block that belongs to a function.
+std::vector<basic_block*> get_function_blocks(binary const& bin,
+    basic_block* const entry, std::vector<symbol_id> const& function_entries) {
+  std::vector<std::uint8_t> visited(bin.symbols().size(), 0);
+
+  for (auto const sym_id : function_entries)
+    visited[sym_id.value] = 1;
+
+  std::vector<basic_block*> blocks = { entry };
+  visited[entry->sym_id.value] = 1;
+
+  for (std::size_t i = 0; i < blocks.size(); ++i) {
+    for (auto const succ : get_successors(bin, blocks[i])) {
+      if (visited[succ->sym_id.value])
+        continue;
+
+      visited[succ->sym_id.value] = 1;
+      blocks.push_back(succ);
+    }
+  }
+
+  return blocks;
+}
+
+} // namespace chum
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "binary.h"
+
+namespace chum {
+
+// This describes how control flow leaves a basic block.
+struct block_exit {
+  // The code symbol that the terminating JMP/JCC branches to. This is NULL
+  // if the block doesn't end with a direct branch.
+  symbol_id branch_target = null_symbol_id;
+
+  // The fallthrough target of the block, if it has one.
+  symbol_id fallthrough_target = null_symbol_id;
+
+  // The block ends with a RET.
+  bool is_return = false;
+
+  // The block ends with an indirect JMP (or any other transfer whose
+  // destination is unknown, such as a branch to a non-code symbol).
+  bool is_indirect = false;
+};
+
+// Figure out where control flow can go after executing a basic block.
+block_exit get_block_exit(binary const& bin, basic_block const* bb);
+
+// Get the direct successors of a basic block.
+std::vector<basic_block*> get_successors(binary const& bin, basic_block const* bb);
+
+// Get the direct predecessors of every basic block, indexed by symbol ID.
+std::vector<std::vector<basic_block*>> get_predecessors(binary const& bin);
+
+// Get every block that belongs to a function, by following branches and
+// fallthroughs from its entry. Branches into other function entries are
+// treated as tail calls and are not followed. The entry block is first.
+std::vector<basic_block*> get_function_blocks(binary const& bin,
+  basic_block* entry, std::vector<symbol_id> const& function_entries = {});
+
+} // namespace chum
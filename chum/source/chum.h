@@ -2,4 +2,28 @@
 
 #include "binary.h"
 #include "disassembler.h"
+#include "coverage.h"
+#include "latency.h"
+#include "hotpatch.h"
+#include "prefetch.h"
+#include "layout.h"
+#include "profile.h"
+#include "roundtrip.h"
+#include "scaling.h"
+#include "signatures.h"
+#include "shard.h"
+#include "daemon.h"
+#include "async.h"
+#include "storage.h"
+#include "lbr.h"
+#include "promotion.h"
+#include "tail_duplication.h"
+#include "outliner.h"
+#include "unroll.h"
+#include "uarch.h"
+#include "data_layout.h"
+#include "memory_trace.h"
+#include "cache_sim.h"
+#include "columnar.h"
+#include "ir_export.h"
 
@@ -0,0 +1,145 @@
+#include "columnar.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace chum {
+
+// "CHCL"
+static constexpr std::uint32_t column_table_magic = 0x4C434843;
+
+// Get the size of a single value of a fixed-width column type.
+static std::size_t get_column_width(column_type const type) {
+  switch (type) {
+  case column_type::u8:  return 1;
+  case column_type::u16: return 2;
+  case column_type::u32: return 4;
+  case column_type::u64: return 8;
+  default: return 0;
+  }
+}
+
+// Create (or overwrite) a table with the specified columns.
+column_writer::column_writer(char const* const path,
+    std::vector<column_desc> const& columns, std::uint32_t const rows_per_group)
+    : file_(path, std::ios::binary), rows_per_group_(rows_per_group ? rows_per_group : 1) {
+  auto const write_u32 = [&](std::uint32_t const value) {
+    file_.write(reinterpret_cast<char const*>(&value), 4);
+  };
+
+  write_u32(column_table_magic);
+  write_u32(1);
+  write_u32(static_cast<std::uint32_t>(columns.size()));
+
+  for (auto const& desc : columns) {
+    auto const name_length = static_cast<std::uint8_t>(
+      (std::min)(std::strlen(desc.name), std::size_t(0xFF)));
+
+    file_.put(static_cast<char>(desc.type));
+    file_.put(static_cast<char>(name_length));
+    file_.write(desc.name, name_length);
+
+    auto& col = columns_.emplace_back();
+    col.type = desc.type;
+
+    if (desc.type == column_type::string) {
+      col.offsets.reserve(rows_per_group_ + 1);
+      col.offsets.push_back(0);
+    } else
+      col.data.reserve(rows_per_group_ * get_column_width(desc.type));
+  }
+}
+
+// Finish the table, if it hasn't been finished already.
+column_writer::~column_writer() {
+  finish();
+}
+
+// Whether the file was created and every write so far has succeeded.
+bool column_writer::valid() const {
+  return static_cast<bool>(file_);
+}
+
+// Append an integer to the next column of the current row.
+void column_writer::push(std::uint64_t const value) {
+  assert(next_column_ < columns_.size());
+  auto& col = columns_[next_column_++];
+  assert(col.type != column_type::string);
+
+  // Only the low bytes are kept.
+  auto const bytes = reinterpret_cast<std::uint8_t const*>(&value);
+  col.data.insert(end(col.data), bytes, bytes + get_column_width(col.type));
+}
+
+// Append a string to the next column of the current row.
+void column_writer::push(std::string_view const value) {
+  assert(next_column_ < columns_.size());
+  auto& col = columns_[next_column_++];
+  assert(col.type == column_type::string);
+
+  col.data.insert(end(col.data), begin(value), end(value));
+  col.offsets.push_back(static_cast<std::uint32_t>(col.data.size()));
+}
+
+// End the current row.
+void column_writer::end_row() {
+  assert(next_column_ == columns_.size());
+  next_column_ = 0;
+
+  ++total_rows_;
+  if (++group_rows_ >= rows_per_group_)
+    flush();
+}
+
+// Write the last row group and the footer, and close the file.
+bool column_writer::finish() {
+  if (finished_)
+    return valid();
+
+  finished_ = true;
+  flush();
+
+  std::uint32_t const terminator = 0;
+  file_.write(reinterpret_cast<char const*>(&terminator), 4);
+  file_.write(reinterpret_cast<char const*>(&total_rows_), 8);
+
+  file_.close();
+  return !file_.fail();
+}
+
+// The number of rows that have been ended so far.
+std::uint64_t column_writer::row_count() const {
+  return total_rows_;
+}
+
+// Write the current row group (if it isn't empty) and clear it.
+void column_writer::flush() {
+  if (group_rows_ == 0)
+    return;
+
+  file_.write(reinterpret_cast<char const*>(&group_rows_), 4);
+
+  for (auto& col : columns_) {
+    std::uint64_t const size = col.data.size() +
+      col.offsets.size() * sizeof(std::uint32_t);
+    file_.write(reinterpret_cast<char const*>(&size), 8);
+
+    if (col.type == column_type::string) {
+      file_.write(reinterpret_cast<char const*>(col.offsets.data()),
+        col.offsets.size() * sizeof(std::uint32_t));
+
+      col.offsets.clear();
+      col.offsets.push_back(0);
+    }
+
+    file_.write(reinterpret_cast<char const*>(col.data.data()), col.data.size());
+
+    // The capacity is kept for the next row group.
+    col.data.clear();
+  }
+
+  group_rows_ = 0;
+}
+
+} // namespace chum
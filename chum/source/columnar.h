@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string_view>
+#include <vector>
+
+namespace chum {
+
+// The type of every value in a column. Integers are stored little-endian.
+enum class column_type : std::uint8_t {
+  u8,
+  u16,
+  u32,
+  u64,
+
+  // Every row group stores (row_count + 1) u32 offsets into the character
+  // data that follows them.
+  string
+};
+
+// The name and type of a single column.
+struct column_desc {
+  char const* name = nullptr;
+  column_type type = column_type::u32;
+};
+
+// Writes a table to disk in a simple columnar format, one row group at a
+// time, so that memory usage only depends on the row group size:
+//
+//   u32 magic, u32 version, u32 column_count
+//   column_count * { u8 type, u8 name_length, char name[name_length] }
+//   row groups:  u32 row_count, column_count * { u64 size, u8 data[size] }
+//   u32 0, u64 total_row_count
+//
+// Values are pushed one column at a time, in the order that the columns
+// were specified, and end_row() is called after the last column.
+class column_writer {
+public:
+  // Create (or overwrite) a table with the specified columns.
+  column_writer(char const* path, std::vector<column_desc> const& columns,
+    std::uint32_t rows_per_group = 64 * 1024);
+
+  // Finish the table, if it hasn't been finished already.
+  ~column_writer();
+
+  column_writer(column_writer const&) = delete;
+  column_writer& operator=(column_writer const&) = delete;
+
+  // Whether the file was created and every write so far has succeeded.
+  bool valid() const;
+
+  // Append an integer to the next column of the current row.
+  void push(std::uint64_t value);
+
+  // Append a string to the next column of the current row.
+  void push(std::string_view value);
+
+  // End the current row. The row group is written once it is full.
+  void end_row();
+
+  // Write the last row group and the footer, and close the file.
+  bool finish();
+
+  // The number of rows that have been ended so far.
+  std::uint64_t row_count() const;
+
+private:
+  // Write the current row group (if it isn't empty) and clear it.
+  void flush();
+
+private:
+  struct column {
+    column_type type = column_type::u32;
+
+    // The values of the current row group. For string columns, these are
+    // the characters, and the offsets are stored separately.
+    std::vector<std::uint8_t> data = {};
+    std::vector<std::uint32_t> offsets = {};
+  };
+
+  std::ofstream file_;
+  std::vector<column> columns_ = {};
+
+  // The column that the next value is pushed to.
+  std::size_t next_column_ = 0;
+
+  std::uint32_t rows_per_group_ = 0;
+  std::uint32_t group_rows_     = 0;
+  std::uint64_t total_rows_     = 0;
+
+  bool finished_ = false;
+};
+
+} // namespace chum
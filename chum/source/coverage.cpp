@@ -0,0 +1,122 @@
+#include "coverage.h"
+#include "liveness.h"
+#include "encoder.h"
+
+#include <random>
+
+namespace chum {
+
+// Instrument every basic block with AFL-style edge coverage.
+edge_coverage_result instrument_edge_coverage(
+    binary& bin, edge_coverage_options const& options) {
+  edge_coverage_result result = {};
+
+  // This needs to be calculated before we modify anything.
+  liveness_analysis const liveness(bin);
+
+  // Copy the blocks that we're going to instrument, since we don't want to
+  // instrument anything that we create.
+  auto const blocks = bin.basic_blocks();
+
+  // Create the coverage bitmap.
+  result.map = bin.create_symbol(symbol_type::data, options.map_name);
+  result.map->db        = bin.create_data_block(coverage_map_size, 64);
+  result.map->db_offset = 0;
+  result.map->target    = null_symbol_id;
+  bin.export_symbol(result.map->id);
+
+  // Create the previous location variable.
+  result.prev_loc = bin.create_symbol(symbol_type::data, options.prev_loc_name);
+  result.prev_loc->db        = bin.create_data_block(8, 8);
+  result.prev_loc->db_offset = 0;
+  result.prev_loc->target    = null_symbol_id;
+  bin.export_symbol(result.prev_loc->id);
+
+  std::mt19937 rng(options.seed ? options.seed : std::random_device{}());
+  std::uniform_int_distribution<std::uint32_t> dist(0, coverage_map_size - 1);
+
+  for (auto const bb : blocks) {
+    if (bb->no_instrument)
+      continue;
+
+    auto const live = liveness.live_in(bb);
+    auto const cur_id = dist(rng);
+
+    // Pick two scratch registers, preferring ones that are dead. RSP is
+    // never used since we might need to push to the stack.
+    std::uint8_t scratch[2] = {};
+    bool spilled[2] = {};
+
+    std::uint16_t taken = 1 << 4;
+    for (std::size_t i = 0; i < 2; ++i) {
+      std::uint8_t id = 0;
+
+      // Look for a dead register first.
+      while (id < 16 && ((taken | live.gprs) & (1 << id)))
+        ++id;
+
+      // Otherwise, just use any register that we haven't taken yet.
+      if (id >= 16) {
+        for (id = 0; taken & (1 << id); ++id) {}
+        spilled[i] = true;
+      }
+
+      scratch[i] = id;
+      taken |= 1 << id;
+    }
+
+    auto const save_flags = (live.flags & status_flags) != 0;
+
+    std::vector<instruction> probe = {};
+
+    if (save_flags)
+      probe.push_back(bin.instr("\x9C")); // PUSHFQ
+
+    for (std::size_t i = 0; i < 2; ++i) {
+      if (spilled[i])
+        probe.push_back(bin.instr(enc_req(ZYDIS_MNEMONIC_PUSH,
+          { enc_reg(gpr64(scratch[i])) })));
+    }
+
+    // MOVZX idx, WORD PTR [prev_loc]
+    probe.push_back(bin.instr(enc_req(ZYDIS_MNEMONIC_MOVZX,
+      { enc_reg(gpr32(scratch[0])), enc_sym(2, result.prev_loc->id) })));
+
+    // XOR idx, cur_id
+    probe.push_back(bin.instr(enc_req(ZYDIS_MNEMONIC_XOR,
+      { enc_reg(gpr32(scratch[0])), enc_imm(cur_id) })));
+
+    // LEA map, [coverage_map]
+    probe.push_back(bin.instr(enc_req(ZYDIS_MNEMONIC_LEA,
+      { enc_reg(gpr64(scratch[1])), enc_sym(8, result.map->id) })));
+
+    // INC BYTE PTR [map + idx]
+    probe.push_back(bin.instr(enc_req(ZYDIS_MNEMONIC_INC,
+      { enc_mem(1, gpr64(scratch[1]), gpr64(scratch[0]), 1) })));
+
+    // MOV WORD PTR [prev_loc], cur_id >> 1
+    probe.push_back(bin.instr(enc_req(ZYDIS_MNEMONIC_MOV,
+      { enc_sym(2, result.prev_loc->id), enc_imm(cur_id >> 1) })));
+
+    for (std::size_t i = 2; i > 0; --i) {
+      if (spilled[i - 1])
+        probe.push_back(bin.instr(enc_req(ZYDIS_MNEMONIC_POP,
+          { enc_reg(gpr64(scratch[i - 1])) })));
+    }
+
+    if (save_flags)
+      probe.push_back(bin.instr("\x9D")); // POPFQ
+
+    bb->instructions.insert(begin(bb->instructions), begin(probe), end(probe));
+
+    ++result.block_count;
+    if (spilled[0] || spilled[1])
+      ++result.spill_count;
+    if (save_flags)
+      ++result.flags_save_count;
+  }
+
+  return result;
+}
+
+} // namespace chum
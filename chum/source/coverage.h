@@ -0,0 +1,55 @@
+#pragma once
+
+#include "binary.h"
+
+#include <cstdint>
+
+namespace chum {
+
+// The size of the edge coverage bitmap, in bytes. This matches AFL's default
+// map size so that existing tooling can consume it directly.
+inline constexpr std::uint32_t coverage_map_size = 1 << 16;
+
+struct edge_coverage_options {
+  // The seed that is used for generating block IDs. A value of 0 means that
+  // a random seed is used.
+  std::uint32_t seed = 0;
+
+  // The exported name of the coverage bitmap.
+  char const* map_name = "__chum_coverage_map";
+
+  // The exported name of the previous location variable. A fuzzer should
+  // reset this to 0 before every execution.
+  char const* prev_loc_name = "__chum_coverage_prev_loc";
+};
+
+struct edge_coverage_result {
+  // The symbol that points to the start of the coverage bitmap.
+  symbol* map = nullptr;
+
+  // The symbol that points to the previous location variable.
+  symbol* prev_loc = nullptr;
+
+  // The number of basic blocks that were instrumented.
+  std::size_t block_count = 0;
+
+  // The number of blocks where a register had to be spilled to the stack.
+  std::size_t spill_count = 0;
+
+  // The number of blocks where RFLAGS had to be saved.
+  std::size_t flags_save_count = 0;
+};
+
+// Instrument every basic block with AFL-style edge coverage. Each block is
+// assigned a random ID, and the edge between the previous block and the
+// current block is recorded by incrementing a byte in a 64KB bitmap:
+//
+//   map[cur_id ^ prev_loc]++;
+//   prev_loc = cur_id >> 1;
+//
+// Dead registers and flags are used whenever possible so that nothing has
+// to be saved.
+edge_coverage_result instrument_edge_coverage(
+  binary& bin, edge_coverage_options const& options = {});
+
+} // namespace chum
@@ -0,0 +1,534 @@
+// Winsock has to be included before Windows.h.
+#include <winsock2.h>
+#include <afunix.h>
+
+#include "daemon.h"
+#include "coverage.h"
+#include "hotpatch.h"
+#include "latency.h"
+#include "layout.h"
+#include "memory_trace.h"
+#include "profile.h"
+#include "outliner.h"
+#include "promotion.h"
+#include "tail_duplication.h"
+#include "unroll.h"
+#include "storage.h"
+#include "util.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <sstream>
+#include <thread>
+
+namespace chum {
+
+// Get the number of milliseconds that have passed since a time point.
+static double elapsed_ms(std::chrono::steady_clock::time_point const start) {
+  return std::chrono::duration<double, std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+analysis_cache::analysis_cache(std::size_t const budget,
+    std::pmr::memory_resource* const storage)
+  : budget_(budget), storage_(storage) {}
+
+// Get a private copy of the analysis of an image.
+std::optional<disassembled_binary> analysis_cache::acquire(
+    std::string const& path, bool* const hit) {
+  std::error_code ec;
+  auto const size = std::filesystem::file_size(path, ec);
+  if (ec)
+    return {};
+
+  auto const mtime = std::filesystem::last_write_time(path, ec);
+  if (ec)
+    return {};
+
+  auto const key = path + "|" + std::to_string(size) + "|" +
+    std::to_string(mtime.time_since_epoch().count());
+
+  std::shared_ptr<disassembled_binary const> bin = nullptr;
+
+  {
+    std::lock_guard lock(mutex_);
+
+    if (auto const it = index_.find(key); it != end(index_)) {
+      entries_.splice(begin(entries_), entries_, it->second);
+      bin = it->second->bin;
+    }
+  }
+
+  if (hit)
+    *hit = (bin != nullptr);
+
+  // Copying happens outside of the lock. The shared pointer keeps the
+  // analysis alive even if it gets evicted in the meantime.
+  if (bin)
+    return bin->clone();
+
+  disassemble_options options = {};
+  options.storage = storage_;
+
+  auto analysis = disassemble(path.c_str(), options);
+  if (!analysis)
+    return {};
+
+  auto copy = analysis->clone();
+  insert(key, std::make_shared<disassembled_binary const>(std::move(*analysis)));
+
+  return copy;
+}
+
+// Get the estimated memory usage of every cached analysis.
+std::size_t analysis_cache::memory_usage() const {
+  std::lock_guard lock(mutex_);
+  return usage_;
+}
+
+// Get the number of cached analyses.
+std::size_t analysis_cache::entry_count() const {
+  std::lock_guard lock(mutex_);
+  return entries_.size();
+}
+
+// Add an analysis to the front of the cache and evict the least recently
+// used analyses until the cache fits in its budget again.
+void analysis_cache::insert(std::string const& key,
+    std::shared_ptr<disassembled_binary const> const& bin) {
+  auto const size = bin->memory_usage();
+
+  // Don't bother caching analyses that would evict everything else and
+  // still not fit.
+  if (size > budget_)
+    return;
+
+  std::lock_guard lock(mutex_);
+
+  // Another request might have analyzed the same image at the same time.
+  if (index_.count(key))
+    return;
+
+  entries_.push_front({ key, bin, size });
+  index_[key] = begin(entries_);
+  usage_ += size;
+
+  while (usage_ > budget_) {
+    auto const& last = entries_.back();
+    usage_ -= last.size;
+    index_.erase(last.key);
+    entries_.pop_back();
+  }
+}
+
+// Parse a rewrite request.
+std::optional<rewrite_request> parse_rewrite_request(std::string const& text,
+    std::string* const error) {
+  rewrite_request request = {};
+
+  std::istringstream stream(text);
+  for (std::string line; std::getline(stream, line);) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+
+    if (line.empty())
+      continue;
+
+    auto const separator = line.find(' ');
+    auto const key   = line.substr(0, separator);
+    auto const value = separator == std::string::npos ? "" : line.substr(separator + 1);
+
+    if (key == "input")
+      request.input_path = value;
+    else if (key == "output")
+      request.output_path = value;
+    else if (key == "transform")
+      request.transforms.push_back(value);
+    else if (key == "profile")
+      request.profile_path = value;
+    else if (key == "startup_trace")
+      request.startup_trace_path = value;
+    else if (key == "import_path")
+      request.import_search_paths.push_back(value);
+    else if (key == "executable")
+      request.executable = true;
+    else if (key == "strip_relocs")
+      request.strip_relocs = true;
+    else if (key == "load_order")
+      request.load_order_sections = true;
+    else {
+      if (error)
+        *error = "unknown key: " + key;
+      return {};
+    }
+  }
+
+  if (request.input_path.empty() || request.output_path.empty()) {
+    if (error)
+      *error = "missing input or output";
+    return {};
+  }
+
+  return request;
+}
+
+// Run a single transform on a binary. The profile is null if the request
+// didn't come with one.
+static bool run_transform(disassembled_binary& bin, std::string const& name,
+    profile const* const prof) {
+  if (name == "edge_coverage")
+    instrument_edge_coverage(bin);
+  else if (name == "latency")
+    instrument_function_latency(bin);
+  else if (name == "memory_trace")
+    instrument_memory_accesses(bin);
+  else if (name == "hotpatch") {
+    std::vector<basic_block*> entries = {};
+    for (auto const function : bin.functions())
+      entries.push_back(bin.get_symbol(function)->bb);
+
+    reserve_hotpatch_sites(bin, entries);
+  }
+  else if (name == "promote_calls" && prof)
+    promote_indirect_calls(bin, prof->calls);
+  else if (name == "tail_duplication") {
+    // Without a profile, every JMP to a small tail is a candidate.
+    tail_duplication_options options = {};
+    options.min_weight = prof ? 1 : 0;
+    duplicate_tails(bin, options);
+  }
+  else if (name == "outline_cold" && prof)
+    outline_cold_sequences(bin);
+  else if (name == "unroll" && prof)
+    unroll_loops(bin);
+  else
+    return false;
+
+  return true;
+}
+
+// Run a rewrite request.
+bool run_rewrite_request(analysis_cache& cache, rewrite_request const& request,
+    rewrite_timing& timing, std::string* const error) {
+  auto const set_error = [&](std::string const& message) {
+    if (error)
+      *error = message;
+    return false;
+  };
+
+  auto const start = std::chrono::steady_clock::now();
+
+  auto bin = cache.acquire(request.input_path, &timing.cache_hit);
+  if (!bin)
+    return set_error("failed to disassemble " + request.input_path);
+
+  timing.analysis = elapsed_ms(start);
+
+  auto const transform_start = std::chrono::steady_clock::now();
+
+  std::optional<profile> prof = {};
+
+  if (!request.profile_path.empty()) {
+    prof = read_profile(request.profile_path.c_str());
+    if (!prof || !attach_profile(*bin, *prof))
+      return set_error("invalid profile " + request.profile_path);
+
+    // Keep the executed blocks in memory while the transforms run. Hot
+    // ranges are only a hint, so concurrent requests replacing each
+    // other's ranges just costs a few extra page faults.
+    if (auto const spill = dynamic_cast<mapped_file_resource*>(bin->storage_resource()))
+      keep_hot_blocks_resident(*bin, *spill);
+  }
+
+  // Check the order of the transforms before running any of them.
+  // promote_calls and memory_trace find instructions by their original
+  // position in a block, and every transform inserts instructions, so they
+  // have to come first.
+  for (std::size_t i = 0; i < request.transforms.size(); ++i) {
+    auto const& name = request.transforms[i];
+
+    if (!prof && (name == "promote_calls" || name == "outline_cold" || name == "unroll"))
+      return set_error(name + " requires a profile");
+
+    if (i > 0 && (name == "promote_calls" || name == "memory_trace"))
+      return set_error(name + " must be the first transform");
+  }
+
+  for (auto const& name : request.transforms) {
+    if (!run_transform(*bin, name, prof ? &*prof : nullptr))
+      return set_error("unknown transform: " + name);
+  }
+
+  // Layout runs after every transform, since transforms can create blocks.
+  if (!request.startup_trace_path.empty())
+    apply_startup_layout(*bin, read_rva_counts(request.startup_trace_path.c_str()));
+
+  timing.transforms = elapsed_ms(transform_start);
+
+  auto const create_start = std::chrono::steady_clock::now();
+
+  create_options options = {};
+  options.import_search_paths = request.import_search_paths;
+  options.executable          = request.executable;
+  options.strip_relocs        = request.strip_relocs;
+  options.load_order_sections = request.load_order_sections;
+
+  if (!bin->create(request.output_path.c_str(), options))
+    return set_error("failed to create " + request.output_path);
+
+  timing.create = elapsed_ms(create_start);
+  timing.total  = elapsed_ms(start);
+
+  return true;
+}
+
+// Read a request from a connection, until the client shuts down its side of
+// the connection.
+static std::string receive_all(SOCKET const sock) {
+  std::string data = "";
+
+  char buffer[0x1000];
+  for (int size = 0; (size = recv(sock, buffer, sizeof(buffer), 0)) > 0;)
+    data.append(buffer, size);
+
+  return data;
+}
+
+// Read a request from a connection, until the client shuts down its side of
+// the connection. The socket must have a receive timeout.
+static std::optional<std::string> receive_request(SOCKET const sock,
+    std::size_t const max_size, std::string* const error) {
+  std::string data = "";
+
+  char buffer[0x1000];
+  for (int size = 0; (size = recv(sock, buffer, sizeof(buffer), 0)) != 0;) {
+    if (size < 0) {
+      *error = WSAGetLastError() == WSAETIMEDOUT ?
+        "request timed out" : "failed to receive request";
+      return {};
+    }
+
+    if (data.size() + size > max_size) {
+      *error = "request too large";
+      return {};
+    }
+
+    data.append(buffer, size);
+  }
+
+  return data;
+}
+
+// Send an entire string over a connection.
+static bool send_all(SOCKET const sock, std::string const& data) {
+  for (std::size_t offset = 0; offset < data.size();) {
+    auto const size = send(sock, data.data() + offset,
+      static_cast<int>(data.size() - offset), 0);
+    if (size <= 0)
+      return false;
+
+    offset += size;
+  }
+
+  return true;
+}
+
+// Fill in the address of a Unix domain socket.
+static bool make_socket_address(char const* const path, sockaddr_un& addr) {
+  if (std::strlen(path) >= sizeof(addr.sun_path))
+    return false;
+
+  addr = {};
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path, std::strlen(path));
+
+  return true;
+}
+
+// Serve a single connection and return false if the daemon should stop.
+static bool serve_connection(analysis_cache& cache,
+    daemon_options const& options, SOCKET const sock) {
+  std::string error = "";
+
+  auto const received = receive_request(sock, options.max_request_size, &error);
+  if (!received) {
+    send_all(sock, "error " + error + "\n");
+    return true;
+  }
+
+  auto const& text = *received;
+
+  if (text.rfind("shutdown", 0) == 0) {
+    send_all(sock, "ok shutdown\n");
+    return false;
+  }
+
+  char response[512] = {};
+
+  if (text.rfind("stats", 0) == 0) {
+    std::snprintf(response, sizeof(response), "ok entries=%zu memory=%zu\n",
+      cache.entry_count(), cache.memory_usage());
+    send_all(sock, response);
+    return true;
+  }
+
+  rewrite_timing timing = {};
+
+  auto const request = parse_rewrite_request(text, &error);
+  if (!request || !run_rewrite_request(cache, *request, timing, &error)) {
+    send_all(sock, "error " + error + "\n");
+    return true;
+  }
+
+  std::snprintf(response, sizeof(response), "ok cache_hit=%d analysis_ms=%.3f "
+    "transform_ms=%.3f create_ms=%.3f total_ms=%.3f\n", timing.cache_hit ? 1 : 0,
+    timing.analysis, timing.transforms, timing.create, timing.total);
+  send_all(sock, response);
+
+  return true;
+}
+
+// Listen for rewrite requests until a "shutdown" request is received.
+bool run_daemon(daemon_options const& options) {
+  WSADATA wsa_data;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+    return false;
+
+  sockaddr_un addr = {};
+  if (!make_socket_address(options.socket_path.c_str(), addr)) {
+    std::printf("[!] Socket path is too long.\n");
+    WSACleanup();
+    return false;
+  }
+
+  // A socket file is left behind if a previous daemon didn't exit cleanly.
+  std::error_code ec;
+  std::filesystem::remove(options.socket_path, ec);
+
+  auto const listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener == INVALID_SOCKET) {
+    WSACleanup();
+    return false;
+  }
+
+  if (bind(listener, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    std::printf("[!] Failed to listen on %s.\n", options.socket_path.c_str());
+    closesocket(listener);
+    WSACleanup();
+    return false;
+  }
+
+  std::unique_ptr<mapped_file_resource> spill = nullptr;
+  if (options.spill_budget) {
+    spill = std::make_unique<mapped_file_resource>(options.spill_budget);
+    if (!spill->valid()) {
+      std::printf("[!] Failed to create the spill file.\n");
+      closesocket(listener);
+      WSACleanup();
+      return false;
+    }
+  }
+
+  // The cache has to be destroyed before the spill file.
+  analysis_cache cache(options.cache_budget, spill.get());
+
+  std::mutex mutex = {};
+  std::condition_variable cv = {};
+  std::deque<SOCKET> connections = {};
+  std::atomic<bool> stopping = false;
+
+  auto const worker = [&] {
+    while (true) {
+      SOCKET sock = INVALID_SOCKET;
+
+      {
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [&] { return stopping || !connections.empty(); });
+
+        if (connections.empty())
+          return;
+
+        sock = connections.front();
+        connections.pop_front();
+      }
+
+      if (!serve_connection(cache, options, sock) && !stopping.exchange(true)) {
+        // Closing the listener wakes up the accept() call below.
+        closesocket(listener);
+        cv.notify_all();
+      }
+
+      closesocket(sock);
+    }
+  };
+
+  std::vector<std::thread> workers = {};
+  for (std::size_t i = 0; i < (std::max)(options.worker_count, std::size_t(1)); ++i)
+    workers.emplace_back(worker);
+
+  std::printf("[+] Listening on %s.\n", options.socket_path.c_str());
+
+  while (!stopping) {
+    auto const sock = accept(listener, nullptr, nullptr);
+    if (sock == INVALID_SOCKET)
+      break;
+
+    DWORD const timeout = options.receive_timeout_ms;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO,
+      reinterpret_cast<char const*>(&timeout), sizeof(timeout));
+
+    std::lock_guard lock(mutex);
+    connections.push_back(sock);
+    cv.notify_one();
+  }
+
+  if (!stopping.exchange(true))
+    closesocket(listener);
+
+  cv.notify_all();
+  for (auto& thread : workers)
+    thread.join();
+
+  // Connections that were accepted after the shutdown request.
+  for (auto const sock : connections)
+    closesocket(sock);
+
+  std::filesystem::remove(options.socket_path, ec);
+  WSACleanup();
+
+  return true;
+}
+
+// Send a request to a running daemon and return its response.
+std::optional<std::string> send_daemon_request(char const* const socket_path,
+    std::string const& request) {
+  sockaddr_un addr = {};
+  if (!make_socket_address(socket_path, addr))
+    return {};
+
+  WSADATA wsa_data;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+    return {};
+
+  std::optional<std::string> response = {};
+
+  auto const sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock != INVALID_SOCKET) {
+    if (connect(sock, reinterpret_cast<sockaddr const*>(&addr), sizeof(addr)) == 0 &&
+        send_all(sock, request) && shutdown(sock, SD_SEND) == 0)
+      response = receive_all(sock);
+
+    closesocket(sock);
+  }
+
+  WSACleanup();
+  return response;
+}
+
+} // namespace chum
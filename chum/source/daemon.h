@@ -0,0 +1,141 @@
+#pragma once
+
+#include "disassembler.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace chum {
+
+// A cache of disassembled images that is bounded by memory usage. Images
+// are keyed by their path, size, and modification time, so a rebuilt image
+// is never served from a stale analysis.
+class analysis_cache {
+public:
+  // If storage is non-null, every analysis stores its instructions and data
+  // bytes there (see disassemble_options::storage).
+  explicit analysis_cache(std::size_t budget,
+    std::pmr::memory_resource* storage = nullptr);
+
+  // Get a private copy of the analysis of an image, disassembling it if it
+  // isn't cached. If hit is non-null, it is set to whether the analysis was
+  // found in the cache.
+  std::optional<disassembled_binary> acquire(std::string const& path,
+    bool* hit = nullptr);
+
+  // Get the estimated memory usage of every cached analysis.
+  std::size_t memory_usage() const;
+
+  // Get the number of cached analyses.
+  std::size_t entry_count() const;
+
+private:
+  struct entry {
+    std::string key = "";
+    std::shared_ptr<disassembled_binary const> bin = nullptr;
+    std::size_t size = 0;
+  };
+
+  // Add an analysis to the front of the cache and evict the least recently
+  // used analyses until the cache fits in its budget again.
+  void insert(std::string const& key,
+    std::shared_ptr<disassembled_binary const> const& bin);
+
+private:
+  mutable std::mutex mutex_ = {};
+
+  // The cached analyses, with the most recently used at the front.
+  std::list<entry> entries_ = {};
+  std::unordered_map<std::string, std::list<entry>::iterator> index_ = {};
+
+  std::size_t budget_ = 0;
+  std::size_t usage_  = 0;
+
+  std::pmr::memory_resource* storage_ = nullptr;
+};
+
+// A single rewrite that was sent to the daemon.
+struct rewrite_request {
+  // The image to rewrite, and where to write the result.
+  std::string input_path  = "";
+  std::string output_path = "";
+
+  // The transforms to run, in order. See run_rewrite_request() for the
+  // supported names.
+  std::vector<std::string> transforms = {};
+
+  // An optional profile (chum --import-profile) that is attached before any
+  // transform is run.
+  std::string profile_path = "";
+
+  // An optional first-execution trace (RVA lines) for startup layout.
+  std::string startup_trace_path = "";
+
+  // Options that are passed to binary::create().
+  std::vector<std::string> import_search_paths = {};
+  bool executable          = false;
+  bool strip_relocs        = false;
+  bool load_order_sections = false;
+};
+
+// How long each part of a rewrite request took, in milliseconds.
+struct rewrite_timing {
+  bool   cache_hit  = false;
+  double analysis   = 0.0;
+  double transforms = 0.0;
+  double create     = 0.0;
+  double total      = 0.0;
+};
+
+struct daemon_options {
+  // The path of the Unix domain socket to listen on.
+  std::string socket_path = "";
+
+  // The maximum amount of memory used for cached analyses.
+  std::size_t cache_budget = std::size_t(1) << 30;
+
+  // The number of requests that can be served at the same time.
+  std::size_t worker_count = 4;
+
+  // If non-zero, cached analyses are stored in a temporary memory-mapped
+  // file, and the file is trimmed whenever more than this many bytes of it
+  // are in the working set (see mapped_file_resource).
+  std::size_t spill_budget = 0;
+
+  // Requests that take longer than this to arrive, or that are larger than
+  // max_request_size, get an error response. This keeps clients that never
+  // finish sending their request from tying up a worker forever.
+  std::uint32_t receive_timeout_ms = 10000;
+  std::size_t   max_request_size   = 1 << 20;
+};
+
+// Parse a rewrite request. Requests are text, with one "key value" pair per
+// line: input, output, transform (repeatable), profile, startup_trace,
+// import_path (repeatable), executable, strip_relocs, and load_order.
+std::optional<rewrite_request> parse_rewrite_request(std::string const& text,
+  std::string* error = nullptr);
+
+// Run a rewrite request. The supported transforms are edge_coverage,
+// latency, memory_trace, hotpatch, promote_calls, outline_cold and unroll
+// (which need a profile), and tail_duplication. memory_trace and
+// promote_calls are only allowed as the first transform, since they find
+// instructions by their original position.
+bool run_rewrite_request(analysis_cache& cache, rewrite_request const& request,
+  rewrite_timing& timing, std::string* error = nullptr);
+
+// Listen for rewrite requests until a "shutdown" request is received. Each
+// connection carries a single request and gets a single line response.
+bool run_daemon(daemon_options const& options);
+
+// Send a request to a running daemon and return its response.
+std::optional<std::string> send_daemon_request(char const* socket_path,
+  std::string const& request);
+
+} // namespace chum
@@ -0,0 +1,299 @@
+#include "data_layout.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace chum {
+
+// Read a text file of per-global access counts.
+std::vector<data_access_count> read_data_access_counts(char const* const path) {
+  std::ifstream file(path);
+  if (!file)
+    return {};
+
+  std::vector<data_access_count> entries = {};
+
+  for (std::string line; std::getline(file, line);) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    char* end = nullptr;
+
+    data_access_count entry = {};
+    entry.rva = static_cast<std::uint32_t>(std::strtoul(line.c_str(), &end, 16));
+
+    // Skip lines that don't start with an RVA and a size.
+    if (end == line.c_str() || *end != ',')
+      continue;
+
+    auto const size_start = end + 1;
+    entry.size = static_cast<std::uint32_t>(std::strtoul(size_start, &end, 10));
+
+    if (end == size_start || entry.size == 0)
+      continue;
+
+    if (*end == ',')
+      entry.reads = std::strtoull(end + 1, &end, 10);
+
+    if (*end == ',')
+      entry.writes = std::strtoull(end + 1, &end, 10);
+
+    entries.push_back(entry);
+  }
+
+  return entries;
+}
+
+// How a global is used, for counting shared cache lines.
+enum class global_usage : std::uint8_t {
+  cold,
+  hot,
+  written
+};
+
+// Count the cache lines that hold a written global as well as any other
+// hot global. Every location is a data block and an offset inside of it.
+static std::size_t count_shared_lines(std::vector<data_layout_entry> const& entries,
+    std::vector<global_usage> const& usages,
+    std::vector<std::pair<data_block const*, std::uint32_t>> const& locations,
+    std::uint32_t const cache_line_size) {
+  struct line_usage {
+    std::size_t hot     = 0;
+    std::size_t written = 0;
+  };
+
+  std::unordered_map<data_block const*, std::unordered_map<std::uint32_t, line_usage>> lines = {};
+
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    auto const& entry = entries[i];
+    auto const [db, offset] = locations[i];
+
+    if (!db || usages[i] == global_usage::cold)
+      continue;
+
+    auto const first = offset / cache_line_size;
+    auto const last  = (offset + entry.access.size - 1) / cache_line_size;
+
+    for (auto line = first; line <= last; ++line) {
+      auto& usage = lines[db][line];
+      ++usage.hot;
+      if (usages[i] == global_usage::written)
+        ++usage.written;
+    }
+  }
+
+  std::size_t shared = 0;
+  for (auto const& [db, block_lines] : lines) {
+    for (auto const& [line, usage] : block_lines) {
+      if (usage.written && usage.hot > 1)
+        ++shared;
+    }
+  }
+
+  return shared;
+}
+
+// Move the hot globals from an access profile into new data blocks.
+data_layout_result apply_data_layout(disassembled_binary& bin,
+    std::vector<data_access_count> const& accesses, data_layout_options const& options) {
+  data_layout_result result = {};
+
+  auto const line = options.cache_line_size;
+  assert(line > 0 && (line & (line - 1)) == 0);
+
+  for (auto const& access : accesses)
+    result.entries.push_back({ access, data_layout_status::cold });
+
+  // The hottest globals get placed first, and win any overlaps.
+  std::stable_sort(begin(result.entries), end(result.entries), [](auto const& left, auto const& right) {
+    return left.access.reads + left.access.writes > right.access.reads + right.access.writes;
+  });
+
+  // Every data symbol in every data block, sorted by offset.
+  std::unordered_map<data_block*, std::vector<symbol*>> block_symbols = {};
+  for (auto const sym : bin.symbols()) {
+    if (sym && sym->type == symbol_type::data)
+      block_symbols[sym->db].push_back(sym);
+  }
+
+  for (auto& [db, syms] : block_symbols) {
+    std::sort(begin(syms), end(syms), [](auto const left, auto const right) {
+      return left->db_offset < right->db_offset;
+    });
+  }
+
+  // The original offsets of every data symbol in every data block, sorted.
+  // Unlike block_symbols, this isn't modified when globals are moved.
+  std::unordered_map<data_block const*, std::vector<std::uint32_t>> symbol_offsets = {};
+  for (auto const& [db, syms] : block_symbols) {
+    auto& offsets = symbol_offsets[db];
+    for (auto const sym : syms)
+      offsets.push_back(sym->db_offset);
+  }
+
+  // The largest profiled size of a global that starts at an offset of a
+  // data block. This bounds how far a data symbol at that offset reaches.
+  std::unordered_map<data_block const*, std::unordered_map<std::uint32_t, std::uint32_t>> extents = {};
+  for (auto const& entry : result.entries) {
+    std::uint32_t offset = 0;
+    if (auto const db = bin.rva_to_containing_db(entry.access.rva, &offset)) {
+      auto& extent = extents[db][offset];
+      extent = (std::max)(extent, entry.access.size);
+    }
+  }
+
+  // Check whether a data symbol starts at a global, and whether an earlier
+  // data symbol in the same block might reach into it.
+  auto const get_unsafe_status = [&](data_block const* const db,
+      std::uint32_t const offset) -> std::optional<data_layout_status> {
+    auto const& offsets = symbol_offsets[db];
+    auto const it = std::lower_bound(begin(offsets), end(offsets), offset);
+
+    if (it == end(offsets) || *it != offset)
+      return data_layout_status::no_symbol;
+
+    // Stale references to read-only data still see the same bytes.
+    if (db->read_only || it == begin(offsets))
+      return std::nullopt;
+
+    auto const prev = *(it - 1);
+    auto const& block_extents = extents[db];
+    auto const extent = block_extents.find(prev);
+
+    if (extent == end(block_extents) || prev + extent->second > offset)
+      return data_layout_status::reachable;
+
+    return std::nullopt;
+  };
+
+  // How every global is used, according to the profile.
+  std::vector<global_usage> usages(result.entries.size(), global_usage::cold);
+
+  // The original location of every global, and where it ended up.
+  std::vector<std::pair<data_block const*, std::uint32_t>> before(result.entries.size());
+  std::vector<std::pair<data_block const*, std::uint32_t>> after(result.entries.size());
+
+  // The ranges of the original data blocks that have been moved.
+  std::unordered_map<data_block*, std::vector<std::pair<std::uint32_t, std::uint32_t>>> moved = {};
+
+  data_block* hot_read_only = nullptr;
+  data_block* hot_writable  = nullptr;
+  data_block* hot_written   = nullptr;
+
+  for (std::size_t i = 0; i < result.entries.size(); ++i) {
+    auto& entry = result.entries[i];
+    auto const& access = entry.access;
+
+    std::uint32_t offset = 0;
+    auto const db = bin.rva_to_containing_db(access.rva, &offset);
+
+    if (!db || std::uint64_t(offset) + access.size > db->bytes.size()) {
+      entry.status = data_layout_status::not_found;
+      continue;
+    }
+
+    before[i] = after[i] = { db, offset };
+
+    if (access.reads + access.writes < options.min_accesses) {
+      entry.status = data_layout_status::cold;
+      continue;
+    }
+
+    // Read-only data can't be written, no matter what the profile says.
+    auto const written = !db->read_only && access.writes >= options.min_writes &&
+      static_cast<double>(access.writes) >= options.write_ratio *
+      static_cast<double>(access.reads + access.writes);
+
+    usages[i] = written ? global_usage::written : global_usage::hot;
+
+    auto& ranges = moved[db];
+    if (std::any_of(begin(ranges), end(ranges), [&](auto const& range) {
+        return offset < range.second && range.first < offset + access.size; })) {
+      entry.status = data_layout_status::overlap;
+      continue;
+    }
+
+    if (auto const status = get_unsafe_status(db, offset)) {
+      entry.status = *status;
+      continue;
+    }
+
+    ranges.push_back({ offset, offset + access.size });
+
+    auto& target = written ? hot_written : (db->read_only ? hot_read_only : hot_writable);
+    if (!target) {
+      target = bin.create_data_block(std::uint32_t(0), line);
+      target->read_only = db->read_only;
+    }
+
+    // Written globals start on a new cache line. Everything else keeps the
+    // alignment of its original RVA (up to a cache line).
+    auto alignment = line;
+    if (!written) {
+      alignment = 1;
+      while (alignment < line && !(access.rva & alignment))
+        alignment <<= 1;
+    }
+
+    auto const new_offset = static_cast<std::uint32_t>(
+      (target->bytes.size() + alignment - 1) & ~std::size_t(alignment - 1));
+
+    auto new_size = new_offset + access.size;
+    if (written)
+      new_size = (new_size + line - 1) & ~(line - 1);
+
+    target->bytes.resize(new_size, 0);
+    std::memcpy(target->bytes.data() + new_offset, db->bytes.data() + offset, access.size);
+
+    // Move every symbol that lands inside of the global.
+    auto& syms = block_symbols[db];
+    auto const first = std::lower_bound(begin(syms), end(syms), offset,
+      [](symbol const* const sym, std::uint32_t const value) {
+        return sym->db_offset < value;
+      });
+
+    auto last = first;
+    for (; last != end(syms) && (*last)->db_offset < offset + access.size; ++last) {
+      (*last)->db_offset = new_offset + ((*last)->db_offset - offset);
+      (*last)->db = target;
+    }
+
+    // These symbols don't belong to the original block anymore.
+    syms.erase(first, last);
+
+    after[i] = { target, new_offset };
+    entry.status = written ? data_layout_status::written : data_layout_status::read_mostly;
+    result.moved_bytes += access.size;
+  }
+
+  result.shared_lines_before = count_shared_lines(result.entries, usages, before, line);
+  result.shared_lines_after  = count_shared_lines(result.entries, usages, after, line);
+
+  return result;
+}
+
+// Print what was done for every global in the access profile.
+void print_data_layout_result(data_layout_result const& result) {
+  std::printf("[+] Globals (%zu), %zu byte(s) moved:\n",
+    result.entries.size(), result.moved_bytes);
+
+  for (auto const& entry : result.entries) {
+    std::printf("[+]   RVA: 0x%-8X Size: %-6u Reads: %-10llu Writes: %-10llu Status: %s\n",
+      entry.access.rva, entry.access.size,
+      static_cast<unsigned long long>(entry.access.reads),
+      static_cast<unsigned long long>(entry.access.writes),
+      serialize_data_layout_status(entry.status));
+  }
+
+  std::printf("[+] Falsely shared cache lines: %zu before, %zu after.\n",
+    result.shared_lines_before, result.shared_lines_after);
+}
+
+} // namespace chum
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "disassembler.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chum {
+
+// The number of reads and writes to a single global, from a memory access
+// profile of the original image.
+struct data_access_count {
+  // The RVA and size of the global in the original image.
+  std::uint32_t rva  = 0;
+  std::uint32_t size = 0;
+
+  std::uint64_t reads  = 0;
+  std::uint64_t writes = 0;
+};
+
+// Read a text file where each line contains the RVA, size, read count, and
+// write count of a global, separated by commas (e.g. "0x5000,8,1200,30").
+// RVAs are in hex, everything else is in decimal, and lines starting with
+// '#' are ignored.
+std::vector<data_access_count> read_data_access_counts(char const* path);
+
+struct data_layout_options {
+  // Globals with fewer accesses (reads plus writes) than this are cold, and
+  // are left where they are.
+  std::uint64_t min_accesses = 1;
+
+  // Globals with at least this many writes, which also make up at least
+  // write_ratio of their accesses, are given their own cache lines.
+  std::uint64_t min_writes  = 1;
+  double        write_ratio = 0.05;
+
+  // The size of a cache line. Some cores prefetch lines in pairs, in which
+  // case 128 keeps written globals from interfering with each other too.
+  std::uint32_t cache_line_size = 64;
+};
+
+// What happened to a single global from the access profile.
+enum class data_layout_status {
+  // The global was moved next to the other hot, read-mostly globals.
+  read_mostly,
+
+  // The global was moved onto its own cache line(s).
+  written,
+
+  // The global had fewer accesses than the threshold.
+  cold,
+
+  // The RVA (or the size) doesn't fit inside of a data block.
+  not_found,
+
+  // The global overlaps with a hotter global that was already moved.
+  overlap,
+
+  // No data symbol starts at the global, so nothing would reference the
+  // moved copy.
+  no_symbol,
+
+  // The global is writable, and an earlier data symbol in the same block
+  // might be used to reach it (there's no profiled global that starts at
+  // that symbol and ends before this one). Moving it would leave that code
+  // working on a stale copy.
+  reachable
+};
+
+// Get the string representation of a data layout status.
+inline constexpr char const* serialize_data_layout_status(data_layout_status const status) {
+  switch (status) {
+  case data_layout_status::read_mostly: return "read_mostly";
+  case data_layout_status::written:     return "written";
+  case data_layout_status::cold:        return "cold";
+  case data_layout_status::not_found:   return "not_found";
+  case data_layout_status::overlap:     return "overlap";
+  case data_layout_status::no_symbol:   return "no_symbol";
+  case data_layout_status::reachable:   return "reachable";
+  default: return "invalid";
+  }
+}
+
+struct data_layout_entry {
+  data_access_count access = {};
+  data_layout_status status = data_layout_status::cold;
+};
+
+struct data_layout_result {
+  // Every global from the access profile, hottest first.
+  std::vector<data_layout_entry> entries = {};
+
+  // The number of bytes that were moved into the new data blocks.
+  std::size_t moved_bytes = 0;
+
+  // The number of cache lines that hold a frequently written global as
+  // well as any other hot global, before and after the layout. These are
+  // the lines that can be falsely shared.
+  std::size_t shared_lines_before = 0;
+  std::size_t shared_lines_after  = 0;
+};
+
+// Move the hot globals from an access profile into new data blocks: hot
+// read-mostly globals are packed together (one block for read-only data,
+// one for writable data), while frequently written globals each start on a
+// new cache line and are padded to the end of their last line. Every data
+// symbol inside of a global is moved along with it, and the original bytes
+// are left where they were. Sizes come from the profile, since a global
+// can be accessed through addresses that don't have a symbol of their own.
+// A global is only moved if a data symbol starts exactly at it, and (for
+// writable globals) the data symbol before it is known to end before it,
+// so that no reference is left behind on the original bytes. The RVA maps
+// still point to the original data blocks afterwards.
+data_layout_result apply_data_layout(disassembled_binary& bin,
+  std::vector<data_access_count> const& accesses, data_layout_options const& options = {});
+
+// Print what was done for every global in the access profile.
+void print_data_layout_result(data_layout_result const& result);
+
+} // namespace chum
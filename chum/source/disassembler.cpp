@@ -1,13 +1,27 @@
 #include "disassembler.h"
+#include "signatures.h"
 #include "util.h"
 
 #include <queue>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
 
 #include <Windows.h>
 #include <Zydis/Zydis.h>
 
 namespace chum {
 
+// Create an empty binary.
+disassembled_binary::disassembled_binary()
+  : disassembled_binary(std::pmr::get_default_resource()) {}
+
+// Create an empty binary where everything is allocated from the specified
+// memory resource.
+disassembled_binary::disassembled_binary(std::pmr::memory_resource* const resource)
+  : binary(resource), sym_rva_map_(1, 0, resource), rva_map_(resource),
+    rva_data_block_map_(resource) {}
+
 // Get the symbol that an RVA points to.
 symbol* disassembled_binary::rva_to_symbol(std::uint32_t const rva) const {
   if (rva >= rva_map_.size())
@@ -126,6 +140,69 @@ basic_block* disassembled_binary::rva_to_containing_bb(
   return nullptr;
 }
 
+// Get the code symbol of every function that was recovered from the
+// original image. This is sorted by RVA.
+std::vector<symbol_id> const& disassembled_binary::functions() const {
+  return functions_;
+}
+
+// Get the combined size of every executable section in the original image.
+std::uint32_t disassembled_binary::original_code_size() const {
+  return original_code_size_;
+}
+
+// Get the combined size of every data section in the original image.
+std::uint32_t disassembled_binary::original_data_size() const {
+  return original_data_size_;
+}
+
+// Get a hash of the original image, which is used to make sure that a
+// profile belongs to this binary.
+std::uint64_t disassembled_binary::identity_hash() const {
+  return identity_hash_;
+}
+
+// Get every function that was recognized from a signature database.
+std::vector<signature_match> const& disassembled_binary::signature_matches() const {
+  return signature_matches_;
+}
+
+// Create a deep copy of this binary, including the RVA maps.
+disassembled_binary disassembled_binary::clone() const {
+  disassembled_binary copy(storage_resource());
+  clone_into(copy);
+
+  copy.sym_rva_map_         = sym_rva_map_;
+  copy.rva_map_             = rva_map_;
+  copy.functions_           = functions_;
+  copy.original_code_size_  = original_code_size_;
+  copy.original_data_size_  = original_data_size_;
+  copy.identity_hash_       = identity_hash_;
+  copy.signature_matches_   = signature_matches_;
+
+  // Data blocks are copied in order, so they can be matched up by index.
+  std::unordered_map<data_block const*, std::size_t> db_indices = {};
+  for (std::size_t i = 0; i < data_blocks().size(); ++i)
+    db_indices[data_blocks()[i]] = i;
+
+  for (auto const& entry : rva_data_block_map_) {
+    copy.rva_data_block_map_.push_back({ entry.rva,
+      copy.data_blocks()[db_indices.at(entry.db)] });
+  }
+
+  return copy;
+}
+
+// Get an estimate of the amount of heap memory used by this binary.
+std::size_t disassembled_binary::memory_usage() const {
+  return binary::memory_usage() +
+    sym_rva_map_.capacity() * sizeof(std::uint32_t) +
+    rva_map_.capacity() * sizeof(rva_map_entry) +
+    rva_data_block_map_.capacity() * sizeof(rva_data_block_entry) +
+    functions_.capacity() * sizeof(symbol_id) +
+    signature_matches_.capacity() * sizeof(signature_match);
+}
+
 // Insert the specified data block into the RVA to data block map.
 void disassembled_binary::insert_data_block_in_rva_map(
     std::uint32_t const rva, data_block* const db) {
@@ -151,22 +228,27 @@ void disassembled_binary::insert_data_block_in_rva_map(
 // a better solution.
 class disassembler {
 public:
+  explicit disassembler(std::pmr::memory_resource* const resource)
+    : bin(resource) {}
+
   // This is the binary that is being produced.
-  disassembled_binary bin = {};
+  disassembled_binary bin;
 
 public:
   // Initialize various structures in the disassembler. This function should
   // only be called ONCE for each instantiation.
-  bool initialize(char const* const path) {
+  bool initialize(std::vector<std::uint8_t> file_buffer) {
     // Initialize the Zydis decoder for x86-64.
     if (ZYAN_FAILED(ZydisDecoderInit(&decoder_,
         ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64)))
       return false;
 
-    file_buffer_ = read_file_to_buffer(path);
-    if (file_buffer_.empty())
+    file_buffer_ = std::move(file_buffer);
+    if (file_buffer_.size() < sizeof(IMAGE_DOS_HEADER))
       return false;
 
+    bin.identity_hash_ = fnv1a_64(file_buffer_.data(), file_buffer_.size());
+
     dos_header_ = reinterpret_cast<PIMAGE_DOS_HEADER>(&file_buffer_[0]);
     if (dos_header_->e_magic != IMAGE_DOS_SIGNATURE)
       return false;
@@ -183,14 +265,15 @@ public:
     sections_ = reinterpret_cast<PIMAGE_SECTION_HEADER>(nt_header_ + 1);
 
     // Allocate the RVA to symbol table so that any RVA can be used as an index.
-    bin.rva_map_ = std::vector<rva_map_entry>(
-      nt_header_->OptionalHeader.SizeOfImage, rva_map_entry{});
+    bin.rva_map_.assign(nt_header_->OptionalHeader.SizeOfImage, rva_map_entry{});
 
     // Add the entrypoint to the disassembly queue.
     if (nt_header_->OptionalHeader.AddressOfEntryPoint) {
       auto const entry = enqueue_rva(
         nt_header_->OptionalHeader.AddressOfEntryPoint, "<entrypoint>");
       bin.entrypoint(bin.get_symbol(entry.sym_id)->bb);
+
+      function_rvas_.push_back(nt_header_->OptionalHeader.AddressOfEntryPoint);
     }
 
     return true;
@@ -202,8 +285,12 @@ public:
       auto const& section = sections_[i];
 
       // Ignore executable sections.
-      if (section.Characteristics & IMAGE_SCN_MEM_EXECUTE)
+      if (section.Characteristics & IMAGE_SCN_MEM_EXECUTE) {
+        bin.original_code_size_ += section.Misc.VirtualSize;
         continue;
+      }
+
+      bin.original_data_size_ += section.Misc.VirtualSize;
 
       assert(section.Characteristics & IMAGE_SCN_MEM_READ);
 
@@ -310,8 +397,10 @@ public:
 
       // If the RVA lands in executable memory, assume that it is a
       // function export. Otherwise, create a data symbol.
-      if (section->Characteristics & IMAGE_SCN_MEM_EXECUTE)
+      if (section->Characteristics & IMAGE_SCN_MEM_EXECUTE) {
         enqueue_rva(rva);
+        function_rvas_.push_back(rva);
+      }
       else {
         assert(section->Characteristics & IMAGE_SCN_MEM_READ);
 
@@ -373,6 +462,8 @@ public:
       // Add the start address of the RUNTIME_FUNCTION to the disassembly queue.
       if (bin.rva_map_[func.BeginAddress].sym_id == null_symbol_id)
         enqueue_rva(func.BeginAddress);
+
+      function_rvas_.push_back(func.BeginAddress);
     }
   }
 
@@ -459,13 +550,18 @@ public:
   }
 
   // The main engine of the recursive disassembler. This tries to distinguish
-  // code from data and form the basic blocks that compose this binary.
-  bool disassemble() {
-    while (!disassembly_queue_.empty()) {
+  // code from data and form the basic blocks that compose this binary. At
+  // most max_items entries of the disassembly queue are processed.
+  bool disassemble(std::size_t const max_items =
+      (std::numeric_limits<std::size_t>::max)()) {
+    for (std::size_t item = 0; item < max_items &&
+         !disassembly_queue_.empty(); ++item) {
       // Pop an RVA from the front of the queue.
       auto const rva_start = disassembly_queue_.front();
       disassembly_queue_.pop();
 
+      CHUM_COUNT_OP(queue_pops);
+
       auto const file_start = rva_to_file_offset(rva_start);
 
       // TODO: Properly handle these cases.
@@ -478,6 +574,10 @@ public:
       assert(bin.get_symbol(bin.rva_map_[rva_start].sym_id)->type == symbol_type::code);
       auto curr_bb = bin.get_symbol(bin.rva_map_[rva_start].sym_id)->bb;
 
+      // This block was already merged from a prebuilt block.
+      if (!curr_bb->instructions.empty())
+        continue;
+
       // Keep decoding until we hit a terminating instruction.
       for (std::uint32_t instr_offset = 0;
            file_start + instr_offset < file_end;) {
@@ -520,24 +620,9 @@ public:
               instr_offset + decoded_instr.length + decoded_instr.raw.imm[0].value.s);
 
             // Get the RVA entry for the branch destination.
-            auto target_rva_entry = bin.rva_map_[target_rva];
-
-            // We jumped into the middle of a basic block.
-            if (target_rva_entry.blink != 0) {
-              target_rva_entry = split_block(target_rva);
-
-              // This happens if we need to split the block that
-              // we're currently building.
-              if (target_rva >= rva_start && target_rva < rva_start + instr_offset)
-                curr_bb = bin.get_symbol(target_rva_entry.sym_id)->bb;
-            }
-            // This is undiscovered code, add it to the disassembly queue.
-            else if (target_rva_entry.sym_id == null_symbol_id) {
-              if (rva_in_exec_section(target_rva))
-                target_rva_entry = enqueue_rva(target_rva);
-            }
-
-            assert(target_rva_entry.blink == 0);
+            auto const target_rva_entry = resolve_branch_target(target_rva,
+              rva_start, instr_offset, curr_bb,
+              decoded_instr.meta.category == ZYDIS_CATEGORY_CALL);
 
             // If we can fit the symbol ID in the original instruction, do that
             // instead of re-encoding.
@@ -548,31 +633,9 @@ public:
                 &target_rva_entry.sym_id, decoded_instr.raw.imm[0].size / 8);
             }
             // Re-encode the new instruction.
-            else {
-              ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT_VISIBLE];
-              if (ZYAN_FAILED(ZydisDecoderDecodeOperands(&decoder_, &decoded_ctx,
-                  &decoded_instr, decoded_ops, decoded_instr.operand_count_visible)))
-                return false;
-
-              ZydisEncoderRequest enc_req;
-              if (ZYAN_FAILED(ZydisEncoderDecodedInstructionToEncoderRequest(
-                  &decoded_instr, decoded_ops, decoded_instr.operand_count_visible, &enc_req)))
-                return false;
-
-              // We want the encoder to choose the best branch size for us.
-              enc_req.branch_type  = ZYDIS_BRANCH_TYPE_NONE;
-              enc_req.branch_width = ZYDIS_BRANCH_WIDTH_NONE;
-
-              // This might have sign issues? Not sure yet, don't care.
-              enc_req.operands[0].imm.u = target_rva_entry.sym_id.value;
-
-              std::size_t length = sizeof(instr.bytes);
-              if (ZYAN_FAILED(ZydisEncoderEncodeInstruction(
-                  &enc_req, instr.bytes, &length)))
-                return false;
-
-              instr.length = length;
-            }
+            else if (!encode_branch(decoded_ctx, decoded_instr,
+                target_rva_entry.sym_id, instr))
+              return false;
           }
           // RIP relative memory references.
           else if (decoded_instr.raw.disp.offset != 0 &&
@@ -585,55 +648,9 @@ public:
               instr_offset + decoded_instr.length + decoded_instr.raw.disp.value);
 
             // Get the RVA entry for this memory reference.
-            auto target_rva_entry = bin.rva_map_[target_rva];
-
-            // We're accessing an instruction in the middle of a basic block.
-            if (target_rva_entry.blink != 0) {
-              target_rva_entry = split_block(target_rva);
-
-              // This happens if we need to split the block that
-              // we're currently building.
-              if (target_rva >= rva_start && target_rva < rva_start + instr_offset)
-                curr_bb = bin.get_symbol(target_rva_entry.sym_id)->bb;
-            }
-
-            // LEA instructions are often used for accessing code, not just data.
-            if (decoded_instr.mnemonic == ZYDIS_MNEMONIC_LEA &&
-                target_rva_entry.sym_id == null_symbol_id &&
-                rva_in_exec_section(target_rva))
-              target_rva_entry = enqueue_rva(target_rva);
-
-            // This is the first reference to this address. Assume that it
-            // is a data access, and create a new symbol for it.
-            if (target_rva_entry.sym_id == null_symbol_id) {
-              std::uint32_t offset = 0;
-              auto const db = bin.rva_to_containing_db(target_rva, &offset);
-
-              symbol* sym = nullptr;
-
-              if (db) {
-                // Create the new data symbol.
-                sym = bin.create_symbol(symbol_type::data);
-                sym->db        = db;
-                sym->db_offset = offset;
-                sym->target    = null_symbol_id;
-
-                // TODO: Should we analyze this data symbol?
-              }
-              // Addresses that don't land in a data block are marked as
-              // relative data symbols. This only really works for addresses
-              // that are in the PE header.
-              else {
-                // Create the new relative data symbol.
-                sym = bin.create_symbol(symbol_type::rel_data);
-                sym->rel_offset = target_rva;
-              }
-
-              bin.sym_rva_map_.push_back(target_rva);
-
-              // Add the symbol to the RVA map.
-              target_rva_entry = bin.rva_map_[target_rva] = { sym->id, 0 };
-            }
+            auto const target_rva_entry = resolve_memory_target(target_rva,
+              rva_start, instr_offset, curr_bb,
+              decoded_instr.mnemonic == ZYDIS_MNEMONIC_LEA);
 
             // Modify the displacement bytes to point to a symbol ID instead.
             static_assert(sizeof(target_rva_entry.sym_id) == 4);
@@ -685,24 +702,10 @@ public:
         instr_offset += instr.length;
 
         // If we've entered into another basic block, end the current block.
-        if (auto rva_entry = bin.rva_map_[rva_start + instr_offset];
-            rva_entry.sym_id != null_symbol_id) {
-          auto const sym = bin.get_symbol(rva_entry.sym_id);
-
-          // We incorrectly identified this symbol as data instead of code.
-          if (sym->type == symbol_type::data) {
-            sym->type = symbol_type::code;
-            sym->name = "data_to_code";
-            rva_entry = enqueue_rva(rva_start + instr_offset, sym->id);
-          }
-
-          // TODO: It *might* be possible to accidently fall into a jump table
-          //       (which would be marked as data, not code).
-          assert(sym->type == symbol_type::code);
-          curr_bb->fallthrough_target = rva_entry.sym_id;
-
+        // TODO: It *might* be possible to accidently fall into a jump table
+        //       (which would be marked as data, not code).
+        if (fall_into(rva_start + instr_offset, curr_bb))
           break;
-        }
 
         // Create an RVA entry for the next instruction.
         bin.rva_map_[rva_start + instr_offset] = {
@@ -724,6 +727,182 @@ public:
       });
   }
 
+  // Resolve every function RVA that was found during analysis into a code
+  // symbol. This needs to happen after disassembly, since blocks might have
+  // been split in the meantime.
+  void collect_functions() {
+    std::sort(begin(function_rvas_), end(function_rvas_));
+    function_rvas_.erase(std::unique(begin(function_rvas_),
+      end(function_rvas_)), end(function_rvas_));
+
+    for (auto const rva : function_rvas_) {
+      auto const sym = bin.rva_to_symbol(rva);
+      if (sym && sym->type == symbol_type::code)
+        bin.functions_.push_back(sym->id);
+    }
+  }
+
+  // Whether there is nothing left in the disassembly queue.
+  bool queue_empty() const {
+    return disassembly_queue_.empty();
+  }
+
+  // Look for functions that match a signature, and add the block boundaries
+  // from the signature to the disassembly queue.
+  void match_signatures(signature_database const& db) {
+    auto candidates = function_rvas_;
+    std::sort(begin(candidates), end(candidates));
+    candidates.erase(std::unique(begin(candidates), end(candidates)), end(candidates));
+
+    for (auto const rva : candidates) {
+      auto const signature = db.match(file_buffer_, rva);
+      if (!signature)
+        continue;
+
+      for (auto const& block : signature->blocks) {
+        auto const block_rva = rva + block.offset;
+        if (block_rva < bin.rva_map_.size() && rva_in_exec_section(block_rva) &&
+            bin.rva_map_[block_rva].sym_id == null_symbol_id)
+          enqueue_rva(block_rva);
+      }
+
+      pending_matches_.emplace_back(rva, signature);
+    }
+  }
+
+  // Add a list of known block starts to the disassembly queue.
+  void enqueue_block_rvas(std::vector<std::uint32_t> const& rvas) {
+    for (auto const rva : rvas) {
+      if (rva < bin.rva_map_.size() && rva_in_exec_section(rva) &&
+          bin.rva_map_[rva].sym_id == null_symbol_id)
+        enqueue_rva(rva);
+    }
+  }
+
+  // Merge blocks that were decoded elsewhere into the binary. A block is
+  // only used if it starts at a code symbol that hasn't been decoded yet,
+  // and it is cut short if it runs into another symbol.
+  bool merge_prebuilt_blocks(
+      std::function<bool(prebuilt_block&)> const& next_block) {
+    for (prebuilt_block block = {}; next_block(block);) {
+      if (block.rva >= bin.rva_map_.size() || block.instructions.empty() ||
+          !rva_in_exec_section(block.rva))
+        continue;
+
+      auto rva_entry = bin.rva_map_[block.rva];
+
+      // This code has already been decoded as part of another block.
+      if (rva_entry.blink != 0)
+        continue;
+
+      if (rva_entry.sym_id == null_symbol_id)
+        rva_entry = enqueue_rva(block.rva);
+
+      auto const sym = bin.get_symbol(rva_entry.sym_id);
+      if (sym->type != symbol_type::code || !sym->bb->instructions.empty())
+        continue;
+
+      auto curr_bb = sym->bb;
+      auto falls_through = true;
+
+      std::uint32_t instr_offset = 0;
+      for (std::size_t i = 0; i < block.instructions.size(); ++i) {
+        auto const& prebuilt = block.instructions[i];
+
+        if (i > 0) {
+          // If we've entered into another basic block, end the current block.
+          if (fall_into(block.rva + instr_offset, curr_bb)) {
+            falls_through = false;
+            break;
+          }
+
+          // Create an RVA entry for this instruction.
+          bin.rva_map_[block.rva + instr_offset] = {
+            0, block.instructions[i - 1].length };
+        }
+
+        instruction instr;
+        instr.length = prebuilt.length;
+        std::memcpy(instr.bytes, prebuilt.bytes, instr.length);
+
+        // Rewrite relative operands to use symbols, the same way that
+        // disassemble() does.
+        if (prebuilt.operand == prebuilt_operand::branch ||
+            prebuilt.operand == prebuilt_operand::call) {
+          auto const target_rva_entry = resolve_branch_target(prebuilt.target_rva,
+            block.rva, instr_offset, curr_bb, prebuilt.operand == prebuilt_operand::call);
+
+          if (target_rva_entry.sym_id.value < (1ull << prebuilt.operand_size)) {
+            assert(prebuilt.operand_size <= 32);
+            std::memcpy(instr.bytes + prebuilt.operand_offset,
+              &target_rva_entry.sym_id, prebuilt.operand_size / 8);
+          }
+          // Only branches that need to be re-encoded are decoded again.
+          else {
+            ZydisDecoderContext decoded_ctx;
+            ZydisDecodedInstruction decoded_instr;
+            if (ZYAN_FAILED(ZydisDecoderDecodeInstruction(&decoder_, &decoded_ctx,
+                prebuilt.bytes, prebuilt.length, &decoded_instr)))
+              return false;
+
+            if (!encode_branch(decoded_ctx, decoded_instr,
+                target_rva_entry.sym_id, instr))
+              return false;
+          }
+        }
+        else if (prebuilt.operand == prebuilt_operand::memory ||
+                 prebuilt.operand == prebuilt_operand::lea) {
+          auto const target_rva_entry = resolve_memory_target(prebuilt.target_rva,
+            block.rva, instr_offset, curr_bb, prebuilt.operand == prebuilt_operand::lea);
+
+          assert(prebuilt.operand_size == 32);
+          std::memcpy(instr.bytes + prebuilt.operand_offset,
+            &target_rva_entry.sym_id, 4);
+        }
+
+        curr_bb->instructions.push_back(instr);
+        instr_offset += prebuilt.length;
+      }
+
+      if (!falls_through || !block.fallthrough_rva ||
+          block.fallthrough_rva >= bin.rva_map_.size())
+        continue;
+
+      // Add undiscovered fallthrough targets to the disassembly queue.
+      auto const& fallthrough_entry = bin.rva_map_[block.fallthrough_rva];
+      if (fallthrough_entry.sym_id == null_symbol_id &&
+          fallthrough_entry.blink == 0 && rva_in_exec_section(block.fallthrough_rva))
+        enqueue_rva(block.fallthrough_rva);
+      else if (fallthrough_entry.blink != 0)
+        split_block(block.fallthrough_rva);
+
+      fall_into(block.fallthrough_rva, curr_bb);
+    }
+
+    return true;
+  }
+
+  // Make sure that the CFG of every function that matched a signature is
+  // the same as the CFG that the signature was created from.
+  void verify_signature_matches() {
+    for (auto const& [rva, signature] : pending_matches_) {
+      auto const sym = bin.rva_to_symbol(rva);
+      if (!sym || sym->type != symbol_type::code)
+        continue;
+
+      if (calculate_cfg_hash(bin, sym->id) != signature->cfg_hash) {
+        std::printf("[!] Signature for %s matched at 0x%X, but the CFG is different.\n",
+          signature->name.c_str(), rva);
+        continue;
+      }
+
+      if (!signature->name.empty())
+        sym->name = signature->name;
+
+      bin.signature_matches_.push_back({ sym->id, signature->flags });
+    }
+  }
+
   // This function is just used to double check that nothing weird is going
   // on.
   bool verify() {
@@ -865,6 +1044,8 @@ private:
     // Create a new basic block.
     bin.create_basic_block(sym_id);
 
+    CHUM_COUNT_OP(rva_claims);
+
     return bin.rva_map_[rva] = { sym_id, 0 };
   }
 
@@ -905,6 +1086,8 @@ private:
       begin(original_bb->instructions) + count,
       end(original_bb->instructions));
 
+    CHUM_COUNT_OP(rva_claims);
+
     return bin.rva_map_[rva] = { new_bb->sym_id, 0 };
   };
 
@@ -999,6 +1182,151 @@ private:
     }
   }
 
+  // Get the RVA entry for the target of a relative branch, splitting the
+  // block that it lands in, or adding it to the disassembly queue if it is
+  // undiscovered code. curr_bb is the block that is being built at
+  // rva_start, and is updated if it gets split.
+  rva_map_entry resolve_branch_target(std::uint32_t const target_rva,
+      std::uint32_t const rva_start, std::uint32_t const instr_offset,
+      basic_block*& curr_bb, bool const is_call) {
+    auto target_rva_entry = bin.rva_map_[target_rva];
+
+    // We jumped into the middle of a basic block.
+    if (target_rva_entry.blink != 0) {
+      target_rva_entry = split_block(target_rva);
+
+      // This happens if we need to split the block that
+      // we're currently building.
+      if (target_rva >= rva_start && target_rva < rva_start + instr_offset)
+        curr_bb = bin.get_symbol(target_rva_entry.sym_id)->bb;
+    }
+    // This is undiscovered code, add it to the disassembly queue.
+    else if (target_rva_entry.sym_id == null_symbol_id) {
+      if (rva_in_exec_section(target_rva))
+        target_rva_entry = enqueue_rva(target_rva);
+    }
+
+    assert(target_rva_entry.blink == 0);
+
+    // The target of a direct CALL is (almost always) a function.
+    if (is_call && target_rva_entry.sym_id != null_symbol_id)
+      function_rvas_.push_back(target_rva);
+
+    return target_rva_entry;
+  }
+
+  // Get the RVA entry for the target of a RIP-relative memory reference,
+  // creating a new symbol for it if needed. curr_bb is the block that is
+  // being built at rva_start, and is updated if it gets split.
+  rva_map_entry resolve_memory_target(std::uint32_t const target_rva,
+      std::uint32_t const rva_start, std::uint32_t const instr_offset,
+      basic_block*& curr_bb, bool const is_lea) {
+    auto target_rva_entry = bin.rva_map_[target_rva];
+
+    // We're accessing an instruction in the middle of a basic block.
+    if (target_rva_entry.blink != 0) {
+      target_rva_entry = split_block(target_rva);
+
+      // This happens if we need to split the block that
+      // we're currently building.
+      if (target_rva >= rva_start && target_rva < rva_start + instr_offset)
+        curr_bb = bin.get_symbol(target_rva_entry.sym_id)->bb;
+    }
+
+    // LEA instructions are often used for accessing code, not just data.
+    if (is_lea && target_rva_entry.sym_id == null_symbol_id &&
+        rva_in_exec_section(target_rva))
+      target_rva_entry = enqueue_rva(target_rva);
+
+    // This is the first reference to this address. Assume that it
+    // is a data access, and create a new symbol for it.
+    if (target_rva_entry.sym_id == null_symbol_id) {
+      std::uint32_t offset = 0;
+      auto const db = bin.rva_to_containing_db(target_rva, &offset);
+
+      symbol* sym = nullptr;
+
+      if (db) {
+        // Create the new data symbol.
+        sym = bin.create_symbol(symbol_type::data);
+        sym->db        = db;
+        sym->db_offset = offset;
+        sym->target    = null_symbol_id;
+
+        // TODO: Should we analyze this data symbol?
+      }
+      // Addresses that don't land in a data block are marked as
+      // relative data symbols. This only really works for addresses
+      // that are in the PE header.
+      else {
+        // Create the new relative data symbol.
+        sym = bin.create_symbol(symbol_type::rel_data);
+        sym->rel_offset = target_rva;
+      }
+
+      bin.sym_rva_map_.push_back(target_rva);
+
+      // Add the symbol to the RVA map.
+      target_rva_entry = bin.rva_map_[target_rva] = { sym->id, 0 };
+    }
+
+    return target_rva_entry;
+  }
+
+  // Re-encode a relative branch so that it points to a symbol ID that
+  // doesn't fit in its original immediate.
+  bool encode_branch(ZydisDecoderContext const& decoded_ctx,
+      ZydisDecodedInstruction const& decoded_instr,
+      symbol_id const sym_id, instruction& instr) {
+    ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT_VISIBLE];
+    if (ZYAN_FAILED(ZydisDecoderDecodeOperands(&decoder_, &decoded_ctx,
+        &decoded_instr, decoded_ops, decoded_instr.operand_count_visible)))
+      return false;
+
+    ZydisEncoderRequest enc_req;
+    if (ZYAN_FAILED(ZydisEncoderDecodedInstructionToEncoderRequest(
+        &decoded_instr, decoded_ops, decoded_instr.operand_count_visible, &enc_req)))
+      return false;
+
+    // We want the encoder to choose the best branch size for us.
+    enc_req.branch_type  = ZYDIS_BRANCH_TYPE_NONE;
+    enc_req.branch_width = ZYDIS_BRANCH_WIDTH_NONE;
+
+    // This might have sign issues? Not sure yet, don't care.
+    enc_req.operands[0].imm.u = sym_id.value;
+
+    std::size_t length = sizeof(instr.bytes);
+    if (ZYAN_FAILED(ZydisEncoderEncodeInstruction(
+        &enc_req, instr.bytes, &length)))
+      return false;
+
+    instr.length = length;
+    return true;
+  }
+
+  // If there is a symbol at the specified RVA, make it the fallthrough
+  // target of the provided block and return true. Symbols that were
+  // incorrectly identified as data are turned into code.
+  bool fall_into(std::uint32_t const rva, basic_block* const bb) {
+    auto rva_entry = bin.rva_map_[rva];
+    if (rva_entry.sym_id == null_symbol_id)
+      return false;
+
+    auto const sym = bin.get_symbol(rva_entry.sym_id);
+
+    // We incorrectly identified this symbol as data instead of code.
+    if (sym->type == symbol_type::data) {
+      sym->type = symbol_type::code;
+      sym->name = "data_to_code";
+      rva_entry = enqueue_rva(rva, sym->id);
+    }
+
+    assert(sym->type == symbol_type::code);
+    bb->fallthrough_target = rva_entry.sym_id;
+
+    return true;
+  }
+
 private:
   ZydisDecoder decoder_ = {};
 
@@ -1008,6 +1336,13 @@ private:
   // A queue of code RVAs to disassemble from.
   std::queue<std::uint32_t> disassembly_queue_ = {};
 
+  // The RVA of every function entrypoint that has been found so far. This
+  // might contain duplicates.
+  std::vector<std::uint32_t> function_rvas_ = {};
+
+  // Functions that matched a signature, but haven't been verified yet.
+  std::vector<std::pair<std::uint32_t, function_signature const*>> pending_matches_ = {};
+
   // Pointers into the file buffer for commonly used PE structures.
   PIMAGE_DOS_HEADER     dos_header_ = nullptr;
   PIMAGE_NT_HEADERS     nt_header_  = nullptr;
@@ -1015,33 +1350,128 @@ private:
 };
 
 // Disassemble an x86-64 PE file.
-std::optional<disassembled_binary> disassemble(char const* const path) {
-  disassembler dasm = {};
-
-  // Initialize the disassembler.
-  if (!dasm.initialize(path)) {
-    printf("Failed to initialize disassembler!\n");
+std::optional<disassembled_binary> disassemble(char const* const path,
+    disassemble_options const& options) {
+  auto file_buffer = read_file_to_buffer(path);
+  if (file_buffer.empty()) {
+    printf("Failed to read file!\n");
     return {};
   }
 
-  // Create a data block for every data section.
-  dasm.create_section_data_blocks();
+  return disassemble(std::move(file_buffer), options);
+}
 
-  // Extract as much metadata as possible from the PE file.
-  dasm.parse_imports();
-  dasm.parse_exports();
-  dasm.parse_exceptions();
-  dasm.parse_relocs();
+// Disassemble an x86-64 PE file that has already been read into memory.
+std::optional<disassembled_binary> disassemble(std::vector<std::uint8_t> file_buffer,
+    disassemble_options const& options) {
+  disassembly_task task(std::move(file_buffer), options);
+  while (task.step()) {}
 
-  if (!dasm.disassemble()) {
-    printf("Failed to disassemble binary!\n");
-    return {};
+  return task.finish();
+}
+
+disassembly_task::disassembly_task(std::vector<std::uint8_t> file_buffer,
+    disassemble_options const& options)
+  : file_buffer_(std::move(file_buffer)), options_(options) {}
+
+disassembly_task::~disassembly_task() = default;
+
+disassembly_task::disassembly_task(disassembly_task&& other) = default;
+
+disassembly_task& disassembly_task::operator=(disassembly_task&& other) = default;
+
+// Do a single chunk of work.
+bool disassembly_task::step(std::size_t const max_items) {
+  switch (stage_) {
+  case stage::parse:
+    dasm_ = std::make_unique<disassembler>(options_.storage ?
+      options_.storage : std::pmr::get_default_resource());
+
+    // Initialize the disassembler.
+    if (!dasm_->initialize(std::move(file_buffer_))) {
+      printf("Failed to initialize disassembler!\n");
+      stage_ = stage::failed;
+      return false;
+    }
+
+    // Create a data block for every data section.
+    dasm_->create_section_data_blocks();
+
+    // Extract as much metadata as possible from the PE file.
+    dasm_->parse_imports();
+    dasm_->parse_exports();
+    dasm_->parse_exceptions();
+    dasm_->parse_relocs();
+
+    if (options_.signatures)
+      dasm_->match_signatures(*options_.signatures);
+
+    if (options_.block_rvas)
+      dasm_->enqueue_block_rvas(*options_.block_rvas);
+
+    // Merge the blocks that were already decoded elsewhere.
+    if (options_.next_prebuilt_block &&
+        !dasm_->merge_prebuilt_blocks(options_.next_prebuilt_block)) {
+      printf("Failed to merge prebuilt blocks!\n");
+      stage_ = stage::failed;
+      return false;
+    }
+
+    stage_ = stage::disassemble;
+    return true;
+
+  case stage::disassemble:
+    if (!dasm_->disassemble(max_items)) {
+      printf("Failed to disassemble binary!\n");
+      stage_ = stage::failed;
+      return false;
+    }
+
+    if (dasm_->queue_empty())
+      stage_ = stage::finalize;
+
+    return true;
+
+  case stage::finalize:
+    dasm_->sort_basic_blocks();
+    dasm_->collect_functions();
+
+    if (options_.signatures) {
+      dasm_->verify_signature_matches();
+
+      if (options_.apply_decisions)
+        apply_signature_decisions(dasm_->bin);
+    }
+
+    assert(dasm_->verify());
+
+    stage_ = stage::finished;
+    return false;
+
+  default:
+    return false;
   }
+}
+
+// Whether the task has finished, whether or not it succeeded.
+bool disassembly_task::done() const {
+  return stage_ == stage::finished || stage_ == stage::failed;
+}
+
+// Whether the task failed.
+bool disassembly_task::failed() const {
+  return stage_ == stage::failed;
+}
+
+// Get the disassembled binary.
+std::optional<disassembled_binary> disassembly_task::finish() {
+  if (stage_ != stage::finished || !dasm_)
+    return {};
 
-  dasm.sort_basic_blocks();
+  auto bin = std::move(dasm_->bin);
+  dasm_ = nullptr;
 
-  assert(dasm.verify());
-  return std::move(dasm.bin);
+  return bin;
 }
 
 } // namespace chum
@@ -2,7 +2,11 @@
 
 #include "binary.h"
 
+#include <functional>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <vector>
 
 namespace chum {
 
@@ -14,6 +18,15 @@ struct rva_data_block_entry {
   data_block* db = nullptr;
 };
 
+// A function that was recognized from a signature database.
+struct signature_match {
+  // The code symbol of the function.
+  symbol_id function = null_symbol_id;
+
+  // The flags that were stored with the signature (signature_flag_*).
+  std::uint32_t flags = 0;
+};
+
 // This contains information about a specific RVA.
 struct rva_map_entry {
   // If the blink is 0, this is the symbol that this RVA lands in.
@@ -30,6 +43,13 @@ struct rva_map_entry {
 class disassembled_binary : public binary {
   friend class disassembler;
 public:
+  // Create an empty binary.
+  disassembled_binary();
+
+  // Create an empty binary where everything (including the RVA maps) is
+  // allocated from the specified memory resource.
+  explicit disassembled_binary(std::pmr::memory_resource* resource);
+
   // Get the symbol that an RVA points to.
   symbol* rva_to_symbol(std::uint32_t rva) const;
 
@@ -54,24 +74,176 @@ public:
   basic_block* rva_to_containing_bb(std::uint32_t rva,
     std::uint32_t* offset = nullptr) const;
 
+  // Get the code symbol of every function that was recovered from the
+  // original image (the entrypoint, exports, .pdata entries, and direct
+  // CALL targets). This is sorted by RVA.
+  std::vector<symbol_id> const& functions() const;
+
+  // Get the combined size of every executable section in the original image.
+  std::uint32_t original_code_size() const;
+
+  // Get the combined size of every data section in the original image.
+  std::uint32_t original_data_size() const;
+
+  // Get a hash of the original image, which is used to make sure that a
+  // profile belongs to this binary.
+  std::uint64_t identity_hash() const;
+
+  // Get every function that was recognized from a signature database.
+  std::vector<signature_match> const& signature_matches() const;
+
+  // Create a deep copy of this binary, including the RVA maps.
+  disassembled_binary clone() const;
+
+  // Get an estimate of the amount of heap memory used by this binary.
+  std::size_t memory_usage() const;
+
 private:
   // Insert the specified data block into the RVA to data block map.
   void insert_data_block_in_rva_map(std::uint32_t rva, data_block* db);
 
 private:
   // This is a map that contains the RVA of every symbol.
-  std::vector<std::uint32_t> sym_rva_map_ = { 0 };
+  std::pmr::vector<std::uint32_t> sym_rva_map_;
 
   // This is a map that contains RVAs and their associated metadata.
-  std::vector<rva_map_entry> rva_map_ = {};
+  std::pmr::vector<rva_map_entry> rva_map_;
 
   // This is a map that links RVAs to data blocks. This vector will always
   // be sorted by RVA, to allow for quick lookup.
-  std::vector<rva_data_block_entry> rva_data_block_map_ = {};
+  std::pmr::vector<rva_data_block_entry> rva_data_block_map_;
+
+  // The code symbol of every recovered function, sorted by RVA.
+  std::vector<symbol_id> functions_ = {};
+
+  // The combined size of the executable and data sections in the original
+  // image.
+  std::uint32_t original_code_size_ = 0;
+  std::uint32_t original_data_size_ = 0;
+
+  // The FNV-1a hash of the original file.
+  std::uint64_t identity_hash_ = 0;
+
+  // Every function that was recognized from a signature database.
+  std::vector<signature_match> signature_matches_ = {};
+};
+
+// The kind of relative operand that a prebuilt instruction has.
+enum class prebuilt_operand : std::uint8_t {
+  none,
+  branch, // The immediate of a relative branch.
+  call,   // The immediate of a relative call.
+  memory, // A RIP-relative memory reference.
+  lea     // A RIP-relative LEA.
+};
+
+// An instruction that was decoded outside of the disassembler, such as by a
+// shard worker. Its relative operand still holds the original value.
+struct prebuilt_instruction {
+  std::uint8_t bytes[15] = {};
+  std::uint8_t length = 0;
+
+  prebuilt_operand operand = prebuilt_operand::none;
+
+  // The offset of the relative operand in the instruction, and its size in
+  // bits.
+  std::uint8_t operand_offset = 0;
+  std::uint8_t operand_size   = 0;
+
+  // The RVA that the relative operand points to.
+  std::uint32_t target_rva = 0;
+};
+
+// A basic block that was decoded outside of the disassembler.
+struct prebuilt_block {
+  // The RVA of the first instruction.
+  std::uint32_t rva = 0;
+
+  // The RVA that this block falls through into, or 0 if it doesn't.
+  std::uint32_t fallthrough_rva = 0;
+
+  std::vector<prebuilt_instruction> instructions = {};
+};
+
+// Optional settings that control how an image is disassembled.
+struct disassemble_options {
+  // If non-null, functions that match a signature get their block
+  // boundaries from the signature (instead of discovering them, and
+  // splitting blocks, one branch at a time) and are named after it.
+  class signature_database const* signatures = nullptr;
+
+  // Apply the decisions that are stored with every matched signature (see
+  // apply_signature_decisions()) once disassembly is done.
+  bool apply_decisions = true;
+
+  // If non-null, every RVA in this (sorted) list is known to be the start
+  // of a basic block, such as the boundaries that were found by a sharded
+  // analysis. These are added to the disassembly queue in order, so that
+  // symbols are numbered the same way no matter where they came from.
+  std::vector<std::uint32_t> const* block_rvas = nullptr;
+
+  // If set, this is called once the PE metadata has been parsed to get the
+  // blocks that were already decoded elsewhere (such as by the workers of a
+  // sharded analysis), one at a time, until it returns false. These are
+  // merged into the binary instead of being decoded again, and anything
+  // that they don't cover is decoded as usual.
+  std::function<bool(prebuilt_block& block)> next_prebuilt_block = {};
+
+  // If non-null, everything in the binary (its symbols, blocks, names, and
+  // RVA maps) is allocated from this resource, such as a monotonic buffer
+  // or a mapped_file_resource. It must outlive the binary.
+  std::pmr::memory_resource* storage = nullptr;
+};
+
+// A disassembly that is run in small steps, so that the caller can do other
+// work (or give up) in between. Nothing happens until step() is called.
+class disassembly_task {
+public:
+  disassembly_task(std::vector<std::uint8_t> file_buffer,
+    disassemble_options const& options = {});
+  ~disassembly_task();
+
+  disassembly_task(disassembly_task&& other);
+  disassembly_task& operator=(disassembly_task&& other);
+
+  // Do a single chunk of work: parsing the PE metadata, disassembling up to
+  // max_items entries of the disassembly queue, or finalizing the binary.
+  // Returns false once the task is finished or has failed.
+  bool step(std::size_t max_items = (std::numeric_limits<std::size_t>::max)());
+
+  // Whether the task has finished, whether or not it succeeded.
+  bool done() const;
+
+  // Whether the task failed.
+  bool failed() const;
+
+  // Get the disassembled binary. This can only be called once, after the
+  // task has finished.
+  std::optional<disassembled_binary> finish();
+
+private:
+  enum class stage {
+    parse,
+    disassemble,
+    finalize,
+    finished,
+    failed
+  };
+
+  std::unique_ptr<class disassembler> dasm_;
+  std::vector<std::uint8_t> file_buffer_ = {};
+  disassemble_options options_ = {};
+  stage stage_ = stage::parse;
 };
 
 // Try to disassemble an x86-64 PE file.
-std::optional<disassembled_binary> disassemble(char const* path);
+std::optional<disassembled_binary> disassemble(char const* path,
+  disassemble_options const& options = {});
+
+// Try to disassemble an x86-64 PE file that has already been read into
+// memory.
+std::optional<disassembled_binary> disassemble(std::vector<std::uint8_t> file_buffer,
+  disassemble_options const& options = {});
 
 } // namespace chum
 
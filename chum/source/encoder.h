@@ -0,0 +1,88 @@
+#pragma once
+
+#include "symbol.h"
+#include "instruction.h"
+
+#include <cassert>
+#include <cstring>
+#include <initializer_list>
+
+#include <Zydis/Zydis.h>
+
+namespace chum {
+
+// Create a register operand for an encoder request.
+inline ZydisEncoderOperand enc_reg(ZydisRegister const reg) {
+  ZydisEncoderOperand op = {};
+  op.type      = ZYDIS_OPERAND_TYPE_REGISTER;
+  op.reg.value = reg;
+  return op;
+}
+
+// Create an immediate operand for an encoder request.
+inline ZydisEncoderOperand enc_imm(std::int64_t const value) {
+  ZydisEncoderOperand op = {};
+  op.type  = ZYDIS_OPERAND_TYPE_IMMEDIATE;
+  op.imm.s = value;
+  return op;
+}
+
+// Create a memory operand for an encoder request. The size is in bytes.
+inline ZydisEncoderOperand enc_mem(std::uint16_t const size,
+    ZydisRegister const base, ZydisRegister const index = ZYDIS_REGISTER_NONE,
+    std::uint8_t const scale = 0, std::int64_t const displacement = 0) {
+  ZydisEncoderOperand op = {};
+  op.type             = ZYDIS_OPERAND_TYPE_MEMORY;
+  op.mem.base         = base;
+  op.mem.index        = index;
+  op.mem.scale        = index == ZYDIS_REGISTER_NONE ? 0 : scale;
+  op.mem.displacement = displacement;
+  op.mem.size         = size;
+  return op;
+}
+
+// Create a RIP-relative memory operand that references a symbol. The size
+// is in bytes.
+inline ZydisEncoderOperand enc_sym(std::uint16_t const size, symbol_id const sym_id) {
+  return enc_mem(size, ZYDIS_REGISTER_RIP, ZYDIS_REGISTER_NONE, 0, sym_id.value);
+}
+
+// Create an encoder request for an x86-64 instruction.
+inline ZydisEncoderRequest enc_req(ZydisMnemonic const mnemonic,
+    std::initializer_list<ZydisEncoderOperand> const operands = {}) {
+  ZydisEncoderRequest req = {};
+  req.machine_mode  = ZYDIS_MACHINE_MODE_LONG_64;
+  req.mnemonic      = mnemonic;
+  req.operand_count = static_cast<ZyanU8>(operands.size());
+
+  std::size_t i = 0;
+  for (auto const& op : operands)
+    req.operands[i++] = op;
+
+  return req;
+}
+
+// Create a single NOP instruction of the specified length (1-9 bytes),
+// using the forms that are recommended by the Intel optimization manual.
+inline instruction make_nop(std::uint8_t const length) {
+  static constexpr std::uint8_t nops[9][9] = {
+    { 0x90 },
+    { 0x66, 0x90 },
+    { 0x0F, 0x1F, 0x00 },
+    { 0x0F, 0x1F, 0x40, 0x00 },
+    { 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+    { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+    { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+    { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 }
+  };
+
+  assert(length >= 1 && length <= 9);
+
+  instruction instr = { 0 };
+  instr.length = length;
+  std::memcpy(instr.bytes, nops[length - 1], length);
+  return instr;
+}
+
+} // namespace chum
@@ -0,0 +1,59 @@
+#include "hotpatch.h"
+#include "encoder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+namespace chum {
+
+// Reserve a patch site at the start of every provided basic block, and
+// emit a table of every patch site.
+symbol* reserve_hotpatch_sites(binary& bin,
+    std::vector<basic_block*> const& entries, hotpatch_options const& options) {
+  // Both styles need to be able to hold a JMP rel32.
+  assert(options.size >= 5);
+
+  hotpatch_table_header header = {};
+  header.magic = hotpatch_table_magic;
+  header.count = static_cast<std::uint32_t>(entries.size());
+  header.style = options.style;
+  header.size  = options.size;
+
+  auto const db = bin.create_data_block(static_cast<std::uint32_t>(
+    sizeof(header) + entries.size() * 8), 8);
+  std::memcpy(db->bytes.data(), &header, sizeof(header));
+
+  auto const table = bin.create_symbol(symbol_type::data, options.table_name);
+  table->db        = db;
+  table->db_offset = 0;
+  table->target    = null_symbol_id;
+  bin.export_symbol(table->id);
+
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    auto const bb = entries[i];
+
+    if (options.style == hotpatch_style::two_byte_pad) {
+      bb->insert(make_nop(2));
+      bb->padding = options.size;
+    }
+    else {
+      // Split the region into the largest possible NOPs.
+      for (auto remaining = options.size; remaining > 0;) {
+        auto const length = (std::min)(remaining, std::uint8_t{ 9 });
+        bb->insert(make_nop(length));
+        remaining -= length;
+      }
+    }
+
+    // This pointer gets filled in (and relocated) when the binary is created.
+    auto const ptr = bin.create_symbol(symbol_type::data);
+    ptr->db        = db;
+    ptr->db_offset = static_cast<std::uint32_t>(sizeof(header) + i * 8);
+    ptr->target    = bb->sym_id;
+  }
+
+  return table;
+}
+
+} // namespace chum
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "binary.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace chum {
+
+// How a hot-patch site is laid out.
+enum class hotpatch_style : std::uint32_t {
+  // A single NOP at the start of the function that can be overwritten with
+  // a JMP (or a CALL) to the instrumentation.
+  nop_region,
+
+  // A 2-byte NOP at the start of the function, plus padding that comes
+  // before the function. The padding can be overwritten with a JMP rel32,
+  // and the 2-byte NOP is then atomically replaced with a JMP rel8 to the
+  // padding. This is the x64 equivalent of the MOV EDI, EDI convention,
+  // since MOV EDI, EDI is not a NOP in 64-bit mode.
+  two_byte_pad
+};
+
+struct hotpatch_options {
+  hotpatch_style style = hotpatch_style::two_byte_pad;
+
+  // The size of the NOP region (nop_region), or the amount of padding
+  // before the function (two_byte_pad). A single NOP is used for regions
+  // of up to 9 bytes, so that a patch can never land in the middle of an
+  // instruction that is being executed. This must be at least 5, which is
+  // the size of a JMP rel32.
+  std::uint8_t size = 5;
+
+  // The exported name of the patch site table.
+  char const* table_name = "__chum_hotpatch_table";
+};
+
+// The patch site table that is emitted in a data block. This header is
+// followed by an array of 64-bit pointers to the start of each function.
+struct hotpatch_table_header {
+  // Always equal to hotpatch_table_magic.
+  std::uint32_t magic;
+
+  // The number of patch sites.
+  std::uint32_t count;
+
+  // The style and size that were used for every patch site.
+  hotpatch_style style;
+  std::uint32_t size;
+};
+
+// 'CHHP'
+inline constexpr std::uint32_t hotpatch_table_magic = 0x50484843;
+
+// Reserve a patch site at the start of every provided basic block, and
+// emit a table of every patch site. This should be the last pass that is
+// run, since anything inserted at the start of a block afterwards would
+// end up in front of the patch site.
+symbol* reserve_hotpatch_sites(binary& bin,
+  std::vector<basic_block*> const& entries, hotpatch_options const& options = {});
+
+} // namespace chum
@@ -1,10 +1,15 @@
 #include "imports.h"
 #include "binary.h"
+#include "util.h"
+
+#include <Windows.h>
+#include <algorithm>
+#include <cstring>
 
 namespace chum {
 
 import_module::import_module(binary& bin, char const* const name)
-    : bin_(bin), name_(name) {}
+    : bin_(bin), routines_(bin.storage_resource()), name_(name, bin.storage_resource()) {}
 
 // Get the null-terminated name of this module.
 char const* import_module::name() const {
@@ -21,7 +26,8 @@ import_routine* import_module::create_routine(char const* const name) {
   auto const sym = bin_.create_symbol(symbol_type::import, symbol_name);
 
   // TODO: Make sure this isn't a duplicate.
-  sym->ir = routines_.emplace_back(new import_routine());
+  sym->ir = routines_.emplace_back(
+    new_object<import_routine>(bin_.storage_resource(), bin_.storage_resource()));
   sym->ir->sym_id = sym->id;
   sym->ir->name   = name;
 
@@ -29,9 +35,90 @@ import_routine* import_module::create_routine(char const* const name) {
 }
 
 // Returns the vector of import routines for this module.
-std::vector<import_routine*> const& import_module::routines() const {
+std::pmr::vector<import_routine*> const& import_module::routines() const {
   return routines_;
 }
 
+// Read the export name table of a PE file on disk.
+std::vector<std::string> read_export_names(char const* const path) {
+  auto const buffer = read_file_to_buffer(path);
+  if (buffer.size() < sizeof(IMAGE_DOS_HEADER))
+    return {};
+
+  auto const dos_header = reinterpret_cast<IMAGE_DOS_HEADER const*>(&buffer[0]);
+  if (dos_header->e_magic != IMAGE_DOS_SIGNATURE)
+    return {};
+
+  if (dos_header->e_lfanew < 0 || buffer.size() <
+      dos_header->e_lfanew + sizeof(IMAGE_NT_HEADERS))
+    return {};
+
+  auto const nt_header = reinterpret_cast<IMAGE_NT_HEADERS const*>(
+    &buffer[dos_header->e_lfanew]);
+  if (nt_header->Signature != IMAGE_NT_SIGNATURE ||
+      nt_header->FileHeader.Machine != IMAGE_FILE_MACHINE_AMD64)
+    return {};
+
+  auto const sections = reinterpret_cast<IMAGE_SECTION_HEADER const*>(nt_header + 1);
+  auto const section_count = nt_header->FileHeader.NumberOfSections;
+
+  if (buffer.size() < dos_header->e_lfanew + sizeof(IMAGE_NT_HEADERS) +
+      section_count * sizeof(IMAGE_SECTION_HEADER))
+    return {};
+
+  // Convert an RVA to a file offset, or 0 if the RVA isn't backed by the
+  // file (or there aren't at least size bytes left in the file).
+  auto const rva_to_offset = [&](std::uint32_t const rva, std::size_t const size) {
+    for (std::size_t i = 0; i < section_count; ++i) {
+      auto const& sec = sections[i];
+      if (rva < sec.VirtualAddress || rva >= sec.VirtualAddress + sec.SizeOfRawData)
+        continue;
+
+      std::size_t const offset = sec.PointerToRawData + (rva - sec.VirtualAddress);
+      return offset + size <= buffer.size() ? offset : 0;
+    }
+
+    return std::size_t(0);
+  };
+
+  auto const& edata =
+    nt_header->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
+  if (!edata.VirtualAddress || !edata.Size)
+    return {};
+
+  auto const exports_off = rva_to_offset(edata.VirtualAddress,
+    sizeof(IMAGE_EXPORT_DIRECTORY));
+  if (!exports_off)
+    return {};
+
+  auto const exports = reinterpret_cast<IMAGE_EXPORT_DIRECTORY const*>(
+    &buffer[exports_off]);
+
+  auto const names_off = rva_to_offset(exports->AddressOfNames,
+    exports->NumberOfNames * 4);
+  if (!names_off)
+    return {};
+
+  std::vector<std::string> names(exports->NumberOfNames);
+
+  for (std::size_t i = 0; i < names.size(); ++i) {
+    std::uint32_t name_rva = 0;
+    std::memcpy(&name_rva, &buffer[names_off + i * 4], 4);
+
+    auto const name_off = rva_to_offset(name_rva, 1);
+    if (!name_off)
+      return {};
+
+    // Make sure the name is null-terminated before the end of the file.
+    auto const name_end = std::find(begin(buffer) + name_off, end(buffer), 0);
+    if (name_end == end(buffer))
+      return {};
+
+    names[i].assign(begin(buffer) + name_off, name_end);
+  }
+
+  return names;
+}
+
 } // namespace chum
 
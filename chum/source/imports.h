@@ -2,19 +2,28 @@
 
 #include "symbol.h"
 
+#include <memory_resource>
 #include <vector>
+#include <string>
 
 namespace chum {
 
 struct import_routine {
+  import_routine() = default;
+
+  // Create an import routine whose name is allocated from a specific memory
+  // resource.
+  explicit import_routine(std::pmr::memory_resource* const resource) : name(resource) {}
+
   // This points to the import symbol for this routine.
   symbol_id sym_id = null_symbol_id;
 
   // The name of this import.
-  std::string name = "";
+  std::pmr::string name = {};
 };
 
 class import_module {
+  friend class binary;
 public:
   import_module(class binary& bin, char const* name);
 
@@ -25,18 +34,25 @@ public:
   import_routine* create_routine(char const* name);
 
   // Returns the vector of import routines for this module.
-  std::vector<import_routine*> const& routines() const;
+  std::pmr::vector<import_routine*> const& routines() const;
 
 private:
   // This is a reference to the binary that this import module is a part of.
   class binary& bin_;
 
-  // This is the list of every imported routine from this module.
-  std::vector<import_routine*> routines_ = {};
+  // This is the list of every imported routine from this module. These are
+  // allocated from the memory resource of the binary.
+  std::pmr::vector<import_routine*> routines_;
 
   // The name of this module.
-  std::string name_ = "";
+  std::pmr::string name_;
 };
 
+// Read the export name table of a PE file on disk. The names are returned in
+// the same order as the export name table, which means that the index of a
+// name is the hint that the loader expects in IMAGE_IMPORT_BY_NAME. An empty
+// vector is returned if the file could not be read or parsed.
+std::vector<std::string> read_export_names(char const* path);
+
 } // namespace chum
 
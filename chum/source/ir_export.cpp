@@ -0,0 +1,231 @@
+#include "ir_export.h"
+#include "cfg.h"
+
+#include <cstring>
+#include <filesystem>
+
+namespace chum {
+
+// Mnemonics that haven't been given a dictionary ID yet.
+static constexpr std::uint16_t invalid_mnemonic_id = 0xFFFF;
+
+// Get the path of a table in the output directory.
+static std::string get_table_path(char const* const directory, char const* const name) {
+  return (std::filesystem::path(directory) / name).string();
+}
+
+// Create (or overwrite) the tables in an existing directory.
+ir_exporter::ir_exporter(char const* const directory, ir_export_options const& options)
+    : directory_(directory), options_(options),
+      binaries_(get_table_path(directory, "binaries.col").c_str(), {
+        { "binary",        column_type::u32    },
+        { "name",          column_type::string },
+        { "identity_hash", column_type::u64    },
+        { "code_size",     column_type::u32    },
+        { "data_size",     column_type::u32    },
+        { "functions",     column_type::u32    } }, options.rows_per_group),
+      symbols_(get_table_path(directory, "symbols.col").c_str(), {
+        { "binary", column_type::u32    },
+        { "symbol", column_type::u32    },
+        { "type",   column_type::u8     },
+        { "rva",    column_type::u32    },
+        { "name",   column_type::string } }, options.rows_per_group),
+      blocks_(get_table_path(directory, "blocks.col").c_str(), {
+        { "binary",         column_type::u32 },
+        { "symbol",         column_type::u32 },
+        { "rva",            column_type::u32 },
+        { "instructions",   column_type::u32 },
+        { "size",           column_type::u32 },
+        { "weight",         column_type::u64 },
+        { "function_entry", column_type::u8  } }, options.rows_per_group),
+      instructions_(get_table_path(directory, "instructions.col").c_str(), {
+        { "binary",   column_type::u32 },
+        { "block",    column_type::u32 },
+        { "index",    column_type::u32 },
+        { "offset",   column_type::u32 },
+        { "length",   column_type::u8  },
+        { "mnemonic", column_type::u16 },
+        { "category", column_type::u8  },
+        { "operands", column_type::u8  } }, options.rows_per_group),
+      edges_(get_table_path(directory, "edges.col").c_str(), {
+        { "binary", column_type::u32 },
+        { "from",   column_type::u32 },
+        { "to",     column_type::u32 },
+        { "kind",   column_type::u8  },
+        { "weight", column_type::u64 } }, options.rows_per_group),
+      mnemonic_ids_(ZYDIS_MNEMONIC_MAX_VALUE + 1, invalid_mnemonic_id) {}
+
+// Finish the tables, if they haven't been finished already.
+ir_exporter::~ir_exporter() {
+  finish();
+}
+
+// Whether every table was created and every write so far has succeeded.
+bool ir_exporter::valid() const {
+  return binaries_.valid() && symbols_.valid() && blocks_.valid() &&
+    instructions_.valid() && edges_.valid();
+}
+
+// Append every symbol, block, instruction, and edge of a binary to the
+// tables, and return the ID that the binary was given.
+std::uint32_t ir_exporter::add(disassembled_binary const& bin, char const* const name) {
+  auto const binary_id = binary_count_++;
+
+  binaries_.push(binary_id);
+  binaries_.push(std::string_view(name));
+  binaries_.push(bin.identity_hash());
+  binaries_.push(bin.original_code_size());
+  binaries_.push(bin.original_data_size());
+  binaries_.push(bin.functions().size());
+  binaries_.end_row();
+
+  for (auto const sym : bin.symbols()) {
+    symbols_.push(binary_id);
+    symbols_.push(sym->id.value);
+    symbols_.push(static_cast<std::uint64_t>(sym->type));
+    symbols_.push(bin.symbol_to_rva(sym->id));
+    symbols_.push(std::string_view(sym->name));
+    symbols_.end_row();
+  }
+
+  std::vector<std::uint8_t> function_entry(bin.symbols().size(), 0);
+  for (auto const function : bin.functions())
+    function_entry[function.value] = 1;
+
+  auto const push_edge = [&](basic_block const* const bb, symbol_id const target,
+      ir_edge_kind const kind, std::uint64_t const weight) {
+    edges_.push(binary_id);
+    edges_.push(bb->sym_id.value);
+    edges_.push(target.value);
+    edges_.push(static_cast<std::uint64_t>(kind));
+    edges_.push(weight);
+    edges_.end_row();
+  };
+
+  for (auto const bb : bin.basic_blocks()) {
+    std::uint32_t offset = 0;
+
+    for (std::size_t i = 0; i < bb->instructions.size(); ++i) {
+      auto const& instr = bb->instructions[i];
+
+      ZydisDecoderContext decoded_ctx;
+      ZydisDecodedInstruction decoded_instr;
+      if (ZYAN_FAILED(ZydisDecoderDecodeInstruction(bin.decoder(), &decoded_ctx,
+          instr.bytes, instr.length, &decoded_instr)))
+        decoded_instr = {};
+
+      instructions_.push(binary_id);
+      instructions_.push(bb->sym_id.value);
+      instructions_.push(i);
+      instructions_.push(offset);
+      instructions_.push(instr.length);
+      instructions_.push(get_mnemonic_id(decoded_instr.mnemonic));
+      instructions_.push(static_cast<std::uint64_t>(decoded_instr.meta.category));
+      instructions_.push(decoded_instr.operand_count_visible);
+      instructions_.end_row();
+
+      offset += instr.length;
+
+      if (decoded_instr.meta.category != ZYDIS_CATEGORY_CALL)
+        continue;
+
+      // Relative calls store the symbol ID in their immediate.
+      if (!decoded_instr.raw.imm[0].is_relative) {
+        push_edge(bb, null_symbol_id, ir_edge_kind::indirect_call, bb->weight);
+        continue;
+      }
+
+      symbol_id target = null_symbol_id;
+      std::memcpy(&target.value, instr.bytes +
+        decoded_instr.raw.imm[0].offset, decoded_instr.raw.imm[0].size / 8);
+
+      push_edge(bb, target, ir_edge_kind::call, bb->weight);
+    }
+
+    blocks_.push(binary_id);
+    blocks_.push(bb->sym_id.value);
+    blocks_.push(bin.symbol_to_rva(bb->sym_id));
+    blocks_.push(bb->instructions.size());
+    blocks_.push(offset);
+    blocks_.push(bb->weight);
+    blocks_.push(function_entry[bb->sym_id.value]);
+    blocks_.end_row();
+
+    auto const exit = get_block_exit(bin, bb);
+
+    if (exit.branch_target)
+      push_edge(bb, exit.branch_target, ir_edge_kind::branch, bb->taken_weight);
+    else if (exit.is_indirect)
+      push_edge(bb, null_symbol_id, ir_edge_kind::indirect_branch, bb->taken_weight);
+
+    if (exit.fallthrough_target) {
+      push_edge(bb, exit.fallthrough_target,
+        ir_edge_kind::fallthrough, bb->fallthrough_weight);
+    }
+  }
+
+  return binary_id;
+}
+
+// Write the mnemonic dictionary and close every table.
+bool ir_exporter::finish() {
+  if (finished_)
+    return valid();
+
+  finished_ = true;
+
+  column_writer mnemonics(get_table_path(directory_.c_str(), "mnemonics.col").c_str(), {
+    { "mnemonic", column_type::u16    },
+    { "name",     column_type::string } }, options_.rows_per_group);
+
+  for (std::size_t i = 0; i < mnemonics_.size(); ++i) {
+    auto const str = ZydisMnemonicGetString(mnemonics_[i]);
+
+    mnemonics.push(i);
+    mnemonics.push(std::string_view(str ? str : ""));
+    mnemonics.end_row();
+  }
+
+  // Every table needs to be finished, even if an earlier one failed.
+  auto success = mnemonics.finish();
+  success &= binaries_.finish();
+  success &= symbols_.finish();
+  success &= blocks_.finish();
+  success &= instructions_.finish();
+  success &= edges_.finish();
+
+  return success;
+}
+
+// The number of rows that were written to the symbol table.
+std::uint64_t ir_exporter::symbol_count() const {
+  return symbols_.row_count();
+}
+
+// The number of rows that were written to the block table.
+std::uint64_t ir_exporter::block_count() const {
+  return blocks_.row_count();
+}
+
+// The number of rows that were written to the instruction table.
+std::uint64_t ir_exporter::instruction_count() const {
+  return instructions_.row_count();
+}
+
+// The number of rows that were written to the edge table.
+std::uint64_t ir_exporter::edge_count() const {
+  return edges_.row_count();
+}
+
+// Get the dictionary ID of a mnemonic, adding it if it's new.
+std::uint16_t ir_exporter::get_mnemonic_id(ZydisMnemonic const mnemonic) {
+  auto& id = mnemonic_ids_[static_cast<std::size_t>(mnemonic)];
+  if (id == invalid_mnemonic_id) {
+    id = static_cast<std::uint16_t>(mnemonics_.size());
+    mnemonics_.push_back(mnemonic);
+  }
+
+  return id;
+}
+
+} // namespace chum
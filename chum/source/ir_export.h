@@ -0,0 +1,102 @@
+#pragma once
+
+#include "disassembler.h"
+#include "columnar.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Zydis/Zydis.h>
+
+namespace chum {
+
+// The kind of an edge in the edge table.
+enum class ir_edge_kind : std::uint8_t {
+  // The block falls through into the target.
+  fallthrough,
+
+  // The terminating JMP/JCC branches to the target.
+  branch,
+
+  // A direct CALL in the block calls the target.
+  call,
+
+  // An indirect CALL. The target is null.
+  indirect_call,
+
+  // The block ends with an indirect JMP (or a branch to a non-code symbol).
+  // The target is null.
+  indirect_branch
+};
+
+struct ir_export_options {
+  // The number of rows that every table buffers before writing them out.
+  std::uint32_t rows_per_group = 64 * 1024;
+};
+
+// Exports disassembled binaries into a set of columnar tables (see
+// column_writer) in a single directory, so that many binaries can be
+// queried together. Every table has a "binary" column with the ID that
+// add() returned:
+//
+//   binaries.col      One row per binary (name, hash, and sizes).
+//   symbols.col       Every symbol, with its type, RVA, and name.
+//   blocks.col        Every basic block, with its size and profile weight.
+//   instructions.col  Every instruction, with a dictionary-encoded mnemonic.
+//   edges.col         Fallthroughs, branches, and calls between blocks.
+//   mnemonics.col     The mnemonic dictionary, written by finish().
+//
+// Rows are streamed out as they're produced, so memory usage doesn't grow
+// with the number of binaries.
+class ir_exporter {
+public:
+  // Create (or overwrite) the tables in an existing directory.
+  explicit ir_exporter(char const* directory, ir_export_options const& options = {});
+
+  // Finish the tables, if they haven't been finished already.
+  ~ir_exporter();
+
+  ir_exporter(ir_exporter const&) = delete;
+  ir_exporter& operator=(ir_exporter const&) = delete;
+
+  // Whether every table was created and every write so far has succeeded.
+  bool valid() const;
+
+  // Append every symbol, block, instruction, and edge of a binary to the
+  // tables, and return the ID that the binary was given.
+  std::uint32_t add(disassembled_binary const& bin, char const* name);
+
+  // Write the mnemonic dictionary and close every table.
+  bool finish();
+
+  // The number of rows that were written to each table.
+  std::uint64_t symbol_count() const;
+  std::uint64_t block_count() const;
+  std::uint64_t instruction_count() const;
+  std::uint64_t edge_count() const;
+
+private:
+  // Get the dictionary ID of a mnemonic, adding it if it's new.
+  std::uint16_t get_mnemonic_id(ZydisMnemonic mnemonic);
+
+private:
+  std::string directory_ = {};
+  ir_export_options options_ = {};
+
+  column_writer binaries_;
+  column_writer symbols_;
+  column_writer blocks_;
+  column_writer instructions_;
+  column_writer edges_;
+
+  // The dictionary ID of every mnemonic (indexed by ZydisMnemonic), or
+  // 0xFFFF if it hasn't been seen yet, and the mnemonic of every ID.
+  std::vector<std::uint16_t> mnemonic_ids_ = {};
+  std::vector<ZydisMnemonic> mnemonics_ = {};
+
+  std::uint32_t binary_count_ = 0;
+  bool finished_ = false;
+};
+
+} // namespace chum
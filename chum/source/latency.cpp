@@ -0,0 +1,209 @@
+#include "latency.h"
+#include "liveness.h"
+#include "cfg.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+
+namespace chum {
+
+// Generate a latency probe that writes a single record to the trace buffer.
+static std::vector<instruction> create_latency_probe(binary const& bin,
+    trace_buffer const& buffer, std::uint32_t const id, register_set const live) {
+  std::vector<instruction> probe = {};
+
+  // RDTSC only clobbers RAX and RDX, which are saved along with everything
+  // that emit_trace_record() clobbers.
+  emit_probe_save(bin, live, probe);
+
+  // RDTSC
+  // SHL RDX, 32
+  // OR RDX, RAX
+  probe.push_back(bin.instr("\x0F\x31"));
+  probe.push_back(bin.instr("\x48\xC1\xE2\x20"));
+  probe.push_back(bin.instr("\x48\x09\xC2"));
+
+  emit_trace_record(bin, buffer, id, probe);
+  emit_probe_restore(bin, live, probe);
+
+  return probe;
+}
+
+// Insert an RDTSC probe at the start of every recovered function, as well as
+// before every RET that belongs to it.
+latency_probe_result instrument_function_latency(
+    disassembled_binary& bin, latency_probe_options const& options) {
+  latency_probe_result result = {};
+
+  auto const& functions = bin.functions();
+
+  // This needs to be calculated before we modify anything.
+  liveness_analysis const liveness(bin);
+
+  // Every function entry, indexed by function ID.
+  std::vector<basic_block*> entries = {};
+  std::vector<std::uint32_t> id_rvas = {};
+
+  // Map every function entry to its function ID.
+  std::unordered_map<basic_block*, std::uint32_t> entry_to_id = {};
+
+  for (auto const sym_id : functions) {
+    auto const bb = bin.get_symbol(sym_id)->bb;
+    if (bb->no_instrument || entry_to_id.count(bb))
+      continue;
+
+    entry_to_id[bb] = static_cast<std::uint32_t>(entries.size());
+    entries.push_back(bb);
+    id_rvas.push_back(bin.symbol_to_rva(sym_id));
+  }
+
+  // Find the RET blocks of every function by walking the CFG from the
+  // function entry, without crossing into another function. If a block is
+  // shared between multiple functions, the first function wins.
+  std::vector<std::pair<basic_block*, std::uint32_t>> rets = {};
+  std::vector<bool> visited(bin.symbols().size(), false);
+
+  for (std::uint32_t id = 0; id < entries.size(); ++id) {
+    std::vector<basic_block*> stack = { entries[id] };
+
+    while (!stack.empty()) {
+      auto const bb = stack.back();
+      stack.pop_back();
+
+      if (visited[bb->sym_id.value])
+        continue;
+      visited[bb->sym_id.value] = true;
+
+      if (get_block_exit(bin, bb).is_return)
+        rets.push_back({ bb, id });
+
+      // Tail calls into a function that isn't instrumented end the walk.
+      for (auto const succ : get_successors(bin, bb)) {
+        if (!succ->no_instrument && !entry_to_id.count(succ))
+          stack.push_back(succ);
+      }
+    }
+  }
+
+  result.buffer = create_trace_buffer(bin, options.buffer_name,
+    trace_kind::timestamp, id_rvas, options.buffer);
+
+  // Insert the exit probes first, so that the instruction indices that we
+  // pass to the liveness analysis are still correct.
+  for (auto const& [bb, id] : rets) {
+    auto const ret_idx = bb->instructions.size() - 1;
+    auto const probe = create_latency_probe(bin, result.buffer,
+      id | latency_exit_flag, liveness.live_before(bb, ret_idx));
+
+    bb->instructions.insert(begin(bb->instructions) + ret_idx,
+      begin(probe), end(probe));
+    ++result.exit_probe_count;
+  }
+
+  for (std::uint32_t id = 0; id < entries.size(); ++id) {
+    auto const bb = entries[id];
+    auto const probe = create_latency_probe(
+      bin, result.buffer, id, liveness.live_in(bb));
+
+    bb->instructions.insert(begin(bb->instructions), begin(probe), end(probe));
+    ++result.entry_probe_count;
+  }
+
+  return result;
+}
+
+// Turn a trace buffer dump that was produced by the latency probes into
+// per-function latency histograms.
+std::vector<function_latency> decode_latency_dump(trace_dump const& dump) {
+  std::vector<function_latency> latencies(dump.id_rvas.size());
+  for (std::size_t i = 0; i < latencies.size(); ++i)
+    latencies[i].rva = dump.id_rvas[i];
+
+  struct pending_call {
+    std::uint32_t id;
+    std::uint64_t timestamp;
+  };
+
+  for (auto const& ring : dump.rings) {
+    // Each thread always writes to the same ring, but multiple threads
+    // might share a ring, so we need a separate call stack for each thread.
+    std::unordered_map<std::uint32_t, std::vector<pending_call>> stacks = {};
+
+    for (auto const& record : ring) {
+      auto const id = record.id & ~latency_exit_flag;
+      if (id >= latencies.size())
+        continue;
+
+      auto& stack = stacks[record.thread_id];
+
+      if (!(record.id & latency_exit_flag)) {
+        stack.push_back({ id, record.value });
+        continue;
+      }
+
+      // Find the matching entry record. Anything above it on the stack
+      // never returned normally (tail calls, exceptions, or records that
+      // were lost when the ring wrapped).
+      auto it = stack.rbegin();
+      while (it != stack.rend() && it->id != id)
+        ++it;
+
+      if (it == stack.rend())
+        continue;
+
+      auto const start = it->timestamp;
+      stack.erase(std::next(it).base(), end(stack));
+
+      if (record.value < start)
+        continue;
+
+      auto const ticks = record.value - start;
+      auto& latency = latencies[id];
+
+      if (latency.calls == 0 || ticks < latency.min_ticks)
+        latency.min_ticks = ticks;
+      if (ticks > latency.max_ticks)
+        latency.max_ticks = ticks;
+
+      latency.total_ticks += ticks;
+      ++latency.calls;
+
+      std::size_t bucket = 0;
+      while (bucket < 63 && (ticks >> (bucket + 1)))
+        ++bucket;
+      ++latency.histogram[bucket];
+    }
+  }
+
+  // Remove any functions that were never called.
+  latencies.erase(std::remove_if(begin(latencies), end(latencies),
+    [](function_latency const& latency) { return latency.calls == 0; }),
+    end(latencies));
+
+  return latencies;
+}
+
+// Print per-function latency histograms.
+void print_latency_histograms(std::vector<function_latency> const& latencies) {
+  std::printf("[+] Functions (%zu):\n", latencies.size());
+
+  for (auto const& latency : latencies) {
+    std::printf("[+]   RVA: 0x%-8X Calls: %-8llu Min: %-8llu Avg: %-8llu Max: %llu\n",
+      latency.rva,
+      static_cast<unsigned long long>(latency.calls),
+      static_cast<unsigned long long>(latency.min_ticks),
+      static_cast<unsigned long long>(latency.total_ticks / latency.calls),
+      static_cast<unsigned long long>(latency.max_ticks));
+
+    for (std::size_t i = 0; i < 64; ++i) {
+      if (!latency.histogram[i])
+        continue;
+
+      std::printf("[+]     [2^%-2zu, 2^%-2zu) %llu\n", i, i + 1,
+        static_cast<unsigned long long>(latency.histogram[i]));
+    }
+  }
+}
+
+} // namespace chum
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "disassembler.h"
+#include "trace_buffer.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace chum {
+
+// Exit records have this bit set in their ID.
+inline constexpr std::uint32_t latency_exit_flag = 0x80000000;
+
+struct latency_probe_options {
+  // The exported name of the trace buffer.
+  char const* buffer_name = "__chum_latency_buffer";
+
+  // The layout of the trace buffer.
+  trace_buffer_options buffer = {};
+};
+
+struct latency_probe_result {
+  // The trace buffer that the probes write to. The ID table maps function
+  // IDs to the original RVA of each function.
+  trace_buffer buffer = {};
+
+  // The number of entry and exit probes that were inserted.
+  std::size_t entry_probe_count = 0;
+  std::size_t exit_probe_count  = 0;
+};
+
+// Insert an RDTSC probe at the start of every recovered function, as well as
+// before every RET that belongs to it. Each probe writes a (function ID,
+// timestamp) record to a trace buffer. Registers and flags are preserved,
+// although registers that are dead at the probe site are not saved.
+latency_probe_result instrument_function_latency(
+  disassembled_binary& bin, latency_probe_options const& options = {});
+
+// Latency statistics for a single function.
+struct function_latency {
+  // The RVA of the function in the original image.
+  std::uint32_t rva = 0;
+
+  // The number of calls that had both an entry and an exit record.
+  std::uint64_t calls = 0;
+
+  // Latencies, in TSC ticks.
+  std::uint64_t min_ticks   = 0;
+  std::uint64_t max_ticks   = 0;
+  std::uint64_t total_ticks = 0;
+
+  // Bucket N counts calls that took [2^N, 2^(N+1)) ticks.
+  std::uint64_t histogram[64] = {};
+};
+
+// Turn a trace buffer dump that was produced by the latency probes into
+// per-function latency histograms. Functions that were never called
+// are omitted.
+std::vector<function_latency> decode_latency_dump(trace_dump const& dump);
+
+// Print per-function latency histograms.
+void print_latency_histograms(std::vector<function_latency> const& latencies);
+
+} // namespace chum
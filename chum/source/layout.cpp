@@ -0,0 +1,41 @@
+#include "layout.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace chum {
+
+// Move every block in a first-execution trace to the start of the code
+// section, in trace order.
+startup_layout_result apply_startup_layout(disassembled_binary& bin,
+    std::vector<rva_count> const& trace) {
+  startup_layout_result result = {};
+
+  // The position of each block in the startup order, indexed by symbol ID.
+  // Blocks that weren't executed are left at the end.
+  auto const not_executed = (std::numeric_limits<std::size_t>::max)();
+  std::vector<std::size_t> order(bin.symbols().size(), not_executed);
+
+  for (auto const& entry : trace) {
+    auto const bb = bin.rva_to_containing_bb(entry.rva);
+    if (!bb) {
+      ++result.missing_count;
+      continue;
+    }
+
+    // Only the first execution matters.
+    if (order[bb->sym_id.value] != not_executed)
+      continue;
+
+    order[bb->sym_id.value] = result.startup_block_count++;
+  }
+
+  std::stable_sort(begin(bin.basic_blocks()), end(bin.basic_blocks()),
+    [&](basic_block const* const left, basic_block const* const right) {
+      return order[left->sym_id.value] < order[right->sym_id.value];
+    });
+
+  return result;
+}
+
+} // namespace chum
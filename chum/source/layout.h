@@ -0,0 +1,26 @@
+#pragma once
+
+#include "disassembler.h"
+#include "util.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace chum {
+
+struct startup_layout_result {
+  // The number of distinct blocks that were moved to the start of .text.
+  std::size_t startup_block_count = 0;
+
+  // The number of trace entries that didn't land in any basic block.
+  std::size_t missing_count = 0;
+};
+
+// Move every block in a first-execution trace (original block RVAs, in the
+// order that they were first executed) to the start of the code section,
+// in trace order. Every other block keeps its relative order and comes
+// afterwards. RVAs that point into the middle of a block place that block.
+startup_layout_result apply_startup_layout(disassembled_binary& bin,
+  std::vector<rva_count> const& trace);
+
+} // namespace chum
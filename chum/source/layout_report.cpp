@@ -0,0 +1,52 @@
+#include "layout_report.h"
+
+#include <cstdio>
+
+namespace chum {
+
+// Serialize a layout report as a single JSON object.
+std::string serialize_layout_report(layout_report const& report) {
+  char buffer[1024] = { 0 };
+
+  std::snprintf(buffer, sizeof(buffer),
+    "{"
+      "\"block_count\":%llu,"
+      "\"instruction_bytes\":%llu,"
+      "\"fallthrough_jmp_count\":%llu,"
+      "\"fallthrough_jmp_bytes\":%llu,"
+      "\"rel8_branch_count\":%llu,"
+      "\"rel32_branch_count\":%llu,"
+      "\"average_branch_distance\":%.2f,"
+      "\"hot_percent\":%.2f,"
+      "\"hot_block_count\":%llu,"
+      "\"hot_page_count\":%llu,"
+      "\"hot_line_count\":%llu,"
+      "\"code_size\":%llu,"
+      "\"original_code_size\":%llu,"
+      "\"code_growth\":%.4f,"
+      "\"data_size\":%llu,"
+      "\"original_data_size\":%llu,"
+      "\"data_growth\":%.4f"
+    "}",
+    static_cast<unsigned long long>(report.block_count),
+    static_cast<unsigned long long>(report.instruction_bytes),
+    static_cast<unsigned long long>(report.fallthrough_jmp_count),
+    static_cast<unsigned long long>(report.fallthrough_jmp_bytes),
+    static_cast<unsigned long long>(report.rel8_branch_count),
+    static_cast<unsigned long long>(report.rel32_branch_count),
+    report.average_branch_distance,
+    report.hot_percent,
+    static_cast<unsigned long long>(report.hot_block_count),
+    static_cast<unsigned long long>(report.hot_page_count),
+    static_cast<unsigned long long>(report.hot_line_count),
+    static_cast<unsigned long long>(report.code_size),
+    static_cast<unsigned long long>(report.original_code_size),
+    report.code_growth,
+    static_cast<unsigned long long>(report.data_size),
+    static_cast<unsigned long long>(report.original_data_size),
+    report.data_growth);
+
+  return buffer;
+}
+
+} // namespace chum
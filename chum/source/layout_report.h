@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace chum {
+
+// This describes what binary::create() did to the code while laying it out.
+// The first few members are inputs that are provided by the caller, while
+// the rest are filled in during emission.
+struct layout_report {
+  // The percentage (0-100) of basic blocks that are considered hot when
+  // calculating the hot code footprint.
+  double hot_percent = 10.0;
+
+  // Per-block execution weights, indexed by the block's symbol ID. Blocks
+  // without a weight (or with a weight of 0) are never considered hot. If
+  // this is empty, basic_block::weight is used instead.
+  std::vector<std::uint64_t> block_weights = {};
+
+  // The size of the code and data in the original image, for calculating
+  // growth. A value of 0 means that the size is unknown.
+  std::uint64_t original_code_size = 0;
+  std::uint64_t original_data_size = 0;
+
+  // ---------------
+  // Everything below this is filled in by binary::create().
+  // ---------------
+
+  // The number of basic blocks that were emitted.
+  std::uint64_t block_count = 0;
+
+  // The number of bytes taken up by re-encoded instructions.
+  std::uint64_t instruction_bytes = 0;
+
+  // The number of JMP instructions that were added because a block's
+  // fallthrough target was not placed directly after it.
+  std::uint64_t fallthrough_jmp_count = 0;
+  std::uint64_t fallthrough_jmp_bytes = 0;
+
+  // The number of relative JMP/JCC instructions, by displacement size. This
+  // includes the JMPs that were added for fallthrough targets.
+  std::uint64_t rel8_branch_count  = 0;
+  std::uint64_t rel32_branch_count = 0;
+
+  // The average distance, in bytes, between a relative branch and its target.
+  double average_branch_distance = 0.0;
+
+  // The number of blocks that were considered hot, as well as the number of
+  // distinct 4KB pages and 64-byte cache lines that they span.
+  std::uint64_t hot_block_count = 0;
+  std::uint64_t hot_page_count  = 0;
+  std::uint64_t hot_line_count  = 0;
+
+  // The size of the emitted code and data sections.
+  std::uint64_t code_size = 0;
+  std::uint64_t data_size = 0;
+
+  // The emitted size divided by the original size (or 0 if unknown).
+  double code_growth = 0.0;
+  double data_growth = 0.0;
+};
+
+// Serialize a layout report as a single JSON object.
+std::string serialize_layout_report(layout_report const& report);
+
+} // namespace chum
@@ -0,0 +1,169 @@
+#include "lbr.h"
+#include "cfg.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+namespace chum {
+
+// Convert an address from an LBR file into an RVA.
+static std::uint32_t lbr_address_to_rva(std::uint64_t const address,
+    std::uint64_t const image_base) {
+  if (image_base && address >= image_base)
+    return static_cast<std::uint32_t>(address - image_base);
+
+  return static_cast<std::uint32_t>(address);
+}
+
+// Read a text file of LBR samples.
+std::vector<lbr_sample> read_lbr_samples(char const* const path,
+    std::uint64_t const image_base) {
+  std::ifstream file(path);
+  if (!file)
+    return {};
+
+  std::vector<lbr_sample> samples = {};
+
+  for (std::string line; std::getline(file, line);) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    lbr_sample sample = {};
+
+    char const* curr = line.c_str();
+    char* end = nullptr;
+
+    while (*curr) {
+      while (*curr == ' ' || *curr == '\t' || *curr == '\r')
+        ++curr;
+
+      if (!*curr)
+        break;
+
+      // A pair always contains a '/', and the weight never does.
+      auto const token_end = curr + std::strcspn(curr, " \t\r");
+      if (std::find(curr, token_end, '/') == token_end) {
+        sample.weight = std::strtoull(curr, nullptr, 10);
+        curr = token_end;
+        continue;
+      }
+
+      auto const from = std::strtoull(curr, &end, 16);
+      if (*end != '/')
+        break;
+
+      auto const to = std::strtoull(end + 1, &end, 16);
+
+      sample.records.push_back({ lbr_address_to_rva(from, image_base),
+        lbr_address_to_rva(to, image_base) });
+
+      curr = end;
+    }
+
+    if (!sample.records.empty() && sample.weight)
+      samples.push_back(std::move(sample));
+  }
+
+  return samples;
+}
+
+// Turn LBR samples into a profile for a binary.
+lbr_import_result import_lbr_samples(disassembled_binary const& bin,
+    std::vector<lbr_sample> const& samples, lbr_import_options const& options) {
+  lbr_import_result result = {};
+  result.prof.identity_hash = bin.identity_hash();
+
+  // The RVA of every recovered function, for recognizing calls.
+  std::vector<std::uint32_t> function_rvas = {};
+  for (auto const function : bin.functions())
+    function_rvas.push_back(bin.symbol_to_rva(function));
+
+  auto const is_function = [&](std::uint32_t const rva) {
+    return std::binary_search(begin(function_rvas), end(function_rvas), rva);
+  };
+
+  auto const block_rva = [&](basic_block const* const bb) {
+    return bin.symbol_to_rva(bb->sym_id);
+  };
+
+  // The blocks of the range that is currently being walked. These are only
+  // added to the profile once the whole range is known to be valid.
+  std::vector<basic_block*> range = {};
+
+  for (auto const& sample : samples) {
+    ++result.sample_count;
+
+    for (std::size_t i = 0; i < sample.records.size(); ++i) {
+      auto const& record = sample.records[i];
+      ++result.record_count;
+
+      auto const src = bin.rva_to_containing_bb(record.from);
+      auto const dst = bin.rva_to_containing_bb(record.to);
+
+      if (!src || !dst) {
+        ++result.unmapped_records;
+        continue;
+      }
+
+      // Taken branches land on the start of a block. Returns land right
+      // after a CALL, which is usually in the middle of a block.
+      if (block_rva(dst) == record.to) {
+        if (get_block_exit(bin, src).branch_target == dst->sym_id) {
+          result.prof.edges.push_back({ record.from, record.to, sample.weight });
+          ++result.branch_records;
+        }
+        else if (is_function(record.to)) {
+          result.prof.calls.push_back({ record.from, record.to, sample.weight });
+          ++result.call_records;
+        }
+      }
+
+      // The most recent record has no range, since the sample was taken
+      // somewhere after its target.
+      if (i == 0)
+        continue;
+
+      // Execution went straight from the target of this (older) record to
+      // the source of the next (newer) one.
+      auto const range_end = bin.rva_to_containing_bb(sample.records[i - 1].from);
+      if (!range_end)
+        continue;
+
+      range.clear();
+      range.push_back(dst);
+
+      while (range.back() != range_end && range.size() <= options.max_range_blocks) {
+        auto const next = get_block_exit(bin, range.back()).fallthrough_target;
+        if (!next)
+          break;
+
+        range.push_back(bin.get_symbol(next)->bb);
+      }
+
+      if (range.back() != range_end) {
+        ++result.broken_ranges;
+        continue;
+      }
+
+      ++result.ranges;
+
+      for (std::size_t j = 0; j < range.size(); ++j) {
+        result.prof.blocks.push_back({ block_rva(range[j]), 0, sample.weight });
+
+        if (j + 1 < range.size()) {
+          result.prof.edges.push_back({ block_rva(range[j]),
+            block_rva(range[j + 1]), sample.weight });
+        }
+      }
+    }
+  }
+
+  normalize_profile(result.prof);
+
+  return result;
+}
+
+} // namespace chum
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "disassembler.h"
+#include "profile.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace chum {
+
+// A single taken branch from a last-branch-record stack.
+struct lbr_record {
+  std::uint32_t from = 0;
+  std::uint32_t to   = 0;
+};
+
+// A single LBR sample: a stack of taken branches, most recent first.
+struct lbr_sample {
+  std::uint64_t weight = 1;
+  std::vector<lbr_record> records = {};
+};
+
+// Read a text file of LBR samples. Each line is a single sample: an
+// optional decimal weight, followed by "from/to" pairs of hex addresses
+// separated by spaces, most recent branch first (the same order that perf
+// uses). If image_base is non-zero, addresses are absolute and are
+// converted to RVAs. Lines starting with '#' are ignored.
+std::vector<lbr_sample> read_lbr_samples(char const* path,
+  std::uint64_t image_base = 0);
+
+struct lbr_import_options {
+  // The maximum number of blocks that can be walked when inferring the
+  // fallthroughs between two consecutive branches. Longer ranges are
+  // assumed to be bogus (such as a missed record) and are thrown away.
+  std::size_t max_range_blocks = 256;
+};
+
+struct lbr_import_result {
+  // The block, edge, and call counts that were inferred from the samples.
+  profile prof = {};
+
+  std::size_t sample_count = 0;
+  std::size_t record_count = 0;
+
+  // Records that matched a branch, or a call to a recovered function.
+  std::size_t branch_records = 0;
+  std::size_t call_records   = 0;
+
+  // Records where either address didn't land in a basic block.
+  std::size_t unmapped_records = 0;
+
+  // The number of fallthrough ranges between consecutive records that were
+  // walked successfully, and the number that didn't follow the CFG.
+  std::size_t ranges        = 0;
+  std::size_t broken_ranges = 0;
+};
+
+// Turn LBR samples into a profile for a binary. Every record becomes a
+// taken edge (or a call count, for calls), and the code that ran between
+// two consecutive records is walked through fallthrough edges to produce
+// block counts and fallthrough edge counts.
+lbr_import_result import_lbr_samples(disassembled_binary const& bin,
+  std::vector<lbr_sample> const& samples, lbr_import_options const& options = {});
+
+} // namespace chum
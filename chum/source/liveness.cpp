@@ -0,0 +1,222 @@
+#include "liveness.h"
+#include "cfg.h"
+
+namespace chum {
+
+// Registers that are used to pass arguments to a called function.
+static constexpr std::uint16_t argument_gprs =
+  (1 << 1) | (1 << 2) | (1 << 8) | (1 << 9);
+
+// Registers that a called function is allowed to clobber.
+static constexpr std::uint16_t volatile_gprs =
+  (1 << 0) | (1 << 1) | (1 << 2) | (1 << 8) | (1 << 9) | (1 << 10) | (1 << 11);
+
+// Registers that must be preserved when a function returns (plus RAX, which
+// holds the return value).
+static constexpr std::uint16_t return_gprs =
+  static_cast<std::uint16_t>(~volatile_gprs | (1 << 0));
+
+// Get the 64-bit GPR for the specified encoding (RAX=0, ..., R15=15).
+ZydisRegister gpr64(std::uint8_t const id) {
+  return ZydisRegisterEncode(ZYDIS_REGCLASS_GPR64, id);
+}
+
+// Get the 32-bit GPR for the specified encoding (EAX=0, ..., R15D=15).
+ZydisRegister gpr32(std::uint8_t const id) {
+  return ZydisRegisterEncode(ZYDIS_REGCLASS_GPR32, id);
+}
+
+// Get the encoding of the GPR that encloses the specified register, or -1
+// if this is not a general-purpose register.
+int gpr_id(ZydisRegister const reg) {
+  auto const enclosing = ZydisRegisterGetLargestEnclosing(
+    ZYDIS_MACHINE_MODE_LONG_64, reg);
+
+  if (ZydisRegisterGetClass(enclosing) != ZYDIS_REGCLASS_GPR64)
+    return -1;
+
+  return ZydisRegisterGetId(enclosing);
+}
+
+// Get the registers that are read and written by a single instruction.
+void instruction_effects(binary const& bin, instruction const& instr,
+    register_set& use, register_set& def) {
+  ZydisDecodedInstruction decoded_instr;
+  ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT];
+
+  // Assume the worst if we can't decode the instruction.
+  if (ZYAN_FAILED(ZydisDecoderDecodeFull(bin.decoder(), instr.bytes,
+      instr.length, &decoded_instr, decoded_ops))) {
+    use = all_registers;
+    def = {};
+    return;
+  }
+
+  for (std::size_t i = 0; i < decoded_instr.operand_count; ++i) {
+    auto const& op = decoded_ops[i];
+
+    if (op.type == ZYDIS_OPERAND_TYPE_MEMORY) {
+      // The base and index registers are always read.
+      if (auto const id = gpr_id(op.mem.base); id >= 0)
+        use.gprs |= 1 << id;
+      if (auto const id = gpr_id(op.mem.index); id >= 0)
+        use.gprs |= 1 << id;
+      continue;
+    }
+
+    if (op.type != ZYDIS_OPERAND_TYPE_REGISTER)
+      continue;
+
+    auto const id = gpr_id(op.reg.value);
+    if (id < 0)
+      continue;
+
+    if (op.actions & ZYDIS_OPERAND_ACTION_MASK_READ)
+      use.gprs |= 1 << id;
+
+    if (op.actions & ZYDIS_OPERAND_ACTION_MASK_WRITE) {
+      // Only unconditional 32-bit and 64-bit writes overwrite the entire
+      // register. Partial writes need to preserve the rest of it.
+      if ((op.actions & ZYDIS_OPERAND_ACTION_WRITE) &&
+          ZydisRegisterGetWidth(ZYDIS_MACHINE_MODE_LONG_64, op.reg.value) >= 32)
+        def.gprs |= 1 << id;
+      else
+        use.gprs |= 1 << id;
+    }
+  }
+
+  if (decoded_instr.cpu_flags) {
+    auto const& flags = *decoded_instr.cpu_flags;
+    use.flags |= flags.tested & status_flags;
+    def.flags |= (flags.modified | flags.set_0 | flags.set_1 |
+      flags.undefined) & status_flags;
+  }
+
+  // The callee reads the argument registers and clobbers every volatile
+  // register, as well as the status flags.
+  if (decoded_instr.meta.category == ZYDIS_CATEGORY_CALL) {
+    use.gprs  |= argument_gprs;
+    def.gprs  |= volatile_gprs;
+    def.flags |= status_flags;
+  }
+}
+
+// Run the analysis on every basic block in the binary. The results are
+// only valid until the binary is modified.
+liveness_analysis::liveness_analysis(binary const& bin)
+    : bin_(bin), live_in_(bin.symbols().size()) {
+  struct block_summary {
+    // Registers that are read before being written in this block.
+    register_set gen;
+
+    // Registers that are written in this block.
+    register_set kill;
+
+    // Every possible successor of this block.
+    std::vector<basic_block*> successors;
+
+    // Whether the block can leave to somewhere that we can't see.
+    bool unknown_exit;
+    bool is_return;
+  };
+
+  auto const& blocks = bin.basic_blocks();
+  std::vector<block_summary> summaries(blocks.size());
+
+  for (std::size_t i = 0; i < blocks.size(); ++i) {
+    auto const bb = blocks[i];
+    auto& summary = summaries[i];
+
+    for (auto const& instr : bb->instructions) {
+      register_set use = {}, def = {};
+      instruction_effects(bin, instr, use, def);
+
+      summary.gen.gprs  |= use.gprs  & ~summary.kill.gprs;
+      summary.gen.flags |= use.flags & ~summary.kill.flags;
+      summary.kill = summary.kill | def;
+    }
+
+    auto const exit = get_block_exit(bin, bb);
+    summary.successors   = get_successors(bin, bb);
+    summary.unknown_exit = exit.is_indirect;
+    summary.is_return    = exit.is_return;
+  }
+
+  // Iterate until we reach a fixed point. Going backwards through the
+  // blocks helps this converge faster, since most blocks are laid out in
+  // their original order.
+  for (bool changed = true; changed;) {
+    changed = false;
+
+    for (std::size_t i = blocks.size(); i > 0; --i) {
+      auto const bb = blocks[i - 1];
+      auto const& summary = summaries[i - 1];
+
+      register_set out = {};
+      if (summary.unknown_exit)
+        out = all_registers;
+      else if (summary.is_return)
+        out.gprs = return_gprs;
+
+      for (auto const succ : summary.successors)
+        out = out | live_in_[succ->sym_id.value];
+
+      register_set const in = {
+        static_cast<std::uint16_t>(summary.gen.gprs |
+          (out.gprs & ~summary.kill.gprs)),
+        summary.gen.flags | (out.flags & ~summary.kill.flags)
+      };
+
+      if (in != live_in_[bb->sym_id.value]) {
+        live_in_[bb->sym_id.value] = in;
+        changed = true;
+      }
+    }
+  }
+}
+
+// Get the registers that are live at the start of a basic block.
+register_set liveness_analysis::live_in(basic_block const* const bb) const {
+  if (bb->sym_id.value >= live_in_.size())
+    return all_registers;
+  return live_in_[bb->sym_id.value];
+}
+
+// Get the registers that are live at the end of a basic block.
+register_set liveness_analysis::live_out(basic_block const* const bb) const {
+  auto const exit = get_block_exit(bin_, bb);
+
+  if (exit.is_indirect)
+    return all_registers;
+
+  register_set out = {};
+  if (exit.is_return)
+    out.gprs = return_gprs;
+
+  for (auto const succ : get_successors(bin_, bb))
+    out = out | live_in(succ);
+
+  return out;
+}
+
+// Get the registers that are live right before the specified instruction.
+register_set liveness_analysis::live_before(
+    basic_block const* const bb, std::size_t const index) const {
+  if (index == 0)
+    return live_in(bb);
+
+  auto live = live_out(bb);
+
+  // Walk backwards from the end of the block.
+  for (auto i = bb->instructions.size(); i > index; --i) {
+    register_set use = {}, def = {};
+    instruction_effects(bin_, bb->instructions[i - 1], use, def);
+
+    live.gprs  = static_cast<std::uint16_t>((live.gprs & ~def.gprs) | use.gprs);
+    live.flags = (live.flags & ~def.flags) | use.flags;
+  }
+
+  return live;
+}
+
+} // namespace chum
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "binary.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace chum {
+
+// A set of general-purpose registers and status flags.
+struct register_set {
+  // Bit N is set if the 64-bit GPR with encoding N (RAX=0, ..., R15=15)
+  // is a part of this set.
+  std::uint16_t gprs = 0;
+
+  // A mask of ZYDIS_CPUFLAG_* values.
+  std::uint32_t flags = 0;
+
+  bool operator==(register_set const& other) const {
+    return gprs == other.gprs && flags == other.flags;
+  }
+  bool operator!=(register_set const& other) const { return !(*this == other); }
+
+  register_set operator|(register_set const& other) const {
+    return { static_cast<std::uint16_t>(gprs | other.gprs), flags | other.flags };
+  }
+};
+
+// The status flags that are tracked by the liveness analysis.
+inline constexpr std::uint32_t status_flags = ZYDIS_CPUFLAG_CF |
+  ZYDIS_CPUFLAG_PF | ZYDIS_CPUFLAG_AF | ZYDIS_CPUFLAG_ZF |
+  ZYDIS_CPUFLAG_SF | ZYDIS_CPUFLAG_OF;
+
+// Every register and status flag.
+inline constexpr register_set all_registers = { 0xFFFF, status_flags };
+
+// Get the 64-bit GPR for the specified encoding (RAX=0, ..., R15=15).
+ZydisRegister gpr64(std::uint8_t id);
+
+// Get the 32-bit GPR for the specified encoding (EAX=0, ..., R15D=15).
+ZydisRegister gpr32(std::uint8_t id);
+
+// Get the encoding of the GPR that encloses the specified register, or -1
+// if this is not a general-purpose register.
+int gpr_id(ZydisRegister reg);
+
+// Get the registers that are read and written by a single instruction.
+// Registers that are only partially written count as being read.
+void instruction_effects(binary const& bin, instruction const& instr,
+  register_set& use, register_set& def);
+
+// This is a backwards dataflow analysis that calculates which registers
+// and status flags might be read before they are written. Calls are assumed
+// to follow the Windows x64 calling convention.
+class liveness_analysis {
+public:
+  // Run the analysis on every basic block in the binary. The results are
+  // only valid until the binary is modified.
+  explicit liveness_analysis(binary const& bin);
+
+  // Get the registers that are live at the start of a basic block.
+  register_set live_in(basic_block const* bb) const;
+
+  // Get the registers that are live at the end of a basic block.
+  register_set live_out(basic_block const* bb) const;
+
+  // Get the registers that are live right before the specified instruction.
+  register_set live_before(basic_block const* bb, std::size_t index) const;
+
+private:
+  // This is the binary that was analyzed.
+  binary const& bin_;
+
+  // The registers that are live at the start of every basic block, indexed
+  // by symbol ID.
+  std::vector<register_set> live_in_ = {};
+};
+
+} // namespace chum
@@ -0,0 +1,210 @@
+#include "loops.h"
+#include "cfg.h"
+
+#include <algorithm>
+
+namespace chum {
+
+// Run the analysis on every basic block in the binary.
+loop_analysis::loop_analysis(binary const& bin) {
+  auto const& blocks = bin.basic_blocks();
+  auto const count = blocks.size();
+  auto const root = root_ = count;
+
+  sym_to_index_.assign(bin.symbols().size(), root);
+  for (std::size_t i = 0; i < count; ++i)
+    sym_to_index_[blocks[i]->sym_id.value] = i;
+
+  // Build the successor and predecessor lists by index.
+  std::vector<std::vector<std::size_t>> succs(count + 1), preds(count + 1);
+  for (std::size_t i = 0; i < count; ++i) {
+    for (auto const succ : get_successors(bin, blocks[i])) {
+      succs[i].push_back(index(succ));
+      preds[index(succ)].push_back(i);
+    }
+  }
+
+  // Compute a reverse post-order, starting with the blocks that have no
+  // predecessors. Anything that is still unreachable afterwards (such as a
+  // function whose entry is also a loop header) becomes a root as well.
+  std::vector<std::size_t> post_order = {};
+  std::vector<bool> visited(count + 1, false);
+  visited[root] = true;
+
+  auto const visit_root = [&](std::size_t const start) {
+    succs[root].push_back(start);
+    preds[start].push_back(root);
+
+    // Iterative DFS: (node, next successor to visit).
+    std::vector<std::pair<std::size_t, std::size_t>> stack = { { start, 0 } };
+    visited[start] = true;
+
+    while (!stack.empty()) {
+      auto& [node, next] = stack.back();
+
+      if (next < succs[node].size()) {
+        auto const succ = succs[node][next++];
+        if (!visited[succ]) {
+          visited[succ] = true;
+          stack.push_back({ succ, 0 });
+        }
+        continue;
+      }
+
+      post_order.push_back(node);
+      stack.pop_back();
+    }
+  };
+
+  for (std::size_t i = 0; i < count; ++i) {
+    if (preds[i].empty())
+      visit_root(i);
+  }
+
+  for (std::size_t i = 0; i < count; ++i) {
+    if (!visited[i])
+      visit_root(i);
+  }
+
+  post_order.push_back(root);
+
+  rpo_number_.assign(count + 1, 0);
+  for (std::size_t i = 0; i < post_order.size(); ++i)
+    rpo_number_[post_order[i]] = post_order.size() - 1 - i;
+
+  // Cooper, Harvey, and Kennedy's "A Simple, Fast Dominance Algorithm".
+  idom_.assign(count + 1, count + 1);
+  idom_[root] = root;
+
+  auto const intersect = [&](std::size_t a, std::size_t b) {
+    while (a != b) {
+      while (rpo_number_[a] > rpo_number_[b])
+        a = idom_[a];
+      while (rpo_number_[b] > rpo_number_[a])
+        b = idom_[b];
+    }
+    return a;
+  };
+
+  for (bool changed = true; changed;) {
+    changed = false;
+
+    // Walk the nodes in reverse post-order, skipping the root.
+    for (auto it = post_order.rbegin() + 1; it != post_order.rend(); ++it) {
+      auto const node = *it;
+      auto new_idom = count + 1;
+
+      for (auto const pred : preds[node]) {
+        if (idom_[pred] == count + 1)
+          continue;
+
+        new_idom = (new_idom == count + 1) ? pred : intersect(pred, new_idom);
+      }
+
+      if (idom_[node] != new_idom) {
+        idom_[node] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  // Find every back-edge (an edge whose target dominates its source).
+  std::vector<std::vector<std::size_t>> latches(count);
+  for (std::size_t latch = 0; latch < count; ++latch) {
+    for (auto const header : succs[latch]) {
+      if (dominates(blocks[header], blocks[latch]))
+        latches[header].push_back(latch);
+    }
+  }
+
+  // The loop that a block was most recently added to.
+  std::vector<std::size_t> loop_mark(count, count);
+
+  // Collect the blocks of every natural loop by walking backwards from each
+  // latch until we reach the header.
+  for (std::size_t header = 0; header < count; ++header) {
+    if (latches[header].empty())
+      continue;
+
+    auto const loop_idx = loops_.size();
+    auto& loop = loops_.emplace_back();
+    loop.header = blocks[header];
+
+    for (auto const latch : latches[header])
+      loop.latches.push_back(blocks[latch]);
+
+    loop.blocks.push_back(blocks[header]);
+    loop_mark[header] = loop_idx;
+
+    auto stack = latches[header];
+    while (!stack.empty()) {
+      auto const node = stack.back();
+      stack.pop_back();
+
+      if (loop_mark[node] == loop_idx)
+        continue;
+
+      loop_mark[node] = loop_idx;
+      loop.blocks.push_back(blocks[node]);
+
+      for (auto const pred : preds[node]) {
+        if (pred != root)
+          stack.push_back(pred);
+      }
+    }
+  }
+
+  // Sort the loops from outermost to innermost so that the innermost loop
+  // of every block is the last one that contains it.
+  std::sort(begin(loops_), end(loops_), [](auto const& left, auto const& right) {
+    return left.blocks.size() > right.blocks.size();
+  });
+
+  innermost_.assign(count, -1);
+  for (std::size_t i = 0; i < loops_.size(); ++i) {
+    for (auto const bb : loops_[i].blocks) {
+      auto& innermost = innermost_[index(bb)];
+
+      if (innermost >= 0)
+        loops_[i].depth = (std::max)(loops_[i].depth, loops_[innermost].depth + 1);
+
+      innermost = i;
+    }
+  }
+}
+
+// Get every natural loop. Loops with the same header are merged.
+std::vector<natural_loop> const& loop_analysis::loops() const {
+  return loops_;
+}
+
+// Get the innermost loop that contains the specified block, if any.
+natural_loop const* loop_analysis::innermost_loop(basic_block const* const bb) const {
+  auto const idx = index(bb);
+  if (idx >= root_ || innermost_[idx] < 0)
+    return nullptr;
+  return &loops_[innermost_[idx]];
+}
+
+// Returns true if the first block dominates the second block.
+bool loop_analysis::dominates(basic_block const* const a,
+    basic_block const* const b) const {
+  auto const a_idx = index(a);
+
+  // Walk up the dominator tree, starting at the second block.
+  for (auto node = index(b); node < root_; node = idom_[node]) {
+    if (node == a_idx)
+      return true;
+  }
+
+  return false;
+}
+
+// Map a basic block to its index in the analysis.
+std::size_t loop_analysis::index(basic_block const* const bb) const {
+  if (bb->sym_id.value >= sym_to_index_.size())
+    return root_;
+  return sym_to_index_[bb->sym_id.value];
+}
+
+} // namespace chum
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "binary.h"
+
+#include <vector>
+
+namespace chum {
+
+// A natural loop is a set of basic blocks with a single entry point (the
+// header), which dominates every block in the loop.
+struct natural_loop {
+  // The entry point of this loop.
+  basic_block* header = nullptr;
+
+  // Every block in this loop, including the header.
+  std::vector<basic_block*> blocks = {};
+
+  // The blocks that have a back-edge to the header.
+  std::vector<basic_block*> latches = {};
+
+  // The number of loops that this loop is nested inside of.
+  std::size_t depth = 0;
+};
+
+// This computes the dominator tree and the natural loops of a binary. Since
+// calls are not considered to be edges, every block without a predecessor
+// (as well as every block that can't be reached from one) is treated as a
+// root of the CFG.
+class loop_analysis {
+public:
+  // Run the analysis on every basic block in the binary. The results are
+  // only valid until the CFG is modified.
+  explicit loop_analysis(binary const& bin);
+
+  // Get every natural loop. Loops with the same header are merged.
+  std::vector<natural_loop> const& loops() const;
+
+  // Get the innermost loop that contains the specified block, if any.
+  natural_loop const* innermost_loop(basic_block const* bb) const;
+
+  // Returns true if the first block dominates the second block.
+  bool dominates(basic_block const* a, basic_block const* b) const;
+
+private:
+  // Map a basic block to its index in the analysis.
+  std::size_t index(basic_block const* bb) const;
+
+private:
+  // The index of the virtual root (which is also the number of blocks).
+  std::size_t root_ = 0;
+
+  // The index of every block, indexed by symbol ID.
+  std::vector<std::size_t> sym_to_index_ = {};
+
+  // The immediate dominator of every block (by index). The virtual root has
+  // an index equal to the number of blocks.
+  std::vector<std::size_t> idom_ = {};
+
+  // The reverse post-order number of every block (by index).
+  std::vector<std::size_t> rpo_number_ = {};
+
+  // Every natural loop.
+  std::vector<natural_loop> loops_ = {};
+
+  // The innermost loop of every block (by index), or -1.
+  std::vector<std::ptrdiff_t> innermost_ = {};
+};
+
+} // namespace chum
@@ -1,6 +1,11 @@
 #include "chum.h"
+#include "util.h"
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
 #include <random>
 
 // Insert a NOP before every instruction.
@@ -74,6 +79,675 @@ int main(int const argc, char const* const* argv) {
     return 0;
   }
 
+  // Turn a dumped latency trace buffer into per-function histograms.
+  if (std::strcmp(argv[1], "--decode-latency") == 0) {
+    if (argc < 3) {
+      std::printf("Usage: chum --decode-latency <dump>\n");
+      return 0;
+    }
+
+    auto const dump = chum::parse_trace_dump(chum::read_file_to_buffer(argv[2]));
+    if (!dump || dump->kind != chum::trace_kind::timestamp) {
+      std::printf("Invalid latency dump.\n");
+      return 0;
+    }
+
+    chum::print_latency_histograms(chum::decode_latency_dump(*dump));
+    return 0;
+  }
+
+  // Replay a dumped memory trace buffer through a simulated cache.
+  if (std::strcmp(argv[1], "--simulate-cache") == 0) {
+    chum::cache_config config = {};
+    char const* misses_path = nullptr;
+
+    int i = 2;
+    for (; i + 1 < argc; ++i) {
+      if (std::strcmp(argv[i], "--size") == 0)
+        config.size = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+      else if (std::strcmp(argv[i], "--line") == 0)
+        config.line_size = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+      else if (std::strcmp(argv[i], "--ways") == 0)
+        config.associativity = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+      else if (std::strcmp(argv[i], "--misses") == 0)
+        misses_path = argv[++i];
+      else if (std::strcmp(argv[i], "--shared") == 0)
+        config.per_thread = false;
+      else
+        break;
+    }
+
+    if (i >= argc) {
+      std::printf("Usage: chum --simulate-cache [--size <bytes>] [--line <bytes>] "
+        "[--ways <count>] [--shared] [--misses <output>] <dump>\n");
+      return 0;
+    }
+
+    auto const dump = chum::parse_trace_dump(chum::read_file_to_buffer(argv[i]));
+    if (!dump) {
+      std::printf("Invalid memory trace dump.\n");
+      return 0;
+    }
+
+    auto const result = chum::simulate_cache(*dump, config);
+    if (!result) {
+      std::printf("Not a memory trace dump, or invalid cache geometry.\n");
+      return 0;
+    }
+
+    chum::print_cache_sim_result(*result);
+
+    // The misses can be fed straight into insert_prefetches().
+    if (misses_path) {
+      auto const file = std::fopen(misses_path, "w");
+      if (!file) {
+        std::printf("Failed to write misses.\n");
+        return 0;
+      }
+
+      for (auto const& s : result->instructions) {
+        if (s.load_misses + s.store_misses) {
+          std::fprintf(file, "0x%X,%llu\n", s.rva,
+            static_cast<unsigned long long>(s.load_misses + s.store_misses));
+        }
+      }
+
+      std::fclose(file);
+    }
+
+    return 0;
+  }
+
+  // Combine many profiles (of the same image) into one.
+  if (std::strcmp(argv[1], "--merge-profiles") == 0) {
+    if (argc < 4) {
+      std::printf("Usage: chum --merge-profiles <output> <profile>...\n");
+      return 0;
+    }
+
+    chum::profile merged = {};
+
+    for (int i = 3; i < argc; ++i) {
+      auto const prof = chum::read_profile(argv[i]);
+      if (!prof) {
+        std::printf("Invalid profile: %s.\n", argv[i]);
+        return 0;
+      }
+
+      if (!chum::merge_profile(merged, *prof)) {
+        std::printf("Profile is for a different image: %s.\n", argv[i]);
+        return 0;
+      }
+    }
+
+    if (!chum::write_profile(argv[2], merged))
+      std::printf("Failed to write profile.\n");
+
+    return 0;
+  }
+
+  // Convert text block/edge/call counts into a profile for an image.
+  if (std::strcmp(argv[1], "--import-profile") == 0) {
+    if (argc < 5) {
+      std::printf("Usage: chum --import-profile <image> <output> "
+        "<blocks.txt> [edges.txt] [calls.txt]\n");
+      return 0;
+    }
+
+    auto const image = chum::read_file_to_buffer(argv[2]);
+    if (image.empty()) {
+      std::printf("Failed to read image.\n");
+      return 0;
+    }
+
+    auto const prof = chum::import_profile(
+      chum::fnv1a_64(image.data(), image.size()),
+      chum::read_rva_counts(argv[4]),
+      argc > 5 ? chum::read_rva_edge_counts(argv[5]) : std::vector<chum::rva_edge_count>{},
+      argc > 6 ? chum::read_rva_edge_counts(argv[6]) : std::vector<chum::rva_edge_count>{});
+
+    if (!chum::write_profile(argv[3], prof))
+      std::printf("Failed to write profile.\n");
+
+    return 0;
+  }
+
+  // Turn LBR samples into a profile.
+  if (std::strcmp(argv[1], "--import-lbr") == 0) {
+    std::uint64_t image_base = 0;
+
+    int i = 2;
+    if (i + 1 < argc && std::strcmp(argv[i], "--image-base") == 0) {
+      image_base = std::strtoull(argv[i + 1], nullptr, 16);
+      i += 2;
+    }
+
+    if (argc - i < 3) {
+      std::printf("Usage: chum --import-lbr [--image-base <hex>] <image> <output> <samples.txt>\n");
+      return 0;
+    }
+
+    auto const image_bin = chum::disassemble(argv[i]);
+    if (!image_bin) {
+      std::printf("Failed to disassemble binary.\n");
+      return 0;
+    }
+
+    auto const result = chum::import_lbr_samples(*image_bin,
+      chum::read_lbr_samples(argv[i + 2], image_base));
+
+    std::printf("[+] %zu sample(s), %zu record(s).\n",
+      result.sample_count, result.record_count);
+    std::printf("[+] %zu branch(es), %zu call(s), %zu unmapped record(s).\n",
+      result.branch_records, result.call_records, result.unmapped_records);
+    std::printf("[+] %zu fallthrough range(s), %zu broken range(s).\n",
+      result.ranges, result.broken_ranges);
+
+    if (!chum::write_profile(argv[i + 1], result.prof))
+      std::printf("Failed to write profile.\n");
+
+    return 0;
+  }
+
+  // Unroll hot single-block loops, and report every loop that was looked at.
+  if (std::strcmp(argv[1], "--unroll") == 0) {
+    if (argc < 5) {
+      std::printf("Usage: chum --unroll <image> <output> <profile> [factor]\n");
+      return 0;
+    }
+
+    auto image_bin = chum::disassemble(argv[2]);
+    if (!image_bin) {
+      std::printf("Failed to disassemble binary.\n");
+      return 0;
+    }
+
+    auto const prof = chum::read_profile(argv[4]);
+    if (!prof || !chum::attach_profile(*image_bin, *prof)) {
+      std::printf("Invalid profile.\n");
+      return 0;
+    }
+
+    chum::unroll_options options = {};
+    if (argc > 5)
+      options.factor = static_cast<std::uint32_t>(std::strtoul(argv[5], nullptr, 10));
+
+    chum::print_unroll_result(chum::unroll_loops(*image_bin, options));
+
+    if (!image_bin->create(argv[3]))
+      std::printf("Failed to create binary.\n");
+
+    return 0;
+  }
+
+  // Insert software prefetches ahead of strided loads from a miss profile.
+  if (std::strcmp(argv[1], "--prefetch") == 0) {
+    if (argc < 5) {
+      std::printf("Usage: chum --prefetch <image> <output> <misses.txt> "
+        "[--profile <profile>] [--distance <iterations>] [--min-misses <count>]\n");
+      return 0;
+    }
+
+    auto image_bin = chum::disassemble(argv[2]);
+    if (!image_bin) {
+      std::printf("Failed to disassemble binary.\n");
+      return 0;
+    }
+
+    chum::prefetch_options options = {};
+
+    for (int i = 5; i + 1 < argc; i += 2) {
+      if (std::strcmp(argv[i], "--profile") == 0) {
+        // Block and edge counts let the distance be capped by the trip count.
+        auto const prof = chum::read_profile(argv[i + 1]);
+        if (!prof || !chum::attach_profile(*image_bin, *prof)) {
+          std::printf("Invalid profile.\n");
+          return 0;
+        }
+      } else if (std::strcmp(argv[i], "--distance") == 0)
+        options.distance = static_cast<std::uint32_t>(std::strtoul(argv[i + 1], nullptr, 10));
+      else if (std::strcmp(argv[i], "--min-misses") == 0)
+        options.min_misses = std::strtoull(argv[i + 1], nullptr, 10);
+    }
+
+    chum::print_prefetch_sites(chum::insert_prefetches(*image_bin,
+      chum::read_rva_counts(argv[4]), options));
+
+    if (!image_bin->create(argv[3]))
+      std::printf("Failed to create binary.\n");
+
+    return 0;
+  }
+
+  // Replace instructions that are slow on a specific microarchitecture.
+  if (std::strcmp(argv[1], "--rewrite-uarch") == 0) {
+    if (argc < 5) {
+      std::printf("Usage: chum --rewrite-uarch <image> <output> <uarch> [--relax-atomics]\n");
+      return 0;
+    }
+
+    auto const uarch = chum::find_uarch(argv[4]);
+    if (!uarch) {
+      std::printf("Unknown microarchitecture. Known:");
+      for (auto const& info : chum::uarch_table)
+        std::printf(" %s", info.name);
+      std::printf("\n");
+      return 0;
+    }
+
+    auto image_bin = chum::disassemble(argv[2]);
+    if (!image_bin) {
+      std::printf("Failed to disassemble binary.\n");
+      return 0;
+    }
+
+    chum::uarch_rewrite_options options = {};
+    options.relax_atomics = argc > 5 && std::strcmp(argv[5], "--relax-atomics") == 0;
+
+    auto const result = chum::rewrite_for_uarch(*image_bin, *uarch, options);
+    std::printf("[+] Rewrote %zu INC/DEC, %zu LEA, %zu XCHG, and %zu NOP instruction(s).\n",
+      result.inc_dec, result.lea3, result.xchg_mem, result.long_nop);
+
+    if (!image_bin->create(argv[3]))
+      std::printf("Failed to create binary.\n");
+
+    return 0;
+  }
+
+  // Move hot globals into new data blocks, based on a memory access profile.
+  if (std::strcmp(argv[1], "--data-layout") == 0) {
+    if (argc < 5) {
+      std::printf("Usage: chum --data-layout <image> <output> <accesses.txt>\n");
+      return 0;
+    }
+
+    auto image_bin = chum::disassemble(argv[2]);
+    if (!image_bin) {
+      std::printf("Failed to disassemble binary.\n");
+      return 0;
+    }
+
+    chum::print_data_layout_result(chum::apply_data_layout(*image_bin,
+      chum::read_data_access_counts(argv[4])));
+
+    if (!image_bin->create(argv[3]))
+      std::printf("Failed to create binary.\n");
+
+    return 0;
+  }
+
+  // Run disassemble() -> create() -> disassemble() on a corpus of images.
+  if (std::strcmp(argv[1], "--roundtrip") == 0) {
+    if (argc < 3) {
+      std::printf("Usage: chum --roundtrip [--synthetic <count>] <image or directory>...\n");
+      return 0;
+    }
+
+    std::size_t failures = 0;
+
+    auto const run = [&](char const* const name, std::vector<std::uint8_t> const& image) {
+      auto const result = chum::run_roundtrip(image);
+      chum::print_roundtrip_result(name, result);
+
+      if (!result.completed || !result.mismatches.empty())
+        ++failures;
+    };
+
+    for (int i = 2; i < argc; ++i) {
+      if (std::strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc) {
+        auto const count = std::strtoul(argv[++i], nullptr, 10);
+
+        for (std::uint32_t seed = 0; seed < count; ++seed) {
+          char name[64] = {};
+          std::snprintf(name, sizeof(name), "<synthetic %u>", seed);
+          run(name, chum::create_synthetic_pe(seed, 16 + seed % 256));
+        }
+
+        continue;
+      }
+
+      if (!std::filesystem::is_directory(argv[i])) {
+        run(argv[i], chum::read_file_to_buffer(argv[i]));
+        continue;
+      }
+
+      for (auto const& entry : std::filesystem::directory_iterator(argv[i])) {
+        auto const extension = entry.path().extension().string();
+        if (!entry.is_regular_file() || (extension != ".exe" && extension != ".dll"))
+          continue;
+
+        run(entry.path().string().c_str(), chum::read_file_to_buffer(
+          entry.path().string().c_str()));
+      }
+    }
+
+    std::printf("[+] %zu round trip(s) failed.\n", failures);
+    return failures ? 1 : 0;
+  }
+
+  // Export a corpus of images into a set of columnar tables.
+  if (std::strcmp(argv[1], "--export-ir") == 0) {
+    // Large corpora can keep every binary in a disk-backed storage file, so
+    // that a batch run fits in a fixed amount of memory.
+    std::size_t storage_budget = 0;
+
+    int first = 2;
+    if (first + 1 < argc && std::strcmp(argv[first], "--storage-mb") == 0) {
+      storage_budget = std::strtoull(argv[first + 1], nullptr, 10) << 20;
+      first += 2;
+    }
+
+    if (argc < first + 2) {
+      std::printf("Usage: chum --export-ir [--storage-mb <resident size>] "
+        "<output directory> <image or directory>...\n");
+      return 0;
+    }
+
+    std::unique_ptr<chum::mapped_file_resource> storage = nullptr;
+    if (storage_budget) {
+      storage = std::make_unique<chum::mapped_file_resource>(storage_budget);
+      if (!storage->valid()) {
+        std::printf("[!] Failed to create the storage file.\n");
+        return 0;
+      }
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(argv[first], ec);
+
+    chum::ir_exporter exporter(argv[first]);
+    if (!exporter.valid()) {
+      std::printf("[!] Failed to create the tables in %s.\n", argv[first]);
+      return 0;
+    }
+
+    std::size_t failures = 0;
+
+    chum::disassemble_options options = {};
+    options.storage = storage.get();
+
+    // Only a single binary is alive at a time.
+    auto const run = [&](std::string const& path) {
+      auto const bin = chum::disassemble(path.c_str(), options);
+      if (!bin) {
+        std::printf("[!] Failed to disassemble %s.\n", path.c_str());
+        ++failures;
+        return;
+      }
+
+      auto const id = exporter.add(*bin, path.c_str());
+      std::printf("[+] Exported %s as binary %u (%zu blocks).\n",
+        path.c_str(), id, bin->basic_blocks().size());
+    };
+
+    for (int i = first + 1; i < argc; ++i) {
+      if (!std::filesystem::is_directory(argv[i])) {
+        run(argv[i]);
+        continue;
+      }
+
+      for (auto const& entry : std::filesystem::directory_iterator(argv[i])) {
+        auto const extension = entry.path().extension().string();
+        if (!entry.is_regular_file() || (extension != ".exe" && extension != ".dll"))
+          continue;
+
+        run(entry.path().string());
+      }
+    }
+
+    if (!exporter.finish()) {
+      std::printf("[!] Failed to write the tables.\n");
+      return 1;
+    }
+
+    std::printf("[+] Wrote %llu symbols, %llu blocks, %llu instructions, and %llu edges.\n",
+      static_cast<unsigned long long>(exporter.symbol_count()),
+      static_cast<unsigned long long>(exporter.block_count()),
+      static_cast<unsigned long long>(exporter.instruction_count()),
+      static_cast<unsigned long long>(exporter.edge_count()));
+    std::printf("[+] %zu image(s) failed.\n", failures);
+
+    if (storage) {
+      std::printf("[+] Storage file: %zu MB mapped, %zu trim(s).\n",
+        storage->mapped() >> 20, storage->trim_count());
+    }
+
+    return failures ? 1 : 0;
+  }
+
+  // Measure how disassembly, passes, and emission scale with thread count.
+  if (std::strcmp(argv[1], "--thread-sweep") == 0) {
+    chum::thread_sweep_options options = {};
+    std::vector<std::vector<std::uint8_t>> images = {};
+
+    for (int i = 2; i < argc; ++i) {
+      // A comma-separated list of thread counts.
+      if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+        options.thread_counts.clear();
+        for (char const* str = argv[++i]; *str;) {
+          char* end = nullptr;
+          auto const count = std::strtoul(str, &end, 10);
+          if (end == str)
+            break;
+
+          options.thread_counts.push_back(count);
+          str = (*end == ',') ? end + 1 : end;
+        }
+        continue;
+      }
+
+      if (std::strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+        options.jobs_per_image = std::strtoul(argv[++i], nullptr, 10);
+        continue;
+      }
+
+      if (auto image = chum::read_file_to_buffer(argv[i]); !image.empty())
+        images.push_back(std::move(image));
+      else
+        std::printf("Failed to read %s.\n", argv[i]);
+    }
+
+    if (images.empty()) {
+      std::printf("Usage: chum --thread-sweep [--threads 1,2,4,...] "
+        "[--jobs <per image>] <image>...\n");
+      return 0;
+    }
+
+    chum::print_thread_sweep(chum::run_thread_sweep(images, options));
+    return 0;
+  }
+
+  // Add every function in a set of images to a signature database.
+  if (std::strcmp(argv[1], "--build-signatures") == 0) {
+    if (argc < 4) {
+      std::printf("Usage: chum --build-signatures <database> "
+        "[--cold] [--no-instrument] <image>...\n");
+      return 0;
+    }
+
+    // Keep adding to an existing database.
+    auto db = chum::read_signature_database(argv[2]).value_or(
+      chum::signature_database{});
+
+    std::uint32_t flags = 0;
+
+    for (int i = 3; i < argc; ++i) {
+      if (std::strcmp(argv[i], "--cold") == 0) {
+        flags |= chum::signature_flag_cold;
+        continue;
+      }
+
+      if (std::strcmp(argv[i], "--no-instrument") == 0) {
+        flags |= chum::signature_flag_no_instrument;
+        continue;
+      }
+
+      auto const image = chum::read_file_to_buffer(argv[i]);
+      auto const image_bin = chum::disassemble(image);
+      if (!image_bin) {
+        std::printf("Failed to disassemble %s.\n", argv[i]);
+        continue;
+      }
+
+      std::printf("[+] %s: added %zu signature(s).\n", argv[i],
+        db.add_binary(*image_bin, image, flags));
+    }
+
+    if (!chum::write_signature_database(argv[2], db))
+      std::printf("Failed to write signature database.\n");
+
+    return 0;
+  }
+
+  // Disassemble an image with a signature database and list the matches.
+  if (std::strcmp(argv[1], "--match-signatures") == 0) {
+    if (argc < 4) {
+      std::printf("Usage: chum --match-signatures <database> <image>\n");
+      return 0;
+    }
+
+    auto const db = chum::read_signature_database(argv[2]);
+    if (!db) {
+      std::printf("Invalid signature database.\n");
+      return 0;
+    }
+
+    chum::disassemble_options options = {};
+    options.signatures = &*db;
+
+    auto const image_bin = chum::disassemble(argv[3], options);
+    if (!image_bin) {
+      std::printf("Failed to disassemble binary.\n");
+      return 0;
+    }
+
+    std::printf("[+] Matched %zu of %zu function(s):\n",
+      image_bin->signature_matches().size(), image_bin->functions().size());
+
+    for (auto const& match : image_bin->signature_matches()) {
+      std::printf("[+]   0x%-8X %s\n", image_bin->symbol_to_rva(match.function),
+        image_bin->get_symbol(match.function)->name.c_str());
+    }
+
+    return 0;
+  }
+
+  // This is spawned by --sharded, and writes its result to stdout. The
+  // arguments are: <discover|build> <image> <index> <shard count>
+  // <include functions (0 or 1)> [roots file].
+  if (std::strcmp(argv[1], "--shard-worker") == 0) {
+    if (argc < 7)
+      return 1;
+
+    auto const task = std::strcmp(argv[2], "build") == 0 ?
+      chum::shard_task::build : chum::shard_task::discover;
+
+    return chum::run_shard_worker(task, argv[3], std::strtoul(argv[4], nullptr, 10),
+      std::strtoul(argv[5], nullptr, 10), std::strcmp(argv[6], "1") == 0,
+      argc > 7 ? argv[7] : nullptr);
+  }
+
+  if (std::strcmp(argv[1], "--sharded") == 0) {
+    chum::sharded_options options = {};
+    options.worker_path = argv[0];
+
+    std::size_t storage_budget = 0;
+
+    int i = 2;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+      if (std::strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+        options.shard_count = std::strtoul(argv[++i], nullptr, 10);
+      else if (std::strcmp(argv[i], "--in-process") == 0)
+        options.worker_path.clear();
+      else if (std::strcmp(argv[i], "--storage-mb") == 0 && i + 1 < argc)
+        storage_budget = std::strtoull(argv[++i], nullptr, 10) << 20;
+    }
+
+    if (i >= argc || options.shard_count == 0) {
+      std::printf("Usage: chum --sharded [--shards <count>] [--in-process] "
+        "[--storage-mb <resident size>] <image>\n");
+      return 0;
+    }
+
+    // The merged binary is built in this process, so this is what keeps it
+    // from being limited by this process's memory.
+    std::unique_ptr<chum::mapped_file_resource> storage = nullptr;
+    if (storage_budget) {
+      storage = std::make_unique<chum::mapped_file_resource>(storage_budget);
+      if (!storage->valid()) {
+        std::printf("[!] Failed to create the storage file.\n");
+        return 0;
+      }
+
+      options.storage = storage.get();
+    }
+
+    chum::sharded_stats stats = {};
+    auto const image_bin = chum::disassemble_sharded(argv[i], options, &stats);
+    if (!image_bin) {
+      std::printf("Failed to disassemble binary.\n");
+      return 0;
+    }
+
+    std::printf("[+] Merged %zu block(s) from %zu shard(s) in %zu round(s).\n",
+      stats.block_count, stats.shard_count, stats.rounds);
+    std::printf("[+] Routed %zu cross-shard target(s).\n", stats.routed_targets);
+    std::printf("[+] %zu basic block(s), %zu function(s).\n",
+      image_bin->basic_blocks().size(), image_bin->functions().size());
+
+    return 0;
+  }
+
+  if (std::strcmp(argv[1], "--daemon") == 0) {
+    chum::daemon_options options = {};
+
+    int i = 2;
+    for (; i < argc && argv[i][0] == '-'; ++i) {
+      if (std::strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc)
+        options.cache_budget = std::strtoull(argv[++i], nullptr, 10) << 20;
+      else if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+        options.worker_count = std::strtoul(argv[++i], nullptr, 10);
+      else if (std::strcmp(argv[i], "--spill-mb") == 0 && i + 1 < argc)
+        options.spill_budget = std::strtoull(argv[++i], nullptr, 10) << 20;
+    }
+
+    if (i >= argc) {
+      std::printf("Usage: chum --daemon [--cache-mb <size>] [--workers <count>] "
+        "[--spill-mb <resident size>] <socket>\n");
+      return 0;
+    }
+
+    options.socket_path = argv[i];
+    return chum::run_daemon(options) ? 0 : 1;
+  }
+
+  // Every argument after the socket is a "key=value" request line, or a
+  // single word such as "shutdown" or "stats".
+  if (std::strcmp(argv[1], "--daemon-request") == 0) {
+    if (argc < 4) {
+      std::printf("Usage: chum --daemon-request <socket> <key=value>...\n");
+      return 0;
+    }
+
+    std::string request = "";
+    for (int i = 3; i < argc; ++i) {
+      std::string line = argv[i];
+      if (auto const separator = line.find('='); separator != std::string::npos)
+        line[separator] = ' ';
+
+      request += line + "\n";
+    }
+
+    auto const response = chum::send_daemon_request(argv[2], request);
+    if (!response) {
+      std::printf("Failed to connect to the daemon.\n");
+      return 1;
+    }
+
+    std::printf("%s", response->c_str());
+    return response->rfind("ok", 0) == 0 ? 0 : 1;
+  }
+
   auto bin = chum::disassemble(argv[1]);
   if (!bin) {
     std::printf("Failed to disassemble binary.\n");
@@ -82,12 +756,25 @@ int main(int const argc, char const* const* argv) {
 
   // insert_nops(*bin);
   // instrument(*bin);
+  // chum::instrument_edge_coverage(*bin);
+  // chum::instrument_function_latency(*bin);
   shuffle_blocks(*bin);
   // transform(*bin);
 
-  for (auto const b : bin->create())
+  chum::layout_report report = {};
+  report.original_code_size = bin->original_code_size();
+  report.original_data_size = bin->original_data_size();
+
+  chum::create_options options = {};
+  options.report = &report;
+
+  for (auto const b : bin->create(options))
     std::printf("%.2X", b);
 
+  // The layout report goes to stderr so that it doesn't get mixed up with
+  // the output binary.
+  std::fprintf(stderr, "%s\n", chum::serialize_layout_report(report).c_str());
+
   return 0;
 }
 
@@ -0,0 +1,147 @@
+#include "memory_trace.h"
+#include "liveness.h"
+#include "encoder.h"
+
+#include <algorithm>
+
+namespace chum {
+
+// Generate a probe that writes the effective address of a memory operand
+// to the trace buffer.
+static std::vector<instruction> create_memory_probe(binary const& bin,
+    trace_buffer const& buffer, std::uint32_t const id,
+    ZydisDecodedOperand const& mem, register_set const live) {
+  std::vector<instruction> probe = {};
+  auto const pushed = emit_probe_save(bin, live, probe);
+
+  // RSP has moved down by every register that was pushed.
+  auto displacement = mem.mem.disp.value;
+  if (gpr_id(mem.mem.base) == 4)
+    displacement += pushed;
+
+  // LEA RDX, [mem]
+  probe.push_back(bin.instr(enc_req(ZYDIS_MNEMONIC_LEA, { enc_reg(ZYDIS_REGISTER_RDX),
+    enc_mem(8, mem.mem.base, mem.mem.index, mem.mem.scale, displacement) })));
+
+  emit_trace_record(bin, buffer, id, probe);
+  emit_probe_restore(bin, live, probe);
+
+  return probe;
+}
+
+// Check whether a block still has the instructions that it was disassembled
+// with (nothing was inserted, removed, or re-encoded to a different size),
+// by mapping the RVA of every instruction back through the original RVA
+// map.
+static bool has_original_layout(disassembled_binary const& bin,
+    basic_block const* const bb, std::uint32_t rva) {
+  for (std::size_t i = 0; i < bb->instructions.size(); rva += bb->instructions[i++].length) {
+    std::uint32_t index = 0;
+    if (bin.rva_to_containing_bb(rva, &index) != bb || index != i)
+      return false;
+  }
+
+  // Instructions might have been removed from the end of the block.
+  std::uint32_t index = 0;
+  return bin.rva_to_containing_bb(rva, &index) != bb;
+}
+
+// Insert a probe before every selected instruction with an explicit memory
+// operand.
+memory_trace_result instrument_memory_accesses(
+    disassembled_binary& bin, memory_trace_options const& options) {
+  memory_trace_result result = {};
+
+  // This needs to be calculated before we modify anything.
+  liveness_analysis const liveness(bin);
+
+  struct pending_probe {
+    basic_block* bb;
+    std::size_t index;
+    std::uint32_t id;
+    ZydisDecodedOperand mem;
+    register_set live;
+  };
+
+  std::vector<pending_probe> pending = {};
+  std::vector<std::uint32_t> id_rvas = {};
+
+  for (auto const bb : bin.basic_blocks()) {
+    // Blocks that were created by another pass don't have an RVA.
+    auto rva = bin.symbol_to_rva(bb->sym_id);
+    if (!rva || bb->no_instrument)
+      continue;
+
+    // The RVA of every instruction is calculated from its position, which
+    // is wrong once another pass has modified the block.
+    if (!has_original_layout(bin, bb, rva)) {
+      ++result.modified_count;
+      continue;
+    }
+
+    for (std::size_t i = 0; i < bb->instructions.size(); rva += bb->instructions[i++].length) {
+      if (options.rvas && !std::binary_search(begin(*options.rvas), end(*options.rvas), rva))
+        continue;
+
+      auto const& instr = bb->instructions[i];
+
+      ZydisDecodedInstruction decoded_instr;
+      ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT];
+      if (ZYAN_FAILED(ZydisDecoderDecodeFull(bin.decoder(), instr.bytes,
+          instr.length, &decoded_instr, decoded_ops)))
+        continue;
+
+      // Find the first explicit memory access. LEA and NOP don't access
+      // memory, and PUSH/POP are implicit accesses.
+      ZydisDecodedOperand const* mem = nullptr;
+      for (std::size_t j = 0; j < decoded_instr.operand_count_visible; ++j) {
+        auto const& op = decoded_ops[j];
+        if (op.type == ZYDIS_OPERAND_TYPE_MEMORY && op.mem.type == ZYDIS_MEMOP_TYPE_MEM &&
+            op.visibility == ZYDIS_OPERAND_VISIBILITY_EXPLICIT) {
+          mem = &op;
+          break;
+        }
+      }
+
+      if (!mem)
+        continue;
+
+      auto const store = (mem->actions & ZYDIS_OPERAND_ACTION_MASK_WRITE) != 0;
+      if (store ? !options.stores : !options.loads)
+        continue;
+
+      if (!options.include_stack && gpr_id(mem->mem.base) == 4)
+        continue;
+
+      // The LEA can't add a segment base, or gather vector indices.
+      if (mem->mem.segment == ZYDIS_REGISTER_FS || mem->mem.segment == ZYDIS_REGISTER_GS ||
+          decoded_instr.address_width != 64 || (mem->mem.index != ZYDIS_REGISTER_NONE &&
+          gpr_id(mem->mem.index) < 0)) {
+        ++result.skipped_count;
+        continue;
+      }
+
+      auto const id = static_cast<std::uint32_t>(id_rvas.size());
+      id_rvas.push_back(rva);
+
+      pending.push_back({ bb, i, store ? (id | memory_trace_store_flag) : id,
+        *mem, liveness.live_before(bb, i) });
+    }
+  }
+
+  result.buffer = create_trace_buffer(bin, options.buffer_name,
+    trace_kind::address, id_rvas, options.buffer);
+
+  // Every liveness query was made up front, so the probes can be inserted
+  // from the back of each block to the front without affecting them.
+  for (auto it = rbegin(pending); it != rend(pending); ++it) {
+    auto const probe = create_memory_probe(bin, result.buffer, it->id, it->mem, it->live);
+    it->bb->instructions.insert(begin(it->bb->instructions) + it->index,
+      begin(probe), end(probe));
+    ++result.probe_count;
+  }
+
+  return result;
+}
+
+} // namespace chum
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "disassembler.h"
+#include "trace_buffer.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace chum {
+
+// Records for instructions that write to memory have this bit set in their
+// ID. Instructions that both read and write (such as ADD [mem], reg) count
+// as writes.
+inline constexpr std::uint32_t memory_trace_store_flag = 0x80000000;
+
+struct memory_trace_options {
+  // The exported name of the trace buffer.
+  char const* buffer_name = "__chum_memory_buffer";
+
+  // The layout of the trace buffer.
+  trace_buffer_options buffer = {};
+
+  // Which kinds of accesses get a probe.
+  bool loads  = true;
+  bool stores = true;
+
+  // Whether accesses through RSP (locals and spills) get a probe. These
+  // are numerous and almost always hit, so they're skipped by default.
+  bool include_stack = false;
+
+  // If non-null, only the instructions at these (sorted) original RVAs are
+  // instrumented.
+  std::vector<std::uint32_t> const* rvas = nullptr;
+};
+
+struct memory_trace_result {
+  // The trace buffer that the probes write to. The ID table maps probe IDs
+  // to the original RVA of each instruction.
+  trace_buffer buffer = {};
+
+  // The number of probes that were inserted.
+  std::size_t probe_count = 0;
+
+  // The number of selected memory operands that couldn't be probed (such as
+  // FS/GS-relative or VSIB operands).
+  std::size_t skipped_count = 0;
+
+  // The number of blocks that were left alone because they had been
+  // modified since disassembly, so their instructions can't be mapped back
+  // to an original RVA.
+  std::size_t modified_count = 0;
+};
+
+// Insert a probe before every selected instruction with an explicit memory
+// operand. Each probe computes the effective address with an LEA and writes
+// an (instruction ID, address) record to a trace buffer. Registers and flags
+// are preserved, although registers that are dead at the probe site are not
+// saved. Addresses are those of the rewritten image. This needs to run
+// before any pass that inserts instructions, since instructions are mapped
+// back to their original RVA by their position in the block. Blocks that
+// were already modified are skipped (see modified_count).
+memory_trace_result instrument_memory_accesses(
+  disassembled_binary& bin, memory_trace_options const& options = {});
+
+} // namespace chum
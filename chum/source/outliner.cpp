@@ -0,0 +1,277 @@
+#include "outliner.h"
+#include "liveness.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+namespace chum {
+
+// The size of a CALL rel32.
+static constexpr std::size_t call_size = 5;
+
+// Get the copy of an instruction that can be executed from an outlined
+// block, where RSP is 8 bytes lower because of the return address. Returns
+// false if the instruction can't be outlined.
+static bool get_outlined_instruction(binary const& bin,
+    instruction const& instr, instruction& outlined) {
+  ZydisDecodedInstruction decoded_instr;
+  ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT];
+  if (ZYAN_FAILED(ZydisDecoderDecodeFull(bin.decoder(), instr.bytes,
+      instr.length, &decoded_instr, decoded_ops)))
+    return false;
+
+  // Anything that transfers control, or depends on where it was called from.
+  switch (decoded_instr.meta.category) {
+  case ZYDIS_CATEGORY_CALL:
+  case ZYDIS_CATEGORY_RET:
+  case ZYDIS_CATEGORY_COND_BR:
+  case ZYDIS_CATEGORY_UNCOND_BR:
+  case ZYDIS_CATEGORY_INTERRUPT:
+  case ZYDIS_CATEGORY_SYSCALL:
+  case ZYDIS_CATEGORY_SYSRET:
+    return false;
+  default:
+    break;
+  }
+
+  bool adjust = false;
+
+  for (std::size_t i = 0; i < decoded_instr.operand_count; ++i) {
+    auto const& op = decoded_ops[i];
+
+    // Reading or writing RSP itself (including PUSH and POP).
+    if (op.type == ZYDIS_OPERAND_TYPE_REGISTER && gpr_id(op.reg.value) == 4)
+      return false;
+
+    if (op.type != ZYDIS_OPERAND_TYPE_MEMORY || gpr_id(op.mem.base) != 4)
+      continue;
+
+    // Implicit stack accesses can't be adjusted, and anything below RSP
+    // would overlap with the return address.
+    if (op.visibility != ZYDIS_OPERAND_VISIBILITY_EXPLICIT || op.mem.disp.value < 0)
+      return false;
+
+    adjust = true;
+  }
+
+  if (!adjust) {
+    outlined = instr;
+    return true;
+  }
+
+  ZydisEncoderRequest req = {};
+  if (ZYAN_FAILED(ZydisEncoderDecodedInstructionToEncoderRequest(&decoded_instr,
+      decoded_ops, decoded_instr.operand_count_visible, &req)))
+    return false;
+
+  for (std::size_t i = 0; i < req.operand_count; ++i) {
+    if (req.operands[i].type == ZYDIS_OPERAND_TYPE_MEMORY &&
+        gpr_id(req.operands[i].mem.base) == 4)
+      req.operands[i].mem.displacement += 8;
+  }
+
+  // Make sure that the adjusted instruction can actually be encoded.
+  std::uint8_t bytes[15] = {};
+  std::size_t length = sizeof(bytes);
+  if (ZYAN_FAILED(ZydisEncoderEncodeInstruction(&req, bytes, &length)))
+    return false;
+
+  outlined = bin.instr(req);
+  return true;
+}
+
+// Find instruction sequences that are repeated across cold blocks and move
+// each one into a shared block that is reached with CALL and left with RET.
+outline_result outline_cold_sequences(binary& bin, outline_options const& options) {
+  outline_result result = {};
+
+  struct cold_block {
+    basic_block* bb;
+
+    // The outlined copy of every instruction, and whether it can be
+    // outlined at all.
+    std::vector<instruction> outlined;
+    std::vector<bool> eligible;
+
+    // Whether each instruction has been claimed by a sequence.
+    std::vector<bool> claimed;
+  };
+
+  std::vector<cold_block> blocks = {};
+
+  for (auto const bb : bin.basic_blocks()) {
+    if (bb->weight > options.max_cold_weight || bb->instructions.size() < options.min_length)
+      continue;
+
+    auto& cold = blocks.emplace_back();
+    cold.bb = bb;
+    cold.outlined.resize(bb->instructions.size());
+    cold.eligible.resize(bb->instructions.size());
+    cold.claimed.resize(bb->instructions.size());
+
+    for (std::size_t i = 0; i < bb->instructions.size(); ++i) {
+      cold.eligible[i] = get_outlined_instruction(bin,
+        bb->instructions[i], cold.outlined[i]);
+    }
+  }
+
+  result.cold_block_count = blocks.size();
+
+  struct occurrence {
+    std::uint32_t block;
+    std::uint32_t start;
+  };
+
+  struct candidate {
+    std::size_t length;
+    std::size_t size;
+    std::size_t outlined_size;
+    std::vector<occurrence> occurrences;
+
+    // The number of bytes that would be saved if every occurrence was used.
+    std::size_t savings() const {
+      return savings(occurrences.size());
+    }
+
+    std::size_t savings(std::size_t const count) const {
+      auto const before = size * count;
+      auto const after  = call_size * count + outlined_size + 1;
+      return before > after ? before - after : 0;
+    }
+  };
+
+  std::vector<candidate> candidates = {};
+
+  // Hash every window of eligible instructions, one length at a time. The
+  // key is the raw bytes of the window, prefixed by each instruction length.
+  for (auto length = options.min_length; length <= options.max_length; ++length) {
+    std::unordered_map<std::string, std::vector<occurrence>> windows = {};
+
+    for (std::uint32_t b = 0; b < blocks.size(); ++b) {
+      auto const& cold = blocks[b];
+
+      // The number of eligible instructions that end at the current one.
+      std::size_t run = 0;
+
+      for (std::uint32_t i = 0; i < cold.eligible.size(); ++i) {
+        run = cold.eligible[i] ? run + 1 : 0;
+        if (run < length)
+          continue;
+
+        std::string key = "";
+        for (auto j = i + 1 - length; j <= i; ++j) {
+          auto const& instr = cold.bb->instructions[j];
+          key.push_back(static_cast<char>(instr.length));
+          key.append(reinterpret_cast<char const*>(instr.bytes), instr.length);
+        }
+
+        windows[std::move(key)].push_back({ b, static_cast<std::uint32_t>(i + 1 - length) });
+      }
+    }
+
+    for (auto& [key, occurrences] : windows) {
+      if (occurrences.size() < 2)
+        continue;
+
+      candidate c = {};
+      c.length      = length;
+      c.size        = key.size() - length;
+      c.occurrences = std::move(occurrences);
+
+      auto const& first = blocks[c.occurrences.front().block];
+      for (std::size_t j = 0; j < length; ++j)
+        c.outlined_size += first.outlined[c.occurrences.front().start + j].length;
+
+      if (c.savings() >= options.min_savings)
+        candidates.push_back(std::move(c));
+    }
+  }
+
+  // Take the sequences that save the most first. Later candidates can only
+  // use the instructions that are still left over.
+  std::sort(begin(candidates), end(candidates), [](auto const& left, auto const& right) {
+    if (left.savings() != right.savings())
+      return left.savings() > right.savings();
+    if (left.length != right.length)
+      return left.length > right.length;
+
+    // Keep the order the same between runs.
+    auto const& l = left.occurrences.front();
+    auto const& r = right.occurrences.front();
+    return l.block != r.block ? l.block < r.block : l.start < r.start;
+  });
+
+  struct replacement {
+    std::uint32_t start;
+    std::size_t length;
+    basic_block* target;
+  };
+
+  // The replacements for every cold block.
+  std::vector<std::vector<replacement>> replacements(blocks.size());
+
+  for (auto const& c : candidates) {
+    std::vector<occurrence> taken = {};
+
+    // Claim every occurrence that doesn't overlap with an earlier sequence
+    // (or with an earlier occurrence of this one).
+    for (auto const& occ : c.occurrences) {
+      auto& claimed = blocks[occ.block].claimed;
+
+      if (std::any_of(begin(claimed) + occ.start, begin(claimed) + occ.start + c.length,
+          [](bool const b) { return b; }))
+        continue;
+
+      std::fill(begin(claimed) + occ.start, begin(claimed) + occ.start + c.length, true);
+      taken.push_back(occ);
+    }
+
+    if (taken.size() < 2 || c.savings(taken.size()) < options.min_savings) {
+      for (auto const& occ : taken) {
+        auto& claimed = blocks[occ.block].claimed;
+        std::fill(begin(claimed) + occ.start, begin(claimed) + occ.start + c.length, false);
+      }
+
+      continue;
+    }
+
+    auto const outlined = bin.create_basic_block();
+    auto const& first = blocks[taken.front().block];
+
+    for (std::size_t j = 0; j < c.length; ++j)
+      outlined->push(first.outlined[taken.front().start + j]);
+
+    // RET
+    outlined->push(bin.instr("\xC3"));
+
+    for (auto const& occ : taken)
+      replacements[occ.block].push_back({ occ.start, c.length, outlined });
+
+    ++result.sequence_count;
+    result.call_site_count += taken.size();
+    result.bytes_saved += c.savings(taken.size());
+  }
+
+  // Replace the sequences from the back of each block to the front, so that
+  // the instruction indices stay valid.
+  for (std::size_t b = 0; b < blocks.size(); ++b) {
+    auto& block_replacements = replacements[b];
+    std::sort(begin(block_replacements), end(block_replacements),
+      [](auto const& left, auto const& right) { return left.start > right.start; });
+
+    auto& instructions = blocks[b].bb->instructions;
+
+    for (auto const& r : block_replacements) {
+      instructions.erase(begin(instructions) + r.start,
+        begin(instructions) + r.start + r.length);
+
+      // CALL outlined
+      instructions.insert(begin(instructions) + r.start, bin.instr("\xE8", r.target));
+    }
+  }
+
+  return result;
+}
+
+} // namespace chum
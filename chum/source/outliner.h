@@ -0,0 +1,48 @@
+#pragma once
+
+#include "binary.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace chum {
+
+struct outline_options {
+  // Blocks with a weight that is at most this value are treated as cold
+  // (see basic_block::weight). Without a profile, every block is cold.
+  std::uint64_t max_cold_weight = 0;
+
+  // The shortest and longest sequences, in instructions, that are outlined.
+  std::size_t min_length = 2;
+  std::size_t max_length = 8;
+
+  // The minimum number of bytes that outlining a sequence needs to save,
+  // after paying for the CALLs and the outlined copy.
+  std::size_t min_savings = 1;
+};
+
+struct outline_result {
+  // The number of cold blocks that were searched.
+  std::size_t cold_block_count = 0;
+
+  // The number of outlined sequences (each becomes a new block), and the
+  // number of places that were replaced with a CALL to one of them.
+  std::size_t sequence_count   = 0;
+  std::size_t call_site_count  = 0;
+
+  // The number of bytes that were saved, including the outlined copies.
+  std::size_t bytes_saved = 0;
+};
+
+// Find instruction sequences that are repeated across cold blocks and move
+// each one into a shared block that is reached with CALL and left with RET.
+// Sequences are matched by their instruction bytes, which already refer to
+// memory through symbol IDs, so identical bytes mean identical behavior.
+// Sequences never contain control flow or implicit stack accesses, and
+// RSP-relative operands are adjusted for the return address. CALL and RET
+// don't touch the status flags, so flags can be live across a sequence.
+// The outlined blocks are added to the end of the binary.
+outline_result outline_cold_sequences(binary& bin,
+  outline_options const& options = {});
+
+} // namespace chum
@@ -0,0 +1,313 @@
+#include "prefetch.h"
+#include "liveness.h"
+#include "loops.h"
+#include "cfg.h"
+#include "encoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+namespace chum {
+
+// Calculate how much a register changes by in a single loop iteration.
+// Returns false if the register isn't an induction variable.
+static bool get_register_step(binary const& bin, loop_analysis const& loops,
+    natural_loop const& loop, int const reg, std::int64_t& step) {
+  step = 0;
+
+  bool found = false;
+
+  for (auto const bb : loop.blocks) {
+    for (auto const& instr : bb->instructions) {
+      register_set use = {}, def = {};
+      instruction_effects(bin, instr, use, def);
+
+      if (!((def.gprs | use.gprs) & (1 << reg)))
+        continue;
+
+      ZydisDecodedInstruction decoded_instr;
+      ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT];
+      if (ZYAN_FAILED(ZydisDecoderDecodeFull(bin.decoder(), instr.bytes,
+          instr.length, &decoded_instr, decoded_ops)))
+        return false;
+
+      // Is the register written to by this instruction?
+      bool writes = false;
+      for (std::size_t i = 0; i < decoded_instr.operand_count; ++i) {
+        auto const& op = decoded_ops[i];
+        if (op.type == ZYDIS_OPERAND_TYPE_REGISTER &&
+            (op.actions & ZYDIS_OPERAND_ACTION_MASK_WRITE) &&
+            gpr_id(op.reg.value) == reg)
+          writes = true;
+      }
+
+      // Something like a CALL that clobbers the register.
+      if (!writes && (def.gprs & (1 << reg)))
+        return false;
+
+      if (!writes)
+        continue;
+
+      // The register can only be updated once per iteration.
+      if (found)
+        return false;
+      found = true;
+
+      // The update needs to happen on every iteration.
+      for (auto const latch : loop.latches) {
+        if (!loops.dominates(bb, latch))
+          return false;
+      }
+
+      auto const& dst = decoded_ops[0];
+      if (dst.type != ZYDIS_OPERAND_TYPE_REGISTER ||
+          gpr_id(dst.reg.value) != reg ||
+          ZydisRegisterGetWidth(ZYDIS_MACHINE_MODE_LONG_64, dst.reg.value) < 32)
+        return false;
+
+      auto const& src = decoded_ops[1];
+
+      switch (decoded_instr.mnemonic) {
+      case ZYDIS_MNEMONIC_INC: step = 1; break;
+      case ZYDIS_MNEMONIC_DEC: step = -1; break;
+      case ZYDIS_MNEMONIC_ADD:
+      case ZYDIS_MNEMONIC_SUB:
+        if (src.type != ZYDIS_OPERAND_TYPE_IMMEDIATE)
+          return false;
+        step = decoded_instr.mnemonic == ZYDIS_MNEMONIC_ADD ?
+          src.imm.value.s : -src.imm.value.s;
+        break;
+      case ZYDIS_MNEMONIC_LEA:
+        // LEA reg, [reg + disp]
+        if (src.mem.base == ZYDIS_REGISTER_RIP || gpr_id(src.mem.base) != reg ||
+            src.mem.index != ZYDIS_REGISTER_NONE)
+          return false;
+        step = src.mem.disp.value;
+        break;
+      default:
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Estimate the average number of iterations of a loop from the profile.
+// Returns 0 if the loop has no profile weights.
+static double get_trip_count(binary const& bin, natural_loop const& loop) {
+  auto const header = loop.header;
+  if (!header->weight)
+    return 0.0;
+
+  std::uint64_t back_edges = 0;
+  for (auto const latch : loop.latches) {
+    auto const exit = get_block_exit(bin, latch);
+    if (exit.branch_target == header->sym_id)
+      back_edges += latch->taken_weight;
+    if (exit.fallthrough_target == header->sym_id)
+      back_edges += latch->fallthrough_weight;
+  }
+
+  // Every execution of the header that didn't come from a back-edge is an
+  // entry into the loop.
+  auto const entries = header->weight > back_edges ? header->weight - back_edges : 1;
+  return static_cast<double>(header->weight) / static_cast<double>(entries);
+}
+
+// Insert a PREFETCHT0 ahead of every load in the miss profile whose
+// address advances by a constant stride in its innermost loop.
+std::vector<prefetch_site> insert_prefetches(disassembled_binary& bin,
+    std::vector<rva_count> const& misses, prefetch_options const& options) {
+  // These need to be calculated before we modify anything.
+  loop_analysis const loops(bin);
+
+  struct pending_prefetch {
+    basic_block* bb;
+    std::uint32_t index;
+    instruction instr;
+  };
+
+  // A cache line that is already being prefetched in a loop. Addresses that
+  // use the same registers and stride only differ by their displacement.
+  struct covered_line {
+    natural_loop const* loop;
+    ZydisRegister base;
+    ZydisRegister index;
+    std::uint8_t scale;
+    std::int64_t line;
+  };
+
+  std::vector<prefetch_site> sites = {};
+  std::vector<pending_prefetch> pending = {};
+  std::vector<covered_line> covered = {};
+
+  // The same load can appear more than once in the miss profile (such as
+  // when profiles are concatenated), so merge the counts first.
+  auto sorted_misses = misses;
+  std::sort(begin(sorted_misses), end(sorted_misses), [](auto const& left, auto const& right) {
+    return left.rva < right.rva;
+  });
+
+  for (std::size_t first = 0; first < sorted_misses.size();) {
+    auto& site = sites.emplace_back();
+    site.rva = sorted_misses[first].rva;
+
+    for (; first < sorted_misses.size() && sorted_misses[first].rva == site.rva; ++first)
+      site.misses += sorted_misses[first].count;
+
+    if (site.misses < options.min_misses) {
+      site.status = prefetch_status::below_threshold;
+      continue;
+    }
+
+    std::uint32_t index = 0;
+    auto const bb = bin.rva_to_containing_bb(site.rva, &index);
+
+    if (!bb || index >= bb->instructions.size()) {
+      site.status = prefetch_status::not_found;
+      continue;
+    }
+
+    auto const& instr = bb->instructions[index];
+
+    ZydisDecodedInstruction decoded_instr;
+    ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT];
+    if (ZYAN_FAILED(ZydisDecoderDecodeFull(bin.decoder(), instr.bytes,
+        instr.length, &decoded_instr, decoded_ops))) {
+      site.status = prefetch_status::not_found;
+      continue;
+    }
+
+    // Find the memory operand that is being read from.
+    ZydisDecodedOperand const* mem = nullptr;
+    for (std::size_t i = 0; i < decoded_instr.operand_count_visible; ++i) {
+      auto const& op = decoded_ops[i];
+      if (op.type == ZYDIS_OPERAND_TYPE_MEMORY &&
+          op.mem.type == ZYDIS_MEMOP_TYPE_MEM &&
+          (op.actions & ZYDIS_OPERAND_ACTION_MASK_READ))
+        mem = &op;
+    }
+
+    if (!mem || mem->mem.base == ZYDIS_REGISTER_RIP ||
+        mem->mem.segment == ZYDIS_REGISTER_FS ||
+        mem->mem.segment == ZYDIS_REGISTER_GS) {
+      site.status = prefetch_status::not_a_load;
+      continue;
+    }
+
+    auto const loop = loops.innermost_loop(bb);
+    if (!loop) {
+      site.status = prefetch_status::not_in_loop;
+      continue;
+    }
+
+    // A load on a conditional path inside the loop doesn't advance by the
+    // stride between two executions, and the prefetch would be wasted
+    // whenever the path isn't taken.
+    if (!std::all_of(begin(loop->latches), end(loop->latches),
+        [&](basic_block const* const latch) { return loops.dominates(bb, latch); })) {
+      site.status = prefetch_status::conditional;
+      continue;
+    }
+
+    site.distance = options.distance;
+    if (auto const trip_count = get_trip_count(bin, *loop); trip_count > 0.0) {
+      site.distance = static_cast<std::uint32_t>((std::min)(
+        static_cast<double>(options.distance), trip_count - 1.0));
+    }
+
+    if (site.distance == 0) {
+      site.status = prefetch_status::short_loop;
+      continue;
+    }
+
+    // Add up the contribution of the base and index registers.
+    bool strided = true;
+    std::int64_t stride = 0;
+
+    if (auto const base = gpr_id(mem->mem.base); base >= 0) {
+      std::int64_t step = 0;
+      strided &= get_register_step(bin, loops, *loop, base, step);
+      stride += step;
+    }
+
+    if (auto const idx = gpr_id(mem->mem.index); idx >= 0) {
+      std::int64_t step = 0;
+      strided &= get_register_step(bin, loops, *loop, idx, step);
+      stride += step * mem->mem.scale;
+    }
+
+    if (!strided || stride == 0) {
+      site.status = prefetch_status::no_stride;
+      continue;
+    }
+
+    site.stride = stride;
+    site.offset = stride * site.distance;
+
+    auto const displacement = mem->mem.disp.value + site.offset;
+    if (displacement < (std::numeric_limits<std::int32_t>::min)() ||
+        displacement > (std::numeric_limits<std::int32_t>::max)()) {
+      site.status = prefetch_status::out_of_range;
+      continue;
+    }
+
+    // Round towards negative infinity, so that negative displacements in the
+    // same line end up with the same line number.
+    auto const line_size = static_cast<std::int64_t>((std::max)(options.line_size, 1u));
+    auto const line = displacement >= 0 ? displacement / line_size :
+      -((-displacement + line_size - 1) / line_size);
+
+    if (std::any_of(begin(covered), end(covered), [&](covered_line const& other) {
+        return other.loop == loop && other.base == mem->mem.base &&
+          other.index == mem->mem.index && other.scale == mem->mem.scale &&
+          other.line == line; })) {
+      site.status = prefetch_status::redundant;
+      continue;
+    }
+
+    covered.push_back({ loop, mem->mem.base, mem->mem.index, mem->mem.scale, line });
+
+    // PREFETCHT0 [base + index * scale + disp + stride * distance]
+    pending.push_back({ bb, index, bin.instr(enc_req(ZYDIS_MNEMONIC_PREFETCHT0,
+      { enc_mem(1, mem->mem.base, mem->mem.index, mem->mem.scale, displacement) })) });
+
+    site.status = prefetch_status::inserted;
+  }
+
+  // Insert the prefetches from the back of each block to the front, so that
+  // the instruction indices stay valid.
+  std::sort(begin(pending), end(pending), [](auto const& left, auto const& right) {
+    if (left.bb != right.bb)
+      return left.bb < right.bb;
+    return left.index > right.index;
+  });
+
+  for (auto const& prefetch : pending)
+    prefetch.bb->insert(prefetch.instr, prefetch.index);
+
+  return sites;
+}
+
+// Print what was done for every load in the miss profile.
+void print_prefetch_sites(std::vector<prefetch_site> const& sites) {
+  std::printf("[+] Prefetch sites (%zu):\n", sites.size());
+
+  for (auto const& site : sites) {
+    std::printf("[+]   RVA: 0x%-8X Misses: %-10llu Status: %-16s",
+      site.rva, static_cast<unsigned long long>(site.misses),
+      serialize_prefetch_status(site.status));
+
+    if (site.status == prefetch_status::inserted) {
+      std::printf(" Stride: %-6lld Distance: %-4u Offset: %lld",
+        static_cast<long long>(site.stride), site.distance,
+        static_cast<long long>(site.offset));
+    }
+
+    std::printf("\n");
+  }
+}
+
+} // namespace chum
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "disassembler.h"
+#include "util.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace chum {
+
+struct prefetch_options {
+  // The number of loop iterations to prefetch ahead of the load. If the
+  // binary has a profile, this is capped by the average trip count of the
+  // loop, since prefetching past the end of the loop only wastes bandwidth.
+  std::uint32_t distance = 8;
+
+  // Loads with fewer misses than this are ignored.
+  std::uint64_t min_misses = 1;
+
+  // The size of a cache line. Loads in the same loop that would prefetch
+  // the same line only get a single prefetch.
+  std::uint32_t line_size = 64;
+};
+
+// What happened to a single load from the miss profile.
+enum class prefetch_status {
+  // A PREFETCHT0 was inserted before the load.
+  inserted,
+
+  // The RVA doesn't point to the start of a disassembled instruction.
+  not_found,
+
+  // The instruction doesn't read from a (non RIP-relative) memory operand.
+  not_a_load,
+
+  // The instruction isn't inside of a loop.
+  not_in_loop,
+
+  // The load doesn't run on every iteration of its innermost loop.
+  conditional,
+
+  // The loop runs too few iterations (according to the profile) for the
+  // prefetched line to be used.
+  short_loop,
+
+  // Another prefetch in the same loop already covers this cache line.
+  redundant,
+
+  // The address doesn't change by a constant amount every iteration.
+  no_stride,
+
+  // The prefetch displacement doesn't fit in 32 bits.
+  out_of_range,
+
+  // The load had fewer misses than the threshold.
+  below_threshold
+};
+
+// Get the string representation of a prefetch status.
+inline constexpr char const* serialize_prefetch_status(prefetch_status const status) {
+  switch (status) {
+  case prefetch_status::inserted:        return "inserted";
+  case prefetch_status::not_found:       return "not_found";
+  case prefetch_status::not_a_load:      return "not_a_load";
+  case prefetch_status::not_in_loop:     return "not_in_loop";
+  case prefetch_status::conditional:     return "conditional";
+  case prefetch_status::short_loop:      return "short_loop";
+  case prefetch_status::redundant:       return "redundant";
+  case prefetch_status::no_stride:       return "no_stride";
+  case prefetch_status::out_of_range:    return "out_of_range";
+  case prefetch_status::below_threshold: return "below_threshold";
+  default: return "invalid";
+  }
+}
+
+// A load from the miss profile, and what was done with it.
+struct prefetch_site {
+  // The RVA of the load in the original image.
+  std::uint32_t rva = 0;
+
+  // The number of misses from the profile. Duplicate RVAs are merged.
+  std::uint64_t misses = 0;
+
+  prefetch_status status = prefetch_status::not_found;
+
+  // The number of bytes that the address advances by every iteration.
+  std::int64_t stride = 0;
+
+  // The number of iterations, and bytes, ahead of the load that are being
+  // prefetched.
+  std::uint32_t distance = 0;
+  std::int64_t  offset   = 0;
+};
+
+// Insert a PREFETCHT0 ahead of every load in the miss profile (which is
+// keyed by the RVA of each load in the original image) whose address
+// advances by a constant stride in its innermost loop, and which runs on
+// every iteration of that loop. Sites are returned sorted by RVA, with
+// duplicate RVAs merged. This needs to run
+// before any pass that inserts instructions, since loads are located by
+// their original instruction index.
+std::vector<prefetch_site> insert_prefetches(disassembled_binary& bin,
+  std::vector<rva_count> const& misses, prefetch_options const& options = {});
+
+// Print what was done for every load in the miss profile.
+void print_prefetch_sites(std::vector<prefetch_site> const& sites);
+
+} // namespace chum
@@ -0,0 +1,234 @@
+#include "profile.h"
+#include "cfg.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <tuple>
+
+namespace chum {
+
+// Sort an array of profile entries by key and combine duplicates.
+template <typename T, typename Key>
+static void normalize_entries(std::vector<T>& entries, Key const& key) {
+  std::sort(begin(entries), end(entries), [&](T const& left, T const& right) {
+    return key(left) < key(right);
+  });
+
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    if (count > 0 && key(entries[count - 1]) == key(entries[i]))
+      entries[count - 1].count += entries[i].count;
+    else
+      entries[count++] = entries[i];
+  }
+
+  entries.resize(count);
+}
+
+// Sort every array in a profile and combine duplicate entries.
+void normalize_profile(profile& prof) {
+  normalize_entries(prof.blocks, [](profile_block const& entry) {
+    return entry.rva;
+  });
+  normalize_entries(prof.edges, [](profile_edge const& entry) {
+    return std::make_tuple(entry.from, entry.to);
+  });
+  normalize_entries(prof.calls, [](profile_call const& entry) {
+    return std::make_tuple(entry.call_site, entry.target);
+  });
+}
+
+// Add the counts of one profile to another.
+bool merge_profile(profile& dst, profile const& src) {
+  if (dst.identity_hash && src.identity_hash &&
+      dst.identity_hash != src.identity_hash)
+    return false;
+
+  if (!dst.identity_hash)
+    dst.identity_hash = src.identity_hash;
+
+  dst.blocks.insert(end(dst.blocks), begin(src.blocks), end(src.blocks));
+  dst.edges.insert(end(dst.edges), begin(src.edges), end(src.edges));
+  dst.calls.insert(end(dst.calls), begin(src.calls), end(src.calls));
+
+  normalize_profile(dst);
+
+  return true;
+}
+
+// Create a profile from text counts.
+profile import_profile(std::uint64_t const identity_hash,
+    std::vector<rva_count> const& blocks,
+    std::vector<rva_edge_count> const& edges,
+    std::vector<rva_edge_count> const& calls) {
+  profile prof = {};
+  prof.identity_hash = identity_hash;
+
+  for (auto const& entry : blocks)
+    prof.blocks.push_back({ entry.rva, 0, entry.count });
+  for (auto const& entry : edges)
+    prof.edges.push_back({ entry.from, entry.to, entry.count });
+  for (auto const& entry : calls)
+    prof.calls.push_back({ entry.from, entry.to, entry.count });
+
+  normalize_profile(prof);
+
+  return prof;
+}
+
+// Serialize a profile.
+std::vector<std::uint8_t> serialize_profile(profile const& prof) {
+  auto normalized = prof;
+  normalize_profile(normalized);
+
+  profile_header header = {};
+  header.magic         = profile_magic;
+  header.version       = 1;
+  header.identity_hash = normalized.identity_hash;
+  header.block_count   = static_cast<std::uint32_t>(normalized.blocks.size());
+  header.edge_count    = static_cast<std::uint32_t>(normalized.edges.size());
+  header.call_count    = static_cast<std::uint32_t>(normalized.calls.size());
+  header.blocks_offset = sizeof(profile_header);
+  header.edges_offset  = header.blocks_offset + header.block_count * sizeof(profile_block);
+  header.calls_offset  = header.edges_offset + header.edge_count * sizeof(profile_edge);
+
+  std::vector<std::uint8_t> buffer(header.calls_offset +
+    header.call_count * sizeof(profile_call));
+
+  std::memcpy(buffer.data(), &header, sizeof(header));
+
+  if (!normalized.blocks.empty()) {
+    std::memcpy(buffer.data() + header.blocks_offset, normalized.blocks.data(),
+      normalized.blocks.size() * sizeof(profile_block));
+  }
+
+  if (!normalized.edges.empty()) {
+    std::memcpy(buffer.data() + header.edges_offset, normalized.edges.data(),
+      normalized.edges.size() * sizeof(profile_edge));
+  }
+
+  if (!normalized.calls.empty()) {
+    std::memcpy(buffer.data() + header.calls_offset, normalized.calls.data(),
+      normalized.calls.size() * sizeof(profile_call));
+  }
+
+  return buffer;
+}
+
+// Parse a serialized profile.
+std::optional<profile> parse_profile(std::vector<std::uint8_t> const& buffer) {
+  if (buffer.size() < sizeof(profile_header))
+    return {};
+
+  profile_header header = {};
+  std::memcpy(&header, buffer.data(), sizeof(header));
+
+  if (header.magic != profile_magic || header.version != 1)
+    return {};
+
+  // Make sure the file is big enough to hold everything.
+  if (header.blocks_offset + header.block_count * sizeof(profile_block) > buffer.size() ||
+      header.edges_offset + header.edge_count * sizeof(profile_edge) > buffer.size() ||
+      header.calls_offset + header.call_count * sizeof(profile_call) > buffer.size())
+    return {};
+
+  profile prof = {};
+  prof.identity_hash = header.identity_hash;
+
+  prof.blocks.resize(header.block_count);
+  prof.edges.resize(header.edge_count);
+  prof.calls.resize(header.call_count);
+
+  if (header.block_count) {
+    std::memcpy(prof.blocks.data(), buffer.data() + header.blocks_offset,
+      header.block_count * sizeof(profile_block));
+  }
+
+  if (header.edge_count) {
+    std::memcpy(prof.edges.data(), buffer.data() + header.edges_offset,
+      header.edge_count * sizeof(profile_edge));
+  }
+
+  if (header.call_count) {
+    std::memcpy(prof.calls.data(), buffer.data() + header.calls_offset,
+      header.call_count * sizeof(profile_call));
+  }
+
+  return prof;
+}
+
+// Read a profile from disk.
+std::optional<profile> read_profile(char const* const path) {
+  return parse_profile(read_file_to_buffer(path));
+}
+
+// Write a profile to disk.
+bool write_profile(char const* const path, profile const& prof) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+
+  auto const buffer = serialize_profile(prof);
+  file.write(reinterpret_cast<char const*>(buffer.data()), buffer.size());
+
+  return static_cast<bool>(file);
+}
+
+// Replace the weights of every basic block with the counts from a profile.
+std::optional<profile_attach_result> attach_profile(
+    disassembled_binary& bin, profile const& prof) {
+  if (prof.identity_hash && prof.identity_hash != bin.identity_hash()) {
+    std::printf("[!] Profile does not match the binary.\n");
+    return {};
+  }
+
+  for (auto const bb : bin.basic_blocks()) {
+    bb->weight             = 0;
+    bb->taken_weight       = 0;
+    bb->fallthrough_weight = 0;
+  }
+
+  profile_attach_result result = {};
+
+  for (auto const& entry : prof.blocks) {
+    auto const bb = bin.rva_to_bb(entry.rva);
+    if (!bb) {
+      ++result.missing_blocks;
+      continue;
+    }
+
+    bb->weight += entry.count;
+    ++result.matched_blocks;
+  }
+
+  for (auto const& entry : prof.edges) {
+    auto const src = bin.rva_to_containing_bb(entry.from);
+    auto const dst = bin.rva_to_bb(entry.to);
+
+    if (!src || !dst) {
+      ++result.missing_edges;
+      continue;
+    }
+
+    auto const exit = get_block_exit(bin, src);
+
+    // A JCC to the next block is counted as taken, since there is no way
+    // to tell the two apart.
+    if (exit.branch_target == dst->sym_id)
+      src->taken_weight += entry.count;
+    else if (exit.fallthrough_target == dst->sym_id)
+      src->fallthrough_weight += entry.count;
+    else {
+      ++result.missing_edges;
+      continue;
+    }
+
+    ++result.matched_edges;
+  }
+
+  return result;
+}
+
+} // namespace chum
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "disassembler.h"
+#include "util.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace chum {
+
+// A profile file is a flat, little-endian blob that can be memory-mapped
+// and searched in place. Every array is sorted and 8-byte aligned:
+//
+//   profile_header
+//   profile_block  blocks[block_count]   (sorted by rva)
+//   profile_edge   edges[edge_count]     (sorted by from, then to)
+//   profile_call   calls[call_count]     (sorted by call_site, then target)
+//
+// Every RVA refers to the original image, which is identified by its hash.
+struct profile_header {
+  // Always equal to profile_magic.
+  std::uint32_t magic;
+  std::uint32_t version;
+
+  // The identity hash of the original image, or 0 if it isn't known.
+  std::uint64_t identity_hash;
+
+  std::uint32_t block_count;
+  std::uint32_t edge_count;
+  std::uint32_t call_count;
+  std::uint32_t reserved;
+
+  // Offsets from the start of the file.
+  std::uint32_t blocks_offset;
+  std::uint32_t edges_offset;
+  std::uint32_t calls_offset;
+  std::uint32_t reserved2;
+};
+
+static_assert(sizeof(profile_header) == 48);
+
+// 'CHPF'
+inline constexpr std::uint32_t profile_magic = 0x46504843;
+
+// The number of times that the block at an RVA was executed.
+struct profile_block {
+  std::uint32_t rva;
+  std::uint32_t reserved;
+  std::uint64_t count;
+};
+
+static_assert(sizeof(profile_block) == 16);
+
+// The number of times that control flow went from one block to another.
+// The source can be any RVA inside of the block (such as the address of the
+// branch), while the destination must be the start of a block.
+struct profile_edge {
+  std::uint32_t from;
+  std::uint32_t to;
+  std::uint64_t count;
+};
+
+static_assert(sizeof(profile_edge) == 16);
+
+// The number of times that a CALL instruction called a specific target.
+struct profile_call {
+  std::uint32_t call_site;
+  std::uint32_t target;
+  std::uint64_t count;
+};
+
+static_assert(sizeof(profile_call) == 16);
+
+// An in-memory profile.
+struct profile {
+  // The identity hash of the original image, or 0 if it isn't known.
+  std::uint64_t identity_hash = 0;
+
+  std::vector<profile_block> blocks = {};
+  std::vector<profile_edge> edges   = {};
+  std::vector<profile_call> calls   = {};
+};
+
+// Sort every array in a profile and combine duplicate entries.
+void normalize_profile(profile& prof);
+
+// Add the counts of one profile to another. This fails if both profiles
+// have an identity hash and they don't match.
+bool merge_profile(profile& dst, profile const& src);
+
+// Create a profile from text counts (see read_rva_counts() and
+// read_rva_edge_counts()).
+profile import_profile(std::uint64_t identity_hash,
+  std::vector<rva_count> const& blocks,
+  std::vector<rva_edge_count> const& edges = {},
+  std::vector<rva_edge_count> const& calls = {});
+
+// Serialize a profile. The profile is normalized first.
+std::vector<std::uint8_t> serialize_profile(profile const& prof);
+
+// Parse a serialized profile.
+std::optional<profile> parse_profile(std::vector<std::uint8_t> const& buffer);
+
+// Read a profile from disk.
+std::optional<profile> read_profile(char const* path);
+
+// Write a profile to disk.
+bool write_profile(char const* path, profile const& prof);
+
+struct profile_attach_result {
+  // The number of block entries that landed in a basic block.
+  std::size_t matched_blocks = 0;
+  std::size_t missing_blocks = 0;
+
+  // The number of edge entries that matched the branch or fallthrough
+  // target of their source block.
+  std::size_t matched_edges = 0;
+  std::size_t missing_edges = 0;
+};
+
+// Replace the weights of every basic block with the counts from a profile.
+// Call counts aren't attached, since they're per-instruction rather than
+// per-block. This fails if the profile belongs to a different image.
+std::optional<profile_attach_result> attach_profile(
+  disassembled_binary& bin, profile const& prof);
+
+} // namespace chum
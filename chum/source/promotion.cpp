@@ -0,0 +1,231 @@
+#include "promotion.h"
+#include "liveness.h"
+#include "encoder.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace chum {
+
+// Volatile registers that can hold the address of the target, in order of
+// preference. These are never used to pass arguments.
+static constexpr std::uint8_t scratch_candidates[] = { 11, 10, 0 };
+
+// Rewrite every indirect CALL in the value profile whose calls mostly go
+// to a single target into a compare and a direct call.
+std::vector<promotion_site> promote_indirect_calls(disassembled_binary& bin,
+    std::vector<profile_call> const& calls, promotion_options const& options) {
+  // This needs to be calculated before we modify anything.
+  liveness_analysis const liveness(bin);
+
+  struct pending_promotion {
+    basic_block* bb;
+    std::uint32_t index;
+    basic_block* target;
+    ZydisEncoderOperand operand;
+    std::uint8_t scratch;
+    std::uint64_t calls;
+    std::uint64_t target_calls;
+  };
+
+  std::vector<promotion_site> sites = {};
+  std::vector<pending_promotion> pending = {};
+
+  auto sorted_calls = calls;
+  std::sort(begin(sorted_calls), end(sorted_calls), [](auto const& left, auto const& right) {
+    return left.call_site < right.call_site;
+  });
+
+  for (std::size_t first = 0; first < sorted_calls.size();) {
+    auto& site = sites.emplace_back();
+    site.rva = sorted_calls[first].call_site;
+
+    // Add up every target of this call site, and find the most common one.
+    auto last = first;
+    for (; last < sorted_calls.size() && sorted_calls[last].call_site == site.rva; ++last) {
+      site.calls += sorted_calls[last].count;
+
+      if (sorted_calls[last].count > site.target_calls) {
+        site.target       = sorted_calls[last].target;
+        site.target_calls = sorted_calls[last].count;
+      }
+    }
+
+    first = last;
+
+    if (site.calls == 0 || site.calls < options.min_calls) {
+      site.status = promotion_status::below_threshold;
+      continue;
+    }
+
+    std::uint32_t index = 0;
+    auto const bb = bin.rva_to_containing_bb(site.rva, &index);
+
+    if (!bb || index >= bb->instructions.size()) {
+      site.status = promotion_status::not_found;
+      continue;
+    }
+
+    auto const& instr = bb->instructions[index];
+
+    ZydisDecodedInstruction decoded_instr;
+    ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT];
+    if (ZYAN_FAILED(ZydisDecoderDecodeFull(bin.decoder(), instr.bytes,
+        instr.length, &decoded_instr, decoded_ops))) {
+      site.status = promotion_status::not_found;
+      continue;
+    }
+
+    // CALL reg or CALL QWORD PTR [mem]. Far calls and calls through FS/GS
+    // (which can't be compared against a near address) are left alone.
+    auto const& op = decoded_ops[0];
+    if (decoded_instr.mnemonic != ZYDIS_MNEMONIC_CALL || op.size != 64 ||
+        (op.type != ZYDIS_OPERAND_TYPE_REGISTER && op.type != ZYDIS_OPERAND_TYPE_MEMORY) ||
+        (op.type == ZYDIS_OPERAND_TYPE_MEMORY && (op.mem.type != ZYDIS_MEMOP_TYPE_MEM ||
+        op.mem.segment == ZYDIS_REGISTER_FS || op.mem.segment == ZYDIS_REGISTER_GS))) {
+      site.status = promotion_status::not_indirect;
+      continue;
+    }
+
+    if (static_cast<double>(site.target_calls) <
+        static_cast<double>(site.calls) * options.min_ratio) {
+      site.status = promotion_status::no_dominant_target;
+      continue;
+    }
+
+    auto const target = bin.rva_to_bb(site.target);
+    if (!target) {
+      site.status = promotion_status::invalid_target;
+      continue;
+    }
+
+    // The CMP clobbers the status flags.
+    auto const live = liveness.live_before(bb, index);
+    if (live.flags & status_flags) {
+      site.status = promotion_status::flags_live;
+      continue;
+    }
+
+    // The operand of the call is live, so this also makes sure that the
+    // scratch register isn't a part of it.
+    int scratch = -1;
+    for (auto const candidate : scratch_candidates) {
+      if (!(live.gprs & (1 << candidate))) {
+        scratch = candidate;
+        break;
+      }
+    }
+
+    if (scratch < 0) {
+      site.status = promotion_status::no_scratch_register;
+      continue;
+    }
+
+    // For RIP-relative operands, the displacement is a symbol ID, which is
+    // copied as-is.
+    auto const operand = op.type == ZYDIS_OPERAND_TYPE_REGISTER ? enc_reg(op.reg.value) :
+      enc_mem(8, op.mem.base, op.mem.index, op.mem.scale, op.mem.disp.value);
+
+    pending.push_back({ bb, index, target, operand, static_cast<std::uint8_t>(scratch),
+      site.calls, site.target_calls });
+
+    site.status = promotion_status::promoted;
+  }
+
+  // Split the blocks from the back to the front, so that the instruction
+  // indices of earlier sites in the same block stay valid.
+  std::sort(begin(pending), end(pending), [](auto const& left, auto const& right) {
+    if (left.bb != right.bb)
+      return left.bb < right.bb;
+    return left.index > right.index;
+  });
+
+  for (auto const& promotion : pending) {
+    auto const bb   = promotion.bb;
+    auto const call = bb->instructions[promotion.index];
+
+    auto const direct   = bin.create_basic_block();
+    auto const fallback = bin.create_basic_block();
+
+    // Everything after the call goes into a new block, unless the call was
+    // the last instruction, in which case both calls return straight to the
+    // original fallthrough target.
+    auto continuation = bb->fallthrough_target;
+    basic_block* rest = nullptr;
+
+    if (promotion.index + 1 < bb->instructions.size()) {
+      rest = bin.create_basic_block();
+      rest->instructions.assign(begin(bb->instructions) + promotion.index + 1,
+        end(bb->instructions));
+      rest->fallthrough_target = bb->fallthrough_target;
+      rest->weight             = bb->weight;
+      rest->taken_weight       = bb->taken_weight;
+      rest->fallthrough_weight = bb->fallthrough_weight;
+      continuation = rest->sym_id;
+    }
+
+    bb->instructions.erase(begin(bb->instructions) + promotion.index,
+      end(bb->instructions));
+
+    auto const scratch = gpr64(promotion.scratch);
+
+    // LEA scratch, [target]
+    // CMP <operand>, scratch
+    // JNE fallback
+    bb->push(bin.instr(enc_req(ZYDIS_MNEMONIC_LEA,
+      { enc_reg(scratch), enc_sym(8, promotion.target->sym_id) })));
+    bb->push(bin.instr(enc_req(ZYDIS_MNEMONIC_CMP,
+      { promotion.operand, enc_reg(scratch) })));
+    bb->push(bin.instr("\x0F\x85", fallback));
+    bb->fallthrough_target = direct->sym_id;
+    bb->taken_weight       = promotion.calls - promotion.target_calls;
+    bb->fallthrough_weight = promotion.target_calls;
+
+    // CALL target
+    direct->push(bin.instr("\xE8", promotion.target));
+    direct->fallthrough_target = continuation;
+    direct->weight             = promotion.target_calls;
+    direct->fallthrough_weight = promotion.target_calls;
+
+    // The original CALL.
+    fallback->push(call);
+    fallback->fallthrough_target = continuation;
+    fallback->weight             = promotion.calls - promotion.target_calls;
+    fallback->fallthrough_weight = fallback->weight;
+
+    // The direct path goes right after the compare, while the fallback stays
+    // at the end of the binary, out of the way.
+    auto& blocks = bin.basic_blocks();
+    blocks.erase(std::remove(begin(blocks), end(blocks), direct), end(blocks));
+    if (rest)
+      blocks.erase(std::remove(begin(blocks), end(blocks), rest), end(blocks));
+
+    auto const position = std::find(begin(blocks), end(blocks), bb) + 1;
+    if (rest)
+      blocks.insert(position, { direct, rest });
+    else
+      blocks.insert(position, direct);
+  }
+
+  return sites;
+}
+
+// Print what was done for every call site in the value profile.
+void print_promotion_sites(std::vector<promotion_site> const& sites) {
+  std::printf("[+] Indirect call sites (%zu):\n", sites.size());
+
+  for (auto const& site : sites) {
+    std::printf("[+]   RVA: 0x%-8X Calls: %-10llu Status: %-20s",
+      site.rva, static_cast<unsigned long long>(site.calls),
+      serialize_promotion_status(site.status));
+
+    if (site.target_calls) {
+      std::printf(" Target: 0x%-8X (%.1f%%)", site.target,
+        100.0 * static_cast<double>(site.target_calls) / static_cast<double>(site.calls));
+    }
+
+    std::printf("\n");
+  }
+}
+
+} // namespace chum
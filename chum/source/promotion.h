@@ -0,0 +1,98 @@
+#pragma once
+
+#include "disassembler.h"
+#include "profile.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace chum {
+
+struct promotion_options {
+  // Call sites that were executed fewer times than this are ignored.
+  std::uint64_t min_calls = 1;
+
+  // The fraction of a site's calls that must go to a single target for the
+  // site to be promoted.
+  double min_ratio = 0.75;
+};
+
+// What happened to a single call site from the value profile.
+enum class promotion_status {
+  // The site was rewritten into a compare and a direct call.
+  promoted,
+
+  // The RVA doesn't point to the start of a disassembled instruction.
+  not_found,
+
+  // The instruction isn't an indirect CALL (or it uses a segment override).
+  not_indirect,
+
+  // No single target received enough of the calls.
+  no_dominant_target,
+
+  // The dominant target isn't the start of a basic block.
+  invalid_target,
+
+  // The status flags are live before the call.
+  flags_live,
+
+  // There is no free register to hold the address of the target.
+  no_scratch_register,
+
+  // The site had fewer calls than the threshold.
+  below_threshold
+};
+
+// Get the string representation of a promotion status.
+inline constexpr char const* serialize_promotion_status(promotion_status const status) {
+  switch (status) {
+  case promotion_status::promoted:            return "promoted";
+  case promotion_status::not_found:           return "not_found";
+  case promotion_status::not_indirect:        return "not_indirect";
+  case promotion_status::no_dominant_target:  return "no_dominant_target";
+  case promotion_status::invalid_target:      return "invalid_target";
+  case promotion_status::flags_live:          return "flags_live";
+  case promotion_status::no_scratch_register: return "no_scratch_register";
+  case promotion_status::below_threshold:     return "below_threshold";
+  default: return "invalid";
+  }
+}
+
+// An indirect call site from the value profile, and what was done with it.
+struct promotion_site {
+  // The RVA of the CALL in the original image.
+  std::uint32_t rva = 0;
+
+  // The total number of calls that were made from this site.
+  std::uint64_t calls = 0;
+
+  // The RVA of the most frequent target, and the number of calls to it.
+  std::uint32_t target       = 0;
+  std::uint64_t target_calls = 0;
+
+  promotion_status status = promotion_status::not_found;
+};
+
+// Rewrite every indirect CALL in the value profile (which is keyed by the
+// RVA of each call site in the original image, see profile::calls) whose
+// calls mostly go to a single target into:
+//
+//   LEA scratch, [target]
+//   CMP <operand>, scratch
+//   JNE fallback
+//   CALL target
+//   ...
+// fallback:
+//   CALL <operand>
+//
+// The block is split at the call, so the instructions after it move into
+// a new block. This needs to run before any pass that inserts instructions,
+// since sites are located by their original instruction index.
+std::vector<promotion_site> promote_indirect_calls(disassembled_binary& bin,
+  std::vector<profile_call> const& calls, promotion_options const& options = {});
+
+// Print what was done for every call site in the value profile.
+void print_promotion_sites(std::vector<promotion_site> const& sites);
+
+} // namespace chum
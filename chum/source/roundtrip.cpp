@@ -0,0 +1,306 @@
+#include "roundtrip.h"
+#include "disassembler.h"
+#include "cfg.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+
+namespace chum {
+
+// Summarize the shape of a disassembled binary.
+static binary_shape get_binary_shape(disassembled_binary const& bin) {
+  binary_shape shape = {};
+
+  shape.block_count    = bin.basic_blocks().size();
+  shape.function_count = bin.functions().size();
+  shape.export_count   = bin.exports().size();
+
+  for (auto const bb : bin.basic_blocks()) {
+    shape.instruction_count += bb->instructions.size();
+    shape.edge_count += get_successors(bin, bb).size();
+  }
+
+  for (auto const sym : bin.symbols()) {
+    if (sym->type == symbol_type::import)
+      ++shape.import_count;
+  }
+
+  shape.data_block_count = bin.data_blocks().size();
+  for (auto const db : bin.data_blocks())
+    shape.data_size += db->bytes.size();
+
+  return shape;
+}
+
+// Compare the blocks and data of the original analysis with the analysis
+// of the image that was created from it.
+static void compare_binaries(disassembled_binary const& first,
+    disassembled_binary const& second, roundtrip_result& result) {
+  auto const mismatch = [&](char const* const format, auto const... args) {
+    char buffer[256] = {};
+    std::snprintf(buffer, sizeof(buffer), format, args...);
+    result.mismatches.push_back(buffer);
+  };
+
+  if (result.first.block_count != result.second.block_count) {
+    mismatch("block count: %llu -> %llu",
+      static_cast<unsigned long long>(result.first.block_count),
+      static_cast<unsigned long long>(result.second.block_count));
+  }
+
+  if (result.first.edge_count != result.second.edge_count) {
+    mismatch("edge count: %llu -> %llu",
+      static_cast<unsigned long long>(result.first.edge_count),
+      static_cast<unsigned long long>(result.second.edge_count));
+  }
+
+  if (result.first.import_count != result.second.import_count) {
+    mismatch("import count: %llu -> %llu",
+      static_cast<unsigned long long>(result.first.import_count),
+      static_cast<unsigned long long>(result.second.import_count));
+  }
+
+  // Both analyses sort blocks by RVA, and create() emits blocks in order,
+  // so the blocks should line up one-to-one. The only expected difference
+  // is the JMP that gets added when a fallthrough target isn't adjacent.
+  auto const& first_blocks  = first.basic_blocks();
+  auto const& second_blocks = second.basic_blocks();
+
+  for (std::size_t i = 0; i < (std::min)(first_blocks.size(),
+      second_blocks.size()); ++i) {
+    auto const a = first_blocks[i];
+    auto const b = second_blocks[i];
+
+    auto expected = a->instructions.size();
+    if (a->fallthrough_target && (i + 1 >= first_blocks.size() ||
+        first_blocks[i + 1]->sym_id != a->fallthrough_target ||
+        first_blocks[i + 1]->padding))
+      ++expected;
+
+    if (b->instructions.size() != expected) {
+      mismatch("block #%zu instruction count: %zu -> %zu",
+        i, a->instructions.size(), b->instructions.size());
+      break;
+    }
+
+    if (get_successors(first, a).size() != get_successors(second, b).size()) {
+      mismatch("block #%zu successor count: %zu -> %zu", i,
+        get_successors(first, a).size(), get_successors(second, b).size());
+      break;
+    }
+  }
+
+  // create() emits every data block as its own section before anything
+  // else, so the first N data blocks of the second analysis should match.
+  // Pointers are skipped, since they get relocated.
+  auto const& first_dbs  = first.data_blocks();
+  auto const& second_dbs = second.data_blocks();
+
+  if (second_dbs.size() < first_dbs.size()) {
+    mismatch("data block count: %zu -> %zu", first_dbs.size(), second_dbs.size());
+    return;
+  }
+
+  // The location of every pointer in each of the original data blocks.
+  std::unordered_map<data_block const*, std::vector<std::uint32_t>> pointers = {};
+  for (auto const sym : first.symbols()) {
+    if (sym->type == symbol_type::data && sym->target)
+      pointers[sym->db].push_back(sym->db_offset);
+  }
+
+  for (std::size_t i = 0; i < first_dbs.size(); ++i) {
+    auto bytes_a = first_dbs[i]->bytes;
+    auto bytes_b = second_dbs[i]->bytes;
+
+    if (bytes_a.size() != bytes_b.size()) {
+      mismatch("data block #%zu size: %zu -> %zu", i, bytes_a.size(), bytes_b.size());
+      continue;
+    }
+
+    if (auto const it = pointers.find(first_dbs[i]); it != end(pointers)) {
+      for (auto const offset : it->second) {
+        if (offset + 8 > bytes_a.size())
+          continue;
+
+        std::memset(&bytes_a[offset], 0, 8);
+        std::memset(&bytes_b[offset], 0, 8);
+      }
+    }
+
+    if (bytes_a != bytes_b)
+      mismatch("data block #%zu contents differ", i);
+  }
+}
+
+// Run the round trip on an image that is already in memory.
+roundtrip_result run_roundtrip(std::vector<std::uint8_t> const& image) {
+  using clock = std::chrono::steady_clock;
+
+  auto const seconds_since = [](clock::time_point const start) {
+    return std::chrono::duration<double>(clock::now() - start).count();
+  };
+
+  roundtrip_result result = {};
+  result.input_size = image.size();
+
+  auto start = clock::now();
+  auto const first = disassemble(image);
+  result.disassemble_time = seconds_since(start);
+
+  if (!first)
+    return result;
+
+  result.first = get_binary_shape(*first);
+
+  start = clock::now();
+  auto const output = first->create();
+  result.create_time = seconds_since(start);
+
+  if (output.empty())
+    return result;
+
+  result.output_size = output.size();
+
+  start = clock::now();
+  auto const second = disassemble(output);
+  result.redisassemble_time = seconds_since(start);
+
+  if (!second)
+    return result;
+
+  result.second    = get_binary_shape(*second);
+  result.completed = true;
+
+  compare_binaries(*first, *second, result);
+
+  return result;
+}
+
+// Create a synthetic PE file.
+std::vector<std::uint8_t> create_synthetic_pe(
+    std::uint32_t const seed, std::uint32_t const function_count) {
+  std::mt19937 rng(seed);
+
+  binary bin = {};
+
+  // A counter for every function.
+  auto const counters = bin.create_data_block(function_count * 8, 8);
+  counters->read_only = false;
+
+  // A table that points to every function, which needs base relocs.
+  auto const table = bin.create_data_block(function_count * 8, 8);
+  table->read_only = true;
+
+  std::vector<basic_block*> functions = {};
+
+  // The final order of every block, so that each function's blocks end up
+  // next to each other.
+  std::vector<basic_block*> layout = {};
+
+  for (std::uint32_t i = 0; i < function_count; ++i) {
+    char name[32] = {};
+    std::snprintf(name, sizeof(name), "synthetic_%u", i);
+    functions.push_back(bin.create_basic_block(name));
+    bin.export_symbol(functions.back()->sym_id);
+  }
+
+  for (std::uint32_t i = 0; i < function_count; ++i) {
+    auto const entry = functions[i];
+    auto const loop  = bin.create_basic_block();
+    auto const exit  = bin.create_basic_block();
+
+    layout.insert(end(layout), { entry, loop, exit });
+
+    auto const counter = bin.create_symbol(symbol_type::data);
+    counter->db        = counters;
+    counter->db_offset = i * 8;
+    counter->target    = null_symbol_id;
+
+    auto const pointer = bin.create_symbol(symbol_type::data);
+    pointer->db        = table;
+    pointer->db_offset = i * 8;
+    pointer->target    = entry->sym_id;
+
+    // XOR EAX, EAX
+    // MOV ECX, iterations
+    entry->push(bin.instr("\x31\xC0"));
+    entry->push(bin.instr("\xB9", static_cast<std::uint32_t>(1 + rng() % 64)));
+    entry->fallthrough_target = loop->sym_id;
+
+    // ADD RAX, RCX
+    // INC QWORD PTR [counter]
+    // DEC ECX
+    // JNZ loop
+    loop->push(bin.instr("\x48\x01\xC8"));
+    loop->push(bin.instr("\x48\xFF\x05", counter));
+    loop->push(bin.instr("\xFF\xC9"));
+    loop->push(bin.instr("\x0F\x85", loop));
+    loop->fallthrough_target = exit->sym_id;
+
+    // CALL a later function, so that the call graph stays acyclic.
+    if (i + 1 < function_count && rng() % 2)
+      exit->push(bin.instr("\xE8", functions[i + 1 + rng() % (function_count - i - 1)]));
+
+    // RET
+    exit->push(bin.instr("\xC3"));
+  }
+
+  bin.basic_blocks().assign(begin(layout), end(layout));
+
+  if (!functions.empty())
+    bin.entrypoint(functions.front());
+
+  return bin.create();
+}
+
+// Print the result of a round trip.
+void print_roundtrip_result(char const* const name, roundtrip_result const& result) {
+  std::printf("[+] %s:\n", name);
+
+  if (!result.completed) {
+    std::printf("[!]   Round trip failed.\n");
+    return;
+  }
+
+  auto const rate = [](double const amount, double const seconds) {
+    return seconds > 0.0 ? amount / seconds : 0.0;
+  };
+
+  std::printf("[+]   Blocks: %llu -> %llu  Instructions: %llu -> %llu  Edges: %llu -> %llu\n",
+    static_cast<unsigned long long>(result.first.block_count),
+    static_cast<unsigned long long>(result.second.block_count),
+    static_cast<unsigned long long>(result.first.instruction_count),
+    static_cast<unsigned long long>(result.second.instruction_count),
+    static_cast<unsigned long long>(result.first.edge_count),
+    static_cast<unsigned long long>(result.second.edge_count));
+
+  std::printf("[+]   Disassemble:   %9.3f ms  %9.2f MB/s  %12.0f instructions/s\n",
+    result.disassemble_time * 1000.0,
+    rate(result.input_size / 1e6, result.disassemble_time),
+    rate(static_cast<double>(result.first.instruction_count), result.disassemble_time));
+  std::printf("[+]   Create:        %9.3f ms  %9.2f MB/s  %12.0f instructions/s\n",
+    result.create_time * 1000.0,
+    rate(result.output_size / 1e6, result.create_time),
+    rate(static_cast<double>(result.first.instruction_count), result.create_time));
+  std::printf("[+]   Redisassemble: %9.3f ms  %9.2f MB/s  %12.0f instructions/s\n",
+    result.redisassemble_time * 1000.0,
+    rate(result.output_size / 1e6, result.redisassemble_time),
+    rate(static_cast<double>(result.second.instruction_count), result.redisassemble_time));
+
+  std::printf("[+]   Size: %llu -> %llu bytes (%.2fx)\n",
+    static_cast<unsigned long long>(result.input_size),
+    static_cast<unsigned long long>(result.output_size),
+    result.input_size ? static_cast<double>(result.output_size) / result.input_size : 0.0);
+
+  if (result.mismatches.empty())
+    std::printf("[+]   Stable.\n");
+
+  for (auto const& mismatch : result.mismatches)
+    std::printf("[!]   Mismatch: %s\n", mismatch.c_str());
+}
+
+} // namespace chum
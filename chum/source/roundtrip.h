@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace chum {
+
+// A summary of the shape of a disassembled binary, for comparing two
+// analyses of (what should be) the same program.
+struct binary_shape {
+  std::uint64_t block_count       = 0;
+  std::uint64_t instruction_count = 0;
+  std::uint64_t edge_count        = 0;
+  std::uint64_t function_count    = 0;
+  std::uint64_t import_count      = 0;
+  std::uint64_t export_count      = 0;
+  std::uint64_t data_block_count  = 0;
+  std::uint64_t data_size         = 0;
+};
+
+// The result of running disassemble() -> create() -> disassemble() on a
+// single image.
+struct roundtrip_result {
+  // Whether every leg of the round trip succeeded.
+  bool completed = false;
+
+  // Every difference that was found between the two analyses. The round
+  // trip is stable if this is empty.
+  std::vector<std::string> mismatches = {};
+
+  binary_shape first  = {};
+  binary_shape second = {};
+
+  // The size of the input image and the image that was created from it.
+  std::uint64_t input_size  = 0;
+  std::uint64_t output_size = 0;
+
+  // The time that each leg took, in seconds.
+  double disassemble_time   = 0.0;
+  double create_time        = 0.0;
+  double redisassemble_time = 0.0;
+};
+
+// Run the round trip on an image that is already in memory.
+roundtrip_result run_roundtrip(std::vector<std::uint8_t> const& image);
+
+// Create a synthetic PE file, made up of small functions with loops, calls,
+// RIP-relative data accesses, and a relocated pointer table. Every function
+// is exported. The same seed always produces the same image.
+std::vector<std::uint8_t> create_synthetic_pe(
+  std::uint32_t seed, std::uint32_t function_count = 64);
+
+// Print the result of a round trip.
+void print_roundtrip_result(char const* name, roundtrip_result const& result);
+
+} // namespace chum
@@ -0,0 +1,217 @@
+#include "scaling.h"
+#include "disassembler.h"
+#include "coverage.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace chum {
+
+// A simple mutex-protected job queue that keeps track of how often it
+// is contended.
+class job_queue {
+public:
+  explicit job_queue(std::size_t const count)
+    : count_(count) {}
+
+  // Claim the next job. Returns false if there are no jobs left.
+  bool pop(std::size_t& job) {
+    if (!mutex_.try_lock()) {
+      ++contended_;
+      mutex_.lock();
+    }
+
+    ++acquisitions_;
+
+    bool const available = next_ < count_;
+    if (available)
+      job = next_++;
+
+    mutex_.unlock();
+    return available;
+  }
+
+  std::uint64_t acquisitions() const { return acquisitions_; }
+  std::uint64_t contended() const { return contended_; }
+
+private:
+  std::mutex mutex_ = {};
+
+  std::size_t next_  = 0;
+  std::size_t count_ = 0;
+
+  std::atomic<std::uint64_t> acquisitions_ = 0;
+  std::atomic<std::uint64_t> contended_    = 0;
+};
+
+// Add one set of operation counters to another.
+static void add_op_counters(op_counters& dst, op_counters const& src) {
+  dst.symbol_allocations += src.symbol_allocations;
+  dst.rva_claims         += src.rva_claims;
+  dst.queue_pops         += src.queue_pops;
+}
+
+// Run a job on every index with the specified number of threads.
+template <typename Fn>
+static phase_scaling run_phase(thread_sweep_point& point,
+    std::size_t const job_count, Fn const& fn) {
+  using clock = std::chrono::steady_clock;
+
+  phase_scaling phase = {};
+  job_queue queue(job_count);
+  std::mutex ops_mutex = {};
+
+  auto const worker = [&] {
+    thread_op_counters() = {};
+
+    for (std::size_t job = 0; queue.pop(job);)
+      fn(job);
+
+    std::lock_guard<std::mutex> lock(ops_mutex);
+    add_op_counters(phase.ops, thread_op_counters());
+  };
+
+  auto const start = clock::now();
+
+  std::vector<std::thread> threads = {};
+  for (std::uint32_t i = 0; i < point.thread_count; ++i)
+    threads.emplace_back(worker);
+
+  for (auto& thread : threads)
+    thread.join();
+
+  phase.time = std::chrono::duration<double>(clock::now() - start).count();
+
+  point.queue_acquisitions += queue.acquisitions();
+  point.queue_contended    += queue.contended();
+
+  return phase;
+}
+
+// Fill in the speedup and efficiency of a phase, relative to a baseline.
+static void calculate_scaling(phase_scaling& phase, std::uint32_t const threads,
+    phase_scaling const& baseline, std::uint32_t const baseline_threads) {
+  if (phase.time <= 0.0)
+    return;
+
+  phase.speedup    = baseline.time / phase.time;
+  phase.efficiency = phase.speedup * baseline_threads / threads;
+}
+
+// Run the disassemble, pass, and create phases on many copies of the input
+// images, at every thread count.
+std::vector<thread_sweep_point> run_thread_sweep(
+    std::vector<std::vector<std::uint8_t>> const& images,
+    thread_sweep_options const& options) {
+  std::vector<thread_sweep_point> points = {};
+
+  auto const job_count = images.size() * options.jobs_per_image;
+
+  for (auto const thread_count : options.thread_counts) {
+    if (thread_count == 0)
+      continue;
+
+    auto& point = points.emplace_back();
+    point.thread_count = thread_count;
+
+    std::vector<std::optional<disassembled_binary>> binaries(job_count);
+    std::vector<std::vector<std::uint8_t>> outputs(job_count);
+    std::vector<std::uint8_t> failed(job_count, 0);
+
+    point.disassemble = run_phase(point, job_count, [&](std::size_t const job) {
+      binaries[job] = disassemble(images[job % images.size()]);
+      if (!binaries[job])
+        failed[job] = 1;
+    });
+
+    point.passes = run_phase(point, job_count, [&](std::size_t const job) {
+      if (!binaries[job])
+        return;
+
+      edge_coverage_options coverage_options = {};
+      coverage_options.seed = static_cast<std::uint32_t>(job + 1);
+      instrument_edge_coverage(*binaries[job], coverage_options);
+    });
+
+    point.create = run_phase(point, job_count, [&](std::size_t const job) {
+      if (!binaries[job])
+        return;
+
+      outputs[job] = binaries[job]->create();
+      if (outputs[job].empty())
+        failed[job] = 1;
+
+      // Free the memory as soon as possible.
+      binaries[job].reset();
+    });
+
+    for (auto const f : failed)
+      point.failed_jobs += f;
+  }
+
+  if (points.empty())
+    return points;
+
+  auto const& baseline = points.front();
+  for (auto& point : points) {
+    calculate_scaling(point.disassemble, point.thread_count,
+      baseline.disassemble, baseline.thread_count);
+    calculate_scaling(point.passes, point.thread_count,
+      baseline.passes, baseline.thread_count);
+    calculate_scaling(point.create, point.thread_count,
+      baseline.create, baseline.thread_count);
+  }
+
+  return points;
+}
+
+// Print the speedup and efficiency curves of a thread sweep.
+void print_thread_sweep(std::vector<thread_sweep_point> const& points) {
+  std::printf("[+] Thread sweep (%zu points):\n", points.size());
+  std::printf("[+]   %-7s | %-26s | %-26s | %-26s | %-21s\n", "Threads",
+    "Disassemble (ms/x/eff)", "Passes (ms/x/eff)", "Create (ms/x/eff)",
+    "Queue (locks/waits)");
+
+  for (auto const& point : points) {
+    std::printf("[+]   %-7u", point.thread_count);
+
+    for (auto const phase : { &point.disassemble, &point.passes, &point.create }) {
+      std::printf(" | %10.2f %6.2fx %6.1f%%", phase->time * 1000.0,
+        phase->speedup, phase->efficiency * 100.0);
+    }
+
+    std::printf(" | %10llu %10llu\n",
+      static_cast<unsigned long long>(point.queue_acquisitions),
+      static_cast<unsigned long long>(point.queue_contended));
+
+    if (point.failed_jobs)
+      std::printf("[!]     %llu job(s) failed.\n",
+        static_cast<unsigned long long>(point.failed_jobs));
+  }
+
+  // The operation counters don't depend on the thread count, so only the
+  // first point is printed.
+#ifdef CHUM_OP_COUNTERS
+  if (!points.empty()) {
+    auto const& point = points.front();
+
+    std::printf("[+]   Shared structure operations:\n");
+    for (auto const& [name, phase] : { std::make_pair("Disassemble", &point.disassemble),
+        std::make_pair("Passes", &point.passes), std::make_pair("Create", &point.create) }) {
+      std::printf("[+]     %-11s Symbol allocations: %-10llu RVA claims: %-10llu Queue pops: %llu\n",
+        name, static_cast<unsigned long long>(phase->ops.symbol_allocations),
+        static_cast<unsigned long long>(phase->ops.rva_claims),
+        static_cast<unsigned long long>(phase->ops.queue_pops));
+    }
+  }
+#else
+  std::printf("[+]   Shared structure operations aren't counted "
+    "(configure with -DCHUM_OP_COUNTERS=ON).\n");
+#endif
+}
+
+} // namespace chum
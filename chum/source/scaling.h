@@ -0,0 +1,61 @@
+#pragma once
+
+#include "util.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace chum {
+
+struct thread_sweep_options {
+  // Every thread count to measure. Speedup and efficiency are relative to
+  // the first entry.
+  std::vector<std::uint32_t> thread_counts = { 1, 2, 4, 8, 16, 32, 64 };
+
+  // The number of jobs to run for every input image, so that there is
+  // enough work to keep every thread busy.
+  std::uint32_t jobs_per_image = 4;
+};
+
+// The measurements for a single phase at a single thread count.
+struct phase_scaling {
+  // The wall-clock time of the phase, in seconds.
+  double time = 0.0;
+
+  // The speedup and efficiency relative to the first thread count.
+  double speedup    = 0.0;
+  double efficiency = 0.0;
+
+  // The sum of every worker's operation counters.
+  op_counters ops = {};
+};
+
+struct thread_sweep_point {
+  std::uint32_t thread_count = 0;
+
+  // Disassembly, an instrumentation pass (edge coverage), and emission.
+  phase_scaling disassemble = {};
+  phase_scaling passes      = {};
+  phase_scaling create      = {};
+
+  // The number of times that a worker took the job queue lock, and the
+  // number of times that it had to wait for another worker to release it.
+  std::uint64_t queue_acquisitions = 0;
+  std::uint64_t queue_contended    = 0;
+
+  // The number of jobs that failed in any phase.
+  std::uint64_t failed_jobs = 0;
+};
+
+// Run the disassemble, pass, and create phases on many copies of the input
+// images, at every thread count. Every job works on its own binary, so this
+// measures how well independent jobs scale (memory bandwidth, allocator
+// contention, etc), which is the upper bound for parallelizing a single job.
+std::vector<thread_sweep_point> run_thread_sweep(
+  std::vector<std::vector<std::uint8_t>> const& images,
+  thread_sweep_options const& options = {});
+
+// Print the speedup and efficiency curves of a thread sweep.
+void print_thread_sweep(std::vector<thread_sweep_point> const& points);
+
+} // namespace chum
@@ -0,0 +1,830 @@
+#include "shard.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#include <Windows.h>
+#include <Zydis/Zydis.h>
+#include <fcntl.h>
+#include <io.h>
+
+namespace chum {
+
+// The magic number at the start of a serialized shard result ('CHSH').
+static constexpr std::uint32_t shard_result_magic = 0x48534843;
+
+// The magic number at the start of the serialized blocks of a shard ('CHSB').
+static constexpr std::uint32_t shard_blocks_magic = 0x42534843;
+
+// An executable section in a raw image.
+struct exec_section {
+  std::uint32_t rva         = 0;
+  std::uint32_t raw_size    = 0;
+  std::uint32_t raw_offset  = 0;
+};
+
+// Get the NT header of a raw image, or null if it isn't a valid x86-64 PE.
+static IMAGE_NT_HEADERS const* get_nt_header(std::vector<std::uint8_t> const& image) {
+  if (image.size() < sizeof(IMAGE_DOS_HEADER))
+    return nullptr;
+
+  auto const dos_header = reinterpret_cast<IMAGE_DOS_HEADER const*>(&image[0]);
+  if (dos_header->e_magic != IMAGE_DOS_SIGNATURE || dos_header->e_lfanew < 0 ||
+      image.size() < dos_header->e_lfanew + sizeof(IMAGE_NT_HEADERS))
+    return nullptr;
+
+  auto const nt_header = reinterpret_cast<IMAGE_NT_HEADERS const*>(
+    &image[dos_header->e_lfanew]);
+  if (nt_header->Signature != IMAGE_NT_SIGNATURE ||
+      nt_header->FileHeader.Machine != IMAGE_FILE_MACHINE_AMD64)
+    return nullptr;
+
+  if (image.size() < dos_header->e_lfanew + sizeof(IMAGE_NT_HEADERS) +
+      nt_header->FileHeader.NumberOfSections * sizeof(IMAGE_SECTION_HEADER))
+    return nullptr;
+
+  return nt_header;
+}
+
+// Get every executable section in a raw image.
+static std::vector<exec_section> get_exec_sections(
+    std::vector<std::uint8_t> const& image) {
+  std::vector<exec_section> sections = {};
+
+  auto const nt_header = get_nt_header(image);
+  if (!nt_header)
+    return sections;
+
+  auto const headers = reinterpret_cast<IMAGE_SECTION_HEADER const*>(nt_header + 1);
+  for (std::size_t i = 0; i < nt_header->FileHeader.NumberOfSections; ++i) {
+    auto const& sec = headers[i];
+    if (!(sec.Characteristics & IMAGE_SCN_MEM_EXECUTE))
+      continue;
+
+    // Ignore any raw data that is past the end of the file.
+    if (sec.PointerToRawData >= image.size())
+      continue;
+
+    auto const raw_size = static_cast<std::uint32_t>((std::min)(
+      std::size_t(sec.SizeOfRawData), image.size() - sec.PointerToRawData));
+
+    sections.push_back({ sec.VirtualAddress, raw_size, sec.PointerToRawData });
+  }
+
+  return sections;
+}
+
+// Get the executable section that contains an RVA.
+static exec_section const* find_exec_section(
+    std::vector<exec_section> const& sections, std::uint32_t const rva) {
+  for (auto const& sec : sections) {
+    if (rva >= sec.rva && rva < sec.rva + sec.raw_size)
+      return &sec;
+  }
+
+  return nullptr;
+}
+
+// Split the .pdata functions of a raw image into shards of roughly equal
+// code size.
+std::vector<shard> plan_shards(std::vector<std::uint8_t> const& image,
+    std::size_t const shard_count) {
+  auto const nt_header = get_nt_header(image);
+  if (!nt_header || shard_count == 0)
+    return {};
+
+  auto const image_size = nt_header->OptionalHeader.SizeOfImage;
+  auto const sections   = get_exec_sections(image);
+
+  // Collect every .pdata function that lands in an executable section.
+  std::vector<RUNTIME_FUNCTION> functions = {};
+
+  auto const& pdata =
+    nt_header->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXCEPTION];
+
+  if (pdata.VirtualAddress && pdata.Size > 0) {
+    if (auto const offset = pe_rva_to_file_offset(image, pdata.VirtualAddress,
+        pdata.Size)) {
+      auto const count = pdata.Size / sizeof(RUNTIME_FUNCTION);
+      for (std::size_t i = 0; i < count; ++i) {
+        RUNTIME_FUNCTION func = {};
+        std::memcpy(&func, &image[offset + i * sizeof(func)], sizeof(func));
+
+        if (find_exec_section(sections, func.BeginAddress) &&
+            func.EndAddress > func.BeginAddress)
+          functions.push_back(func);
+      }
+    }
+  }
+
+  std::sort(begin(functions), end(functions),
+      [](RUNTIME_FUNCTION const& left, RUNTIME_FUNCTION const& right) {
+    return left.BeginAddress < right.BeginAddress;
+  });
+
+  std::uint64_t total_size = 0;
+  for (auto const& func : functions)
+    total_size += func.EndAddress - func.BeginAddress;
+
+  // Fill each shard until it holds its share of the code. Shards always
+  // end at a function boundary.
+  std::vector<shard> shards = {};
+  shards.emplace_back();
+
+  std::uint64_t shard_size = 0;
+  for (auto const& func : functions) {
+    if (shard_size * shard_count >= total_size && shards.size() < shard_count &&
+        !shards.back().functions.empty()) {
+      shards.back().end = func.BeginAddress;
+      shards.push_back({ func.BeginAddress, 0, {} });
+      shard_size = 0;
+    }
+
+    // Chained unwind info produces multiple entries for the same function.
+    if (shards.back().functions.empty() ||
+        shards.back().functions.back() != func.BeginAddress)
+      shards.back().functions.push_back(func.BeginAddress);
+
+    shard_size += func.EndAddress - func.BeginAddress;
+  }
+
+  shards.back().end = image_size;
+
+  return shards;
+}
+
+// Find the block boundaries in a shard.
+shard_result analyze_shard(std::vector<std::uint8_t> const& image,
+    shard const& sh, std::vector<std::uint32_t> const& extra_roots,
+    bool const include_functions) {
+  shard_result result = {};
+
+  ZydisDecoder decoder;
+  if (ZYAN_FAILED(ZydisDecoderInit(&decoder,
+      ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64)))
+    return result;
+
+  auto const sections = get_exec_sections(image);
+
+  // 1 if an instruction was decoded at this RVA, 2 if it is a block start.
+  std::vector<std::uint8_t> visited(sh.end - sh.begin, 0);
+
+  std::vector<std::uint32_t> queue = {};
+
+  // Add a block start to the queue, or remember it as an external target if
+  // it belongs to another shard.
+  auto const add_target = [&](std::uint32_t const rva) {
+    if (!find_exec_section(sections, rva))
+      return;
+
+    if (rva < sh.begin || rva >= sh.end) {
+      result.external_targets.push_back(rva);
+      return;
+    }
+
+    if (visited[rva - sh.begin] & 2)
+      return;
+
+    visited[rva - sh.begin] |= 2;
+    result.block_rvas.push_back(rva);
+    queue.push_back(rva);
+  };
+
+  if (include_functions) {
+    for (auto const rva : sh.functions)
+      add_target(rva);
+  }
+
+  for (auto const rva : extra_roots)
+    add_target(rva);
+
+  while (!queue.empty()) {
+    auto rva = queue.back();
+    queue.pop_back();
+
+    auto const sec = find_exec_section(sections, rva);
+    assert(sec != nullptr);
+
+    auto const sec_end = sec->rva + sec->raw_size;
+
+    for (bool first = true; rva < sec_end; first = false) {
+      // We ran into the next shard.
+      if (rva >= sh.end) {
+        result.external_targets.push_back(rva);
+        break;
+      }
+
+      // This code has already been decoded.
+      if (visited[rva - sh.begin] & 1)
+        break;
+
+      // We fell through into another block, which is already in the queue.
+      if (!first && (visited[rva - sh.begin] & 2))
+        break;
+
+      visited[rva - sh.begin] |= 1;
+
+      auto const offset = sec->raw_offset + (rva - sec->rva);
+
+      ZydisDecoderContext decoded_ctx;
+      ZydisDecodedInstruction decoded_instr;
+      if (ZYAN_FAILED(ZydisDecoderDecodeInstruction(&decoder, &decoded_ctx,
+          &image[offset], sec_end - rva, &decoded_instr)))
+        break;
+
+      auto const next_rva = static_cast<std::uint32_t>(rva + decoded_instr.length);
+
+      if (decoded_instr.attributes & ZYDIS_ATTRIB_IS_RELATIVE) {
+        // Direct branches and calls.
+        if (decoded_instr.raw.imm[0].is_relative) {
+          add_target(static_cast<std::uint32_t>(
+            next_rva + decoded_instr.raw.imm[0].value.s));
+        }
+        // LEA instructions are often used for accessing code.
+        else if (decoded_instr.mnemonic == ZYDIS_MNEMONIC_LEA &&
+                 decoded_instr.raw.modrm.mod == 0 &&
+                 decoded_instr.raw.modrm.rm  == 5) {
+          add_target(static_cast<std::uint32_t>(
+            next_rva + decoded_instr.raw.disp.value));
+        }
+      }
+
+      // Terminating instructions end the block.
+      if (decoded_instr.meta.category == ZYDIS_CATEGORY_RET       ||
+          decoded_instr.meta.category == ZYDIS_CATEGORY_COND_BR   ||
+          decoded_instr.meta.category == ZYDIS_CATEGORY_UNCOND_BR ||
+         (decoded_instr.meta.category == ZYDIS_CATEGORY_INTERRUPT &&
+          decoded_instr.raw.imm[0].value.s == 0x29)) {
+        // Conditional branches fall through into a new block.
+        if (decoded_instr.meta.category == ZYDIS_CATEGORY_COND_BR)
+          add_target(next_rva);
+
+        break;
+      }
+
+      rva = next_rva;
+    }
+  }
+
+  std::sort(begin(result.block_rvas), end(result.block_rvas));
+
+  auto& external = result.external_targets;
+  std::sort(begin(external), end(external));
+  external.erase(std::unique(begin(external), end(external)), end(external));
+
+  return result;
+}
+
+// Decode every block in a shard that starts at one of the block RVAs.
+std::vector<prebuilt_block> build_shard_blocks(std::vector<std::uint8_t> const& image,
+    shard const& sh, std::vector<std::uint32_t> const& block_rvas) {
+  std::vector<prebuilt_block> blocks = {};
+
+  ZydisDecoder decoder;
+  if (ZYAN_FAILED(ZydisDecoderInit(&decoder,
+      ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64)))
+    return blocks;
+
+  auto const sections = get_exec_sections(image);
+
+  for (auto const start : block_rvas) {
+    if (start < sh.begin || start >= sh.end)
+      continue;
+
+    auto const sec = find_exec_section(sections, start);
+    if (!sec)
+      continue;
+
+    auto const sec_end = sec->rva + sec->raw_size;
+
+    prebuilt_block block = {};
+    block.rva = start;
+
+    for (auto rva = start; rva < sec_end;) {
+      auto const offset = sec->raw_offset + (rva - sec->rva);
+
+      ZydisDecoderContext decoded_ctx;
+      ZydisDecodedInstruction decoded_instr;
+      if (ZYAN_FAILED(ZydisDecoderDecodeInstruction(&decoder, &decoded_ctx,
+          &image[offset], sec_end - rva, &decoded_instr)))
+        break;
+
+      auto const next_rva = static_cast<std::uint32_t>(rva + decoded_instr.length);
+
+      prebuilt_instruction instr = {};
+      instr.length = decoded_instr.length;
+      std::memcpy(instr.bytes, &image[offset], instr.length);
+
+      if (decoded_instr.attributes & ZYDIS_ATTRIB_IS_RELATIVE) {
+        // Direct branches and calls.
+        if (decoded_instr.raw.imm[0].is_relative) {
+          instr.operand = decoded_instr.meta.category == ZYDIS_CATEGORY_CALL ?
+            prebuilt_operand::call : prebuilt_operand::branch;
+          instr.operand_offset = decoded_instr.raw.imm[0].offset;
+          instr.operand_size   = decoded_instr.raw.imm[0].size;
+          instr.target_rva     = static_cast<std::uint32_t>(
+            next_rva + decoded_instr.raw.imm[0].value.s);
+        }
+        // RIP relative memory references.
+        else if (decoded_instr.raw.disp.offset != 0 &&
+                 decoded_instr.raw.modrm.mod   == 0 &&
+                 decoded_instr.raw.modrm.rm    == 5) {
+          instr.operand = decoded_instr.mnemonic == ZYDIS_MNEMONIC_LEA ?
+            prebuilt_operand::lea : prebuilt_operand::memory;
+          instr.operand_offset = decoded_instr.raw.disp.offset;
+          instr.operand_size   = decoded_instr.raw.disp.size;
+          instr.target_rva     = static_cast<std::uint32_t>(
+            next_rva + decoded_instr.raw.disp.value);
+        }
+        // Leave this instruction to the disassembler, so that it fails the
+        // same way that it would without shards.
+        else {
+          block.fallthrough_rva = rva;
+          break;
+        }
+      }
+
+      block.instructions.push_back(instr);
+
+      // Terminating instructions end the block.
+      if (decoded_instr.meta.category == ZYDIS_CATEGORY_RET       ||
+          decoded_instr.meta.category == ZYDIS_CATEGORY_COND_BR   ||
+          decoded_instr.meta.category == ZYDIS_CATEGORY_UNCOND_BR ||
+         (decoded_instr.meta.category == ZYDIS_CATEGORY_INTERRUPT &&
+          decoded_instr.raw.imm[0].value.s == 0x29)) {
+        // Conditional branches fall through into a new block.
+        if (decoded_instr.meta.category == ZYDIS_CATEGORY_COND_BR)
+          block.fallthrough_rva = next_rva;
+
+        break;
+      }
+
+      // We ran into the next block, or into the next shard.
+      if (next_rva >= sh.end ||
+          std::binary_search(begin(block_rvas), end(block_rvas), next_rva)) {
+        block.fallthrough_rva = next_rva;
+        break;
+      }
+
+      rva = next_rva;
+    }
+
+    // The disassembler decodes (and reports) blocks that failed here.
+    if (!block.instructions.empty())
+      blocks.push_back(std::move(block));
+  }
+
+  return blocks;
+}
+
+// Serialize the result of a shard, so that it can be sent over a pipe.
+std::vector<std::uint8_t> serialize_shard_result(shard_result const& result) {
+  std::uint32_t const header[3] = {
+    shard_result_magic,
+    static_cast<std::uint32_t>(result.block_rvas.size()),
+    static_cast<std::uint32_t>(result.external_targets.size())
+  };
+
+  std::vector<std::uint8_t> buffer(sizeof(header) + 4 *
+    (result.block_rvas.size() + result.external_targets.size()));
+
+  std::memcpy(buffer.data(), header, sizeof(header));
+
+  if (!result.block_rvas.empty()) {
+    std::memcpy(buffer.data() + sizeof(header), result.block_rvas.data(),
+      result.block_rvas.size() * 4);
+  }
+
+  if (!result.external_targets.empty()) {
+    std::memcpy(buffer.data() + sizeof(header) + result.block_rvas.size() * 4,
+      result.external_targets.data(), result.external_targets.size() * 4);
+  }
+
+  return buffer;
+}
+
+// Parse a serialized shard result.
+std::optional<shard_result> parse_shard_result(std::vector<std::uint8_t> const& buffer) {
+  std::uint32_t header[3] = {};
+  if (buffer.size() < sizeof(header))
+    return {};
+
+  std::memcpy(header, buffer.data(), sizeof(header));
+  if (header[0] != shard_result_magic ||
+      buffer.size() != sizeof(header) + 4ull * (std::uint64_t(header[1]) + header[2]))
+    return {};
+
+  shard_result result = {};
+  result.block_rvas.resize(header[1]);
+  result.external_targets.resize(header[2]);
+
+  if (header[1]) {
+    std::memcpy(result.block_rvas.data(), buffer.data() + sizeof(header),
+      header[1] * 4ull);
+  }
+
+  if (header[2]) {
+    std::memcpy(result.external_targets.data(),
+      buffer.data() + sizeof(header) + header[1] * 4ull, header[2] * 4ull);
+  }
+
+  return result;
+}
+
+// Serialize the blocks that were built for a shard.
+std::vector<std::uint8_t> serialize_shard_blocks(std::vector<prebuilt_block> const& blocks) {
+  std::vector<std::uint8_t> buffer = {};
+
+  auto const write = [&](void const* const data, std::size_t const size) {
+    auto const bytes = static_cast<std::uint8_t const*>(data);
+    buffer.insert(end(buffer), bytes, bytes + size);
+  };
+
+  auto const block_count = static_cast<std::uint32_t>(blocks.size());
+  write(&shard_blocks_magic, 4);
+  write(&block_count, 4);
+
+  for (auto const& block : blocks) {
+    auto const instr_count = static_cast<std::uint32_t>(block.instructions.size());
+    write(&block.rva, 4);
+    write(&block.fallthrough_rva, 4);
+    write(&instr_count, 4);
+
+    // Instructions without a relative operand only need their bytes.
+    for (auto const& instr : block.instructions) {
+      write(&instr.length, 1);
+      write(&instr.operand, 1);
+
+      if (instr.operand != prebuilt_operand::none) {
+        write(&instr.operand_offset, 1);
+        write(&instr.operand_size, 1);
+        write(&instr.target_rva, 4);
+      }
+
+      write(instr.bytes, instr.length);
+    }
+  }
+
+  return buffer;
+}
+
+// Parse the serialized blocks of a shard.
+std::optional<std::vector<prebuilt_block>> parse_shard_blocks(
+    std::vector<std::uint8_t> const& buffer) {
+  std::size_t offset = 0;
+
+  auto const read = [&](void* const data, std::size_t const size) {
+    if (buffer.size() - offset < size)
+      return false;
+
+    std::memcpy(data, buffer.data() + offset, size);
+    offset += size;
+    return true;
+  };
+
+  std::uint32_t header[2] = {};
+  if (!read(header, sizeof(header)) || header[0] != shard_blocks_magic)
+    return {};
+
+  std::vector<prebuilt_block> blocks = {};
+
+  for (std::uint32_t i = 0; i < header[1]; ++i) {
+    prebuilt_block block = {};
+    std::uint32_t instr_count = 0;
+
+    if (!read(&block.rva, 4) || !read(&block.fallthrough_rva, 4) ||
+        !read(&instr_count, 4))
+      return {};
+
+    for (std::uint32_t j = 0; j < instr_count; ++j) {
+      prebuilt_instruction instr = {};
+
+      if (!read(&instr.length, 1) || !read(&instr.operand, 1) ||
+          instr.length == 0 || instr.length > sizeof(instr.bytes) ||
+          instr.operand > prebuilt_operand::lea)
+        return {};
+
+      if (instr.operand != prebuilt_operand::none) {
+        if (!read(&instr.operand_offset, 1) || !read(&instr.operand_size, 1) ||
+            !read(&instr.target_rva, 4))
+          return {};
+
+        // Memory references always have a 32-bit displacement.
+        auto const is_memory = instr.operand == prebuilt_operand::memory ||
+          instr.operand == prebuilt_operand::lea;
+        if ((instr.operand_size != 8 && instr.operand_size != 16 &&
+             instr.operand_size != 32) || (is_memory && instr.operand_size != 32) ||
+            instr.operand_offset + instr.operand_size / 8 > instr.length)
+          return {};
+      }
+
+      if (!read(instr.bytes, instr.length))
+        return {};
+
+      block.instructions.push_back(instr);
+    }
+
+    blocks.push_back(std::move(block));
+  }
+
+  if (offset != buffer.size())
+    return {};
+
+  return blocks;
+}
+
+// Run a shard worker and write the serialized result to stdout.
+int run_shard_worker(shard_task const task, char const* const path,
+    std::size_t const index, std::size_t const shard_count,
+    bool const include_functions, char const* const roots_path) {
+  auto const image = read_file_to_buffer(path);
+
+  // Every worker creates the same plan, so only the index needs to be sent.
+  auto const shards = plan_shards(image, shard_count);
+  if (index >= shards.size())
+    return 1;
+
+  std::vector<std::uint32_t> roots = {};
+  if (roots_path) {
+    auto const buffer = read_file_to_buffer(roots_path);
+    roots.resize(buffer.size() / 4);
+    if (!roots.empty())
+      std::memcpy(roots.data(), buffer.data(), roots.size() * 4);
+  }
+
+  auto const buffer = task == shard_task::build ?
+    serialize_shard_blocks(build_shard_blocks(image, shards[index], roots)) :
+    serialize_shard_result(analyze_shard(image, shards[index], roots, include_functions));
+
+  _setmode(_fileno(stdout), _O_BINARY);
+  std::fwrite(buffer.data(), 1, buffer.size(), stdout);
+  std::fflush(stdout);
+
+  return 0;
+}
+
+// Spawn a worker process for a single shard and read its serialized result
+// from a pipe.
+static std::optional<std::vector<std::uint8_t>> run_worker_process(
+    std::string const& worker_path, shard_task const task, char const* const path,
+    std::size_t const index, std::size_t const shard_count,
+    std::vector<std::uint32_t> const& roots, bool const include_functions) {
+  std::string roots_path = "";
+
+  // Roots are passed through a temporary file, since they can be far too
+  // big for a command line.
+  if (!roots.empty()) {
+    roots_path = (std::filesystem::temp_directory_path() / ("chum_shard_" +
+      std::to_string(GetCurrentProcessId()) + "_" + std::to_string(index) +
+      ".bin")).string();
+
+    std::ofstream file(roots_path, std::ios::binary);
+    file.write(reinterpret_cast<char const*>(roots.data()), roots.size() * 4);
+    if (!file)
+      return {};
+  }
+
+  auto command = "\"" + worker_path + "\" --shard-worker " +
+    (task == shard_task::build ? "build" : "discover") + " \"" + path + "\" " +
+    std::to_string(index) + " " + std::to_string(shard_count) +
+    (include_functions ? " 1" : " 0");
+  if (!roots_path.empty())
+    command += " \"" + roots_path + "\"";
+
+  // cmd.exe strips the outer quotes of the command.
+  command = "\"" + command + "\"";
+
+  auto const pipe = _popen(command.c_str(), "rb");
+  if (!pipe)
+    return {};
+
+  std::vector<std::uint8_t> buffer = {};
+  std::uint8_t chunk[0x1000];
+  for (std::size_t size = 0;
+       (size = std::fread(chunk, 1, sizeof(chunk), pipe)) > 0;)
+    buffer.insert(end(buffer), chunk, chunk + size);
+
+  auto const exit_code = _pclose(pipe);
+
+  if (!roots_path.empty())
+    std::filesystem::remove(roots_path);
+
+  if (exit_code != 0)
+    return {};
+
+  return buffer;
+}
+
+// Get the index of the shard that an RVA belongs to.
+static std::size_t find_shard(std::vector<shard> const& shards,
+    std::uint32_t const rva) {
+  auto const it = std::upper_bound(begin(shards), end(shards), rva,
+      [](std::uint32_t const value, shard const& sh) {
+    return value < sh.begin;
+  });
+
+  return it == begin(shards) ? 0 : (it - begin(shards)) - 1;
+}
+
+// Find the block boundaries of every shard, routing cross-shard targets to
+// their owners until no new targets are found.
+static bool discover_sharded_blocks(std::vector<std::uint8_t> const& image,
+    char const* const path, std::vector<shard> const& shards,
+    sharded_options const& options, std::vector<std::uint32_t>& block_rvas,
+    sharded_stats& stats) {
+  // The roots that will be sent to each shard in the next round.
+  std::vector<std::vector<std::uint32_t>> pending(shards.size());
+
+  // The entrypoint usually doesn't have a .pdata entry.
+  auto const entrypoint = get_nt_header(image)->OptionalHeader.AddressOfEntryPoint;
+  if (entrypoint)
+    pending[find_shard(shards, entrypoint)].push_back(entrypoint);
+
+  // Every target that has already been routed (so that no target is sent
+  // twice).
+  std::vector<std::uint8_t> routed(
+    get_nt_header(image)->OptionalHeader.SizeOfImage, 0);
+
+  for (bool first_round = true;; first_round = false) {
+    std::vector<std::size_t> active = {};
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+      if (first_round || !pending[i].empty())
+        active.push_back(i);
+    }
+
+    if (active.empty())
+      break;
+
+    ++stats.rounds;
+
+    std::vector<std::optional<shard_result>> results(shards.size());
+
+    if (options.worker_path.empty()) {
+      for (auto const i : active)
+        results[i] = analyze_shard(image, shards[i], pending[i], first_round);
+    }
+    else {
+      // Each thread waits on a single worker process.
+      std::vector<std::thread> threads = {};
+      for (auto const i : active) {
+        threads.emplace_back([&, i] {
+          // Functions are only used as roots in the first round. Later
+          // rounds only need to decode the code that other shards found.
+          if (auto const buffer = run_worker_process(options.worker_path,
+              shard_task::discover, path, i, shards.size(), pending[i], first_round))
+            results[i] = parse_shard_result(*buffer);
+        });
+      }
+
+      for (auto& thread : threads)
+        thread.join();
+    }
+
+    for (auto& roots : pending)
+      roots.clear();
+
+    // Collect the results and route external targets to their owners. The
+    // shards are processed in order so that the next round is deterministic.
+    for (auto const i : active) {
+      if (!results[i]) {
+        std::printf("[!] Shard %zu failed.\n", i);
+        return false;
+      }
+
+      for (auto const rva : results[i]->block_rvas) {
+        if (rva < routed.size())
+          routed[rva] = 1;
+      }
+
+      block_rvas.insert(end(block_rvas),
+        begin(results[i]->block_rvas), end(results[i]->block_rvas));
+
+      for (auto const rva : results[i]->external_targets) {
+        if (rva >= routed.size() || routed[rva])
+          continue;
+
+        routed[rva] = 1;
+        pending[find_shard(shards, rva)].push_back(rva);
+        ++stats.routed_targets;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Have every shard decode the blocks that start inside of it.
+static bool build_sharded_blocks(std::vector<std::uint8_t> const& image,
+    char const* const path, std::vector<shard> const& shards,
+    sharded_options const& options, std::vector<std::uint32_t> const& block_rvas,
+    std::vector<std::vector<prebuilt_block>>& shard_blocks) {
+  // The block RVAs that belong to each shard. Every worker needs these to
+  // know where its blocks end.
+  std::vector<std::vector<std::uint32_t>> roots(shards.size());
+  for (auto const rva : block_rvas)
+    roots[find_shard(shards, rva)].push_back(rva);
+
+  std::vector<std::optional<std::vector<prebuilt_block>>> results(shards.size());
+
+  if (options.worker_path.empty()) {
+    for (std::size_t i = 0; i < shards.size(); ++i)
+      results[i] = build_shard_blocks(image, shards[i], roots[i]);
+  }
+  else {
+    // Each thread waits on a single worker process.
+    std::vector<std::thread> threads = {};
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+      threads.emplace_back([&, i] {
+        if (auto const buffer = run_worker_process(options.worker_path,
+            shard_task::build, path, i, shards.size(), roots[i], false))
+          results[i] = parse_shard_blocks(*buffer);
+      });
+    }
+
+    for (auto& thread : threads)
+      thread.join();
+  }
+
+  shard_blocks.resize(shards.size());
+  for (std::size_t i = 0; i < shards.size(); ++i) {
+    if (!results[i]) {
+      std::printf("[!] Shard %zu failed to build its blocks.\n", i);
+      return false;
+    }
+
+    shard_blocks[i] = std::move(*results[i]);
+  }
+
+  return true;
+}
+
+// Disassemble an image in shards and merge the blocks that every shard
+// decoded into a single disassembled_binary.
+std::optional<disassembled_binary> disassemble_sharded(char const* const path,
+    sharded_options const& options, sharded_stats* const stats) {
+  auto image = read_file_to_buffer(path);
+  if (image.empty()) {
+    std::printf("[!] Failed to read file.\n");
+    return {};
+  }
+
+  auto const shards = plan_shards(image, options.shard_count);
+  if (shards.empty()) {
+    std::printf("[!] Failed to split the image into shards.\n");
+    return {};
+  }
+
+  sharded_stats local_stats = {};
+  local_stats.shard_count = shards.size();
+
+  std::vector<std::uint32_t> block_rvas = {};
+  if (!discover_sharded_blocks(image, path, shards, options, block_rvas, local_stats))
+    return {};
+
+  // Sorting the boundaries makes the symbol numbering of the merged binary
+  // independent of how the image was split up.
+  std::sort(begin(block_rvas), end(block_rvas));
+  block_rvas.erase(std::unique(begin(block_rvas), end(block_rvas)), end(block_rvas));
+  block_rvas.shrink_to_fit();
+
+  std::vector<std::vector<prebuilt_block>> shard_blocks = {};
+  if (!build_sharded_blocks(image, path, shards, options, block_rvas, shard_blocks))
+    return {};
+
+  for (auto const& blocks : shard_blocks)
+    local_stats.block_count += blocks.size();
+
+  if (stats)
+    *stats = local_stats;
+
+  disassemble_options dasm_options = {};
+  dasm_options.block_rvas = &block_rvas;
+  dasm_options.storage    = options.storage;
+
+  // Shards (and their blocks) are in RVA order, and each shard is freed as
+  // soon as it has been merged.
+  std::size_t shard_index = 0, block_index = 0;
+  dasm_options.next_prebuilt_block = [&](prebuilt_block& block) {
+    while (shard_index < shard_blocks.size() &&
+           block_index >= shard_blocks[shard_index].size()) {
+      shard_blocks[shard_index++] = {};
+      block_index = 0;
+    }
+
+    if (shard_index >= shard_blocks.size())
+      return false;
+
+    block = std::move(shard_blocks[shard_index][block_index++]);
+    return true;
+  };
+
+  return disassemble(std::move(image), dasm_options);
+}
+
+} // namespace chum
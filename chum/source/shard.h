@@ -0,0 +1,128 @@
+#pragma once
+
+#include "disassembler.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace chum {
+
+// A contiguous piece of the image that a single worker is responsible for.
+// Shards are created from .pdata, so every shard starts at the beginning of
+// a function, and the shards cover the entire RVA space without overlapping.
+struct shard {
+  // The first RVA that belongs to this shard.
+  std::uint32_t begin = 0;
+
+  // One past the last RVA that belongs to this shard.
+  std::uint32_t end = 0;
+
+  // The start of every .pdata function in the shard, sorted by RVA.
+  std::vector<std::uint32_t> functions = {};
+};
+
+// The block boundaries that were discovered in a single shard.
+struct shard_result {
+  // Every block start in the shard that was decoded, sorted by RVA.
+  std::vector<std::uint32_t> block_rvas = {};
+
+  // Code that is reached from this shard, but belongs to another shard.
+  // These need to be sent to the owning shard. Sorted by RVA.
+  std::vector<std::uint32_t> external_targets = {};
+};
+
+// What a shard worker is asked to do.
+enum class shard_task {
+  // Find the block boundaries that are reachable from the roots.
+  discover,
+
+  // Decode the blocks that start at the roots.
+  build
+};
+
+// Optional settings for a sharded analysis.
+struct sharded_options {
+  // The number of shards (and worker processes) to use.
+  std::size_t shard_count = 4;
+
+  // The path to the chum executable that is spawned for each shard. If this
+  // is empty, every shard is analyzed in the calling process instead.
+  std::string worker_path = "";
+
+  // If non-null, the merged binary is allocated from this resource (see
+  // disassemble_options::storage). A mapped_file_resource keeps the merged
+  // binary from being limited by the memory of the coordinating process.
+  std::pmr::memory_resource* storage = nullptr;
+};
+
+// Statistics about a sharded analysis.
+struct sharded_stats {
+  // The number of shards that the image was split into. This can be less
+  // than the requested count for images with very few functions.
+  std::size_t shard_count = 0;
+
+  // The number of times that workers were run before no new cross-shard
+  // targets were found.
+  std::size_t rounds = 0;
+
+  // The number of cross-shard targets that were sent to another shard.
+  std::size_t routed_targets = 0;
+
+  // The number of blocks that were decoded by the shards and merged.
+  std::size_t block_count = 0;
+};
+
+// Split the .pdata functions of a raw image into shards of roughly equal
+// code size.
+std::vector<shard> plan_shards(std::vector<std::uint8_t> const& image,
+  std::size_t shard_count);
+
+// Find the block boundaries in a shard. If include_functions is true, the
+// start of every function in the shard is used as a root, in addition to
+// the extra roots.
+shard_result analyze_shard(std::vector<std::uint8_t> const& image,
+  shard const& sh, std::vector<std::uint32_t> const& extra_roots,
+  bool include_functions = true);
+
+// Decode every block in a shard that starts at one of the (sorted) block
+// RVAs. Blocks end at a terminating instruction, at the next block RVA, or
+// at the end of the shard. Relative operands keep their original values.
+std::vector<prebuilt_block> build_shard_blocks(std::vector<std::uint8_t> const& image,
+  shard const& sh, std::vector<std::uint32_t> const& block_rvas);
+
+// Serialize the result of a shard, so that it can be sent over a pipe.
+std::vector<std::uint8_t> serialize_shard_result(shard_result const& result);
+
+// Parse a serialized shard result.
+std::optional<shard_result> parse_shard_result(std::vector<std::uint8_t> const& buffer);
+
+// Serialize the blocks that were built for a shard.
+std::vector<std::uint8_t> serialize_shard_blocks(std::vector<prebuilt_block> const& blocks);
+
+// Parse the serialized blocks of a shard.
+std::optional<std::vector<prebuilt_block>> parse_shard_blocks(
+  std::vector<std::uint8_t> const& buffer);
+
+// Run a shard worker: analyze or build a single shard of an image and write
+// the serialized result to stdout. The roots file is optional, and holds the
+// roots (as an array of 32-bit RVAs) that were sent to this shard. If
+// include_functions is true, the functions of the shard are used as roots
+// as well.
+int run_shard_worker(shard_task task, char const* path, std::size_t index,
+  std::size_t shard_count, bool include_functions, char const* roots_path);
+
+// Disassemble an image in shards (optionally in separate worker processes).
+// The shards first find their block boundaries, routing cross-shard targets
+// to each other until nothing new is found. Every shard then decodes its
+// blocks, and these are merged into a single disassembled_binary without
+// being decoded again. The symbols in the merged binary are numbered in RVA
+// order, so the result does not depend on the number of shards.
+//
+// The merged binary is built in the calling process. Use
+// sharded_options::storage to keep it out of memory.
+std::optional<disassembled_binary> disassemble_sharded(char const* path,
+  sharded_options const& options = {}, sharded_stats* stats = nullptr);
+
+} // namespace chum
@@ -0,0 +1,384 @@
+#include "signatures.h"
+#include "cfg.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace chum {
+
+// 'CHSG'
+static constexpr std::uint32_t signature_database_magic = 0x47534843;
+
+// Get every block of a function, sorted by RVA. The RVA of every block is
+// returned as well. Blocks that don't have an RVA (because they were added
+// after disassembly) cause this to fail.
+static bool get_sorted_function_blocks(disassembled_binary const& bin,
+    symbol_id const function, std::vector<std::pair<std::uint32_t, basic_block*>>& blocks) {
+  auto const sym = bin.get_symbol(function);
+  if (!sym || sym->type != symbol_type::code)
+    return false;
+
+  auto const entry_rva = bin.symbol_to_rva(function);
+  if (!entry_rva)
+    return false;
+
+  blocks.clear();
+  for (auto const bb : get_function_blocks(bin, sym->bb, bin.functions())) {
+    auto const rva = bin.symbol_to_rva(bb->sym_id);
+
+    // The offsets from the entry are unsigned.
+    if (rva < entry_rva)
+      return false;
+
+    blocks.emplace_back(rva, bb);
+  }
+
+  std::sort(begin(blocks), end(blocks), [](auto const& left, auto const& right) {
+    return left.first < right.first;
+  });
+
+  return true;
+}
+
+// Calculate the CFG hash of a function in a disassembled binary.
+std::uint64_t calculate_cfg_hash(disassembled_binary const& bin, symbol_id const function) {
+  std::vector<std::pair<std::uint32_t, basic_block*>> blocks = {};
+  if (!get_sorted_function_blocks(bin, function, blocks))
+    return 0;
+
+  auto const entry_rva = blocks.front().first;
+
+  // Every block contributes its offset, its instruction count, and the
+  // offset of each of its successors.
+  std::vector<std::uint32_t> values = {};
+
+  for (auto const& [rva, bb] : blocks) {
+    values.push_back(rva - entry_rva);
+    values.push_back(static_cast<std::uint32_t>(bb->instructions.size()));
+
+    auto const exit = get_block_exit(bin, bb);
+    values.push_back((exit.is_return ? 1 : 0) | (exit.is_indirect ? 2 : 0));
+
+    for (auto const target : { exit.branch_target, exit.fallthrough_target }) {
+      auto const target_rva = bin.symbol_to_rva(target);
+      values.push_back(target && target_rva ? target_rva - entry_rva : 0xFFFFFFFF);
+    }
+  }
+
+  return fnv1a_64(values.data(), values.size() * sizeof(values[0]));
+}
+
+// Create a signature for a function, using the raw image that the binary
+// was disassembled from.
+std::optional<function_signature> create_function_signature(
+    disassembled_binary const& bin, std::vector<std::uint8_t> const& image,
+    symbol_id const function, std::uint32_t const flags) {
+  std::vector<std::pair<std::uint32_t, basic_block*>> blocks = {};
+  if (!get_sorted_function_blocks(bin, function, blocks))
+    return {};
+
+  auto const entry_rva = blocks.front().first;
+
+  function_signature signature = {};
+  signature.name     = bin.get_symbol(function)->name;
+  signature.cfg_hash = calculate_cfg_hash(bin, function);
+  signature.flags    = flags;
+
+  std::size_t exact_bytes = 0;
+
+  for (auto const& [rva, bb] : blocks) {
+    auto& block = signature.blocks.emplace_back();
+    block.offset = rva - entry_rva;
+
+    // Decode the original instructions, since the instructions in the block
+    // contain symbol IDs instead of displacements (and might have been
+    // re-encoded to fit them).
+    for (std::size_t i = 0; i < bb->instructions.size(); ++i) {
+      auto const instr_rva = static_cast<std::uint32_t>(rva + block.bytes.size());
+      auto const file_offset = pe_rva_to_file_offset(image, instr_rva);
+      if (!file_offset)
+        return {};
+
+      ZydisDecodedInstruction decoded_instr;
+      ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT];
+      if (ZYAN_FAILED(ZydisDecoderDecodeFull(bin.decoder(), &image[file_offset],
+          image.size() - file_offset, &decoded_instr, decoded_ops)))
+        return {};
+
+      auto const start = block.bytes.size();
+      block.bytes.insert(end(block.bytes), &image[file_offset],
+        &image[file_offset] + decoded_instr.length);
+      block.mask.insert(end(block.mask), decoded_instr.length, 0xFF);
+
+      // Relative branch targets.
+      if (decoded_instr.raw.imm[0].is_relative) {
+        std::memset(&block.mask[start + decoded_instr.raw.imm[0].offset], 0,
+          decoded_instr.raw.imm[0].size / 8);
+      }
+
+      // RIP-relative memory references.
+      if (decoded_instr.raw.disp.offset != 0 &&
+          decoded_instr.raw.modrm.mod == 0 &&
+          decoded_instr.raw.modrm.rm  == 5) {
+        std::memset(&block.mask[start + decoded_instr.raw.disp.offset], 0,
+          decoded_instr.raw.disp.size / 8);
+      }
+    }
+
+    exact_bytes += std::count(begin(block.mask), end(block.mask), 0xFF);
+  }
+
+  if (exact_bytes < min_signature_bytes)
+    return {};
+
+  return signature;
+}
+
+// Get the length of the non-wildcard prefix of a signature.
+static std::uint32_t get_prefix_length(function_signature const& signature) {
+  auto const& block = signature.blocks.front();
+
+  std::uint32_t length = 0;
+  while (length < 16 && length < block.mask.size() && block.mask[length] == 0xFF)
+    ++length;
+
+  return length;
+}
+
+// Hash a prefix of a certain length.
+static std::uint64_t hash_prefix(std::uint8_t const* const bytes,
+    std::uint32_t const length) {
+  return fnv1a_64(bytes, length) ^ (length * 0x9E3779B97F4A7C15);
+}
+
+// Add a signature.
+bool signature_database::add(function_signature signature) {
+  if (signature.blocks.empty())
+    return false;
+
+  auto const prefix_length = get_prefix_length(signature);
+  auto const key = hash_prefix(signature.blocks.front().bytes.data(), prefix_length);
+
+  // Make sure that this signature doesn't already exist.
+  auto const [first, last] = index_.equal_range(key);
+  for (auto it = first; it != last; ++it) {
+    auto const& other = signatures_[it->second];
+    if (other.cfg_hash != signature.cfg_hash ||
+        other.blocks.size() != signature.blocks.size())
+      continue;
+
+    bool identical = true;
+    for (std::size_t i = 0; i < other.blocks.size() && identical; ++i) {
+      identical = other.blocks[i].offset == signature.blocks[i].offset &&
+                  other.blocks[i].bytes  == signature.blocks[i].bytes  &&
+                  other.blocks[i].mask   == signature.blocks[i].mask;
+    }
+
+    if (identical)
+      return false;
+  }
+
+  if (std::find(begin(prefix_lengths_), end(prefix_lengths_),
+      prefix_length) == end(prefix_lengths_)) {
+    prefix_lengths_.push_back(prefix_length);
+    std::sort(begin(prefix_lengths_), end(prefix_lengths_));
+  }
+
+  index_.emplace(key, signatures_.size());
+  signatures_.push_back(std::move(signature));
+
+  return true;
+}
+
+// Add a signature for every function in a binary.
+std::size_t signature_database::add_binary(disassembled_binary const& bin,
+    std::vector<std::uint8_t> const& image, std::uint32_t const flags) {
+  std::size_t count = 0;
+
+  for (auto const function : bin.functions()) {
+    auto signature = create_function_signature(bin, image, function, flags);
+    if (signature && add(std::move(*signature)))
+      ++count;
+  }
+
+  return count;
+}
+
+// Find the signature that matches the function at an RVA in a raw image.
+function_signature const* signature_database::match(
+    std::vector<std::uint8_t> const& image, std::uint32_t const rva) const {
+  // Check whether a block matches the image.
+  auto const block_matches = [&](signature_block const& block) {
+    auto const file_offset = pe_rva_to_file_offset(image,
+      rva + block.offset, block.bytes.size());
+    if (!file_offset)
+      return false;
+
+    for (std::size_t i = 0; i < block.bytes.size(); ++i) {
+      if ((image[file_offset + i] & block.mask[i]) != (block.bytes[i] & block.mask[i]))
+        return false;
+    }
+
+    return true;
+  };
+
+  // Try the longest prefixes first, since they're the most specific.
+  for (auto it = rbegin(prefix_lengths_); it != rend(prefix_lengths_); ++it) {
+    auto const file_offset = pe_rva_to_file_offset(image, rva, *it);
+    if (!file_offset)
+      continue;
+
+    auto const [first, last] = index_.equal_range(hash_prefix(&image[file_offset], *it));
+    for (auto entry = first; entry != last; ++entry) {
+      auto const& signature = signatures_[entry->second];
+      if (std::all_of(begin(signature.blocks), end(signature.blocks), block_matches))
+        return &signature;
+    }
+  }
+
+  return nullptr;
+}
+
+// Get every signature.
+std::vector<function_signature> const& signature_database::signatures() const {
+  return signatures_;
+}
+
+// Serialize a signature database.
+std::vector<std::uint8_t> serialize_signature_database(signature_database const& db) {
+  std::vector<std::uint8_t> buffer = {};
+
+  auto const write = [&](void const* const data, std::size_t const size) {
+    buffer.insert(end(buffer), static_cast<std::uint8_t const*>(data),
+      static_cast<std::uint8_t const*>(data) + size);
+  };
+
+  auto const write_u32 = [&](std::uint32_t const value) { write(&value, 4); };
+  auto const write_u64 = [&](std::uint64_t const value) { write(&value, 8); };
+
+  write_u32(signature_database_magic);
+  write_u32(1);
+  write_u32(static_cast<std::uint32_t>(db.signatures().size()));
+
+  for (auto const& signature : db.signatures()) {
+    write_u32(static_cast<std::uint32_t>(signature.name.size()));
+    write(signature.name.data(), signature.name.size());
+    write_u64(signature.cfg_hash);
+    write_u32(signature.flags);
+    write_u32(static_cast<std::uint32_t>(signature.blocks.size()));
+
+    for (auto const& block : signature.blocks) {
+      write_u32(block.offset);
+      write_u32(static_cast<std::uint32_t>(block.bytes.size()));
+      write(block.bytes.data(), block.bytes.size());
+      write(block.mask.data(), block.mask.size());
+    }
+  }
+
+  return buffer;
+}
+
+// Parse a serialized signature database.
+std::optional<signature_database> parse_signature_database(
+    std::vector<std::uint8_t> const& buffer) {
+  std::size_t offset = 0;
+
+  auto const read = [&](void* const data, std::size_t const size) {
+    if (offset + size > buffer.size())
+      return false;
+
+    if (size)
+      std::memcpy(data, &buffer[offset], size);
+
+    offset += size;
+    return true;
+  };
+
+  std::uint32_t magic = 0, version = 0, count = 0;
+  if (!read(&magic, 4) || !read(&version, 4) || !read(&count, 4))
+    return {};
+
+  if (magic != signature_database_magic || version != 1)
+    return {};
+
+  signature_database db = {};
+
+  for (std::uint32_t i = 0; i < count; ++i) {
+    function_signature signature = {};
+
+    std::uint32_t name_length = 0;
+    if (!read(&name_length, 4) || offset + name_length > buffer.size())
+      return {};
+
+    signature.name.resize(name_length);
+    std::uint32_t block_count = 0;
+
+    if (!read(signature.name.data(), name_length) ||
+        !read(&signature.cfg_hash, 8) ||
+        !read(&signature.flags, 4) ||
+        !read(&block_count, 4))
+      return {};
+
+    for (std::uint32_t j = 0; j < block_count; ++j) {
+      auto& block = signature.blocks.emplace_back();
+
+      std::uint32_t length = 0;
+      if (!read(&block.offset, 4) || !read(&length, 4) ||
+          offset + length * 2ull > buffer.size())
+        return {};
+
+      block.bytes.resize(length);
+      block.mask.resize(length);
+
+      if (!read(block.bytes.data(), length) || !read(block.mask.data(), length))
+        return {};
+    }
+
+    db.add(std::move(signature));
+  }
+
+  return db;
+}
+
+// Read a signature database from disk.
+std::optional<signature_database> read_signature_database(char const* const path) {
+  return parse_signature_database(read_file_to_buffer(path));
+}
+
+// Write a signature database to disk.
+bool write_signature_database(char const* const path, signature_database const& db) {
+  std::ofstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+
+  auto const buffer = serialize_signature_database(db);
+  file.write(reinterpret_cast<char const*>(buffer.data()), buffer.size());
+
+  return static_cast<bool>(file);
+}
+
+// Apply the decisions of every matched signature that can be applied
+// directly to the binary.
+void apply_signature_decisions(disassembled_binary& bin) {
+  std::vector<std::uint8_t> cold(bin.symbols().size(), 0);
+
+  for (auto const& match : bin.signature_matches()) {
+    if (!(match.flags & (signature_flag_cold | signature_flag_no_instrument)))
+      continue;
+
+    auto const sym = bin.get_symbol(match.function);
+    for (auto const bb : get_function_blocks(bin, sym->bb, bin.functions())) {
+      if (match.flags & signature_flag_cold)
+        cold[bb->sym_id.value] = 1;
+      if (match.flags & signature_flag_no_instrument)
+        bb->no_instrument = true;
+    }
+  }
+
+  std::stable_partition(begin(bin.basic_blocks()), end(bin.basic_blocks()),
+    [&](basic_block const* const bb) { return !cold[bb->sym_id.value]; });
+}
+
+} // namespace chum
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "disassembler.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace chum {
+
+// Decisions that are stored with a signature, and apply to every function
+// that matches it.
+inline constexpr std::uint32_t signature_flag_no_instrument = 1 << 0;
+inline constexpr std::uint32_t signature_flag_cold          = 1 << 1;
+
+// The original bytes of a single basic block in a function.
+struct signature_block {
+  // The offset of the block from the start of the function.
+  std::uint32_t offset = 0;
+
+  // The raw bytes of the block, and a mask where 0xFF means that the byte
+  // must match and 0x00 means that it can be anything (relative branch
+  // targets and RIP-relative displacements).
+  std::vector<std::uint8_t> bytes = {};
+  std::vector<std::uint8_t> mask  = {};
+};
+
+// A known function, which can be recognized in other binaries.
+struct function_signature {
+  // The name of the function. This is given to the function's symbol when
+  // it is matched.
+  std::string name = "";
+
+  // A hash of the function's control flow graph (block offsets, instruction
+  // counts, and successors), which is used to double check byte matches
+  // after disassembly.
+  std::uint64_t cfg_hash = 0;
+
+  // Any combination of signature_flag_*.
+  std::uint32_t flags = 0;
+
+  // Every block in the function, sorted by offset. The first block is the
+  // function entry.
+  std::vector<signature_block> blocks = {};
+};
+
+// Functions with fewer than this many non-wildcard bytes don't get a
+// signature, since they would match far too many unrelated functions.
+inline constexpr std::size_t min_signature_bytes = 16;
+
+// Calculate the CFG hash of a function in a disassembled binary.
+std::uint64_t calculate_cfg_hash(disassembled_binary const& bin, symbol_id function);
+
+// Create a signature for a function, using the raw image that the binary
+// was disassembled from.
+std::optional<function_signature> create_function_signature(
+  disassembled_binary const& bin, std::vector<std::uint8_t> const& image,
+  symbol_id function, std::uint32_t flags = 0);
+
+// A collection of function signatures that is indexed by the first few
+// bytes of each function.
+class signature_database {
+public:
+  // Add a signature. Returns false if an identical signature already exists.
+  bool add(function_signature signature);
+
+  // Add a signature for every function in a binary, using the raw image that
+  // it was disassembled from. Returns the number of signatures that were added.
+  std::size_t add_binary(disassembled_binary const& bin,
+    std::vector<std::uint8_t> const& image, std::uint32_t flags = 0);
+
+  // Find the signature that matches the function at an RVA in a raw image.
+  function_signature const* match(std::vector<std::uint8_t> const& image,
+    std::uint32_t rva) const;
+
+  // Get every signature.
+  std::vector<function_signature> const& signatures() const;
+
+private:
+  // Signatures are indexed by a hash of their longest non-wildcard prefix
+  // (up to 16 bytes), so this holds every prefix length that is in use.
+  std::vector<std::uint32_t> prefix_lengths_ = {};
+
+  std::unordered_multimap<std::uint64_t, std::size_t> index_ = {};
+
+  std::vector<function_signature> signatures_ = {};
+};
+
+// Serialize a signature database.
+std::vector<std::uint8_t> serialize_signature_database(signature_database const& db);
+
+// Parse a serialized signature database.
+std::optional<signature_database> parse_signature_database(
+  std::vector<std::uint8_t> const& buffer);
+
+// Read a signature database from disk.
+std::optional<signature_database> read_signature_database(char const* path);
+
+// Write a signature database to disk.
+bool write_signature_database(char const* path, signature_database const& db);
+
+// Apply the decisions of every matched signature that can be applied
+// directly to the binary: cold functions are moved after every other block,
+// and the blocks of functions that shouldn't be instrumented are marked
+// with basic_block::no_instrument. disassemble() calls this by default
+// (see disassemble_options::apply_decisions).
+void apply_signature_decisions(disassembled_binary& bin);
+
+} // namespace chum
@@ -0,0 +1,300 @@
+#include "storage.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <filesystem>
+#include <new>
+
+#include <Windows.h>
+#include <Psapi.h>
+
+namespace chum {
+
+// Mapped views have to start at a multiple of the allocation granularity,
+// which is 64KB on every version of Windows.
+static constexpr std::size_t view_granularity = 0x10000;
+
+// The size of a page, which is the unit that the working set is tracked in.
+static constexpr std::size_t page_size = 0x1000;
+
+// Get the size class of an allocation.
+static std::size_t get_size_class(std::size_t const size) {
+  std::size_t size_class = 0;
+  while ((std::size_t(1) << size_class) < size)
+    ++size_class;
+
+  return size_class;
+}
+
+// Create the backing file in the specified directory (or the temporary
+// directory if null).
+mapped_file_resource::mapped_file_resource(std::size_t const resident_budget,
+    char const* const directory, std::size_t const segment_size)
+    : resident_budget_(resident_budget) {
+  segment_size_ = (segment_size + view_granularity - 1) & ~(view_granularity - 1);
+
+  // Querying the working set costs about as much as touching every mapped
+  // page, so only do it a few times per budget.
+  check_interval_ = (std::max)(resident_budget / 8, view_granularity);
+
+  // Every resource gets its own file.
+  static std::atomic<std::uint32_t> file_counter = 0;
+
+  std::error_code ec;
+  auto const parent = directory ? std::filesystem::path(directory) :
+    std::filesystem::temp_directory_path(ec);
+
+  if (ec) {
+    std::printf("[!] Failed to get the temporary directory: %s.\n", ec.message().c_str());
+    return;
+  }
+
+  auto const path = parent / ("chum_storage_" + std::to_string(GetCurrentProcessId()) +
+    "_" + std::to_string(file_counter++) + ".bin");
+
+  // The file is deleted by the OS once the last handle is closed, even if
+  // the process crashes.
+  auto const file = CreateFileA(path.string().c_str(), GENERIC_READ | GENERIC_WRITE,
+    0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+
+  if (file != INVALID_HANDLE_VALUE)
+    file_ = file;
+}
+
+// Unmap and delete the backing file.
+mapped_file_resource::~mapped_file_resource() {
+  for (auto const& seg : segments_) {
+    UnmapViewOfFile(seg.view);
+    CloseHandle(seg.mapping);
+  }
+
+  if (file_)
+    CloseHandle(file_);
+}
+
+// Whether the backing file was created.
+bool mapped_file_resource::valid() const {
+  return file_ != nullptr;
+}
+
+// Remove every mapped page that isn't hot from the working set.
+void mapped_file_resource::trim() {
+  std::lock_guard lock(mutex_);
+  trim_locked();
+}
+
+// Replace the set of hot ranges.
+void mapped_file_resource::set_hot_ranges(
+    std::vector<std::pair<void const*, std::size_t>> ranges) {
+  std::sort(begin(ranges), end(ranges));
+
+  std::lock_guard lock(mutex_);
+  hot_ranges_.clear();
+
+  for (auto const& [p, size] : ranges) {
+    auto const start = static_cast<std::uint8_t const*>(p);
+    if (!hot_ranges_.empty() && start <= hot_ranges_.back().second)
+      hot_ranges_.back().second = (std::max)(hot_ranges_.back().second, start + size);
+    else
+      hot_ranges_.push_back({ start, start + size });
+  }
+}
+
+// The number of bytes that are currently allocated.
+std::size_t mapped_file_resource::allocated() const {
+  std::lock_guard lock(mutex_);
+  return allocated_;
+}
+
+// The number of bytes of the mapping that are currently in the working set.
+std::size_t mapped_file_resource::resident() const {
+  std::lock_guard lock(mutex_);
+  return resident_locked();
+}
+
+// The number of bytes that are mapped (the size of the backing file).
+std::size_t mapped_file_resource::mapped() const {
+  std::lock_guard lock(mutex_);
+  return static_cast<std::size_t>(file_size_);
+}
+
+// The number of times that the mapping has been trimmed.
+std::size_t mapped_file_resource::trim_count() const {
+  std::lock_guard lock(mutex_);
+  return trim_count_;
+}
+
+void* mapped_file_resource::do_allocate(std::size_t const bytes,
+    std::size_t const alignment) {
+  // Every allocation is aligned to its size (up to a page), so any
+  // alignment that is not larger than the size is satisfied.
+  assert(alignment <= 0x1000);
+
+  auto const size_class = (std::max)(get_size_class(
+    (std::max)(bytes, alignment)), min_size_class);
+  auto const size = std::size_t(1) << size_class;
+
+  if (size_class >= size_class_count)
+    throw std::bad_alloc();
+
+  std::lock_guard lock(mutex_);
+
+  allocated_ += size;
+  allocated_since_check_ += size;
+
+  // Pages only become resident when they're touched, so the allocation
+  // volume is just used to decide when to look at the working set.
+  if (resident_budget_ && allocated_since_check_ > check_interval_) {
+    allocated_since_check_ = 0;
+    if (resident_locked() > resident_budget_)
+      trim_locked();
+  }
+
+  // Reuse a freed allocation of the same size.
+  if (auto& free_list = free_lists_[size_class]; !free_list.empty()) {
+    auto const p = free_list.back();
+    free_list.pop_back();
+    return p;
+  }
+
+  auto const align = (std::min)(size, std::size_t(0x1000));
+
+  // Find space at the end of the last segment, or map a new one.
+  if (segments_.empty() || ((segments_.back().used + align - 1) & ~(align - 1)) +
+      size > segments_.back().size) {
+    if (!add_segment((std::max)(size, segment_size_)))
+      throw std::bad_alloc();
+  }
+
+  auto& seg = segments_.back();
+  seg.used = (seg.used + align - 1) & ~(align - 1);
+
+  auto const p = seg.view + seg.used;
+  seg.used += size;
+
+  return p;
+}
+
+void mapped_file_resource::do_deallocate(void* const p, std::size_t const bytes,
+    std::size_t const alignment) {
+  auto const size_class = (std::max)(get_size_class(
+    (std::max)(bytes, alignment)), min_size_class);
+
+  std::lock_guard lock(mutex_);
+
+  allocated_ -= std::size_t(1) << size_class;
+  free_lists_[size_class].push_back(p);
+}
+
+bool mapped_file_resource::do_is_equal(
+    std::pmr::memory_resource const& other) const noexcept {
+  return this == &other;
+}
+
+// Map a new segment of at least the specified size.
+bool mapped_file_resource::add_segment(std::size_t size) {
+  if (!file_)
+    return false;
+
+  size = (size + view_granularity - 1) & ~(view_granularity - 1);
+
+  // Creating a mapping that is larger than the file extends the file.
+  auto const new_file_size = file_size_ + size;
+  auto const mapping = CreateFileMappingA(file_, nullptr, PAGE_READWRITE,
+    static_cast<DWORD>(new_file_size >> 32), static_cast<DWORD>(new_file_size), nullptr);
+  if (!mapping)
+    return false;
+
+  auto const view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS,
+    static_cast<DWORD>(file_size_ >> 32), static_cast<DWORD>(file_size_), size);
+  if (!view) {
+    CloseHandle(mapping);
+    return false;
+  }
+
+  segments_.push_back({ mapping, static_cast<std::uint8_t*>(view), size, 0 });
+  file_size_ = new_file_size;
+
+  return true;
+}
+
+// Remove every mapped page that isn't hot from the working set.
+void mapped_file_resource::trim_locked() {
+  // Unlocking pages that aren't locked removes them from the working set.
+  // They stay on the standby (or modified) list, so touching them again is
+  // cheap unless the OS actually needed the memory.
+  auto const unlock = [](std::uint8_t* const start, std::uint8_t* const end) {
+    if (start < end)
+      VirtualUnlock(start, end - start);
+  };
+
+  for (auto const& seg : segments_) {
+    auto const seg_end = seg.view + ((seg.used + page_size - 1) & ~(page_size - 1));
+    auto cold_start = seg.view;
+
+    // Unlock every page between the hot ranges that land in this segment.
+    auto hot = std::upper_bound(begin(hot_ranges_), end(hot_ranges_),
+      std::pair<std::uint8_t const*, std::uint8_t const*>(seg.view, seg.view),
+      [](auto const& left, auto const& right) { return left.second < right.second; });
+
+    for (; hot != end(hot_ranges_) && hot->first < seg_end; ++hot) {
+      auto const offset = static_cast<std::size_t>(
+        (std::max)(hot->first, static_cast<std::uint8_t const*>(seg.view)) - seg.view);
+      auto const end_offset = static_cast<std::size_t>(
+        (std::min)(hot->second, static_cast<std::uint8_t const*>(seg_end)) - seg.view);
+
+      unlock(cold_start, seg.view + (offset & ~(page_size - 1)));
+      cold_start = (std::max)(cold_start,
+        seg.view + ((end_offset + page_size - 1) & ~(page_size - 1)));
+    }
+
+    unlock(cold_start, seg_end);
+  }
+
+  ++trim_count_;
+}
+
+// Get the number of resident bytes.
+std::size_t mapped_file_resource::resident_locked() const {
+  std::vector<PSAPI_WORKING_SET_EX_INFORMATION> pages = {};
+  std::size_t resident_pages = 0;
+
+  for (auto const& seg : segments_) {
+    pages.resize((seg.used + page_size - 1) / page_size);
+    for (std::size_t i = 0; i < pages.size(); ++i)
+      pages[i].VirtualAddress = seg.view + i * page_size;
+
+    if (pages.empty() || !QueryWorkingSetEx(GetCurrentProcess(), pages.data(),
+        static_cast<DWORD>(pages.size() * sizeof(pages[0]))))
+      continue;
+
+    for (auto const& page : pages)
+      resident_pages += page.VirtualAttributes.Valid;
+  }
+
+  return resident_pages * page_size;
+}
+
+// Mark the instructions of every block that was executed at least
+// min_weight times as hot.
+void keep_hot_blocks_resident(binary const& bin, mapped_file_resource& storage,
+    std::uint64_t const min_weight) {
+  std::vector<std::pair<void const*, std::size_t>> ranges = {};
+
+  for (auto const bb : bin.basic_blocks()) {
+    if (bb->weight < min_weight)
+      continue;
+
+    ranges.push_back({ bb, sizeof(*bb) });
+    if (!bb->instructions.empty()) {
+      ranges.push_back({ bb->instructions.data(),
+        bb->instructions.size() * sizeof(instruction) });
+    }
+  }
+
+  storage.set_hot_ranges(std::move(ranges));
+}
+
+} // namespace chum
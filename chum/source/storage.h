@@ -0,0 +1,122 @@
+#pragma once
+
+#include "binary.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace chum {
+
+// A memory resource that allocates from a temporary memory-mapped file
+// instead of the page file. Pages that are removed from the working set are
+// written back to the file, so memory that isn't being used (such as the
+// instructions of cold blocks) doesn't count against the process's memory
+// limit. The file is deleted when the resource is destroyed.
+//
+// A binary uses the resource for everything that it allocates once it is
+// passed to the binary's constructor (or to disassemble_options::storage).
+// The resource must outlive the binary.
+class mapped_file_resource : public std::pmr::memory_resource {
+public:
+  // Create the backing file in the specified directory (or the temporary
+  // directory if null). Whenever more than resident_budget bytes of the
+  // mapping are in the working set, every page that isn't hot is trimmed.
+  explicit mapped_file_resource(std::size_t resident_budget,
+    char const* directory = nullptr, std::size_t segment_size = 256 << 20);
+
+  // Unmap and delete the backing file.
+  ~mapped_file_resource();
+
+  mapped_file_resource(mapped_file_resource const&) = delete;
+  mapped_file_resource& operator=(mapped_file_resource const&) = delete;
+
+  // Whether the backing file was created.
+  bool valid() const;
+
+  // Remove every mapped page that isn't hot from the working set. Dirty
+  // pages are written back to the file by the OS, and are read back in when
+  // they are touched again. This is cheap to call between passes.
+  void trim();
+
+  // Replace the set of hot ranges. The pages that hold them are never
+  // trimmed, so they stay in memory for as long as the OS allows.
+  void set_hot_ranges(std::vector<std::pair<void const*, std::size_t>> ranges);
+
+  // The number of bytes that are currently allocated.
+  std::size_t allocated() const;
+
+  // The number of bytes of the mapping that are currently in the working
+  // set. This is a query to the OS, so it isn't free.
+  std::size_t resident() const;
+
+  // The number of bytes that are mapped (the size of the backing file).
+  std::size_t mapped() const;
+
+  // The number of times that the mapping has been trimmed.
+  std::size_t trim_count() const;
+
+protected:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+  bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override;
+
+private:
+  // A single view of the backing file.
+  struct segment {
+    void*         mapping = nullptr;
+    std::uint8_t* view    = nullptr;
+    std::size_t   size    = 0;
+    std::size_t   used    = 0;
+  };
+
+  // Allocations are rounded up to a power of two, and freed allocations are
+  // reused by later allocations of the same size class.
+  static constexpr std::size_t min_size_class   = 4;
+  static constexpr std::size_t size_class_count = 48;
+
+  // Map a new segment of at least the specified size.
+  bool add_segment(std::size_t size);
+
+  // Remove every mapped page that isn't hot from the working set. The mutex
+  // must be held.
+  void trim_locked();
+
+  // Get the number of resident bytes. The mutex must be held.
+  std::size_t resident_locked() const;
+
+private:
+  mutable std::mutex mutex_ = {};
+
+  void* file_ = nullptr;
+  std::uint64_t file_size_ = 0;
+
+  std::vector<segment> segments_ = {};
+  std::vector<void*> free_lists_[size_class_count] = {};
+
+  // Sorted and merged, so that trimming can skip over them.
+  std::vector<std::pair<std::uint8_t const*, std::uint8_t const*>> hot_ranges_ = {};
+
+  std::size_t segment_size_    = 0;
+  std::size_t resident_budget_ = 0;
+
+  // The resident set is checked whenever this many bytes have been
+  // allocated since the last check.
+  std::size_t check_interval_ = 0;
+
+  std::size_t allocated_             = 0;
+  std::size_t allocated_since_check_ = 0;
+  std::size_t trim_count_            = 0;
+};
+
+// Mark the instructions of every block that was executed at least
+// min_weight times (according to the attached profile) as hot, so that
+// trims leave them in memory. Blocks can move when they grow, so this
+// should be called again after passes that insert instructions.
+void keep_hot_blocks_resident(binary const& bin, mapped_file_resource& storage,
+  std::uint64_t min_weight = 1);
+
+} // namespace chum
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory_resource>
 #include <string>
 
 namespace chum {
@@ -50,6 +51,15 @@ inline constexpr symbol_id null_symbol_id = { 0 };
 // A symbol represents a memory address that is not known until link-time.
 // TODO: support exporting symbols.
 struct symbol {
+  symbol() = default;
+
+  // Create a symbol whose name is allocated from a specific memory resource.
+  explicit symbol(std::pmr::memory_resource* const resource) : name(resource) {
+    db        = nullptr;
+    db_offset = 0;
+    target    = null_symbol_id;
+  }
+
   // The symbol ID pointing to this symbol.
   symbol_id id = null_symbol_id;
 
@@ -80,7 +90,7 @@ struct symbol {
   };
 
   // An optional name for this symbol.
-  std::string name = "";
+  std::pmr::string name = {};
 };
 
 } // namespace chum
@@ -0,0 +1,99 @@
+#include "tail_duplication.h"
+#include "cfg.h"
+
+#include <algorithm>
+
+namespace chum {
+
+// Get the number of bytes that a block's instructions take up.
+static std::size_t get_block_size(basic_block const* const bb) {
+  std::size_t size = 0;
+  for (auto const& instr : bb->instructions)
+    size += instr.length;
+
+  return size;
+}
+
+// Replace every JMP to a small block that never falls through with a copy
+// of that block, hottest predecessors first.
+tail_duplication_result duplicate_tails(binary& bin,
+    tail_duplication_options const& options) {
+  tail_duplication_result result = {};
+
+  std::size_t code_size = 0;
+  for (auto const bb : bin.basic_blocks())
+    code_size += get_block_size(bb);
+
+  result.budget = static_cast<std::size_t>(static_cast<double>(code_size) * options.max_growth);
+
+  struct candidate {
+    basic_block* pred;
+    basic_block* tail;
+  };
+
+  std::vector<candidate> candidates = {};
+
+  for (auto const bb : bin.basic_blocks()) {
+    // The block must end with a JMP, rather than a JCC.
+    if (bb->fallthrough_target || bb->weight < options.min_weight)
+      continue;
+
+    auto const exit = get_block_exit(bin, bb);
+    if (!exit.branch_target)
+      continue;
+
+    auto const tail = bin.get_symbol(exit.branch_target)->bb;
+    if (tail == bb || tail->fallthrough_target || tail->instructions.empty() ||
+        get_block_size(tail) > options.max_tail_size)
+      continue;
+
+    candidates.push_back({ bb, tail });
+  }
+
+  // The hottest JMPs get first pick of the budget.
+  std::stable_sort(begin(candidates), end(candidates), [](auto const& left, auto const& right) {
+    return left.pred->weight > right.pred->weight;
+  });
+
+  // Whether each block has been duplicated, indexed by symbol ID.
+  std::vector<bool> duplicated(bin.symbols().size(), false);
+
+  for (auto const& [pred, tail] : candidates) {
+    // The tail might have been a predecessor itself, and grown since.
+    auto const tail_size = get_block_size(tail);
+    if (tail->fallthrough_target || tail_size > options.max_tail_size)
+      continue;
+
+    auto const jmp_size = pred->instructions.back().length;
+    auto const growth = tail_size > jmp_size ? tail_size - jmp_size : 0;
+
+    if (result.growth + growth > result.budget) {
+      ++result.over_budget_count;
+      continue;
+    }
+
+    pred->instructions.pop_back();
+    pred->instructions.insert(end(pred->instructions),
+      begin(tail->instructions), end(tail->instructions));
+
+    // The copy takes over the tail's exit, along with this predecessor's
+    // share of the tail's executions.
+    pred->taken_weight = tail->weight ? tail->taken_weight *
+      (std::min)(pred->weight, tail->weight) / tail->weight : 0;
+    pred->fallthrough_weight = 0;
+    tail->weight -= (std::min)(pred->weight, tail->weight);
+    tail->taken_weight = (std::min)(tail->taken_weight, tail->weight);
+
+    result.growth += growth;
+    ++result.duplicated_count;
+
+    if (!duplicated[tail->sym_id.value]) {
+      duplicated[tail->sym_id.value] = true;
+      ++result.tail_count;
+    }
+  }
+
+  return result;
+}
+
+} // namespace chum
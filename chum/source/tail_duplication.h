@@ -0,0 +1,48 @@
+#pragma once
+
+#include "binary.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace chum {
+
+struct tail_duplication_options {
+  // Only blocks whose instructions add up to at most this many bytes are
+  // duplicated. This fits a typical epilogue (ADD RSP, N; a few POPs; RET).
+  std::size_t max_tail_size = 16;
+
+  // The maximum amount of code that can be added, as a fraction of the
+  // total size of every instruction in the binary.
+  double max_growth = 0.02;
+
+  // Only predecessors that were executed at least this many times are
+  // considered (see basic_block::weight). A value of 0 considers every
+  // predecessor, which is useful when no profile is attached.
+  std::uint64_t min_weight = 1;
+};
+
+struct tail_duplication_result {
+  // The number of JMPs that were replaced with a copy of their target.
+  std::size_t duplicated_count = 0;
+
+  // The number of distinct blocks that were duplicated at least once.
+  std::size_t tail_count = 0;
+
+  // The number of bytes that were added, and the most that could have been.
+  std::size_t growth = 0;
+  std::size_t budget = 0;
+
+  // The number of candidates that were skipped because of the budget.
+  std::size_t over_budget_count = 0;
+};
+
+// Replace every JMP to a small block that never falls through (such as a
+// shared epilogue) with a copy of that block, hottest predecessors first,
+// until the code growth budget runs out. The original block is kept for any
+// other predecessors. This should run before any layout pass, since it
+// changes which blocks are hot.
+tail_duplication_result duplicate_tails(binary& bin,
+  tail_duplication_options const& options = {});
+
+} // namespace chum
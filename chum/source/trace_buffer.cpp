@@ -0,0 +1,192 @@
+#include "trace_buffer.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace chum {
+
+// Create a new trace buffer and export it under the provided name.
+trace_buffer create_trace_buffer(binary& bin, char const* const name,
+    trace_kind const kind, std::vector<std::uint32_t> const& id_rvas,
+    trace_buffer_options const& options) {
+  assert(options.ring_count && !(options.ring_count & (options.ring_count - 1)));
+  assert(options.ring_capacity && !(options.ring_capacity & (options.ring_capacity - 1)));
+
+  trace_buffer buffer = {};
+
+  auto& header = buffer.header;
+  header.magic           = trace_buffer_magic;
+  header.version         = 1;
+  header.kind            = kind;
+  header.ring_count      = options.ring_count;
+  header.ring_capacity   = options.ring_capacity;
+  header.id_count        = static_cast<std::uint32_t>(id_rvas.size());
+  header.id_table_offset = sizeof(trace_buffer_header);
+
+  // Keep every ring on its own cache lines.
+  header.rings_offset = (header.id_table_offset + header.id_count * 4 + 63) & ~63u;
+
+  auto const ring_size = trace_ring_header_size +
+    options.ring_capacity * static_cast<std::uint32_t>(sizeof(trace_record));
+
+  auto const db = bin.create_data_block(
+    header.rings_offset + options.ring_count * ring_size, 64);
+
+  std::memcpy(db->bytes.data(), &header, sizeof(header));
+  if (!id_rvas.empty()) {
+    std::memcpy(db->bytes.data() + header.id_table_offset,
+      id_rvas.data(), id_rvas.size() * 4);
+  }
+
+  buffer.sym = bin.create_symbol(symbol_type::data, name);
+  buffer.sym->db        = db;
+  buffer.sym->db_offset = 0;
+  buffer.sym->target    = null_symbol_id;
+  bin.export_symbol(buffer.sym->id);
+
+  return buffer;
+}
+
+// Generate the instructions that append a record to a trace buffer.
+void emit_trace_record(binary const& bin, trace_buffer const& buffer,
+    std::uint32_t const id, std::vector<instruction>& instructions) {
+  auto const& header = buffer.header;
+  auto const ring_size = trace_ring_header_size +
+    header.ring_capacity * static_cast<std::uint32_t>(sizeof(trace_record));
+
+  // MOV RAX, GS:[0x48] (TEB->ClientId.UniqueThread)
+  instructions.push_back(bin.instr("\x65\x48\x8B\x04\x25", std::uint32_t{ 0x48 }));
+
+  // Thread IDs are multiples of 4.
+  // SHR EAX, 2
+  instructions.push_back(bin.instr("\xC1\xE8\x02"));
+
+  // AND EAX, ring_count - 1
+  instructions.push_back(bin.instr("\x25", header.ring_count - 1));
+
+  // IMUL EAX, EAX, ring_size
+  instructions.push_back(bin.instr("\x69\xC0", ring_size));
+
+  // LEA RCX, [buffer]
+  instructions.push_back(bin.instr("\x48\x8D\x0D", buffer.sym));
+
+  // LEA RCX, [RCX + RAX + rings_offset]
+  instructions.push_back(bin.instr("\x48\x8D\x8C\x01", header.rings_offset));
+
+  // Claim a slot in the ring.
+  // MOV EAX, 1
+  // LOCK XADD DWORD PTR [RCX], EAX
+  instructions.push_back(bin.instr("\xB8", std::uint32_t{ 1 }));
+  instructions.push_back(bin.instr("\xF0\x0F\xC1\x01"));
+
+  // AND EAX, ring_capacity - 1
+  // SHL EAX, 4
+  instructions.push_back(bin.instr("\x25", header.ring_capacity - 1));
+  instructions.push_back(bin.instr("\xC1\xE0\x04"));
+
+  // LEA RAX, [RCX + RAX + trace_ring_header_size]
+  static_assert(trace_ring_header_size < 0x80);
+  instructions.push_back(bin.instr("\x48\x8D\x44\x01",
+    static_cast<std::uint8_t>(trace_ring_header_size)));
+
+  // MOV DWORD PTR [RAX], id
+  instructions.push_back(bin.instr("\xC7", std::uint8_t{ 0x00 }, id));
+
+  // MOV RCX, GS:[0x48]
+  // MOV DWORD PTR [RAX + 4], ECX
+  instructions.push_back(bin.instr("\x65\x48\x8B\x0C\x25", std::uint32_t{ 0x48 }));
+  instructions.push_back(bin.instr("\x89\x48\x04"));
+
+  // MOV QWORD PTR [RAX + 8], RDX
+  instructions.push_back(bin.instr("\x48\x89\x50\x08"));
+}
+
+// Generate the instructions that save every register that a probe clobbers
+// (RAX, RCX, RDX, and the status flags) if it is live at the probe.
+std::uint32_t emit_probe_save(binary const& bin,
+    register_set const live, std::vector<instruction>& instructions) {
+  bool const save_rax = live.gprs & (1 << 0);
+  bool const save_rcx = live.gprs & (1 << 1);
+  bool const save_rdx = live.gprs & (1 << 2);
+  bool const save_flags = live.flags != 0;
+
+  if (save_flags)
+    instructions.push_back(bin.instr("\x9C")); // PUSHFQ
+  if (save_rax)
+    instructions.push_back(bin.instr("\x50")); // PUSH RAX
+  if (save_rcx)
+    instructions.push_back(bin.instr("\x51")); // PUSH RCX
+  if (save_rdx)
+    instructions.push_back(bin.instr("\x52")); // PUSH RDX
+
+  return 8 * (save_flags + save_rax + save_rcx + save_rdx);
+}
+
+// Generate the instructions that restore the registers that were saved by
+// emit_probe_save(), in the reverse order.
+void emit_probe_restore(binary const& bin,
+    register_set const live, std::vector<instruction>& instructions) {
+  if (live.gprs & (1 << 2))
+    instructions.push_back(bin.instr("\x5A")); // POP RDX
+  if (live.gprs & (1 << 1))
+    instructions.push_back(bin.instr("\x59")); // POP RCX
+  if (live.gprs & (1 << 0))
+    instructions.push_back(bin.instr("\x58")); // POP RAX
+  if (live.flags)
+    instructions.push_back(bin.instr("\x9D")); // POPFQ
+}
+
+// Parse a raw trace buffer dump.
+std::optional<trace_dump> parse_trace_dump(std::vector<std::uint8_t> const& buffer) {
+  if (buffer.size() < sizeof(trace_buffer_header))
+    return {};
+
+  trace_buffer_header header = {};
+  std::memcpy(&header, buffer.data(), sizeof(header));
+
+  if (header.magic != trace_buffer_magic || header.version != 1)
+    return {};
+
+  auto const ring_size = trace_ring_header_size +
+    static_cast<std::uint64_t>(header.ring_capacity) * sizeof(trace_record);
+
+  // Make sure the dump is big enough to hold everything.
+  if (header.id_table_offset + header.id_count * 4ull > buffer.size() ||
+      header.rings_offset + header.ring_count * ring_size > buffer.size())
+    return {};
+
+  trace_dump dump = {};
+  dump.kind = header.kind;
+
+  dump.id_rvas.resize(header.id_count);
+  if (header.id_count) {
+    std::memcpy(dump.id_rvas.data(), buffer.data() +
+      header.id_table_offset, header.id_count * 4);
+  }
+
+  dump.rings.resize(header.ring_count);
+
+  for (std::uint32_t i = 0; i < header.ring_count; ++i) {
+    auto const ring = buffer.data() + header.rings_offset + i * ring_size;
+    auto const records = ring + trace_ring_header_size;
+
+    // The total number of records that have ever been claimed.
+    std::uint32_t head = 0;
+    std::memcpy(&head, ring, 4);
+
+    auto const count = (std::min)(head, header.ring_capacity);
+    auto& ring_records = dump.rings[i];
+    ring_records.resize(count);
+
+    // Unwrap the ring so that the oldest record comes first.
+    for (std::uint32_t j = 0; j < count; ++j) {
+      auto const slot = (head - count + j) & (header.ring_capacity - 1);
+      std::memcpy(&ring_records[j], records + slot * sizeof(trace_record),
+        sizeof(trace_record));
+    }
+  }
+
+  return dump;
+}
+
+} // namespace chum
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "binary.h"
+#include "liveness.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace chum {
+
+// The kind of values that are recorded in a trace buffer.
+enum class trace_kind : std::uint32_t {
+  invalid,
+
+  // Each record holds an RDTSC timestamp.
+  timestamp,
+
+  // Each record holds an effective address.
+  address
+};
+
+// A trace buffer is a data block that holds a number of lock-free ring
+// buffers. Probes pick a ring based on the current thread ID, so threads
+// rarely share a ring, and every record is tagged with its thread ID so
+// that shared rings can still be untangled offline. The layout is:
+//
+//   trace_buffer_header
+//   std::uint32_t       id_rvas[id_count]
+//   (64-byte aligned)   ring[ring_count]
+//
+// Where each ring consists of a 64-byte header (the first 4 bytes are the
+// number of records that have ever been claimed) followed by the records.
+struct trace_buffer_header {
+  // Always equal to trace_buffer_magic.
+  std::uint32_t magic;
+  std::uint32_t version;
+
+  // The kind of values stored in the records.
+  trace_kind kind;
+
+  // The number of rings, and the number of records per ring. Both of
+  // these are powers of 2.
+  std::uint32_t ring_count;
+  std::uint32_t ring_capacity;
+
+  // The number of entries in the ID table. Record IDs index into this table
+  // to get the original RVA that the record refers to.
+  std::uint32_t id_count;
+
+  // Offsets from the start of the buffer.
+  std::uint32_t id_table_offset;
+  std::uint32_t rings_offset;
+};
+
+// 'CHTB'
+inline constexpr std::uint32_t trace_buffer_magic = 0x42544843;
+
+// The size of the header at the start of every ring.
+inline constexpr std::uint32_t trace_ring_header_size = 64;
+
+// A single record in a ring.
+struct trace_record {
+  // An index into the ID table. Probes are allowed to set the high bit to
+  // differentiate between different types of records.
+  std::uint32_t id;
+
+  // The ID of the thread that wrote this record.
+  std::uint32_t thread_id;
+
+  // A timestamp or an address, depending on the trace kind.
+  std::uint64_t value;
+};
+
+static_assert(sizeof(trace_record) == 16);
+
+struct trace_buffer_options {
+  // The number of rings. This must be a power of 2.
+  std::uint32_t ring_count = 64;
+
+  // The number of records in each ring. This must be a power of 2.
+  std::uint32_t ring_capacity = 1 << 14;
+};
+
+// A trace buffer that was created in a binary.
+struct trace_buffer {
+  // The data symbol that points to the start of the buffer.
+  symbol* sym = nullptr;
+
+  // The header that was written to the start of the buffer.
+  trace_buffer_header header = {};
+};
+
+// Create a new trace buffer and export it under the provided name, so that
+// it can be found when dumping a running process.
+trace_buffer create_trace_buffer(binary& bin, char const* name, trace_kind kind,
+  std::vector<std::uint32_t> const& id_rvas, trace_buffer_options const& options = {});
+
+// Generate the instructions that append a record to a trace buffer. The
+// record value must be in RDX. RAX and RCX are clobbered, as well as the
+// status flags, so the caller is responsible for preserving them.
+void emit_trace_record(binary const& bin, trace_buffer const& buffer,
+  std::uint32_t id, std::vector<instruction>& instructions);
+
+// Generate the instructions that save every register that a probe clobbers
+// (RAX, RCX, RDX, and the status flags) if it is live at the probe. Returns
+// the number of bytes that RSP was moved down by.
+std::uint32_t emit_probe_save(binary const& bin,
+  register_set live, std::vector<instruction>& instructions);
+
+// Generate the instructions that restore the registers that were saved by
+// emit_probe_save(), using the same set of live registers.
+void emit_probe_restore(binary const& bin,
+  register_set live, std::vector<instruction>& instructions);
+
+// The contents of a trace buffer that was dumped from a running process.
+struct trace_dump {
+  trace_kind kind = trace_kind::invalid;
+
+  // The original RVA for every record ID.
+  std::vector<std::uint32_t> id_rvas = {};
+
+  // The records of every ring, oldest first. Records that were overwritten
+  // because a ring wrapped around are lost.
+  std::vector<std::vector<trace_record>> rings = {};
+};
+
+// Parse a raw trace buffer dump.
+std::optional<trace_dump> parse_trace_dump(std::vector<std::uint8_t> const& buffer);
+
+} // namespace chum
@@ -0,0 +1,268 @@
+#include "uarch.h"
+#include "liveness.h"
+#include "encoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace chum {
+
+// Everything that a rewrite needs to know about a single instruction.
+struct rewrite_context {
+  binary const& bin;
+  instruction const& instr;
+  ZydisDecodedInstruction const& decoded_instr;
+  ZydisDecodedOperand const* decoded_ops;
+
+  // The registers that are live right after the instruction.
+  register_set live_after;
+
+  uarch_info const& uarch;
+  uarch_rewrite_options const& options;
+};
+
+// Encode a request into an instruction. Returns false if the request can't
+// be encoded.
+static bool try_encode(binary const& bin, ZydisEncoderRequest const& req,
+    std::vector<instruction>& replacement) {
+  std::uint8_t bytes[15] = {};
+  std::size_t length = sizeof(bytes);
+  if (ZYAN_FAILED(ZydisEncoderEncodeInstruction(&req, bytes, &length)))
+    return false;
+
+  replacement.push_back(bin.instr(req));
+  return true;
+}
+
+// INC/DEC -> ADD/SUB 1.
+static bool rewrite_inc_dec(rewrite_context const& ctx,
+    std::vector<instruction>& replacement) {
+  auto const mnemonic = ctx.decoded_instr.mnemonic;
+  if (mnemonic != ZYDIS_MNEMONIC_INC && mnemonic != ZYDIS_MNEMONIC_DEC)
+    return false;
+
+  // INC and DEC preserve CF, while ADD and SUB don't.
+  if (ctx.live_after.flags & ZYDIS_CPUFLAG_CF)
+    return false;
+
+  // For RIP-relative operands, the displacement is a symbol ID, which is
+  // copied as-is. LOCK prefixes are kept as well.
+  ZydisEncoderRequest req = {};
+  if (ZYAN_FAILED(ZydisEncoderDecodedInstructionToEncoderRequest(&ctx.decoded_instr,
+      ctx.decoded_ops, ctx.decoded_instr.operand_count_visible, &req)))
+    return false;
+
+  req.mnemonic      = mnemonic == ZYDIS_MNEMONIC_INC ? ZYDIS_MNEMONIC_ADD : ZYDIS_MNEMONIC_SUB;
+  req.operand_count = 2;
+  req.operands[1]   = enc_imm(1);
+
+  return try_encode(ctx.bin, req, replacement);
+}
+
+// LEA r, [base + index * scale + disp] -> LEA r, [base + index * scale]; ADD r, disp.
+static bool rewrite_lea3(rewrite_context const& ctx,
+    std::vector<instruction>& replacement) {
+  if (ctx.decoded_instr.mnemonic != ZYDIS_MNEMONIC_LEA ||
+      ctx.decoded_instr.address_width != 64)
+    return false;
+
+  auto const& dst = ctx.decoded_ops[0];
+  auto const& src = ctx.decoded_ops[1];
+
+  if (dst.size < 32 || src.mem.base == ZYDIS_REGISTER_NONE ||
+      src.mem.base == ZYDIS_REGISTER_RIP || src.mem.index == ZYDIS_REGISTER_NONE ||
+      src.mem.disp.value == 0)
+    return false;
+
+  // RBP and R13 can't be encoded as a base without a displacement, so the
+  // result would still have three components.
+  if (auto const base = gpr_id(src.mem.base); base == 5 || base == 13)
+    return false;
+
+  // The ADD clobbers every status flag.
+  if (ctx.live_after.flags & status_flags)
+    return false;
+
+  auto const size = static_cast<std::uint16_t>(dst.size / 8);
+
+  return try_encode(ctx.bin, enc_req(ZYDIS_MNEMONIC_LEA, { enc_reg(dst.reg.value),
+      enc_mem(size, src.mem.base, src.mem.index, src.mem.scale) }), replacement) &&
+    try_encode(ctx.bin, enc_req(ZYDIS_MNEMONIC_ADD, { enc_reg(dst.reg.value),
+      enc_imm(src.mem.disp.value) }), replacement);
+}
+
+// XCHG [mem], r -> MOV tmp, [mem]; MOV [mem], r; MOV r, tmp.
+static bool rewrite_xchg_mem(rewrite_context const& ctx,
+    std::vector<instruction>& replacement) {
+  if (!ctx.options.relax_atomics || ctx.decoded_instr.mnemonic != ZYDIS_MNEMONIC_XCHG)
+    return false;
+
+  ZydisDecodedOperand const* mem = nullptr;
+  ZydisDecodedOperand const* reg = nullptr;
+
+  for (std::size_t i = 0; i < 2; ++i) {
+    auto const& op = ctx.decoded_ops[i];
+    if (op.type == ZYDIS_OPERAND_TYPE_MEMORY)
+      mem = &op;
+    else if (op.type == ZYDIS_OPERAND_TYPE_REGISTER)
+      reg = &op;
+  }
+
+  // 8-bit registers are skipped, since AH-DH can't be encoded alongside
+  // the extended registers.
+  if (!mem || !reg || reg->size < 16 || mem->mem.segment == ZYDIS_REGISTER_FS ||
+      mem->mem.segment == ZYDIS_REGISTER_GS)
+    return false;
+
+  // The scratch register can't be live afterwards, or be a part of the
+  // instruction.
+  register_set use = {}, def = {};
+  instruction_effects(ctx.bin, ctx.instr, use, def);
+
+  auto const taken = static_cast<std::uint16_t>(ctx.live_after.gprs |
+    use.gprs | def.gprs | (1 << 4));
+
+  int scratch = -1;
+  for (int id = 0; id < 16; ++id) {
+    if (!(taken & (1 << id))) {
+      scratch = id;
+      break;
+    }
+  }
+
+  if (scratch < 0)
+    return false;
+
+  auto const tmp = ZydisRegisterEncode(ZydisRegisterGetClass(reg->reg.value),
+    static_cast<ZyanU8>(scratch));
+  auto const size = static_cast<std::uint16_t>(reg->size / 8);
+  auto const operand = enc_mem(size, mem->mem.base, mem->mem.index,
+    mem->mem.scale, mem->mem.disp.value);
+
+  return try_encode(ctx.bin, enc_req(ZYDIS_MNEMONIC_MOV,
+      { enc_reg(tmp), operand }), replacement) &&
+    try_encode(ctx.bin, enc_req(ZYDIS_MNEMONIC_MOV,
+      { operand, enc_reg(reg->reg.value) }), replacement) &&
+    try_encode(ctx.bin, enc_req(ZYDIS_MNEMONIC_MOV,
+      { enc_reg(reg->reg.value), enc_reg(tmp) }), replacement);
+}
+
+// Split a long NOP into several shorter ones.
+static bool rewrite_long_nop(rewrite_context const& ctx,
+    std::vector<instruction>& replacement) {
+  auto const max_length = (std::min)(ctx.uarch.max_nop_length, std::uint8_t(9));
+
+  if (ctx.decoded_instr.mnemonic != ZYDIS_MNEMONIC_NOP || max_length == 0 ||
+      ctx.instr.length <= max_length)
+    return false;
+
+  for (std::uint8_t remaining = ctx.instr.length; remaining > 0;) {
+    auto const length = (std::min)(remaining, max_length);
+    replacement.push_back(make_nop(length));
+    remaining -= length;
+  }
+
+  return true;
+}
+
+// A single kind of rewrite.
+struct rewrite_rule {
+  // The uarch_rewrite_* value that enables this rule.
+  std::uint32_t flag;
+
+  // Fills in the replacement and returns true if the rule applies.
+  bool (*apply)(rewrite_context const& ctx, std::vector<instruction>& replacement);
+
+  // The counter in the result that is incremented by this rule.
+  std::size_t uarch_rewrite_result::* counter;
+};
+
+// Every rule, in the order that they are tried. At most one rule is
+// applied to a single instruction.
+static constexpr rewrite_rule rewrite_rules[] = {
+  { uarch_rewrite_inc_dec,  rewrite_inc_dec,  &uarch_rewrite_result::inc_dec  },
+  { uarch_rewrite_lea3,     rewrite_lea3,     &uarch_rewrite_result::lea3     },
+  { uarch_rewrite_xchg_mem, rewrite_xchg_mem, &uarch_rewrite_result::xchg_mem },
+  { uarch_rewrite_long_nop, rewrite_long_nop, &uarch_rewrite_result::long_nop }
+};
+
+// Find a microarchitecture in uarch_table by name.
+uarch_info const* find_uarch(char const* const name) {
+  for (auto const& uarch : uarch_table) {
+    if (std::strcmp(uarch.name, name) == 0)
+      return &uarch;
+  }
+
+  return nullptr;
+}
+
+// Replace every instruction that is slow on a microarchitecture with a
+// faster equivalent.
+uarch_rewrite_result rewrite_for_uarch(binary& bin, uarch_info const& uarch,
+    uarch_rewrite_options const& options) {
+  uarch_rewrite_result result = {};
+
+  if (!uarch.rewrites)
+    return result;
+
+  // This needs to be calculated before we modify anything.
+  liveness_analysis const liveness(bin);
+
+  struct pending_rewrite {
+    std::size_t index;
+    std::vector<instruction> replacement;
+  };
+
+  for (auto const bb : bin.basic_blocks()) {
+    std::vector<pending_rewrite> pending = {};
+
+    // Walk backwards from the end of the block, so that the live registers
+    // after every instruction are known.
+    auto live = liveness.live_out(bb);
+
+    for (auto i = bb->instructions.size(); i > 0; --i) {
+      auto const& instr = bb->instructions[i - 1];
+      auto const live_after = live;
+
+      register_set use = {}, def = {};
+      instruction_effects(bin, instr, use, def);
+
+      live.gprs  = static_cast<std::uint16_t>((live.gprs & ~def.gprs) | use.gprs);
+      live.flags = (live.flags & ~def.flags) | use.flags;
+
+      ZydisDecodedInstruction decoded_instr;
+      ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT];
+      if (ZYAN_FAILED(ZydisDecoderDecodeFull(bin.decoder(), instr.bytes,
+          instr.length, &decoded_instr, decoded_ops)))
+        continue;
+
+      rewrite_context const ctx = { bin, instr, decoded_instr,
+        decoded_ops, live_after, uarch, options };
+
+      for (auto const& rule : rewrite_rules) {
+        if (!(uarch.rewrites & rule.flag))
+          continue;
+
+        std::vector<instruction> replacement = {};
+        if (!rule.apply(ctx, replacement))
+          continue;
+
+        pending.push_back({ i - 1, std::move(replacement) });
+        ++(result.*rule.counter);
+        break;
+      }
+    }
+
+    // The rewrites were found from the back of the block to the front, so
+    // the instruction indices stay valid.
+    for (auto const& rewrite : pending) {
+      auto const position = begin(bb->instructions) + rewrite.index;
+      auto const after = bb->instructions.erase(position);
+      bb->instructions.insert(after, begin(rewrite.replacement), end(rewrite.replacement));
+    }
+  }
+
+  return result;
+}
+
+} // namespace chum
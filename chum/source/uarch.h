@@ -0,0 +1,83 @@
+#pragma once
+
+#include "binary.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace chum {
+
+// Instruction rewrites that can be enabled for a microarchitecture.
+//
+// inc_dec:  INC/DEC -> ADD/SUB 1, since INC and DEC only write some of the
+//           flags, which costs a flag merge on cores that rename flags
+//           separately. Needs CF to be dead afterwards.
+// lea3:     LEA r, [base + index * scale + disp] -> LEA r, [base + index *
+//           scale]; ADD r, disp, since three-component LEAs have a longer
+//           latency and fewer ports. Needs the status flags to be dead.
+// xchg_mem: XCHG [mem], r -> three MOVs through a dead register, since
+//           XCHG with memory is implicitly locked. This drops atomicity, so
+//           it also has to be allowed by the caller.
+// long_nop: NOPs that are longer than uarch_info::max_nop_length are split
+//           into several shorter NOPs of the same total length.
+inline constexpr std::uint32_t uarch_rewrite_inc_dec  = 1 << 0;
+inline constexpr std::uint32_t uarch_rewrite_lea3     = 1 << 1;
+inline constexpr std::uint32_t uarch_rewrite_xchg_mem = 1 << 2;
+inline constexpr std::uint32_t uarch_rewrite_long_nop = 1 << 3;
+
+// The instruction choices that are slow on a specific microarchitecture.
+struct uarch_info {
+  char const* name;
+
+  // A mask of uarch_rewrite_* values.
+  std::uint32_t rewrites;
+
+  // The longest NOP that decodes without a penalty (up to 9 bytes).
+  std::uint8_t max_nop_length;
+};
+
+// Every known microarchitecture. Adding a core only needs a new row here.
+inline constexpr uarch_info uarch_table[] = {
+  // Rewrites nothing.
+  { "generic",     0, 9 },
+
+  // Partial flag writes stall until the flags are merged.
+  { "pentium4",    uarch_rewrite_inc_dec | uarch_rewrite_xchg_mem, 9 },
+  { "core2",       uarch_rewrite_inc_dec | uarch_rewrite_xchg_mem, 9 },
+
+  // Sandy Bridge through Skylake run three-component LEAs with a 3-cycle
+  // latency on a single port.
+  { "sandybridge", uarch_rewrite_lea3 | uarch_rewrite_xchg_mem, 9 },
+  { "skylake",     uarch_rewrite_lea3 | uarch_rewrite_xchg_mem, 9 },
+
+  // The Atom decoders slow down on instructions with more than three
+  // prefixes and escape bytes, which includes the longest NOP forms.
+  { "silvermont",  uarch_rewrite_lea3 | uarch_rewrite_long_nop | uarch_rewrite_xchg_mem, 7 },
+
+  { "zen",         uarch_rewrite_xchg_mem, 9 }
+};
+
+// Find a microarchitecture in uarch_table by name.
+uarch_info const* find_uarch(char const* name);
+
+struct uarch_rewrite_options {
+  // Allow rewrites that make an atomic instruction non-atomic (xchg_mem).
+  // This is only safe if the binary doesn't use XCHG for synchronization.
+  bool relax_atomics = false;
+};
+
+// The number of instructions that were rewritten by each kind of rewrite.
+struct uarch_rewrite_result {
+  std::size_t inc_dec  = 0;
+  std::size_t lea3     = 0;
+  std::size_t xchg_mem = 0;
+  std::size_t long_nop = 0;
+};
+
+// Replace every instruction that is slow on a microarchitecture with a
+// faster equivalent, as long as the flags (and registers) that it would
+// clobber are dead. Rewrites that would change behavior are skipped.
+uarch_rewrite_result rewrite_for_uarch(binary& bin, uarch_info const& uarch,
+  uarch_rewrite_options const& options = {});
+
+} // namespace chum
@@ -0,0 +1,191 @@
+#include "unroll.h"
+#include "cfg.h"
+#include "loops.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace chum {
+
+// Get the number of bytes that a block's instructions take up.
+static std::size_t get_block_size(basic_block const* const bb) {
+  std::size_t size = 0;
+  for (auto const& instr : bb->instructions)
+    size += instr.length;
+
+  return size;
+}
+
+// Get the condition code (the low 4 bits of the opcode) of a JCC rel8 or
+// JCC rel32. Returns false for any other conditional branch.
+static bool get_condition_code(binary const& bin, instruction const& instr,
+    std::uint8_t& cc) {
+  ZydisDecodedInstruction decoded_instr;
+  ZydisDecodedOperand decoded_ops[ZYDIS_MAX_OPERAND_COUNT];
+  if (ZYAN_FAILED(ZydisDecoderDecodeFull(bin.decoder(), instr.bytes,
+      instr.length, &decoded_instr, decoded_ops)))
+    return false;
+
+  if (decoded_instr.meta.category != ZYDIS_CATEGORY_COND_BR ||
+      !decoded_instr.raw.imm[0].is_relative)
+    return false;
+
+  // The opcode comes right before the immediate.
+  auto const offset = decoded_instr.raw.imm[0].offset;
+  if (offset < 1)
+    return false;
+
+  auto const opcode = instr.bytes[offset - 1];
+
+  // JCC rel8
+  if (decoded_instr.raw.imm[0].size == 8 && opcode >= 0x70 && opcode <= 0x7F) {
+    cc = opcode & 0xF;
+    return true;
+  }
+
+  // JCC rel32
+  if (decoded_instr.raw.imm[0].size == 32 && offset >= 2 &&
+      instr.bytes[offset - 2] == 0x0F && opcode >= 0x80 && opcode <= 0x8F) {
+    cc = opcode & 0xF;
+    return true;
+  }
+
+  return false;
+}
+
+// Unroll every hot natural loop that consists of a single block.
+unroll_result unroll_loops(disassembled_binary& bin, unroll_options const& options) {
+  unroll_result result = {};
+
+  std::size_t code_size = 0;
+  for (auto const bb : bin.basic_blocks())
+    code_size += get_block_size(bb);
+
+  result.budget = static_cast<std::size_t>(static_cast<double>(code_size) * options.max_growth);
+
+  // These need to be calculated before we modify anything.
+  std::vector<basic_block*> headers = {};
+  {
+    loop_analysis const loops(bin);
+
+    for (auto const& loop : loops.loops()) {
+      if (loop.blocks.size() != 1 || !loop.header->fallthrough_target)
+        continue;
+
+      if (get_block_exit(bin, loop.header).branch_target == loop.header->sym_id)
+        headers.push_back(loop.header);
+    }
+  }
+
+  // The hottest loops get first pick of the budget.
+  std::stable_sort(begin(headers), end(headers), [](auto const left, auto const right) {
+    return left->weight > right->weight;
+  });
+
+  for (auto const bb : headers) {
+    auto& loop = result.loops.emplace_back();
+    loop.rva       = bin.symbol_to_rva(bb->sym_id);
+    loop.weight    = bb->weight;
+    loop.body_size = get_block_size(bb);
+
+    // Every exit from the loop goes through the fallthrough edge.
+    loop.trip_count = bb->fallthrough_weight ? static_cast<double>(bb->weight) /
+      static_cast<double>(bb->fallthrough_weight) : static_cast<double>(bb->weight);
+
+    if (bb->weight == 0 || bb->weight < options.min_weight) {
+      loop.status = unroll_status::below_threshold;
+      continue;
+    }
+
+    if (loop.trip_count < options.min_trip_count) {
+      loop.status = unroll_status::low_trip_count;
+      continue;
+    }
+
+    if (loop.body_size > options.max_body_size) {
+      loop.status = unroll_status::too_large;
+      continue;
+    }
+
+    std::uint8_t cc = 0;
+    if (options.factor < 2 || !get_condition_code(bin, bb->instructions.back(), cc)) {
+      loop.status = unroll_status::unsupported_branch;
+      continue;
+    }
+
+    // The inverted JCC is always a rel32, so it can be a little larger.
+    auto const growth = (options.factor - 1) * (loop.body_size -
+      bb->instructions.back().length + 6);
+
+    if (result.growth + growth > result.budget) {
+      loop.status = unroll_status::over_budget;
+      continue;
+    }
+
+    auto const exit  = bb->fallthrough_target;
+    auto const body  = bb->instructions;
+    auto const count = options.factor;
+
+    // The exits (and back-edges) are spread evenly over every copy.
+    auto const weight      = bb->weight / count;
+    auto const exit_weight = bb->fallthrough_weight / count;
+
+    std::vector<basic_block*> copies = { bb };
+    for (std::uint32_t i = 1; i < count; ++i)
+      copies.push_back(bin.create_basic_block());
+
+    for (std::uint32_t i = 0; i < count; ++i) {
+      auto const copy = copies[i];
+      auto const last = i + 1 == count;
+
+      copy->weight = weight;
+
+      if (i > 0)
+        copy->instructions.assign(begin(body), end(body));
+
+      if (last) {
+        // The last copy keeps the original back-edge.
+        copy->fallthrough_target = exit;
+        copy->taken_weight       = weight - exit_weight;
+        copy->fallthrough_weight = exit_weight;
+        continue;
+      }
+
+      // JNCC exit
+      copy->instructions.back() = bin.instr("\x0F",
+        static_cast<std::uint8_t>(0x80 | (cc ^ 1)), exit);
+      copy->fallthrough_target = copies[i + 1]->sym_id;
+      copy->taken_weight       = exit_weight;
+      copy->fallthrough_weight = weight - exit_weight;
+    }
+
+    // The copies go right after the original block, in order.
+    auto& blocks = bin.basic_blocks();
+    blocks.erase(std::remove_if(begin(blocks), end(blocks), [&](basic_block const* const b) {
+      return std::find(begin(copies) + 1, end(copies), b) != end(copies);
+    }), end(blocks));
+
+    blocks.insert(std::find(begin(blocks), end(blocks), bb) + 1,
+      begin(copies) + 1, end(copies));
+
+    result.growth += growth;
+    loop.status = unroll_status::unrolled;
+  }
+
+  return result;
+}
+
+// Print what was done for every single-block loop.
+void print_unroll_result(unroll_result const& result) {
+  std::printf("[+] Single-block loops (%zu), %zu of %zu byte(s) of growth used:\n",
+    result.loops.size(), result.growth, result.budget);
+
+  for (auto const& loop : result.loops) {
+    std::printf("[+]   RVA: 0x%-8X Weight: %-10llu Trips: %-8.1f Size: %-4zu Status: %s\n",
+      loop.rva, static_cast<unsigned long long>(loop.weight), loop.trip_count,
+      loop.body_size, serialize_unroll_status(loop.status));
+  }
+}
+
+} // namespace chum
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "disassembler.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chum {
+
+struct unroll_options {
+  // The number of copies of the loop body after unrolling.
+  std::uint32_t factor = 4;
+
+  // Loops whose header was executed fewer times than this are ignored (see
+  // basic_block::weight). This pass needs a profile to do anything.
+  std::uint64_t min_weight = 1;
+
+  // Loops that run for fewer iterations than this every time that they are
+  // entered, on average, are ignored.
+  double min_trip_count = 4.0;
+
+  // Only loop bodies of up to this many bytes are unrolled.
+  std::size_t max_body_size = 32;
+
+  // The maximum amount of code that can be added, as a fraction of the
+  // total size of every instruction in the binary.
+  double max_growth = 0.02;
+};
+
+// What happened to a single-block loop.
+enum class unroll_status {
+  // The loop was unrolled.
+  unrolled,
+
+  // The back-edge isn't a JCC that can be inverted (such as LOOP or JRCXZ).
+  unsupported_branch,
+
+  // The loop body is larger than max_body_size.
+  too_large,
+
+  // The loop was executed fewer times than min_weight.
+  below_threshold,
+
+  // The loop runs for fewer iterations than min_trip_count.
+  low_trip_count,
+
+  // Unrolling the loop would go over the code growth budget.
+  over_budget
+};
+
+// Get the string representation of an unroll status.
+inline constexpr char const* serialize_unroll_status(unroll_status const status) {
+  switch (status) {
+  case unroll_status::unrolled:           return "unrolled";
+  case unroll_status::unsupported_branch: return "unsupported_branch";
+  case unroll_status::too_large:          return "too_large";
+  case unroll_status::below_threshold:    return "below_threshold";
+  case unroll_status::low_trip_count:     return "low_trip_count";
+  case unroll_status::over_budget:        return "over_budget";
+  default: return "invalid";
+  }
+}
+
+// A single-block loop, and what was done with it.
+struct unrolled_loop {
+  // The RVA of the loop in the original image.
+  std::uint32_t rva = 0;
+
+  // The number of times that the loop body was executed, and the average
+  // number of iterations every time that the loop was entered.
+  std::uint64_t weight     = 0;
+  double        trip_count = 0.0;
+
+  // The size of the loop body, in bytes.
+  std::size_t body_size = 0;
+
+  unroll_status status = unroll_status::below_threshold;
+};
+
+struct unroll_result {
+  // Every single-block loop, hottest first.
+  std::vector<unrolled_loop> loops = {};
+
+  // The number of bytes that were added, and the most that could have been.
+  std::size_t growth = 0;
+  std::size_t budget = 0;
+};
+
+// Unroll every hot natural loop that consists of a single block (whose
+// terminating JCC branches back to itself). The body is copied factor - 1
+// times, and every copy but the last gets the inverse JCC to the loop exit
+// so that it falls through into the next copy. The last copy keeps the
+// original back-edge. Every copy keeps its exit test, so the trip count
+// doesn't need to be a multiple of the factor. The block weights are
+// spread evenly over the copies.
+unroll_result unroll_loops(disassembled_binary& bin, unroll_options const& options = {});
+
+// Print what was done for every single-block loop.
+void print_unroll_result(unroll_result const& result);
+
+} // namespace chum
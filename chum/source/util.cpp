@@ -1,6 +1,9 @@
 #include "util.h"
 
+#include <Windows.h>
+#include <cstdlib>
 #include <fstream>
+#include <string>
 
 namespace chum {
 
@@ -22,5 +25,133 @@ std::vector<std::uint8_t> read_file_to_buffer(char const* const path) {
   return contents;
 }
 
-} // namespace chum
+// Convert an RVA in a raw x86-64 PE file into a file offset.
+std::size_t pe_rva_to_file_offset(std::vector<std::uint8_t> const& image,
+    std::uint32_t const rva, std::size_t const size) {
+  if (image.size() < sizeof(IMAGE_DOS_HEADER))
+    return 0;
+
+  auto const dos_header = reinterpret_cast<IMAGE_DOS_HEADER const*>(&image[0]);
+  if (dos_header->e_magic != IMAGE_DOS_SIGNATURE || dos_header->e_lfanew < 0 ||
+      image.size() < dos_header->e_lfanew + sizeof(IMAGE_NT_HEADERS))
+    return 0;
+
+  auto const nt_header = reinterpret_cast<IMAGE_NT_HEADERS const*>(
+    &image[dos_header->e_lfanew]);
+  if (nt_header->Signature != IMAGE_NT_SIGNATURE ||
+      nt_header->FileHeader.Machine != IMAGE_FILE_MACHINE_AMD64)
+    return 0;
+
+  auto const section_count = nt_header->FileHeader.NumberOfSections;
+  if (image.size() < dos_header->e_lfanew + sizeof(IMAGE_NT_HEADERS) +
+      section_count * sizeof(IMAGE_SECTION_HEADER))
+    return 0;
+
+  auto const sections = reinterpret_cast<IMAGE_SECTION_HEADER const*>(nt_header + 1);
+
+  for (std::size_t i = 0; i < section_count; ++i) {
+    auto const& sec = sections[i];
+    if (rva < sec.VirtualAddress || rva >= sec.VirtualAddress + sec.SizeOfRawData)
+      continue;
+
+    // Make sure the entire range is in the same section.
+    if (rva + size > sec.VirtualAddress + sec.SizeOfRawData)
+      return 0;
+
+    std::size_t const offset = sec.PointerToRawData + (rva - sec.VirtualAddress);
+    return offset + size <= image.size() ? offset : 0;
+  }
+
+  return 0;
+}
+
+// Read a text file where each line contains an RVA and a count, separated
+// by a comma.
+std::vector<rva_count> read_rva_counts(char const* const path) {
+  std::ifstream file(path);
+  if (!file)
+    return {};
+
+  std::vector<rva_count> entries = {};
+
+  for (std::string line; std::getline(file, line);) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    char* end = nullptr;
+
+    rva_count entry = {};
+    entry.rva   = static_cast<std::uint32_t>(std::strtoul(line.c_str(), &end, 16));
+    entry.count = 1;
+
+    // Skip lines that don't start with a number.
+    if (end == line.c_str())
+      continue;
+
+    if (*end == ',')
+      entry.count = std::strtoull(end + 1, nullptr, 10);
+
+    entries.push_back(entry);
+  }
+
+  return entries;
+}
 
+// Read a text file where each line contains two RVAs and a count, separated
+// by commas.
+std::vector<rva_edge_count> read_rva_edge_counts(char const* const path) {
+  std::ifstream file(path);
+  if (!file)
+    return {};
+
+  std::vector<rva_edge_count> entries = {};
+
+  for (std::string line; std::getline(file, line);) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    char* end = nullptr;
+
+    rva_edge_count entry = {};
+    entry.from  = static_cast<std::uint32_t>(std::strtoul(line.c_str(), &end, 16));
+    entry.count = 1;
+
+    // Skip lines that don't start with two numbers.
+    if (end == line.c_str() || *end != ',')
+      continue;
+
+    auto const to_start = end + 1;
+    entry.to = static_cast<std::uint32_t>(std::strtoul(to_start, &end, 16));
+
+    if (end == to_start)
+      continue;
+
+    if (*end == ',')
+      entry.count = std::strtoull(end + 1, nullptr, 10);
+
+    entries.push_back(entry);
+  }
+
+  return entries;
+}
+
+// Get the operation counters of the current thread.
+op_counters& thread_op_counters() {
+  thread_local op_counters counters = {};
+  return counters;
+}
+
+// Calculate the 64-bit FNV-1a hash of a buffer.
+std::uint64_t fnv1a_64(void const* const data, std::size_t const size) {
+  auto const bytes = static_cast<std::uint8_t const*>(data);
+
+  std::uint64_t hash = 0xCBF29CE484222325;
+  for (std::size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001B3;
+  }
+
+  return hash;
+}
+
+} // namespace chum
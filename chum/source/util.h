@@ -2,11 +2,90 @@
 
 #include <vector>
 #include <cstdint>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <utility>
 
 namespace chum {
 
 // Return the raw contents of a file.
 std::vector<std::uint8_t> read_file_to_buffer(char const* path);
 
-} // namespace chum
+// Convert an RVA in a raw x86-64 PE file into a file offset. This returns 0
+// if the file is malformed, or if the RVA (plus the following size bytes)
+// isn't backed by raw data.
+std::size_t pe_rva_to_file_offset(std::vector<std::uint8_t> const& image,
+  std::uint32_t rva, std::size_t size = 1);
+
+// An RVA in the original image, along with a count (such as a number of
+// executions or cache misses).
+struct rva_count {
+  std::uint32_t rva   = 0;
+  std::uint64_t count = 0;
+};
+
+// Read a text file where each line contains an RVA and a count, separated
+// by a comma (e.g. "0x1234,500"). RVAs are in hex, counts are in decimal,
+// and lines starting with '#' are ignored. The count is optional and
+// defaults to 1, which allows plain RVA lists to be read as well.
+std::vector<rva_count> read_rva_counts(char const* path);
+
+// A pair of RVAs in the original image (such as the source and destination
+// of a branch), along with a count.
+struct rva_edge_count {
+  std::uint32_t from  = 0;
+  std::uint32_t to    = 0;
+  std::uint64_t count = 0;
+};
+
+// Read a text file where each line contains two RVAs and a count, separated
+// by commas (e.g. "0x1234,0x1300,20"). This follows the same rules as
+// read_rva_counts().
+std::vector<rva_edge_count> read_rva_edge_counts(char const* path);
+
+// Calculate the 64-bit FNV-1a hash of a buffer.
+std::uint64_t fnv1a_64(void const* data, std::size_t size);
+
+// Counters for operations on the structures that would need to be shared
+// (and synchronized) if analysis or emission ran on multiple threads. These
+// are per-thread, and are only updated when CHUM_OP_COUNTERS is defined
+// (see the CMake option of the same name), since the hot paths that build
+// the IR update them.
+struct op_counters {
+  // The number of symbols that were allocated.
+  std::uint64_t symbol_allocations = 0;
 
+  // The number of RVA map entries that were claimed by the disassembler.
+  std::uint64_t rva_claims = 0;
+
+  // The number of RVAs that were popped from the disassembly queue.
+  std::uint64_t queue_pops = 0;
+};
+
+// Get the operation counters of the current thread.
+op_counters& thread_op_counters();
+
+// Increment an operation counter of the current thread. This compiles to
+// nothing unless CHUM_OP_COUNTERS is defined.
+#ifdef CHUM_OP_COUNTERS
+#define CHUM_COUNT_OP(counter) (++::chum::thread_op_counters().counter)
+#else
+#define CHUM_COUNT_OP(counter) ((void)0)
+#endif
+
+// Allocate and construct an object from a memory resource.
+template <typename T, typename... Args>
+inline T* new_object(std::pmr::memory_resource* const resource, Args&&... args) {
+  return new (resource->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+}
+
+// Destroy an object that was created with new_object(), using the same
+// memory resource.
+template <typename T>
+inline void delete_object(std::pmr::memory_resource* const resource, T* const object) {
+  object->~T();
+  resource->deallocate(object, sizeof(T), alignof(T));
+}
+
+} // namespace chum